@@ -32,11 +32,21 @@ void init_config(Config *cfg) {
     cfg->layer_types[sizeof(cfg->layer_types)-1] = '\0';
     cfg->weight_init_method = DEFAULT_WEIGHT_INIT_METHOD;
     cfg->input_dim         = DEFAULT_INPUT_DIM;
+    cfg->input_channels    = DEFAULT_INPUT_CHANNELS;
+    cfg->input_height      = DEFAULT_INPUT_HEIGHT;
+    cfg->input_width       = DEFAULT_INPUT_WIDTH;
+    
+    // Convolution & Pooling
+    cfg->conv_stride       = DEFAULT_CONV_STRIDE;
+    cfg->conv_padding      = DEFAULT_CONV_PADDING;
+    cfg->pool_size         = DEFAULT_POOL_SIZE;
+    cfg->pool_stride       = DEFAULT_POOL_STRIDE;
     
     // Prior Distribution
     cfg->prior_type        = DEFAULT_PRIOR_TYPE;
     cfg->prior_variance    = DEFAULT_PRIOR_VARIANCE;
     cfg->covariance_structure = DEFAULT_COVARIANCE_STRUCTURE;
+    cfg->posterior_rank    = DEFAULT_POSTERIOR_RANK;
     
     // Posterior Approximation Method
     cfg->posterior_method  = DEFAULT_POSTERIOR_METHOD;
@@ -45,6 +55,7 @@ void init_config(Config *cfg) {
     cfg->mc_samples_train  = DEFAULT_MC_SAMPLES_TRAIN;
     cfg->kl_weight         = DEFAULT_KL_WEIGHT;
     cfg->local_reparam     = DEFAULT_LOCAL_REPARAM;
+    cfg->kl_estimator      = DEFAULT_KL_ESTIMATOR;
     
     // MC-Dropout
     cfg->dropout_prob      = DEFAULT_DROPOUT_PROB;
@@ -62,6 +73,14 @@ void init_config(Config *cfg) {
     
     // Sampling / Predictive Inference
     cfg->sampling_temperature = DEFAULT_SAMPLING_TEMPERATURE;
+    cfg->mc_perturbation_rank = DEFAULT_MC_PERTURBATION_RANK;
+    cfg->threads = DEFAULT_THREADS;
+    cfg->serve_max_batch = DEFAULT_SERVE_MAX_BATCH;
+    cfg->serve_max_latency_us = DEFAULT_SERVE_MAX_LATENCY_US;
+    strncpy(cfg->serve_socket, DEFAULT_SERVE_SOCKET, sizeof(cfg->serve_socket)-1);
+    cfg->serve_socket[sizeof(cfg->serve_socket)-1] = '\0';
+    strncpy(cfg->model_path, DEFAULT_MODEL_PATH, sizeof(cfg->model_path)-1);
+    cfg->model_path[sizeof(cfg->model_path)-1] = '\0';
     
     // Regularization
     cfg->regularization_weight = DEFAULT_REGULARIZATION_WEIGHT;
@@ -100,6 +119,20 @@ void parse_args(Config *cfg, int argc, char *argv[]) {
             cfg->grad_clip = atof(argv[++i]);
         } else if (strcmp(argv[i], "--input_dim") == 0 && i+1 < argc) {
             cfg->input_dim = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--input_channels") == 0 && i+1 < argc) {
+            cfg->input_channels = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--input_height") == 0 && i+1 < argc) {
+            cfg->input_height = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--input_width") == 0 && i+1 < argc) {
+            cfg->input_width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--conv_stride") == 0 && i+1 < argc) {
+            cfg->conv_stride = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--conv_padding") == 0 && i+1 < argc) {
+            cfg->conv_padding = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool_size") == 0 && i+1 < argc) {
+            cfg->pool_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool_stride") == 0 && i+1 < argc) {
+            cfg->pool_stride = atoi(argv[++i]);
         } else if (strcmp(argv[i], "--noise_injection") == 0 && i+1 < argc) {
             cfg->noise_injection = atof(argv[++i]);
         } else if (strcmp(argv[i], "--inference") == 0 && i+1 < argc) {
@@ -120,6 +153,8 @@ void parse_args(Config *cfg, int argc, char *argv[]) {
             cfg->prior_variance = atof(argv[++i]);
         } else if (strcmp(argv[i], "--cov_structure") == 0 && i+1 < argc) {
             cfg->covariance_structure = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--posterior_rank") == 0 && i+1 < argc) {
+            cfg->posterior_rank = atoi(argv[++i]);
         } else if (strcmp(argv[i], "--posterior_method") == 0 && i+1 < argc) {
             cfg->posterior_method = atoi(argv[++i]);
         } else if (strcmp(argv[i], "--mc_samples_train") == 0 && i+1 < argc) {
@@ -128,6 +163,8 @@ void parse_args(Config *cfg, int argc, char *argv[]) {
             cfg->kl_weight = atof(argv[++i]);
         } else if (strcmp(argv[i], "--local_reparam") == 0 && i+1 < argc) {
             cfg->local_reparam = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--kl_estimator") == 0 && i+1 < argc) {
+            cfg->kl_estimator = atoi(argv[++i]);
         } else if (strcmp(argv[i], "--dropout") == 0 && i+1 < argc) {
             cfg->dropout_prob = atof(argv[++i]);
         } else if (strcmp(argv[i], "--mc_samples_inference") == 0 && i+1 < argc) {
@@ -146,6 +183,20 @@ void parse_args(Config *cfg, int argc, char *argv[]) {
             cfg->ep_tolerance = atof(argv[++i]);
         } else if (strcmp(argv[i], "--sampling_temp") == 0 && i+1 < argc) {
             cfg->sampling_temperature = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--mc_perturbation_rank") == 0 && i+1 < argc) {
+            cfg->mc_perturbation_rank = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc) {
+            cfg->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--serve_max_batch") == 0 && i+1 < argc) {
+            cfg->serve_max_batch = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--serve_max_latency_us") == 0 && i+1 < argc) {
+            cfg->serve_max_latency_us = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--socket") == 0 && i+1 < argc) {
+            strncpy(cfg->serve_socket, argv[++i], sizeof(cfg->serve_socket)-1);
+            cfg->serve_socket[sizeof(cfg->serve_socket)-1] = '\0';
+        } else if (strcmp(argv[i], "--model") == 0 && i+1 < argc) {
+            strncpy(cfg->model_path, argv[++i], sizeof(cfg->model_path)-1);
+            cfg->model_path[sizeof(cfg->model_path)-1] = '\0';
         } else if (strcmp(argv[i], "--reg") == 0 && i+1 < argc) {
             cfg->regularization_weight = atof(argv[++i]);
         } else if (strcmp(argv[i], "--kl_annealing") == 0 && i+1 < argc) {
@@ -201,6 +252,22 @@ int load_config_file(Config *cfg, const char *filename) {
             } else if (strcmp(key, "layer_types") == 0) {
                 strncpy(cfg->layer_types, value, sizeof(cfg->layer_types)-1);
                 cfg->layer_types[sizeof(cfg->layer_types)-1] = '\0';
+            } else if (strcmp(key, "input_dim") == 0) {
+                cfg->input_dim = atoi(value);
+            } else if (strcmp(key, "input_channels") == 0) {
+                cfg->input_channels = atoi(value);
+            } else if (strcmp(key, "input_height") == 0) {
+                cfg->input_height = atoi(value);
+            } else if (strcmp(key, "input_width") == 0) {
+                cfg->input_width = atoi(value);
+            } else if (strcmp(key, "conv_stride") == 0) {
+                cfg->conv_stride = atoi(value);
+            } else if (strcmp(key, "conv_padding") == 0) {
+                cfg->conv_padding = atoi(value);
+            } else if (strcmp(key, "pool_size") == 0) {
+                cfg->pool_size = atoi(value);
+            } else if (strcmp(key, "pool_stride") == 0) {
+                cfg->pool_stride = atoi(value);
             } else if (strcmp(key, "weight_init_method") == 0) {
                 cfg->weight_init_method = atoi(value);
             } else if (strcmp(key, "prior_type") == 0) {
@@ -209,6 +276,8 @@ int load_config_file(Config *cfg, const char *filename) {
                 cfg->prior_variance = atof(value);
             } else if (strcmp(key, "covariance_structure") == 0) {
                 cfg->covariance_structure = atoi(value);
+            } else if (strcmp(key, "posterior_rank") == 0) {
+                cfg->posterior_rank = atoi(value);
             } else if (strcmp(key, "posterior_method") == 0) {
                 cfg->posterior_method = atoi(value);
             } else if (strcmp(key, "mc_samples_train") == 0) {
@@ -217,6 +286,8 @@ int load_config_file(Config *cfg, const char *filename) {
                 cfg->kl_weight = atof(value);
             } else if (strcmp(key, "local_reparam") == 0) {
                 cfg->local_reparam = atoi(value);
+            } else if (strcmp(key, "kl_estimator") == 0) {
+                cfg->kl_estimator = atoi(value);
             } else if (strcmp(key, "dropout_prob") == 0) {
                 cfg->dropout_prob = atof(value);
             } else if (strcmp(key, "mc_samples_inference") == 0) {
@@ -235,6 +306,20 @@ int load_config_file(Config *cfg, const char *filename) {
                 cfg->ep_tolerance = atof(value);
             } else if (strcmp(key, "sampling_temperature") == 0) {
                 cfg->sampling_temperature = atof(value);
+            } else if (strcmp(key, "mc_perturbation_rank") == 0) {
+                cfg->mc_perturbation_rank = atoi(value);
+            } else if (strcmp(key, "threads") == 0) {
+                cfg->threads = atoi(value);
+            } else if (strcmp(key, "serve_max_batch") == 0) {
+                cfg->serve_max_batch = atoi(value);
+            } else if (strcmp(key, "serve_max_latency_us") == 0) {
+                cfg->serve_max_latency_us = atoi(value);
+            } else if (strcmp(key, "serve_socket") == 0) {
+                strncpy(cfg->serve_socket, value, sizeof(cfg->serve_socket)-1);
+                cfg->serve_socket[sizeof(cfg->serve_socket)-1] = '\0';
+            } else if (strcmp(key, "model_path") == 0) {
+                strncpy(cfg->model_path, value, sizeof(cfg->model_path)-1);
+                cfg->model_path[sizeof(cfg->model_path)-1] = '\0';
             } else if (strcmp(key, "regularization_weight") == 0) {
                 cfg->regularization_weight = atof(value);
             } else if (strcmp(key, "kl_annealing") == 0) {
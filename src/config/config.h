@@ -30,11 +30,21 @@
 #define DEFAULT_LAYER_TYPES           "linear,linear,linear"  // Comma-separated list of layer types (e.g., "linear,conv,dropout")
 #define DEFAULT_WEIGHT_INIT_METHOD    0           // 0: Xavier, 1: He, etc.
 #define DEFAULT_INPUT_DIM            100          // Default input dimension
+#define DEFAULT_INPUT_CHANNELS        1           // Channels of the (NHWC-flattened) input image
+#define DEFAULT_INPUT_HEIGHT          0           // 0: infer a square image from input_dim / input_channels
+#define DEFAULT_INPUT_WIDTH           0           // 0: infer a square image from input_dim / input_channels
+
+// Convolution & Pooling
+#define DEFAULT_CONV_STRIDE           1
+#define DEFAULT_CONV_PADDING          0           // Zero padding on each spatial border
+#define DEFAULT_POOL_SIZE             2           // Window size for "maxpool" / "avgpool" layers
+#define DEFAULT_POOL_STRIDE           2
 
 // Prior Distribution
 #define DEFAULT_PRIOR_TYPE            0           // 0: Gaussian, 1: Laplace, 2: Mixture
 #define DEFAULT_PRIOR_VARIANCE        1.0
-#define DEFAULT_COVARIANCE_STRUCTURE  0           // 0: Mean-field, 1: Full covariance
+#define DEFAULT_COVARIANCE_STRUCTURE  0           // 0: Mean-field, 1: Full covariance, 2: Low-rank + diagonal, 3: Matrix-normal
+#define DEFAULT_POSTERIOR_RANK        8           // Rank of the low-rank + diagonal posterior
 
 // Posterior Approximation Method
 #define DEFAULT_POSTERIOR_METHOD      0           // 0: Mean-field, 1: Structured, 2: Flipout
@@ -43,6 +53,7 @@
 #define DEFAULT_MC_SAMPLES_TRAIN      1           // MC samples per gradient update
 #define DEFAULT_KL_WEIGHT             .001        // Scaling factor for KL divergence
 #define DEFAULT_LOCAL_REPARAM         1           // Flag: 1 to use local reparameterization
+#define DEFAULT_KL_ESTIMATOR          0           // 0: Closed form, 1: Monte Carlo on the forward sample
 
 // MC-Dropout
 #define DEFAULT_DROPOUT_PROB          0.5
@@ -60,6 +71,16 @@
 
 // Sampling / Predictive Inference
 #define DEFAULT_SAMPLING_TEMPERATURE  1.0
+#define DEFAULT_MC_PERTURBATION_RANK  0           // 0: exact predictive draws, r > 0: rank-r weight noise
+
+// Parallelism
+#define DEFAULT_THREADS               1           // Threads per kernel, 0: one per CPU
+
+// Serving (bnn_serve)
+#define DEFAULT_SERVE_MAX_BATCH       32          // Most requests coalesced into one micro-batch
+#define DEFAULT_SERVE_MAX_LATENCY_US  5000        // Latency budget of a request, in microseconds
+#define DEFAULT_SERVE_SOCKET          ""          // Unix domain socket path; empty: stdin/stdout
+#define DEFAULT_MODEL_PATH            ""          // Parameters saved by network_save(); empty: none
 
 // Regularization
 #define DEFAULT_REGULARIZATION_WEIGHT 0.0001
@@ -103,11 +124,21 @@ typedef struct {
     char layer_types[256];       // Comma-separated list of layer types
     int weight_init_method;
     int input_dim;              // Input dimension for the network
+    int input_channels;         // Input image channels (input is NHWC-flattened)
+    int input_height;           // Input image height (0: infer square)
+    int input_width;            // Input image width (0: infer square)
+    
+    // Convolution & Pooling
+    int conv_stride;
+    int conv_padding;
+    int pool_size;
+    int pool_stride;
     
     // Prior Distribution
     int prior_type;
     double prior_variance;
     int covariance_structure;
+    int posterior_rank;
     
     // Posterior Approximation Method
     int posterior_method;  // 0: Mean-field, 1: Structured, 2: Flipout, etc.
@@ -116,6 +147,7 @@ typedef struct {
     int mc_samples_train;
     double kl_weight;
     int local_reparam;
+    int kl_estimator;
     
     // MC-Dropout
     double dropout_prob;
@@ -133,6 +165,16 @@ typedef struct {
     
     // Sampling / Predictive Inference
     double sampling_temperature;
+    int mc_perturbation_rank;
+    
+    // Parallelism
+    int threads;
+    
+    // Serving
+    int serve_max_batch;
+    int serve_max_latency_us;
+    char serve_socket[108];     // Fits sockaddr_un.sun_path
+    char model_path[256];
     
     // Regularization
     double regularization_weight;
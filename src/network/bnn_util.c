@@ -1,5 +1,7 @@
 #include "bnn_util.h"
 #include "random_utils.h"  // For random_gaussian()
+#include "../utils/fast_math.h"
+#include "../utils/thread_pool.h"
 #include <math.h>
 
 // sample_gaussian:
@@ -11,6 +13,52 @@ double sample_gaussian(double mean, double logvar) {
     return mean + stddev * epsilon;
 }
 
+void compute_sigma(const double *logvar, double *sigma, int n) {
+    for (int i = 0; i < n; i++) {
+        sigma[i] = fast_exp(0.5 * logvar[i]);
+    }
+}
+
+static void sample_sigma_serial(const double *mu, const double *sigma, double *w, int n) {
+    random_add_gaussian(w, NULL, n, 0.0, 1.0);
+    for (int i = 0; i < n; i++) {
+        w[i] = mu[i] + sigma[i] * w[i];
+    }
+}
+
+typedef struct {
+    const double *mu;
+    const double *sigma;
+    double *w;
+    uint64_t seed;
+} SampleTask;
+
+static void sample_blocks(void *arg, int begin, int end) {
+    SampleTask *t = (SampleTask*)arg;
+    for (int b = begin; b < end; b++) {
+        int first = b * SAMPLE_BLOCK;
+        random_seed_stream(t->seed, (uint64_t) b);
+        sample_sigma_serial(t->mu + first, t->sigma + first, t->w + first, SAMPLE_BLOCK);
+    }
+}
+
+void sample_gaussian_sigma(const double *mu, const double *sigma, double *w, int n) {
+    if (n < 2 * SAMPLE_BLOCK) {
+        sample_sigma_serial(mu, sigma, w, n);
+        return;
+    }
+    // Block b draws from stream b of a seed taken from the caller's generator, so the sample
+    // does not depend on how the blocks are spread over threads. The caller's stream resumes
+    // afterwards; the remainder after the last full block is drawn from it.
+    SampleTask task = { mu, sigma, w, random_u64() };
+    RandomState caller = random_get_state();
+    int num_blocks = n / SAMPLE_BLOCK;
+    parallel_for(num_blocks, 1, sample_blocks, &task);
+    random_set_state(&caller);
+    int done = num_blocks * SAMPLE_BLOCK;
+    sample_sigma_serial(mu + done, sigma + done, w + done, n - done);
+}
+
 // kl_divergence_single:
 // Computes the KL divergence between N(mu, exp(logvar)) and N(0, prior_variance).
 double kl_divergence_single(double mu, double logvar, double prior_variance) {
@@ -9,6 +9,19 @@
 //   where epsilon ~ N(0,1).
 double sample_gaussian(double mean, double logvar);
 
+// compute_sigma:
+//   sigma[i] = exp(0.5 * logvar[i]) for i < n. Layers cache the result between optimizer
+//   updates so that sampling does not re-evaluate exp per draw.
+void compute_sigma(const double *logvar, double *sigma, int n);
+
+// sample_gaussian_sigma:
+//   w[i] = mu[i] + sigma[i] * epsilon_i for i < n, with the epsilons drawn in bulk by
+//   random_add_gaussian(); the per-weight work is one multiply-add. Arrays of at least
+//   2 * SAMPLE_BLOCK entries are drawn in blocks, one random stream per block, on the kernel
+//   threads (see parallel_for() in thread_pool.h).
+#define SAMPLE_BLOCK 4096
+void sample_gaussian_sigma(const double *mu, const double *sigma, double *w, int n);
+
 // kl_divergence_single:
 //   Computes the KL divergence between the approximate posterior N(mu, sigma^2) and the prior
 //   N(0, prior_variance). Here sigma^2 is computed as exp(logvar).
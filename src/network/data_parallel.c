@@ -0,0 +1,144 @@
+#include "data_parallel.h"
+#include "layers/dropout_layer.h"
+#include "../utils/utils.h"          // For handle_error().
+#include "../utils/random_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void create_context(void *arg, int worker) {
+    DataParallelTrainer *trainer = (DataParallelTrainer*)arg;
+    trainer->contexts[worker] = exec_context_create(trainer->net);
+}
+
+static void free_context(void *arg, int worker) {
+    DataParallelTrainer *trainer = (DataParallelTrainer*)arg;
+    exec_context_free(trainer->contexts[worker]);
+}
+
+// Scale every gradient of a context.
+static void scale_gradients(ExecContext *ctx, double scale) {
+    Network *net = &ctx->view;
+    vector_scale(net->arena->grad_mean, scale, net->arena->num_means);
+    vector_scale(net->arena->grad_logvar, scale, net->arena->num_logvars);
+    for (int i = 0; i < net->num_layers; i++) {
+        if (net->layers[i]->type == LAYER_DROPOUT) {
+            ((DropoutLayer*)net->layers[i]->layer)->d_p_logit *= scale;
+        }
+    }
+}
+
+static void train_shard(void *arg, int worker) {
+    DataParallelTrainer *trainer = (DataParallelTrainer*)arg;
+    ExecContext *ctx = trainer->contexts[worker];
+    int batch = trainer->input->rows, num_workers = trainer->pool->num_threads;
+    int first = (int) ((long) batch * worker / num_workers);
+    int rows = (int) ((long) batch * (worker + 1) / num_workers) - first;
+    exec_zero_gradients(ctx);
+    trainer->shard_loss[worker] = 0.0;
+    if (rows == 0) {
+        return;
+    }
+    Matrix x = { rows, trainer->input->cols, trainer->input->data + (size_t) first * trainer->input->cols, NULL, 0 };
+    Matrix y = { rows, trainer->target->cols, trainer->target->data + (size_t) first * trainer->target->cols, NULL, 0 };
+    // The loss gradient is allocated in the context's arena as well, so it is reused across steps.
+    MatrixArena *previous_arena = matrix_arena_activate(ctx->view.activations);
+    exec_context_seed(ctx, trainer->seed, (uint64_t) worker);
+    Matrix *pred = exec_forward(ctx, &x, 1);
+    Matrix *grad = create_matrix(pred->rows, pred->cols);
+    trainer->shard_loss[worker] = trainer->loss_gradient(pred, &y, grad);
+    Matrix *grad_input = exec_backward(ctx, grad, trainer->step_cfg);
+    free_matrix(grad_input);
+    free_matrix(grad);
+    free_matrix(pred);
+    matrix_arena_activate(previous_arena);
+    scale_gradients(ctx, (double) rows / batch);
+}
+
+// One round of the tree reduction: context w absorbs context w + stride for every w that is a
+// multiple of 2 * stride. After the round with stride 2^k, context w holds the sum of contexts
+// w .. w + 2^(k+1) - 1.
+static void reduce_round(void *arg, int worker) {
+    DataParallelTrainer *trainer = (DataParallelTrainer*)arg;
+    int partner = worker + trainer->stride;
+    if (worker % (2 * trainer->stride) != 0 || partner >= trainer->pool->num_threads) {
+        return;
+    }
+    ParamArena *dst = trainer->contexts[worker]->view.arena, *src = trainer->contexts[partner]->view.arena;
+    vector_axpy(dst->grad_mean, 1.0, src->grad_mean, dst->num_means);
+    vector_axpy(dst->grad_logvar, 1.0, src->grad_logvar, dst->num_logvars);
+}
+
+DataParallelTrainer* data_parallel_create(Network *net, int num_threads) {
+    if (!net) {
+        handle_error("Null network in data_parallel_create.");
+    }
+    DataParallelTrainer *trainer = (DataParallelTrainer*)malloc(sizeof(DataParallelTrainer));
+    if (!trainer) {
+        handle_error("Failed to allocate data-parallel trainer.");
+    }
+    trainer->net = net;
+    trainer->pool = thread_pool_create(num_threads);
+    trainer->contexts = (ExecContext**)calloc(trainer->pool->num_threads, sizeof(ExecContext*));
+    trainer->shard_loss = (double*)calloc(trainer->pool->num_threads, sizeof(double));
+    if (!trainer->contexts || !trainer->shard_loss) {
+        handle_error("Failed to allocate data-parallel trainer.");
+    }
+    network_refresh_caches(net);
+    thread_pool_run(trainer->pool, create_context, trainer);
+    return trainer;
+}
+
+double data_parallel_gradients(DataParallelTrainer *trainer, const Matrix *input, const Matrix *target,
+                               LossGradientFn loss_gradient, const Config *cfg) {
+    if (!trainer || !input || !target || !loss_gradient || input->rows != target->rows || input->rows < 1) {
+        handle_error("Invalid arguments in data_parallel_gradients.");
+    }
+    Network *net = trainer->net;
+    // The optimizer has changed the parameters since the last step.
+    network_refresh_caches(net);
+    trainer->input = input;
+    trainer->target = target;
+    trainer->loss_gradient = loss_gradient;
+    trainer->step_cfg = cfg;
+    trainer->seed = random_u64();
+    thread_pool_run(trainer->pool, train_shard, trainer);
+
+    int num_workers = trainer->pool->num_threads;
+    for (trainer->stride = 1; trainer->stride < num_workers; trainer->stride *= 2) {
+        thread_pool_run(trainer->pool, reduce_round, trainer);
+    }
+    ParamArena *sum = trainer->contexts[0]->view.arena;
+    memcpy(net->arena->grad_mean, sum->grad_mean, sizeof(double) * sum->num_means);
+    memcpy(net->arena->grad_logvar, sum->grad_logvar, sizeof(double) * sum->num_logvars);
+    for (int i = 0; i < net->num_layers; i++) {
+        if (net->layers[i]->type != LAYER_DROPOUT) {
+            continue;
+        }
+        double d_p_logit = 0.0;
+        for (int w = 0; w < num_workers; w++) {
+            d_p_logit += ((DropoutLayer*)trainer->contexts[w]->view.layers[i]->layer)->d_p_logit;
+        }
+        ((DropoutLayer*)net->layers[i]->layer)->d_p_logit = d_p_logit;
+    }
+
+    double loss = 0.0;
+    for (int w = 0; w < num_workers; w++) {
+        int first = (int) ((long) input->rows * w / num_workers);
+        int rows = (int) ((long) input->rows * (w + 1) / num_workers) - first;
+        loss += trainer->shard_loss[w] * rows / input->rows;
+    }
+    // The KL of the weights the contexts sampled is not the network's.
+    network_invalidate_kl(net);
+    return loss;
+}
+
+void data_parallel_free(DataParallelTrainer *trainer) {
+    if (!trainer) {
+        return;
+    }
+    thread_pool_run(trainer->pool, free_context, trainer);
+    thread_pool_free(trainer->pool);
+    free(trainer->contexts);
+    free(trainer->shard_loss);
+    free(trainer);
+}
@@ -0,0 +1,53 @@
+#ifndef DATA_PARALLEL_H
+#define DATA_PARALLEL_H
+
+#include <stdint.h>
+#include "network.h"
+#include "exec_context.h"
+#include "../config/config.h"
+#include "../utils/thread_pool.h"
+
+// Data-parallel training. Each minibatch is split into one contiguous shard of rows per worker.
+// Every worker runs the network through its own ExecContext (with its own activation arena,
+// layer caches and gradient slabs, reading the network's parameters in place): it draws its
+// weights from its own random stream and runs a forward and backward pass on its shard. The
+// contexts' gradients are then summed by a tree reduction over their gradient slabs, which
+// covers dW_mean, dW_logvar, db_*, the conv and dwconv gradients and d_alpha_mean (Concrete
+// dropout logits are summed separately), and the sum is written to the network's own
+// gradients, ready for network_update_params().
+//
+// Each shard's gradient is weighted by its share of the rows. With a loss that is a mean over
+// rows, the sum is the full-batch gradient of the data term, plus the KL gradient once.
+
+// Gradient of the loss w.r.t. the network output: fills 'grad' (same shape as pred) with the
+// gradient of the mean loss over the rows of pred, and returns that mean loss.
+typedef double (*LossGradientFn)(const Matrix *pred, const Matrix *target, Matrix *grad);
+
+typedef struct DataParallelTrainer {
+    ThreadPool *pool;
+    ExecContext **contexts;    // One per worker
+    double *shard_loss;        // Mean loss of each worker's shard in the current step
+    Network *net;              // The network being trained
+    // The step being run
+    const Matrix *input;
+    const Matrix *target;
+    const Config *step_cfg;
+    LossGradientFn loss_gradient;
+    uint64_t seed;
+    int stride;                // Distance between the contexts combined in the current round
+} DataParallelTrainer;
+
+// Start num_threads workers (one per online CPU when num_threads <= 0), each with a context
+// of 'net'.
+DataParallelTrainer* data_parallel_create(Network *net, int num_threads);
+
+// Compute the minibatch gradients of the network on input/target and store them in its
+// gradient buffers, as network_forward() + network_backward(net, ..., cfg) on the whole
+// minibatch would. Returns the mean loss over the minibatch. Follow with
+// network_update_params(net, cfg, ...).
+double data_parallel_gradients(DataParallelTrainer *trainer, const Matrix *input, const Matrix *target,
+                               LossGradientFn loss_gradient, const Config *cfg);
+
+void data_parallel_free(DataParallelTrainer *trainer);
+
+#endif // DATA_PARALLEL_H
@@ -0,0 +1,134 @@
+#include "exec_context.h"
+#include "network_plan.h"
+#include "layers/dropout_layer.h"
+#include "../utils/utils.h"          // For handle_error().
+#include <stdlib.h>
+#include <string.h>
+
+ExecContext* exec_context_create(Network *net) {
+    if (!net || !net->arena) {
+        handle_error("Invalid network in exec_context_create.");
+    }
+    ExecContext *ctx = (ExecContext*)malloc(sizeof(ExecContext));
+    if (!ctx) {
+        handle_error("Failed to allocate execution context.");
+    }
+    network_refresh_caches(net);
+    ctx->net = net;
+    ctx->view = *net;
+    ctx->view.plan = NULL;
+    ctx->view.arena = param_arena_create_view(net->arena);
+    ctx->view.layers = (Layer**)malloc(sizeof(Layer*) * net->num_layers);
+    if (!ctx->view.layers) {
+        handle_error("Failed to allocate execution context.");
+    }
+    // The per-call buffers of the layers are ordinary heap memory.
+    MatrixArena *previous_arena = matrix_arena_activate(NULL);
+    ParamBlock means[MAX_PARAM_BLOCKS], logvars[MAX_PARAM_BLOCKS];
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = (Layer*)malloc(sizeof(Layer));
+        if (!l) {
+            handle_error("Failed to allocate execution context.");
+        }
+        *l = *net->layers[i];
+        l->layer = net->layers[i]->create_context(net->layers[i]->layer);
+        l->optimizer_state = NULL;
+        l->kl_dirty = 1;
+        l->free_layer = l->free_context;
+        int nl, nm = network_layer_param_blocks(l, means, logvars, &nl);
+        param_arena_bind_grads(ctx->view.arena->grad_mean, l->arena_mean_offset, means, nm);
+        param_arena_bind_grads(ctx->view.arena->grad_logvar, l->arena_logvar_offset, logvars, nl);
+        ctx->view.layers[i] = l;
+    }
+    matrix_arena_activate(previous_arena);
+    ctx->view.activations = matrix_arena_create();
+    if (net->plan) {
+        network_plan_reserve(&ctx->view, net->plan);
+    }
+    exec_context_seed(ctx, random_u64(), 0);
+    return ctx;
+}
+
+void exec_context_seed(ExecContext *ctx, uint64_t seed, uint64_t stream) {
+    RandomState caller = random_get_state();
+    random_seed_stream(seed, stream);
+    ctx->rng = random_get_state();
+    random_set_state(&caller);
+}
+
+// Swap the context's stream in (enter) or out (leave) of the calling thread.
+static RandomState enter(ExecContext *ctx) {
+    RandomState caller = random_get_state();
+    random_set_state(&ctx->rng);
+    return caller;
+}
+
+static void leave(ExecContext *ctx, const RandomState *caller) {
+    ctx->rng = random_get_state();
+    random_set_state(caller);
+}
+
+// Scalar parameters are copied into the layer contexts, so they are re-read before each pass.
+static void sync_params(ExecContext *ctx) {
+    for (int i = 0; i < ctx->net->num_layers; i++) {
+        if (ctx->net->layers[i]->type == LAYER_DROPOUT) {
+            const DropoutLayer *src = (const DropoutLayer*)ctx->net->layers[i]->layer;
+            DropoutLayer *dst = (DropoutLayer*)ctx->view.layers[i]->layer;
+            dst->dropout_prob = src->dropout_prob;
+            dst->p_logit = src->p_logit;
+        }
+    }
+}
+
+Matrix* exec_forward(ExecContext *ctx, const Matrix *input, int stochastic) {
+    sync_params(ctx);
+    RandomState caller = enter(ctx);
+    Matrix *output = network_forward(&ctx->view, input, stochastic);
+    leave(ctx, &caller);
+    return output;
+}
+
+void exec_forward_mc(ExecContext *ctx, const Matrix *input, int num_samples, Matrix *out) {
+    sync_params(ctx);
+    RandomState caller = enter(ctx);
+    network_forward_mc(&ctx->view, input, num_samples, out);
+    leave(ctx, &caller);
+}
+
+Matrix* exec_backward(ExecContext *ctx, const Matrix *grad_output, const Config *cfg) {
+    RandomState caller = enter(ctx);
+    Matrix *grad_input = network_backward(&ctx->view, grad_output, cfg);
+    leave(ctx, &caller);
+    return grad_input;
+}
+
+double exec_total_kl(ExecContext *ctx) {
+    // The context cannot tell whether the shared parameters changed since its last call.
+    network_invalidate_kl(&ctx->view);
+    return network_total_kl(&ctx->view);
+}
+
+void exec_zero_gradients(ExecContext *ctx) {
+    ParamArena *grads = ctx->view.arena;
+    memset(grads->grad_mean, 0, sizeof(double) * grads->num_means);
+    memset(grads->grad_logvar, 0, sizeof(double) * grads->num_logvars);
+    for (int i = 0; i < ctx->view.num_layers; i++) {
+        if (ctx->view.layers[i]->type == LAYER_DROPOUT) {
+            ((DropoutLayer*)ctx->view.layers[i]->layer)->d_p_logit = 0.0;
+        }
+    }
+}
+
+void exec_context_free(ExecContext *ctx) {
+    if (!ctx) {
+        return;
+    }
+    for (int i = 0; i < ctx->view.num_layers; i++) {
+        ctx->view.layers[i]->free_context(ctx->view.layers[i]->layer);
+        free(ctx->view.layers[i]);
+    }
+    free(ctx->view.layers);
+    param_arena_free_view(ctx->view.arena);
+    matrix_arena_free(ctx->view.activations);
+    free(ctx);
+}
@@ -0,0 +1,51 @@
+#ifndef EXEC_CONTEXT_H
+#define EXEC_CONTEXT_H
+
+#include "network.h"
+#include "../utils/random_utils.h"
+
+// Reentrant execution of one network. The layers of a Network hold their parameters together
+// with the state of the latest call (cached inputs, masks, sampled weights, gradients), so a
+// Network itself runs one pass at a time. An ExecContext holds that per-call state for one
+// caller: for every layer an instance made by Layer.create_context(), which reads the
+// network's parameters in place, and its own activation arena, gradient slabs and random
+// stream. Any number of contexts of one network may run at once, each on one thread at a time,
+// while the parameters stay shared and are stored once.
+//
+// The network's parameters must not change while its contexts run. After changing them (an
+// optimizer step, network_copy_params(), ...) call network_refresh_caches() before running
+// the contexts again. Concrete dropout probabilities are re-read at the start of every pass.
+//
+// A context presents itself as a Network ('view', whose arena shares the parameter slabs and
+// has its own gradient slabs), so the network functions run on it unchanged; the functions
+// below add the random stream and the parameter synchronization around them.
+
+typedef struct ExecContext {
+    Network *net;         // The network whose parameters the context reads
+    Network view;         // The context's layers, activation arena and gradients
+    RandomState rng;      // The context's random stream, swapped in for each call
+} ExecContext;
+
+// A context of 'net', seeded from the caller's generator. Refreshes the network's caches.
+ExecContext* exec_context_create(Network *net);
+
+// Seed the context with stream 'stream' of 'seed' (see random_seed_stream()).
+void exec_context_seed(ExecContext *ctx, uint64_t seed, uint64_t stream);
+
+// network_forward(), network_forward_mc() and network_backward() on the context. Each
+// exec_backward() overwrites the gradients in ctx->view.arena; only the logit gradients of the
+// context's Concrete dropout layers accumulate, until exec_zero_gradients().
+Matrix* exec_forward(ExecContext *ctx, const Matrix *input, int stochastic);
+void exec_forward_mc(ExecContext *ctx, const Matrix *input, int num_samples, Matrix *out);
+Matrix* exec_backward(ExecContext *ctx, const Matrix *grad_output, const Config *cfg);
+
+// KL divergence of the network's posterior, as network_total_kl(); layers with a Monte Carlo
+// estimate report the one from the context's latest stochastic pass.
+double exec_total_kl(ExecContext *ctx);
+
+// Clear the context's gradients.
+void exec_zero_gradients(ExecContext *ctx);
+
+void exec_context_free(ExecContext *ctx);
+
+#endif // EXEC_CONTEXT_H
@@ -7,6 +7,7 @@
 #include <math.h>
 #include <string.h>
 #include "../priors/prior.h"       // For the common Prior interface.
+#include "../priors/prior_gaussian.h" // For prior_kl_sum().
 #include "../posteriors/posterior.h"
 #include <stdio.h>
 
@@ -21,7 +22,6 @@ Tensor* create_tensor(int channels, int height, int width) {
     t->width = width;
     t->data = (double*)calloc(channels * height * width, sizeof(double));
     if (!t->data) {
-        free(t);
         handle_error("Failed to allocate Tensor data.");
     }
     return t;
@@ -34,21 +34,13 @@ void free_tensor(Tensor *t) {
         free(t);
     }
 }
-#include "bayesian_conv.h"
-#include "../utils/utils.h"
-#include "../utils/random_utils.h"
-#include "../utils/math_utils.h"
-#include "../bnn_util.h"
-#include <stdlib.h>
-#include <math.h>
-#include <string.h>
-#include "../priors/prior.h"       // For the common Prior interface.
-#include "../posteriors/posterior.h"
-
-
 
 // Create a new Bayesian Convolutional layer.
-BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int kernel_height, int kernel_width) {
+BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int kernel_height, int kernel_width,
+                                   int stride, int padding) {
+    if (stride < 1 || padding < 0) {
+        handle_error("Invalid stride or padding in create_bayesian_conv.");
+    }
     BayesianConv *layer = (BayesianConv*)malloc(sizeof(BayesianConv));
     if (!layer) {
         handle_error("Failed to allocate BayesianConv layer.");
@@ -57,6 +49,12 @@ BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int
     layer->output_channels = output_channels;
     layer->kernel_height = kernel_height;
     layer->kernel_width = kernel_width;
+    layer->stride = stride;
+    layer->padding = padding;
+    layer->input_height = 0;
+    layer->input_width = 0;
+    layer->output_height = 0;
+    layer->output_width = 0;
     
     int weight_size = output_channels * input_channels * kernel_height * kernel_width;
     layer->W_mean = (double*)malloc(sizeof(double) * weight_size);
@@ -71,23 +69,37 @@ BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int
         handle_error("Failed to allocate convolutional bias arrays.");
     }
     
-    // Initialize weights and biases.
+    // Initialize weights and biases (layout-agnostic: every entry is i.i.d.).
+    for (int i = 0; i < weight_size; i++) {
+        layer->W_mean[i] = random_gaussian(0.0, 0.1);
+        layer->W_logvar[i] = -5.0;
+    }
     for (int oc = 0; oc < output_channels; oc++) {
-        for (int ic = 0; ic < input_channels; ic++) {
-            for (int kh = 0; kh < kernel_height; kh++) {
-                for (int kw = 0; kw < kernel_width; kw++) {
-                    int idx = oc * (input_channels * kernel_height * kernel_width)
-                              + ic * (kernel_height * kernel_width)
-                              + kh * kernel_width + kw;
-                    layer->W_mean[idx] = random_gaussian(0.0, 0.1);
-                    layer->W_logvar[idx] = -5.0;
-                }
-            }
-        }
         layer->b_mean[oc] = random_gaussian(0.0, 0.1);
         layer->b_logvar[oc] = -5.0;
     }
     
+    // Allocate gradient accumulators, the per-forward weight sample and the cached standard
+    // deviations it is drawn with (computed on first use).
+    layer->dW_mean = (double*)calloc(weight_size, sizeof(double));
+    layer->dW_logvar = (double*)calloc(weight_size, sizeof(double));
+    layer->db_mean = (double*)calloc(output_channels, sizeof(double));
+    layer->db_logvar = (double*)calloc(output_channels, sizeof(double));
+    layer->W_sample = (double*)malloc(sizeof(double) * weight_size);
+    layer->b_sample = (double*)malloc(sizeof(double) * output_channels);
+    layer->W_sigma = (double*)malloc(sizeof(double) * weight_size);
+    layer->b_sigma = (double*)malloc(sizeof(double) * output_channels);
+    if (!layer->dW_mean || !layer->dW_logvar || !layer->db_mean || !layer->db_logvar ||
+        !layer->W_sample || !layer->b_sample || !layer->W_sigma || !layer->b_sigma) {
+        handle_error("Failed to allocate convolutional gradient arrays.");
+    }
+    layer->sigma_dirty = 1;
+    layer->cached_input = NULL;
+    layer->kl_estimator = 0;
+    layer->mc_kl = 0.0;
+    layer->mc_kl_valid = 0;
+    layer->mc_kl_grad = NULL;
+    
     // Initialize the Prior and Posterior pointers to NULL.
     layer->prior = NULL;
     layer->posterior = NULL;
@@ -95,8 +107,20 @@ BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int
     return layer;
 }
 
-// Free a Bayesian Convolutional layer.
-
+void bayesian_conv_set_input_size(BayesianConv *layer, int input_height, int input_width) {
+    int out_height = (input_height + 2 * layer->padding - layer->kernel_height) / layer->stride + 1;
+    int out_width = (input_width + 2 * layer->padding - layer->kernel_width) / layer->stride + 1;
+    if (input_height + 2 * layer->padding < layer->kernel_height ||
+        input_width + 2 * layer->padding < layer->kernel_width || out_height <= 0 || out_width <= 0) {
+        printf("input: %dx%d, kernel: %dx%d, padding: %d; ", input_height, input_width,
+               layer->kernel_height, layer->kernel_width, layer->padding);
+        handle_error("Invalid output dimensions in bayesian_conv_set_input_size.");
+    }
+    layer->input_height = input_height;
+    layer->input_width = input_width;
+    layer->output_height = out_height;
+    layer->output_width = out_width;
+}
 
 Tensor* matrix_to_tensor(const Matrix *m, int channels, int height, int width) {
     int flat = channels * height * width;
@@ -113,7 +137,6 @@ Tensor* matrix_to_tensor(const Matrix *m, int channels, int height, int width) {
     int total = m->rows * flat;
     t->data = (double*)malloc(sizeof(double) * total);
     if (!t->data) {
-         free(t);
          handle_error("Failed to allocate Tensor data.");
     }
     // Copy data row-by-row.
@@ -122,147 +145,267 @@ Tensor* matrix_to_tensor(const Matrix *m, int channels, int height, int width) {
 }
 
 
-// Forward pass for the Bayesian convolutional layer (stride 1, no padding).
-// Forward pass for the Bayesian convolutional layer (with 'same' padding).
-// This function now produces an output tensor with the same height and width as the input.
-// Forward pass for the Bayesian convolutional layer with global average pooling.
-// This function first computes a standard convolution (using valid convolution),
-// then applies global average pooling to collapse the spatial dimensions, yielding
-// an output matrix of shape (batch_size x output_channels).
-Matrix* bayesian_conv_forward(BayesianConv *layer, const Tensor *input, int stochastic) {
-    if (input->channels != layer->input_channels) {
-        printf("input to channels: %d", input->channels);
-        printf("layer to input channels: %d", layer->input_channels);
-        handle_error("Input channel mismatch in bayesian_conv_forward.");
-        
+// Forward pass for the Bayesian convolutional layer (NHWC, configurable stride and zero padding).
+// One weight/bias sample is drawn per call and shared by the whole batch, as in BayesianLinear.
+// For every output pixel the kernel window is accumulated as a sequence of rank-1 updates
+// out[oc] += x[ic] * W[kh][kw][ic][oc], whose inner loop runs over contiguous output channels.
+Matrix* bayesian_conv_forward(BayesianConv *layer, const Matrix *input, int stochastic) {
+    int C = layer->input_channels;
+    int OC = layer->output_channels;
+    if (layer->input_height == 0) {
+        handle_error("BayesianConv input size not set; call bayesian_conv_set_input_size() first.");
     }
-    
-    // Compute output spatial dimensions using valid convolution.
-    // Compute output spatial dimensions using valid convolution.
-    // (Assuming input->height and input->width represent the spatial dimensions of one sample.)
-    int out_height = input->height - layer->kernel_height + 1;
-    int out_width = input->width - layer->kernel_width + 1;
-
-    if (out_height <= 0 || out_width <= 0) {
-        printf("out_height: %d; ", out_height);
-        printf("out_width: %d", out_width);
-        handle_error("Invalid output dimensions in bayesian_conv_forward.");
+    int H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    if (input->cols != H * W * C) {
+        printf("input to cols: %d", input->cols);
+        printf("layer to input size: %dx%dx%d", H, W, C);
+        handle_error("Input shape mismatch in bayesian_conv_forward.");
     }
     
-    // Create an intermediate tensor for the convolution result.
-    // This tensor has dimensions: [output_channels x out_height x out_width].
-    Tensor *conv_out = create_tensor(layer->output_channels, out_height, out_width);
+    // Cache the input for the backward pass.
+    if (layer->cached_input) {
+        free_matrix(layer->cached_input);
+    }
+    layer->cached_input = copy_matrix(input);
     
-    // Perform convolution for each output channel.
-    for (int oc = 0; oc < layer->output_channels; oc++) {
-        // Compute effective bias for the output channel.
-        double b_effective;
+    // Draw the effective weights and biases for this pass.
+    int weight_size = layer->kernel_height * layer->kernel_width * C * OC;
+    // Monte Carlo KL: each kernel tap's C x OC block of weights is scored right after it is
+    // drawn, while it is still in cache.
+    int mc_kl = stochastic && layer->kl_estimator == 1;
+    int num_params = weight_size + OC;
+    if (mc_kl) {
+        if (!layer->mc_kl_grad) {
+            layer->mc_kl_grad = (double*)malloc(sizeof(double) * 2 * num_params);
+            if (!layer->mc_kl_grad) {
+                handle_error("Failed to allocate Monte Carlo KL gradients.");
+            }
+        }
+        zero_array(layer->mc_kl_grad, 2 * num_params);
+        layer->mc_kl = 0.0;
+    }
+    // The standard deviations are cached between optimizer updates of the log-variances.
+    if (stochastic && layer->posterior == NULL && layer->sigma_dirty) {
+        compute_sigma(layer->W_logvar, layer->W_sigma, weight_size);
+        compute_sigma(layer->b_logvar, layer->b_sigma, OC);
+        layer->sigma_dirty = 0;
+    }
+    for (int tap = 0; tap < weight_size; tap += C * OC) {
+        if (stochastic && layer->posterior == NULL) {
+            // Mean-field: one multiply-add per weight with the cached standard deviations.
+            sample_gaussian_sigma(layer->W_mean + tap, layer->W_sigma + tap, layer->W_sample + tap, C * OC);
+        } else {
+            for (int i = tap; i < tap + C * OC; i++) {
+                if (stochastic) {
+                    layer->W_sample[i] = layer->posterior->sample(layer->posterior, layer->W_mean[i], layer->W_logvar[i]);
+                } else {
+                    layer->W_sample[i] = layer->W_mean[i];
+                }
+            }
+        }
+        if (mc_kl) {
+            layer->mc_kl += prior_mc_kl_sum(layer->prior, 1.0, layer->W_mean + tap, layer->W_logvar + tap,
+                                            layer->W_sample + tap, C * OC, layer->mc_kl_grad + tap,
+                                            layer->mc_kl_grad + num_params + tap, 1.0);
+        }
+    }
+    for (int oc = 0; oc < OC; oc++) {
         if (stochastic) {
             if (layer->posterior != NULL) {
-                b_effective = layer->posterior->sample(layer->posterior, layer->b_mean[oc], layer->b_logvar[oc]);
+                layer->b_sample[oc] = layer->posterior->sample(layer->posterior, layer->b_mean[oc], layer->b_logvar[oc]);
             } else {
-                b_effective = sample_gaussian(layer->b_mean[oc], layer->b_logvar[oc]);
+                layer->b_sample[oc] = layer->b_mean[oc] + layer->b_sigma[oc] * random_gaussian(0.0, 1.0);
             }
         } else {
-            b_effective = layer->b_mean[oc];
+            layer->b_sample[oc] = layer->b_mean[oc];
         }
-        
-        // For each spatial location in the output.
-        for (int oh = 0; oh < out_height; oh++) {
-            for (int ow = 0; ow < out_width; ow++) {
-                double sum = 0.0;
-                // Sum over input channels and kernel window.
-                for (int ic = 0; ic < layer->input_channels; ic++) {
-                    for (int kh = 0; kh < layer->kernel_height; kh++) {
-                        for (int kw = 0; kw < layer->kernel_width; kw++) {
-                            int ih = oh + kh;
-                            int iw = ow + kw;
-                            int input_idx = ic * (input->height * input->width) + ih * input->width + iw;
-                            
-                            int weight_idx = oc * (layer->input_channels * layer->kernel_height * layer->kernel_width)
-                                             + ic * (layer->kernel_height * layer->kernel_width)
-                                             + kh * layer->kernel_width + kw;
-                            
-                            double weight_effective;
-                            if (stochastic) {
-                                if (layer->posterior != NULL) {
-                                    weight_effective = layer->posterior->sample(layer->posterior,
-                                                                                 layer->W_mean[weight_idx],
-                                                                                 layer->W_logvar[weight_idx]);
-                                } else {
-                                    weight_effective = sample_gaussian(layer->W_mean[weight_idx],
-                                                                       layer->W_logvar[weight_idx]);
-                                }
-                            } else {
-                                weight_effective = layer->W_mean[weight_idx];
+    }
+    if (mc_kl) {
+        layer->mc_kl += prior_mc_kl_sum(layer->prior, 1.0, layer->b_mean, layer->b_logvar, layer->b_sample, OC,
+                                        layer->mc_kl_grad + weight_size, layer->mc_kl_grad + num_params + weight_size,
+                                        1.0);
+        layer->mc_kl_valid = 1;
+    }
+    
+    int batch_size = input->rows;
+    Matrix *output = create_matrix(batch_size, OH * OW * OC);
+    const double *Wt = layer->W_sample;
+    
+    for (int b = 0; b < batch_size; b++) {
+        const double *in_img = input->data + (size_t) b * H * W * C;
+        double *out_img = output->data + (size_t) b * OH * OW * OC;
+        for (int oh = 0; oh < OH; oh++) {
+            for (int ow = 0; ow < OW; ow++) {
+                double *out_px = out_img + (oh * OW + ow) * OC;
+                for (int oc = 0; oc < OC; oc++) {
+                    out_px[oc] = layer->b_sample[oc];
+                }
+                for (int kh = 0; kh < layer->kernel_height; kh++) {
+                    int ih = oh * layer->stride - layer->padding + kh;
+                    if (ih < 0 || ih >= H) continue;  // Zero padding.
+                    for (int kw = 0; kw < layer->kernel_width; kw++) {
+                        int iw = ow * layer->stride - layer->padding + kw;
+                        if (iw < 0 || iw >= W) continue;
+                        const double *in_px = in_img + (ih * W + iw) * C;
+                        const double *w_tap = Wt + (kh * layer->kernel_width + kw) * C * OC;
+                        for (int ic = 0; ic < C; ic++) {
+                            double x = in_px[ic];
+                            const double *w_row = w_tap + ic * OC;
+                            for (int oc = 0; oc < OC; oc++) {
+                                out_px[oc] += x * w_row[oc];
                             }
-                            
-                            sum += input->data[input_idx] * weight_effective;
                         }
                     }
                 }
-                // Add bias and store the result.
-                int conv_idx = oc * (out_height * out_width) + oh * out_width + ow;
-                conv_out->data[conv_idx] = sum + b_effective;
             }
         }
     }
+    return output;
+}
+
+// Backward pass for the Bayesian convolutional layer.
+// Mirrors the forward loop nest: every (output pixel, kernel tap) pair contributes
+//   dW[kh][kw][ic][oc] += x[ic] * g[oc]         (rank-1 update over contiguous oc)
+//   dx[ic]             += sum_oc W[..][ic][oc] * g[oc]
+// The KL gradient is added the same way as in bayesian_linear_backward.
+Matrix* bayesian_conv_backward(BayesianConv *layer, const Matrix *grad_output, const Config *cfg) {
+    if (!layer || !grad_output || !layer->cached_input) {
+        handle_error("Invalid input to bayesian_conv_backward.");
+    }
+    const Matrix *input = layer->cached_input;
+    int C = layer->input_channels, OC = layer->output_channels;
+    int H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    int weight_size = layer->kernel_height * layer->kernel_width * C * OC;
+    int batch_size = input->rows;
     
-    // Flatten the convolution result into a Matrix.
-    // The flattened dimensions will be:
-    //   rows = batch_size (same as input->height? -- note: usually batch size is stored separately)
-    //   cols = output_channels * out_height * out_width
-    // Here, we assume that 'input->height' is being used as the batch size (if your Matrix and Tensor conventions differ,
-    // adjust accordingly).
-    int batch_size = input->width;  // Assuming 'rows' in Matrix represent batch size.
-    int flatten_dim = layer->output_channels * out_height * out_width;
-    Matrix *output = create_matrix(batch_size, flatten_dim);
+    // Clear the mean gradients (the log-variance gradients are written in full below)
+    zero_array(layer->dW_mean, weight_size);
+    zero_array(layer->db_mean, OC);
+    
+    Matrix *grad_input = create_matrix(batch_size, H * W * C);
     
-    // For each sample in the batch, copy and flatten the corresponding data from conv_out.
-    // Note: This assumes that conv_out->data is organized per sample.
-    // If your Tensor structure doesn't include a batch dimension, you'll need to modify accordingly.
-    // Here, we assume conv_out has 'batch_size' copies (one per sample) concatenated in memory.
-    // For demonstration purposes, we'll assume that conv_out->data holds one sample and we replicate for each row.
     for (int b = 0; b < batch_size; b++) {
-        for (int j = 0; j < flatten_dim; j++) {
-            // Adjust indexing based on your actual Tensor organization.
-            // Here we assume the same conv_out for each sample.
-            output->data[b * flatten_dim + j] = conv_out->data[j];
+        const double *in_img = input->data + (size_t) b * H * W * C;
+        double *gin_img = grad_input->data + (size_t) b * H * W * C;
+        const double *g_img = grad_output->data + (size_t) b * OH * OW * OC;
+        for (int oh = 0; oh < OH; oh++) {
+            for (int ow = 0; ow < OW; ow++) {
+                const double *g_px = g_img + (oh * OW + ow) * OC;
+                for (int oc = 0; oc < OC; oc++) {
+                    layer->db_mean[oc] += g_px[oc];
+                }
+                for (int kh = 0; kh < layer->kernel_height; kh++) {
+                    int ih = oh * layer->stride - layer->padding + kh;
+                    if (ih < 0 || ih >= H) continue;
+                    for (int kw = 0; kw < layer->kernel_width; kw++) {
+                        int iw = ow * layer->stride - layer->padding + kw;
+                        if (iw < 0 || iw >= W) continue;
+                        const double *in_px = in_img + (ih * W + iw) * C;
+                        double *gin_px = gin_img + (ih * W + iw) * C;
+                        int tap = (kh * layer->kernel_width + kw) * C * OC;
+                        for (int ic = 0; ic < C; ic++) {
+                            double x = in_px[ic];
+                            const double *w_row = layer->W_sample + tap + ic * OC;
+                            double *dw_row = layer->dW_mean + tap + ic * OC;
+                            double acc = 0.0;
+                            for (int oc = 0; oc < OC; oc++) {
+                                dw_row[oc] += x * g_px[oc];
+                                acc += w_row[oc] * g_px[oc];
+                            }
+                            gin_px[ic] += acc;
+                        }
+                    }
+                }
+            }
         }
     }
     
-    free_tensor(conv_out);
-    return output;
+    // --- Log-variance and KL gradients, fused into one sweep over the parameters ---
+    // dL/dlogvar = dL/dw * 0.5 * (w - mu) for w = mu + exp(logvar/2) * eps; then kl_weight times
+    // dKL/dmu and dKL/dlogvar, from the Monte Carlo estimate or from the prior, block by block.
+    double kl_weight = cfg->kl_weight;
+    int num_params = weight_size + OC;
+    const double *mc_grad = (layer->kl_estimator == 1 && layer->mc_kl_valid) ? layer->mc_kl_grad : NULL;
+    int block = C * OC;
+    for (int start = 0; start < weight_size; start += block) {
+        for (int i = start; i < start + block; i++) {
+            layer->dW_logvar[i] = layer->dW_mean[i] * 0.5 * (layer->W_sample[i] - layer->W_mean[i]);
+        }
+        if (mc_grad) {
+            for (int i = start; i < start + block; i++) {
+                layer->dW_mean[i] += kl_weight * mc_grad[i];
+                layer->dW_logvar[i] += kl_weight * mc_grad[num_params + i];
+            }
+        } else {
+            prior_grad_kl(layer->prior, 1.0, layer->W_mean + start, layer->W_logvar + start, block,
+                          layer->dW_mean + start, layer->dW_logvar + start, kl_weight);
+        }
+    }
+    for (int oc = 0; oc < OC; oc++) {
+        layer->db_logvar[oc] = layer->db_mean[oc] * 0.5 * (layer->b_sample[oc] - layer->b_mean[oc]);
+        if (mc_grad) {
+            layer->db_mean[oc] += kl_weight * mc_grad[weight_size + oc];
+            layer->db_logvar[oc] += kl_weight * mc_grad[num_params + weight_size + oc];
+        }
+    }
+    if (!mc_grad) {
+        prior_grad_kl(layer->prior, 1.0, layer->b_mean, layer->b_logvar, OC, layer->db_mean, layer->db_logvar,
+                      kl_weight);
+    }
+    
+    return grad_input;
 }
 
 
 
 // Compute the total KL divergence for the layer's weights and biases using the Prior interface.
-// For each weight and bias, if a Prior is assigned, call its compute_kl() function;
-// otherwise, use a default Gaussian KL divergence with variance 1.0.
+// With the Monte Carlo estimator this is the estimate of the last stochastic forward pass.
+// Otherwise each parameter tensor is reduced in one prior_kl_sum() call; without a Prior the
+// default Gaussian with variance 1.0 is used.
 double bayesian_conv_kl(BayesianConv *layer) {
-    double kl_total = 0.0;
+    if (layer->kl_estimator == 1 && layer->mc_kl_valid) {
+        return layer->mc_kl;
+    }
     int total_weights = layer->output_channels * layer->input_channels * layer->kernel_height * layer->kernel_width;
-    
-    if (layer->prior == NULL) {
-        double default_variance = 1.0;
-        for (int i = 0; i < total_weights; i++) {
-            kl_total += kl_divergence_single(layer->W_mean[i], layer->W_logvar[i], default_variance);
-        }
-        for (int i = 0; i < layer->output_channels; i++) {
-            kl_total += kl_divergence_single(layer->b_mean[i], layer->b_logvar[i], default_variance);
-        }
-    } else {
-        for (int i = 0; i < total_weights; i++) {
-            kl_total += layer->prior->compute_kl(layer->prior, layer->W_mean[i], layer->W_logvar[i]);
-        }
-        for (int i = 0; i < layer->output_channels; i++) {
-            kl_total += layer->prior->compute_kl(layer->prior, layer->b_mean[i], layer->b_logvar[i]);
-        }
+    double default_variance = 1.0;
+    return prior_kl_sum(layer->prior, default_variance, layer->W_mean, layer->W_logvar, total_weights, NULL, NULL, 0.0)
+         + prior_kl_sum(layer->prior, default_variance, layer->b_mean, layer->b_logvar, layer->output_channels,
+                        NULL, NULL, 0.0);
+}
+
+// Per-call state sharing the parameters of 'params'.
+BayesianConv* bayesian_conv_create_context(const BayesianConv *params) {
+    BayesianConv *ctx = (BayesianConv*)malloc(sizeof(BayesianConv));
+    if (!ctx) {
+        handle_error("Failed to allocate BayesianConv context.");
     }
-    return kl_total;
+    *ctx = *params;
+    int weight_size = params->output_channels * params->input_channels * params->kernel_height * params->kernel_width;
+    ctx->dW_mean = ctx->dW_logvar = ctx->db_mean = ctx->db_logvar = NULL;
+    ctx->W_sample = (double*)malloc(sizeof(double) * weight_size);
+    ctx->b_sample = (double*)malloc(sizeof(double) * params->output_channels);
+    if (!ctx->W_sample || !ctx->b_sample) {
+        handle_error("Failed to allocate BayesianConv context.");
+    }
+    ctx->sigma_dirty = 0;
+    ctx->cached_input = NULL;
+    ctx->mc_kl = 0.0;
+    ctx->mc_kl_valid = 0;
+    ctx->mc_kl_grad = NULL;
+    return ctx;
 }
 
+void free_bayesian_conv_context(BayesianConv *ctx) {
+    if (ctx) {
+        free(ctx->W_sample);
+        free(ctx->b_sample);
+        free(ctx->mc_kl_grad);
+        free_matrix(ctx->cached_input);
+        free(ctx);
+    }
+}
 
 void free_bayesian_conv(BayesianConv *layer) {
     if (layer) {
@@ -270,6 +413,18 @@ void free_bayesian_conv(BayesianConv *layer) {
         free(layer->W_logvar);
         free(layer->b_mean);
         free(layer->b_logvar);
+        free(layer->dW_mean);
+        free(layer->dW_logvar);
+        free(layer->db_mean);
+        free(layer->db_logvar);
+        free(layer->W_sample);
+        free(layer->b_sample);
+        free(layer->W_sigma);
+        free(layer->b_sigma);
+        free(layer->mc_kl_grad);
+        if (layer->cached_input) {
+            free_matrix(layer->cached_input);
+        }
         free(layer);
     }
 }
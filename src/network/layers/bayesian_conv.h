@@ -7,6 +7,7 @@
 #include "../utils/random_utils.h"
 #include "../priors/prior.h"       // For the Prior interface
 #include "../posteriors/posterior.h" // For the Posterior interface
+#include "../config/config.h"
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
@@ -24,13 +25,25 @@ Tensor* create_tensor(int channels, int height, int width);
 void free_tensor(Tensor *t);
 
 // Structure representing a Bayesian Convolutional Layer.
+//
+// Activations are exchanged with the rest of the network as a Matrix of shape
+// (batch_size x height*width*channels), each row holding one image in NHWC order
+// (channel index fastest). Keeping channels innermost lets the convolution and
+// pooling inner loops run over contiguous channels, so they vectorize.
 typedef struct {
     int input_channels;
     int output_channels;
     int kernel_height;
     int kernel_width;
-    // Weight parameters: stored as a flat array of size:
-    // output_channels * input_channels * kernel_height * kernel_width.
+    int stride;
+    int padding;            // Zero padding applied to every spatial border.
+    // Spatial geometry, set by bayesian_conv_set_input_size().
+    int input_height;
+    int input_width;
+    int output_height;
+    int output_width;
+    // Weight parameters: stored as a flat array in HWIO order
+    // [kernel_height][kernel_width][input_channels][output_channels].
     double *W_mean;
     double *W_logvar;
     // Bias parameters: arrays of length output_channels.
@@ -40,26 +53,63 @@ typedef struct {
     Prior *prior;
     // NEW: Pointer to a Posterior structure for sampling the weights and biases.
     Posterior *posterior;
+    // Gradients (same layout as the parameters).
+    double *dW_mean;
+    double *dW_logvar;
+    double *db_mean;
+    double *db_logvar;
+    // Weights and biases drawn in the most recent forward pass.
+    double *W_sample;
+    double *b_sample;
+    // exp(0.5 * logvar), cached for sampling. Whoever writes W_logvar or b_logvar (the optimizer)
+    // sets sigma_dirty, and the next stochastic forward pass recomputes both arrays.
+    double *W_sigma;
+    double *b_sigma;
+    int sigma_dirty;
+    Matrix *cached_input; // The input used in the most recent forward pass
+    // Monte Carlo KL (kl_estimator == 1), accumulated while the weights are sampled.
+    int kl_estimator;     // 0: closed-form KL, 1: Monte Carlo estimate
+    double mc_kl;         // Estimate from the most recent stochastic forward pass
+    int mc_kl_valid;      // Nonzero once mc_kl and mc_kl_grad hold an estimate
+    double *mc_kl_grad;   // dKL/d(W_mean, b_mean) followed by dKL/d(W_logvar, b_logvar); NULL until used
 } BayesianConv;
 
-// Create a Bayesian Convolutional layer with specified dimensions.
-BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int kernel_height, int kernel_width);
+// Create a Bayesian Convolutional layer with specified dimensions, stride and padding.
+BayesianConv* create_bayesian_conv(int input_channels, int output_channels, int kernel_height, int kernel_width,
+                                   int stride, int padding);
+
+// Set the spatial size of the input images and derive the output size:
+//   out = (in + 2 * padding - kernel) / stride + 1
+// Calls handle_error() if the output would be empty.
+void bayesian_conv_set_input_size(BayesianConv *layer, int input_height, int input_width);
 
 // Free memory allocated for a Bayesian Convolutional layer.
 void free_bayesian_conv(BayesianConv *layer);
 
+// Per-call state for running the layer from several threads (see exec_context.h and
+// bayesian_linear_create_context()): shares the parameters and cached standard deviations,
+// owns the samples and input cache; the gradient pointers are left NULL for the caller.
+BayesianConv* bayesian_conv_create_context(const BayesianConv *params);
+void free_bayesian_conv_context(BayesianConv *ctx);
+
 // Forward pass for the Bayesian Convolutional layer.
-// 'input' is a Tensor of shape (input_channels, height, width).
-// If 'stochastic' is nonzero, weights and biases are sampled via the reparameterization trick.
-// If a Posterior object is provided, its sample() function is used for sampling.
-// Returns a new Tensor representing the output (shape: (output_channels, out_height, out_width))
-// with out_height = input->height - kernel_height + 1, out_width = input->width - kernel_width + 1.
-Matrix* bayesian_conv_forward(BayesianConv *layer, const Tensor *input, int stochastic);
+// 'input' is a Matrix of shape (batch_size x input_height*input_width*input_channels) in NHWC order.
+// If 'stochastic' is nonzero, weights and biases are sampled once per call via the reparameterization
+// trick (through the Posterior's sample() function if one is set).
+// Returns a new Matrix of shape (batch_size x output_height*output_width*output_channels), NHWC.
+// The input size must have been set with bayesian_conv_set_input_size().
+Matrix* bayesian_conv_forward(BayesianConv *layer, const Matrix *input, int stochastic);
+
+// Backward pass: accumulates dW_mean/db_mean from the data loss plus the KL contribution
+// and returns the gradient w.r.t. the input (same shape as the forward input).
+Matrix* bayesian_conv_backward(BayesianConv *layer, const Matrix *grad_output, const Config *cfg);
+
 Tensor* matrix_to_tensor(const Matrix *m, int channels, int height, int width);
 
 // Compute the total KL divergence for this convolutional layer using the Prior interface.
-// For each weight and bias, if a Prior is assigned, it uses layer->prior->compute_kl();
-// otherwise, it falls back to a default Gaussian prior (variance = 1.0).
+// The weight and bias tensors each go through one prior_kl_sum() call, which uses the Prior's
+// per-tensor kernel, or a default Gaussian prior (variance = 1.0) when none is assigned.
+// With kl_estimator == 1 it returns the Monte Carlo estimate of the last stochastic forward pass.
 double bayesian_conv_kl(BayesianConv *layer);
 
 #endif // BAYESIAN_CONV_H
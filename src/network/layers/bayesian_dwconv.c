@@ -0,0 +1,399 @@
+#include "bayesian_dwconv.h"
+#include "../utils/utils.h"          // For handle_error()
+#include "../utils/random_utils.h"   // For random_gaussian()
+#include "../priors/prior_gaussian.h"  // For prior_kl_sum()
+#include <stdlib.h>
+#include <stdio.h>
+
+// Allocate an array of n doubles or abort.
+static double* alloc_params(int n) {
+    double *p = (double*)calloc(n, sizeof(double));
+    if (!p) {
+        handle_error("Failed to allocate BayesianDWConv parameter array.");
+    }
+    return p;
+}
+
+// Draw one sample per parameter (or copy the means when not stochastic).
+// With non-NULL kl_grad_mean / kl_grad_logvar the sample is also scored by the Monte Carlo KL,
+// whose gradients are added to those arrays; the estimate is returned (0 otherwise).
+static double sample_params(const BayesianDWConv *layer, const double *mean, const double *logvar,
+                            double *out, int n, int stochastic, double *kl_grad_mean, double *kl_grad_logvar) {
+    for (int i = 0; i < n; i++) {
+        if (stochastic) {
+            if (layer->posterior != NULL) {
+                out[i] = layer->posterior->sample(layer->posterior, mean[i], logvar[i]);
+            } else {
+                out[i] = sample_gaussian(mean[i], logvar[i]);
+            }
+        } else {
+            out[i] = mean[i];
+        }
+    }
+    if (kl_grad_mean) {
+        return prior_mc_kl_sum(layer->prior, 1.0, mean, logvar, out, n, kl_grad_mean, kl_grad_logvar, 1.0);
+    }
+    return 0.0;
+}
+
+// Complete the gradients of one parameter array once its data gradient w.r.t. the mean is
+// accumulated in grad_mean: set the log-variance gradient dL/dw * 0.5 * (w - mu)
+// (w = mu + exp(logvar/2) * eps) and add kl_weight times the KL gradients, taken from the
+// Monte Carlo estimate when mc_grad_mean is non-NULL and from the prior otherwise.
+static void finish_param_grads(const BayesianDWConv *layer, const double *mean, const double *logvar,
+                               const double *sample, double *grad_mean, double *grad_logvar, int n,
+                               const double *mc_grad_mean, const double *mc_grad_logvar, double kl_weight) {
+    for (int i = 0; i < n; i++) {
+        grad_logvar[i] = grad_mean[i] * 0.5 * (sample[i] - mean[i]);
+    }
+    if (mc_grad_mean) {
+        for (int i = 0; i < n; i++) {
+            grad_mean[i] += kl_weight * mc_grad_mean[i];
+            grad_logvar[i] += kl_weight * mc_grad_logvar[i];
+        }
+    } else {
+        prior_grad_kl(layer->prior, 1.0, mean, logvar, n, grad_mean, grad_logvar, kl_weight);
+    }
+}
+
+// KL divergence summed over one parameter array.
+static double params_kl(const BayesianDWConv *layer, const double *mean, const double *logvar, int n) {
+    return prior_kl_sum(layer->prior, 1.0, mean, logvar, n, NULL, NULL, 0.0);
+}
+
+// Create a depthwise-separable Bayesian convolution.
+BayesianDWConv* create_bayesian_dwconv(int input_channels, int output_channels, int kernel_height, int kernel_width,
+                                       int stride, int padding) {
+    if (stride < 1 || padding < 0) {
+        handle_error("Invalid stride or padding in create_bayesian_dwconv.");
+    }
+    BayesianDWConv *layer = (BayesianDWConv*)malloc(sizeof(BayesianDWConv));
+    if (!layer) {
+        handle_error("Failed to allocate BayesianDWConv layer.");
+    }
+    layer->input_channels = input_channels;
+    layer->output_channels = output_channels;
+    layer->kernel_height = kernel_height;
+    layer->kernel_width = kernel_width;
+    layer->stride = stride;
+    layer->padding = padding;
+    layer->input_height = 0;
+    layer->input_width = 0;
+    layer->output_height = 0;
+    layer->output_width = 0;
+    
+    int dw_size = kernel_height * kernel_width * input_channels;
+    int pw_size = input_channels * output_channels;
+    layer->dw_mean = alloc_params(dw_size);
+    layer->dw_logvar = alloc_params(dw_size);
+    layer->pw_mean = alloc_params(pw_size);
+    layer->pw_logvar = alloc_params(pw_size);
+    layer->b_mean = alloc_params(output_channels);
+    layer->b_logvar = alloc_params(output_channels);
+    
+    // Initialize weights and biases.
+    for (int i = 0; i < dw_size; i++) {
+        layer->dw_mean[i] = random_gaussian(0.0, 0.1);
+        layer->dw_logvar[i] = -5.0;
+    }
+    for (int i = 0; i < pw_size; i++) {
+        layer->pw_mean[i] = random_gaussian(0.0, 0.1);
+        layer->pw_logvar[i] = -5.0;
+    }
+    for (int oc = 0; oc < output_channels; oc++) {
+        layer->b_mean[oc] = random_gaussian(0.0, 0.1);
+        layer->b_logvar[oc] = -5.0;
+    }
+    
+    layer->d_dw_mean = alloc_params(dw_size);
+    layer->d_dw_logvar = alloc_params(dw_size);
+    layer->d_pw_mean = alloc_params(pw_size);
+    layer->d_pw_logvar = alloc_params(pw_size);
+    layer->db_mean = alloc_params(output_channels);
+    layer->db_logvar = alloc_params(output_channels);
+    layer->dw_sample = alloc_params(dw_size);
+    layer->pw_sample = alloc_params(pw_size);
+    layer->b_sample = alloc_params(output_channels);
+    layer->cached_input = NULL;
+    layer->cached_depthwise = NULL;
+    layer->kl_estimator = 0;
+    layer->mc_kl = 0.0;
+    layer->mc_kl_valid = 0;
+    layer->mc_kl_grad = NULL;
+    
+    // Initialize the Prior and Posterior pointers to NULL.
+    layer->prior = NULL;
+    layer->posterior = NULL;
+    
+    return layer;
+}
+
+void bayesian_dwconv_set_input_size(BayesianDWConv *layer, int input_height, int input_width) {
+    int out_height = (input_height + 2 * layer->padding - layer->kernel_height) / layer->stride + 1;
+    int out_width = (input_width + 2 * layer->padding - layer->kernel_width) / layer->stride + 1;
+    if (input_height + 2 * layer->padding < layer->kernel_height ||
+        input_width + 2 * layer->padding < layer->kernel_width || out_height <= 0 || out_width <= 0) {
+        printf("input: %dx%d, kernel: %dx%d, padding: %d; ", input_height, input_width,
+               layer->kernel_height, layer->kernel_width, layer->padding);
+        handle_error("Invalid output dimensions in bayesian_dwconv_set_input_size.");
+    }
+    layer->input_height = input_height;
+    layer->input_width = input_width;
+    layer->output_height = out_height;
+    layer->output_width = out_width;
+}
+
+int bayesian_dwconv_num_params(const BayesianDWConv *layer) {
+    return layer->kernel_height * layer->kernel_width * layer->input_channels
+           + layer->input_channels * layer->output_channels
+           + layer->output_channels;
+}
+
+// Forward pass.
+// Depthwise: mid[p][c] = sum_{kh,kw} x[p'][c] * dw[kh][kw][c]   (vectorized over c)
+// Pointwise: out[p][oc] = b[oc] + sum_c mid[p][c] * pw[c][oc]   (row-times-matrix GEMM, vectorized over oc)
+Matrix* bayesian_dwconv_forward(BayesianDWConv *layer, const Matrix *input, int stochastic) {
+    int C = layer->input_channels, OC = layer->output_channels;
+    int H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    if (H == 0 || input->cols != H * W * C) {
+        handle_error("Input shape mismatch in bayesian_dwconv_forward.");
+    }
+    
+    // Cache the input for the backward pass.
+    if (layer->cached_input) {
+        free_matrix(layer->cached_input);
+    }
+    layer->cached_input = copy_matrix(input);
+    
+    int dw_size = layer->kernel_height * layer->kernel_width * C;
+    int pw_size = C * OC;
+    int num_params = bayesian_dwconv_num_params(layer);
+    double *g_mean = NULL, *g_logvar = NULL;
+    if (stochastic && layer->kl_estimator == 1) {
+        if (!layer->mc_kl_grad) {
+            layer->mc_kl_grad = alloc_params(2 * num_params);
+        } else {
+            zero_array(layer->mc_kl_grad, 2 * num_params);
+        }
+        g_mean = layer->mc_kl_grad;
+        g_logvar = layer->mc_kl_grad + num_params;
+    }
+    double mc_kl = sample_params(layer, layer->dw_mean, layer->dw_logvar, layer->dw_sample, dw_size, stochastic,
+                                 g_mean, g_logvar);
+    mc_kl += sample_params(layer, layer->pw_mean, layer->pw_logvar, layer->pw_sample, pw_size, stochastic,
+                           g_mean ? g_mean + dw_size : NULL, g_logvar ? g_logvar + dw_size : NULL);
+    mc_kl += sample_params(layer, layer->b_mean, layer->b_logvar, layer->b_sample, OC, stochastic,
+                           g_mean ? g_mean + dw_size + pw_size : NULL, g_logvar ? g_logvar + dw_size + pw_size : NULL);
+    if (g_mean) {
+        layer->mc_kl = mc_kl;
+        layer->mc_kl_valid = 1;
+    }
+    
+    int batch_size = input->rows;
+    int pixels = batch_size * OH * OW;
+    if (layer->cached_depthwise) {
+        free_matrix(layer->cached_depthwise);
+    }
+    Matrix *mid = create_matrix(pixels, C);
+    layer->cached_depthwise = mid;
+    
+    for (int b = 0; b < batch_size; b++) {
+        const double *in_img = input->data + (size_t) b * H * W * C;
+        for (int oh = 0; oh < OH; oh++) {
+            for (int ow = 0; ow < OW; ow++) {
+                double *mid_px = mid->data + (((size_t) b * OH + oh) * OW + ow) * C;
+                for (int kh = 0; kh < layer->kernel_height; kh++) {
+                    int ih = oh * layer->stride - layer->padding + kh;
+                    if (ih < 0 || ih >= H) continue;  // Zero padding.
+                    for (int kw = 0; kw < layer->kernel_width; kw++) {
+                        int iw = ow * layer->stride - layer->padding + kw;
+                        if (iw < 0 || iw >= W) continue;
+                        const double *in_px = in_img + (ih * W + iw) * C;
+                        const double *w_tap = layer->dw_sample + (kh * layer->kernel_width + kw) * C;
+                        for (int c = 0; c < C; c++) {
+                            mid_px[c] += in_px[c] * w_tap[c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    
+    Matrix *output = create_matrix(batch_size, OH * OW * OC);
+    for (int p = 0; p < pixels; p++) {
+        const double *mid_px = mid->data + (size_t) p * C;
+        double *out_px = output->data + (size_t) p * OC;
+        for (int oc = 0; oc < OC; oc++) {
+            out_px[oc] = layer->b_sample[oc];
+        }
+        for (int c = 0; c < C; c++) {
+            double v = mid_px[c];
+            const double *pw_row = layer->pw_sample + c * OC;
+            for (int oc = 0; oc < OC; oc++) {
+                out_px[oc] += v * pw_row[oc];
+            }
+        }
+    }
+    return output;
+}
+
+// Backward pass: pointwise GEMM gradients first, then the depthwise step.
+Matrix* bayesian_dwconv_backward(BayesianDWConv *layer, const Matrix *grad_output, const Config *cfg) {
+    if (!layer || !grad_output || !layer->cached_input || !layer->cached_depthwise) {
+        handle_error("Invalid input to bayesian_dwconv_backward.");
+    }
+    int C = layer->input_channels, OC = layer->output_channels;
+    int H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    int dw_size = layer->kernel_height * layer->kernel_width * C;
+    int pw_size = C * OC;
+    const Matrix *input = layer->cached_input;
+    const Matrix *mid = layer->cached_depthwise;
+    int batch_size = input->rows;
+    int pixels = batch_size * OH * OW;
+    
+    // Clear the mean gradients (the log-variance gradients are written in full below)
+    zero_array(layer->d_dw_mean, dw_size);
+    zero_array(layer->d_pw_mean, pw_size);
+    zero_array(layer->db_mean, OC);
+    
+    // Pointwise step: db, d_pw and the gradient w.r.t. the depthwise output.
+    Matrix *grad_mid = create_matrix(pixels, C);
+    for (int p = 0; p < pixels; p++) {
+        const double *g_px = grad_output->data + (size_t) p * OC;
+        const double *mid_px = mid->data + (size_t) p * C;
+        double *gmid_px = grad_mid->data + (size_t) p * C;
+        for (int oc = 0; oc < OC; oc++) {
+            layer->db_mean[oc] += g_px[oc];
+        }
+        for (int c = 0; c < C; c++) {
+            double v = mid_px[c];
+            const double *pw_row = layer->pw_sample + c * OC;
+            double *dpw_row = layer->d_pw_mean + c * OC;
+            double acc = 0.0;
+            for (int oc = 0; oc < OC; oc++) {
+                dpw_row[oc] += v * g_px[oc];
+                acc += pw_row[oc] * g_px[oc];
+            }
+            gmid_px[c] = acc;
+        }
+    }
+    
+    // Depthwise step: d_dw and the gradient w.r.t. the input.
+    Matrix *grad_input = create_matrix(batch_size, H * W * C);
+    for (int b = 0; b < batch_size; b++) {
+        const double *in_img = input->data + (size_t) b * H * W * C;
+        double *gin_img = grad_input->data + (size_t) b * H * W * C;
+        for (int oh = 0; oh < OH; oh++) {
+            for (int ow = 0; ow < OW; ow++) {
+                const double *gmid_px = grad_mid->data + (((size_t) b * OH + oh) * OW + ow) * C;
+                for (int kh = 0; kh < layer->kernel_height; kh++) {
+                    int ih = oh * layer->stride - layer->padding + kh;
+                    if (ih < 0 || ih >= H) continue;
+                    for (int kw = 0; kw < layer->kernel_width; kw++) {
+                        int iw = ow * layer->stride - layer->padding + kw;
+                        if (iw < 0 || iw >= W) continue;
+                        int tap = (kh * layer->kernel_width + kw) * C;
+                        const double *in_px = in_img + (ih * W + iw) * C;
+                        double *gin_px = gin_img + (ih * W + iw) * C;
+                        const double *w_tap = layer->dw_sample + tap;
+                        double *dw_tap = layer->d_dw_mean + tap;
+                        for (int c = 0; c < C; c++) {
+                            dw_tap[c] += in_px[c] * gmid_px[c];
+                            gin_px[c] += w_tap[c] * gmid_px[c];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free_matrix(grad_mid);
+    
+    // --- Log-variance and KL gradients, fused into one sweep over each parameter array ---
+    double kl_weight = cfg->kl_weight;
+    int num_params = dw_size + pw_size + OC;
+    const double *mc_grad = (layer->kl_estimator == 1 && layer->mc_kl_valid) ? layer->mc_kl_grad : NULL;
+    finish_param_grads(layer, layer->dw_mean, layer->dw_logvar, layer->dw_sample, layer->d_dw_mean,
+                       layer->d_dw_logvar, dw_size, mc_grad, mc_grad ? mc_grad + num_params : NULL, kl_weight);
+    finish_param_grads(layer, layer->pw_mean, layer->pw_logvar, layer->pw_sample, layer->d_pw_mean,
+                       layer->d_pw_logvar, pw_size, mc_grad ? mc_grad + dw_size : NULL,
+                       mc_grad ? mc_grad + num_params + dw_size : NULL, kl_weight);
+    finish_param_grads(layer, layer->b_mean, layer->b_logvar, layer->b_sample, layer->db_mean,
+                       layer->db_logvar, OC, mc_grad ? mc_grad + dw_size + pw_size : NULL,
+                       mc_grad ? mc_grad + num_params + dw_size + pw_size : NULL, kl_weight);
+    
+    return grad_input;
+}
+
+// Compute the total KL divergence for the depthwise, pointwise and bias parameters.
+double bayesian_dwconv_kl(BayesianDWConv *layer) {
+    if (layer->kl_estimator == 1 && layer->mc_kl_valid) {
+        return layer->mc_kl;
+    }
+    int C = layer->input_channels, OC = layer->output_channels;
+    return params_kl(layer, layer->dw_mean, layer->dw_logvar, layer->kernel_height * layer->kernel_width * C)
+         + params_kl(layer, layer->pw_mean, layer->pw_logvar, C * OC)
+         + params_kl(layer, layer->b_mean, layer->b_logvar, OC);
+}
+
+// Per-call state sharing the parameters of 'params'.
+BayesianDWConv* bayesian_dwconv_create_context(const BayesianDWConv *params) {
+    BayesianDWConv *ctx = (BayesianDWConv*)malloc(sizeof(BayesianDWConv));
+    if (!ctx) {
+        handle_error("Failed to allocate BayesianDWConv context.");
+    }
+    *ctx = *params;
+    ctx->d_dw_mean = ctx->d_dw_logvar = ctx->d_pw_mean = ctx->d_pw_logvar = NULL;
+    ctx->db_mean = ctx->db_logvar = NULL;
+    ctx->dw_sample = alloc_params(params->kernel_height * params->kernel_width * params->input_channels);
+    ctx->pw_sample = alloc_params(params->input_channels * params->output_channels);
+    ctx->b_sample = alloc_params(params->output_channels);
+    ctx->cached_input = NULL;
+    ctx->cached_depthwise = NULL;
+    ctx->mc_kl = 0.0;
+    ctx->mc_kl_valid = 0;
+    ctx->mc_kl_grad = NULL;
+    return ctx;
+}
+
+void free_bayesian_dwconv_context(BayesianDWConv *ctx) {
+    if (ctx) {
+        free(ctx->dw_sample);
+        free(ctx->pw_sample);
+        free(ctx->b_sample);
+        free(ctx->mc_kl_grad);
+        free_matrix(ctx->cached_input);
+        free_matrix(ctx->cached_depthwise);
+        free(ctx);
+    }
+}
+
+// Free the depthwise-separable convolution.
+void free_bayesian_dwconv(BayesianDWConv *layer) {
+    if (layer) {
+        free(layer->dw_mean);
+        free(layer->dw_logvar);
+        free(layer->pw_mean);
+        free(layer->pw_logvar);
+        free(layer->b_mean);
+        free(layer->b_logvar);
+        free(layer->d_dw_mean);
+        free(layer->d_dw_logvar);
+        free(layer->d_pw_mean);
+        free(layer->d_pw_logvar);
+        free(layer->db_mean);
+        free(layer->db_logvar);
+        free(layer->dw_sample);
+        free(layer->pw_sample);
+        free(layer->b_sample);
+        free(layer->mc_kl_grad);
+        if (layer->cached_input) {
+            free_matrix(layer->cached_input);
+        }
+        if (layer->cached_depthwise) {
+            free_matrix(layer->cached_depthwise);
+        }
+        free(layer);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef BAYESIAN_DWCONV_H
+#define BAYESIAN_DWCONV_H
+
+#include "../utils/math_utils.h"
+#include "../bnn_util.h"
+#include "../priors/prior.h"       // For the Prior interface
+#include "../posteriors/posterior.h" // For the Posterior interface
+#include "../config/config.h"
+
+// Structure representing a depthwise-separable Bayesian convolution:
+//   1. a depthwise step: one kernel_height x kernel_width Gaussian filter per input channel,
+//   2. a pointwise step: a Bayesian 1x1 convolution (a GEMM over channels) plus bias.
+// Compared with BayesianConv this needs channels*(kh*kw + output_channels) Gaussian weights
+// instead of channels*kh*kw*output_channels.
+// Activations use the same NHWC-flattened Matrix layout as BayesianConv.
+typedef struct {
+    int input_channels;
+    int output_channels;
+    int kernel_height;
+    int kernel_width;
+    int stride;             // Applied by the depthwise step.
+    int padding;            // Zero padding applied by the depthwise step.
+    // Spatial geometry, set by bayesian_dwconv_set_input_size().
+    int input_height;
+    int input_width;
+    int output_height;
+    int output_width;
+    // Depthwise weights: [kernel_height][kernel_width][input_channels].
+    double *dw_mean;
+    double *dw_logvar;
+    // Pointwise weights: [input_channels][output_channels].
+    double *pw_mean;
+    double *pw_logvar;
+    // Bias parameters: arrays of length output_channels.
+    double *b_mean;
+    double *b_logvar;
+    // Pointer to a Prior structure for KL divergence computation.
+    Prior *prior;
+    // Pointer to a Posterior structure for sampling the weights and biases.
+    Posterior *posterior;
+    // Gradients (same layout as the parameters).
+    double *d_dw_mean;
+    double *d_dw_logvar;
+    double *d_pw_mean;
+    double *d_pw_logvar;
+    double *db_mean;
+    double *db_logvar;
+    // Parameters drawn in the most recent forward pass.
+    double *dw_sample;
+    double *pw_sample;
+    double *b_sample;
+    Matrix *cached_input;     // The input used in the most recent forward pass
+    Matrix *cached_depthwise; // Depthwise output (pointwise input) of the most recent forward pass
+    // Monte Carlo KL (kl_estimator == 1), accumulated while the parameters are sampled.
+    int kl_estimator;     // 0: closed-form KL, 1: Monte Carlo estimate
+    double mc_kl;         // Estimate from the most recent stochastic forward pass
+    int mc_kl_valid;      // Nonzero once mc_kl and mc_kl_grad hold an estimate
+    double *mc_kl_grad;   // dKL/d(dw, pw, b means) followed by dKL/d(dw, pw, b logvars); NULL until used
+} BayesianDWConv;
+
+// Create a depthwise-separable Bayesian convolution with the given dimensions, stride and padding.
+BayesianDWConv* create_bayesian_dwconv(int input_channels, int output_channels, int kernel_height, int kernel_width,
+                                       int stride, int padding);
+
+// Set the spatial size of the input images and derive the output size
+// (same formula as bayesian_conv_set_input_size()).
+void bayesian_dwconv_set_input_size(BayesianDWConv *layer, int input_height, int input_width);
+
+// Free memory allocated for the layer.
+void free_bayesian_dwconv(BayesianDWConv *layer);
+
+// Per-call state for running the layer from several threads (see exec_context.h): shares the
+// parameters, owns the samples and caches; the gradient pointers are left NULL for the caller.
+BayesianDWConv* bayesian_dwconv_create_context(const BayesianDWConv *params);
+void free_bayesian_dwconv_context(BayesianDWConv *ctx);
+
+// Number of depthwise, pointwise and bias parameters (the optimizer's view of the layer).
+int bayesian_dwconv_num_params(const BayesianDWConv *layer);
+
+// Forward pass on a batch of NHWC images (batch_size x input_height*input_width*input_channels).
+// Returns a new Matrix of shape (batch_size x output_height*output_width*output_channels).
+Matrix* bayesian_dwconv_forward(BayesianDWConv *layer, const Matrix *input, int stochastic);
+
+// Backward pass: accumulates the depthwise, pointwise and bias gradients (data loss plus KL)
+// and returns the gradient w.r.t. the input.
+Matrix* bayesian_dwconv_backward(BayesianDWConv *layer, const Matrix *grad_output, const Config *cfg);
+
+// Compute the total KL divergence over the depthwise, pointwise and bias parameters.
+// Each tensor goes through one prior_kl_sum() call: the Prior's per-tensor kernel if one is set,
+// otherwise a Gaussian prior with variance 1.0.
+// With kl_estimator == 1 it returns the Monte Carlo estimate of the last stochastic forward pass.
+double bayesian_dwconv_kl(BayesianDWConv *layer);
+
+#endif // BAYESIAN_DWCONV_H
@@ -1,7 +1,11 @@
 #include "bayesian_linear.h"
 #include "../utils/utils.h"          // For handle_error() and logging.
 #include "../utils/random_utils.h"   // For random number generation.
+#include "../utils/thread_pool.h"    // For parallel_for().
+#include "../priors/prior_gaussian.h"  // For prior_kl_sum().
+#include "../posteriors/posterior_structured.h"  // For the low-rank posterior kernels.
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "../config/config.h"
 
@@ -49,9 +53,42 @@ BayesianLinear* create_bayesian_linear(int input_dim, int output_dim) {
         handle_error("Failed to allocate gradient accumulators.");
     }
     
+    // Weights and biases drawn in the most recent forward pass, and the cached standard
+    // deviations they are drawn with (computed on first use).
+    layer->W_sample = create_matrix(output_dim, input_dim);
+    layer->b_sample = (double*)calloc(output_dim, sizeof(double));
+    layer->W_sigma = (double*)malloc(sizeof(double) * output_dim * input_dim);
+    layer->b_sigma = (double*)malloc(sizeof(double) * output_dim);
+    if (!layer->W_sample || !layer->b_sample || !layer->W_sigma || !layer->b_sigma) {
+        handle_error("Failed to allocate weight sample buffers.");
+    }
+    layer->sigma_dirty = 1;
+    
     // Initialize cached_input pointer to NULL.
     layer->cached_input = NULL;
     
+    // Closed-form KL unless the network selects the Monte Carlo estimator.
+    layer->kl_estimator = 0;
+    layer->mc_kl = 0.0;
+    layer->mc_kl_valid = 0;
+    layer->mc_kl_grad = NULL;
+    
+    // Mean-field unless bayesian_linear_set_rank() is called.
+    layer->posterior_rank = 0;
+    layer->W_factor = NULL;
+    layer->dW_factor = NULL;
+    layer->z_sample = NULL;
+    layer->matrix_normal = 0;
+    layer->local_reparam = 0;
+    layer->mn_mode = 0;
+    layer->L_row = layer->L_col = layer->dL_row = layer->dL_col = NULL;
+    layer->mn_noise = layer->mn_tmp = layer->mn_eps = layer->mn_scale = NULL;
+    layer->mn_capacity = 0;
+    layer->pred_weights = layer->pred_transposed = NULL;
+    layer->pred_capacity = 0;
+    layer->mc_rank = 0;
+    layer->mc_scratch = NULL;
+    
     // Initialize the Prior and Posterior pointers to NULL.
     layer->prior = NULL;
     layer->posterior = NULL;
@@ -59,6 +96,212 @@ BayesianLinear* create_bayesian_linear(int input_dim, int output_dim) {
     return layer;
 }
 
+void bayesian_linear_set_rank(BayesianLinear *layer, int rank) {
+    if (rank < 1 || rank > LOWRANK_MAX_RANK) {
+        handle_error("posterior_rank must be between 1 and LOWRANK_MAX_RANK.");
+    }
+    int total_weights = layer->output_dim * layer->input_dim;
+    free(layer->W_factor);
+    free(layer->dW_factor);
+    free(layer->z_sample);
+    layer->W_factor = (double*)malloc(sizeof(double) * total_weights * rank);
+    layer->dW_factor = (double*)calloc((size_t) total_weights * rank, sizeof(double));
+    layer->z_sample = (double*)calloc(rank, sizeof(double));
+    if (!layer->W_factor || !layer->dW_factor || !layer->z_sample) {
+        handle_error("Failed to allocate low-rank posterior factor.");
+    }
+    // A factor well below the initial diagonal standard deviation (exp(-5 / 2) ~ 0.08) starts
+    // training close to mean-field; a nonzero one keeps the columns from staying identical.
+    for (int i = 0; i < total_weights * rank; i++) {
+        layer->W_factor[i] = random_gaussian(0.0, 0.01);
+    }
+    layer->posterior_rank = rank;
+}
+
+// KL of the low-rank weight posterior, with gradients added when grad_mu is non-NULL.
+static double lowrank_weight_kl(BayesianLinear *layer, double default_variance, double *grad_mu,
+                                double *grad_logvar, double *grad_U, double scale) {
+    double prior_mean, prior_variance;
+    if (!prior_gaussian_params(layer->prior, default_variance, &prior_mean, &prior_variance)) {
+        handle_error("The low-rank posterior needs a Gaussian prior.");
+    }
+    return lowrank_posterior_kl(layer->W_mean->data, layer->W_logvar->data, layer->W_factor,
+                                layer->output_dim * layer->input_dim, layer->posterior_rank,
+                                prior_mean, prior_variance, grad_mu, grad_logvar, grad_U, scale);
+}
+
+void bayesian_linear_set_matrix_normal(BayesianLinear *layer, int local_reparam) {
+    int out_dim = layer->output_dim, in_dim = layer->input_dim;
+    layer->L_row = (double*)calloc((size_t) out_dim * out_dim, sizeof(double));
+    layer->L_col = (double*)calloc((size_t) in_dim * in_dim, sizeof(double));
+    layer->dL_row = (double*)calloc((size_t) out_dim * out_dim, sizeof(double));
+    layer->dL_col = (double*)calloc((size_t) in_dim * in_dim, sizeof(double));
+    layer->mn_noise = (double*)calloc((size_t) out_dim * in_dim, sizeof(double));
+    layer->mn_tmp = (double*)malloc(sizeof(double) * out_dim * in_dim);
+    if (!layer->L_row || !layer->L_col || !layer->dL_row || !layer->dL_col || !layer->mn_noise || !layer->mn_tmp) {
+        handle_error("Failed to allocate matrix-normal posterior factors.");
+    }
+    // Each weight's variance is L_row[i][i]^2 * L_col[j][j]^2 = exp(-5), as for the mean-field
+    // initial log-variance.
+    double diag = exp(-1.25);
+    for (int i = 0; i < out_dim; i++) {
+        layer->L_row[i * out_dim + i] = diag;
+    }
+    for (int j = 0; j < in_dim; j++) {
+        layer->L_col[j * in_dim + j] = diag;
+    }
+    layer->matrix_normal = 1;
+    layer->local_reparam = local_reparam;
+}
+
+// KL of the matrix-normal weight posterior, with gradients added when grad_M is non-NULL.
+static double matnorm_weight_kl(BayesianLinear *layer, double default_variance, double *grad_M,
+                                double *grad_L_row, double *grad_L_col, double scale) {
+    double prior_mean, prior_variance;
+    if (!prior_gaussian_params(layer->prior, default_variance, &prior_mean, &prior_variance)) {
+        handle_error("The matrix-normal posterior needs a Gaussian prior.");
+    }
+    return matnorm_posterior_kl(layer->W_mean->data, layer->L_row, layer->L_col, layer->output_dim,
+                                layer->input_dim, prior_mean, prior_variance, grad_M, grad_L_row,
+                                grad_L_col, scale);
+}
+
+// t = L_col^T x, returning |t| = sqrt(x^T V x).
+static double matnorm_input_scale(const double *L_col, const double *x, int in_dim, double *t) {
+    double norm = 0.0;
+    for (int k = 0; k < in_dim; k++) {
+        double sum = 0.0;
+        for (int j = k; j < in_dim; j++) {
+            sum += L_col[j * in_dim + k] * x[j];
+        }
+        t[k] = sum;
+        norm += sum * sum;
+    }
+    return sqrt(norm);
+}
+
+// Forward pass with the matrix-normal posterior. A shared sample draws one weight matrix
+// W = M + L_row E L_col^T. With local reparameterization each example's pre-activations are
+// drawn directly, y_b = M x_b + b + sqrt(x_b^T V x_b) * L_row eps_b, which has the same
+// distribution per example and independent noise across the batch.
+static Matrix* matnorm_forward(BayesianLinear *layer, const Matrix *input, int stochastic) {
+    int batch = input->rows, in_dim = layer->input_dim, out_dim = layer->output_dim;
+    layer->mn_mode = !stochastic ? 0 : (layer->local_reparam ? 2 : 1);
+    for (int i = 0; i < out_dim; i++) {
+        layer->b_sample[i] = stochastic ? sample_gaussian(layer->b_mean[i], layer->b_logvar[i]) : layer->b_mean[i];
+    }
+    if (layer->mn_mode == 1) {
+        matnorm_posterior_sample(layer->W_mean->data, layer->L_row, layer->L_col, out_dim, in_dim,
+                                 layer->mn_noise, layer->mn_tmp, layer->W_sample->data);
+    } else {
+        for (int i = 0; i < out_dim * in_dim; i++) {
+            layer->W_sample->data[i] = layer->W_mean->data[i];
+        }
+    }
+    Matrix *W_transposed = matrix_transpose(layer->W_sample);
+    Matrix *output = matrix_multiply(input, W_transposed);
+    free_matrix(W_transposed);
+    for (int b = 0; b < batch; b++) {
+        for (int i = 0; i < out_dim; i++) {
+            output->data[b * out_dim + i] += layer->b_sample[i];
+        }
+    }
+    if (layer->mn_mode == 2) {
+        if (batch > layer->mn_capacity) {
+            free(layer->mn_eps);
+            free(layer->mn_scale);
+            layer->mn_eps = (double*)malloc(sizeof(double) * batch * out_dim);
+            layer->mn_scale = (double*)malloc(sizeof(double) * batch);
+            if (!layer->mn_eps || !layer->mn_scale) {
+                handle_error("Failed to allocate local reparameterization buffers.");
+            }
+            layer->mn_capacity = batch;
+        }
+        for (int b = 0; b < batch; b++) {
+            double s = matnorm_input_scale(layer->L_col, input->data + b * in_dim, in_dim, layer->mn_tmp);
+            double *eps = layer->mn_eps + b * out_dim;
+            layer->mn_scale[b] = s;
+            for (int i = 0; i < out_dim; i++) {
+                eps[i] = random_gaussian(0.0, 1.0);
+                double r = 0.0;
+                for (int k = 0; k <= i; k++) {
+                    r += layer->L_row[i * out_dim + k] * eps[k];
+                }
+                output->data[b * out_dim + i] += s * r;
+            }
+        }
+    }
+    return output;
+}
+
+// Backward pass with the matrix-normal posterior: mean and bias gradients as in the mean-field
+// layer, the factor gradients of the pass's sample, and kl_weight times the closed-form KL.
+static Matrix* matnorm_backward(BayesianLinear *layer, const Matrix *grad_output, const Config *cfg) {
+    const Matrix *x = layer->cached_input;
+    int batch = x->rows, in_dim = layer->input_dim, out_dim = layer->output_dim;
+    double kl_weight = cfg->kl_weight;
+    for (int i = 0; i < out_dim; i++) {
+        double grad_bias = 0.0;
+        for (int j = 0; j < in_dim; j++) {
+            double grad_sum = 0.0;
+            for (int b = 0; b < batch; b++) {
+                grad_sum += grad_output->data[b * out_dim + i] * x->data[b * in_dim + j];
+            }
+            layer->dW_mean->data[i * in_dim + j] = grad_sum;
+            layer->dW_logvar->data[i * in_dim + j] = 0.0;
+        }
+        for (int b = 0; b < batch; b++) {
+            grad_bias += grad_output->data[b * out_dim + i];
+        }
+        layer->db_mean[i] = grad_bias;
+        layer->db_logvar[i] = grad_bias * 0.5 * (layer->b_sample[i] - layer->b_mean[i]);
+    }
+    prior_grad_kl(layer->prior, 1.0, layer->b_mean, layer->b_logvar, out_dim, layer->db_mean, layer->db_logvar,
+                  kl_weight);
+    zero_array(layer->dL_row, out_dim * out_dim);
+    zero_array(layer->dL_col, in_dim * in_dim);
+    
+    Matrix *grad_input = matrix_multiply(grad_output, layer->W_sample);
+    if (layer->mn_mode == 1) {
+        // dL/dW of the shared sample is the data part of dW_mean, before the KL is added.
+        matnorm_posterior_factor_grads(layer->dW_mean->data, layer->mn_noise, layer->L_row, layer->L_col,
+                                       out_dim, in_dim, layer->mn_tmp, layer->dL_row, layer->dL_col);
+    } else if (layer->mn_mode == 2) {
+        // y_b = ... + s_b * r_b with s_b = |L_col^T x_b| and r_b = L_row eps_b. With a_b = g_b . r_b:
+        //   dL/dL_row += s_b * tril(g_b eps_b^T),  dL/dL_col += (a_b / s_b) * tril(x_b t_b^T),
+        //   dL/dx_b   += (a_b / s_b) * L_col t_b,  t_b = L_col^T x_b.
+        double *t = layer->mn_tmp;
+        for (int b = 0; b < batch; b++) {
+            const double *g = grad_output->data + b * out_dim;
+            const double *eps = layer->mn_eps + b * out_dim;
+            const double *xb = x->data + b * in_dim;
+            double s = matnorm_input_scale(layer->L_col, xb, in_dim, t);
+            double a = 0.0;
+            for (int i = 0; i < out_dim; i++) {
+                double r = 0.0;
+                for (int k = 0; k <= i; k++) {
+                    r += layer->L_row[i * out_dim + k] * eps[k];
+                    layer->dL_row[i * out_dim + k] += s * g[i] * eps[k];
+                }
+                a += g[i] * r;
+            }
+            if (s > 0.0) {
+                double c = a / s;
+                for (int j = 0; j < in_dim; j++) {
+                    double vx = 0.0;
+                    for (int k = 0; k <= j; k++) {
+                        layer->dL_col[j * in_dim + k] += c * xb[j] * t[k];
+                        vx += layer->L_col[j * in_dim + k] * t[k];
+                    }
+                    grad_input->data[b * in_dim + j] += c * vx;
+                }
+            }
+        }
+    }
+    matnorm_weight_kl(layer, 1.0, layer->dW_mean->data, layer->dL_row, layer->dL_col, kl_weight);
+    return grad_input;
+}
+
 
 // Free the resources allocated for the Bayesian linear layer.
 void free_bayesian_linear(BayesianLinear *layer) {
@@ -67,69 +310,202 @@ void free_bayesian_linear(BayesianLinear *layer) {
         free_matrix(layer->W_logvar);
         free(layer->b_mean);
         free(layer->b_logvar);
+        free_matrix(layer->dW_mean);
+        free_matrix(layer->dW_logvar);
+        free(layer->db_mean);
+        free(layer->db_logvar);
+        free_matrix(layer->cached_input);
+        free_matrix(layer->W_sample);
+        free(layer->b_sample);
+        free(layer->W_sigma);
+        free(layer->b_sigma);
+        free(layer->mc_kl_grad);
+        free(layer->W_factor);
+        free(layer->dW_factor);
+        free(layer->z_sample);
+        free(layer->L_row);
+        free(layer->L_col);
+        free(layer->dL_row);
+        free(layer->dL_col);
+        free(layer->mn_noise);
+        free(layer->mn_tmp);
+        free(layer->mn_eps);
+        free(layer->mn_scale);
+        free(layer->pred_weights);
+        free(layer->pred_transposed);
+        free(layer->mc_scratch);
         // Note: The Prior and Posterior objects are managed externally.
         free(layer);
     }
 }
 
-Matrix* bayesian_linear_backward(BayesianLinear *layer, const Matrix *grad_output, const Config *cfg) {
+// Per-call state sharing the parameters of 'params'.
+BayesianLinear* bayesian_linear_create_context(const BayesianLinear *params) {
+    BayesianLinear *ctx = (BayesianLinear*)malloc(sizeof(BayesianLinear));
+    if (!ctx) {
+        handle_error("Failed to allocate BayesianLinear context.");
+    }
+    *ctx = *params;
+    int in_dim = params->input_dim, out_dim = params->output_dim;
+    // Gradient headers; the caller points their data (and the other gradients) at its own storage.
+    ctx->dW_mean = (Matrix*)calloc(1, sizeof(Matrix));
+    ctx->dW_logvar = (Matrix*)calloc(1, sizeof(Matrix));
+    if (!ctx->dW_mean || !ctx->dW_logvar) {
+        handle_error("Failed to allocate BayesianLinear context.");
+    }
+    ctx->dW_mean->rows = ctx->dW_logvar->rows = out_dim;
+    ctx->dW_mean->cols = ctx->dW_logvar->cols = in_dim;
+    ctx->db_mean = ctx->db_logvar = ctx->dW_factor = ctx->dL_row = ctx->dL_col = NULL;
+    ctx->cached_input = NULL;
+    ctx->W_sample = create_matrix(out_dim, in_dim);
+    ctx->b_sample = (double*)calloc(out_dim, sizeof(double));
+    ctx->z_sample = (params->posterior_rank > 0) ? (double*)calloc(params->posterior_rank, sizeof(double)) : NULL;
+    ctx->mn_noise = ctx->mn_tmp = ctx->mn_eps = ctx->mn_scale = NULL;
+    if (params->matrix_normal) {
+        ctx->mn_noise = (double*)calloc((size_t) out_dim * in_dim, sizeof(double));
+        ctx->mn_tmp = (double*)malloc(sizeof(double) * out_dim * in_dim);
+    }
+    if (!ctx->b_sample || (params->posterior_rank > 0 && !ctx->z_sample) ||
+        (params->matrix_normal && (!ctx->mn_noise || !ctx->mn_tmp))) {
+        handle_error("Failed to allocate BayesianLinear context.");
+    }
+    // The standard deviations are read from the parameters' cache, see network_refresh_caches().
+    ctx->sigma_dirty = 0;
+    ctx->mc_kl = 0.0;
+    ctx->mc_kl_valid = 0;
+    ctx->mc_kl_grad = NULL;
+    ctx->mn_mode = 0;
+    ctx->mn_capacity = 0;
+    ctx->pred_weights = ctx->pred_transposed = NULL;
+    ctx->pred_capacity = 0;
+    ctx->mc_scratch = NULL;
+    bayesian_linear_set_mc_rank(ctx, params->mc_rank);
+    return ctx;
+}
+
+void free_bayesian_linear_context(BayesianLinear *ctx) {
+    if (ctx) {
+        free(ctx->dW_mean);
+        free(ctx->dW_logvar);
+        free_matrix(ctx->cached_input);
+        free_matrix(ctx->W_sample);
+        free(ctx->b_sample);
+        free(ctx->z_sample);
+        free(ctx->mc_kl_grad);
+        free(ctx->mn_noise);
+        free(ctx->mn_tmp);
+        free(ctx->mn_eps);
+        free(ctx->mn_scale);
+        free(ctx->pred_weights);
+        free(ctx->pred_transposed);
+        free(ctx->mc_scratch);
+        free(ctx);
+    }
+}
+
+typedef struct {
+    BayesianLinear *layer;
+    const Matrix *grad_output;
+    const double *mc_grad;
+    double kl_weight;
+} WeightGradTask;
+
+// Gradients of output rows [begin, end) of the weights and biases; the rows are independent, so
+// they are split over the kernel threads.
+static void weight_grad_rows(void *arg, int begin, int end) {
+    WeightGradTask *task = (WeightGradTask*)arg;
+    BayesianLinear *layer = task->layer;
+    const Matrix *grad_output = task->grad_output;
+    const double *mc_grad = task->mc_grad;
+    double kl_weight = task->kl_weight;
     int batch_size = layer->cached_input->rows;
     int in_dim = layer->input_dim;
     int out_dim = layer->output_dim;
-
-    // Clear old gradients
-    zero_matrix(layer->dW_mean);
-    zero_matrix(layer->dW_logvar);
-    zero_array(layer->db_mean, out_dim);
-    zero_array(layer->db_logvar, out_dim);
-
-    // Compute gradients from the data loss (MSE component)
-    for (int i = 0; i < out_dim; i++) {
+    int num_params = out_dim * in_dim + out_dim;
+    int rank = layer->posterior_rank;
+    for (int i = begin; i < end; i++) {
+        int row = i * in_dim;
+        double *dw_row = layer->dW_mean->data + row;
+        double *dlv_row = layer->dW_logvar->data + row;
+        const double *mu_row = layer->W_mean->data + row;
+        const double *lv_row = layer->W_logvar->data + row;
+        const double *w_row = layer->W_sample->data + row;
         for (int j = 0; j < in_dim; j++) {
             double grad_sum = 0.0;
             for (int b = 0; b < batch_size; b++) {
                 grad_sum += grad_output->data[b * out_dim + i] *
                             layer->cached_input->data[b * in_dim + j];
             }
-            layer->dW_mean->data[i * in_dim + j] = grad_sum;
+            dw_row[j] = grad_sum;
+            if (rank > 0) {
+                const double *u = layer->W_factor + (size_t) (row + j) * rank;
+                double *du = layer->dW_factor + (size_t) (row + j) * rank;
+                double uz = 0.0;
+                for (int a = 0; a < rank; a++) {
+                    uz += u[a] * layer->z_sample[a];
+                    du[a] = grad_sum * layer->z_sample[a];
+                }
+                dlv_row[j] = grad_sum * 0.5 * (w_row[j] - mu_row[j] - uz);
+            } else {
+                dlv_row[j] = grad_sum * 0.5 * (w_row[j] - mu_row[j]);
+            }
         }
         double grad_bias = 0.0;
         for (int b = 0; b < batch_size; b++) {
             grad_bias += grad_output->data[b * out_dim + i];
         }
         layer->db_mean[i] = grad_bias;
-    }
-
-    // --- Incorporate the KL divergence gradient ---
-    double kl_weight = cfg->kl_weight;  // hardcoded or from cfg
-   // printf("Inside bayesian_linear_backward: kl_weight = %f\n", kl_weight);
-    for (int i = 0; i < out_dim; i++) {
-        for (int j = 0; j < in_dim; j++) {
-            double old_grad = layer->dW_mean->data[i * in_dim + j];
-            double kl_contrib = kl_weight * layer->W_mean->data[i * in_dim + j];
-            layer->dW_mean->data[i * in_dim + j] += kl_contrib;
-            // Print a few sample gradients for debugging:
-            if (i == 0 && j < 5) {
-                //printf("Grad[%d,%d]: data loss = %f, KL contrib = %f, new grad = %f\n",
-                //       i, j, old_grad, kl_contrib, layer->dW_mean->data[i * in_dim + j]);
+        layer->db_logvar[i] = grad_bias * 0.5 * (layer->b_sample[i] - layer->b_mean[i]);
+        
+        if (mc_grad) {
+            // Gradient of the Monte Carlo KL, computed on the forward pass's weight sample.
+            for (int j = 0; j < in_dim; j++) {
+                dw_row[j] += kl_weight * mc_grad[row + j];
+                dlv_row[j] += kl_weight * mc_grad[num_params + row + j];
             }
+        } else if (rank == 0) {
+            prior_grad_kl(layer->prior, 1.0, mu_row, lv_row, in_dim, dw_row, dlv_row, kl_weight);
         }
     }
-    // Optionally incorporate KL for biases:
-    for (int i = 0; i < out_dim; i++) {
-        double old_bias_grad = layer->db_mean[i];
-        double kl_bias = kl_weight * layer->b_mean[i];
-        layer->db_mean[i] += kl_bias;
-        if (i < 5) {
-           // printf("Bias Grad[%d]: data loss = %f, KL contrib = %f, new grad = %f\n",
-             //      i, old_bias_grad, kl_bias, layer->db_mean[i]);
+}
+
+Matrix* bayesian_linear_backward(BayesianLinear *layer, const Matrix *grad_output, const Config *cfg) {
+    if (layer->matrix_normal) {
+        return matnorm_backward(layer, grad_output, cfg);
+    }
+    int batch_size = layer->cached_input->rows;
+    int in_dim = layer->input_dim;
+    int out_dim = layer->output_dim;
+
+    // Data and KL gradients for every parameter in one sweep, one output row at a time
+    // (every gradient entry is written, so there is no separate clearing pass):
+    //   dL/dmu     = dL/dw
+    //   dL/dlogvar = dL/dw * dw/dlogvar = dL/dw * 0.5 * (w - mu)     (w = mu + exp(logvar/2) * eps)
+    // and kl_weight times the prior's dKL/dmu and dKL/dlogvar are added while the row is in cache.
+    // With a low-rank posterior w = mu + exp(logvar/2) * eps + U z, so the diagonal noise is
+    // w - mu - U z and dL/dU = dL/dw z^T; its KL couples all weights and is added after the sweep.
+    double kl_weight = cfg->kl_weight;
+    int num_params = out_dim * in_dim + out_dim;
+    const double *mc_grad = (layer->kl_estimator == 1 && layer->mc_kl_valid) ? layer->mc_kl_grad : NULL;
+    int rank = layer->posterior_rank;
+    WeightGradTask task = { layer, grad_output, mc_grad, kl_weight };
+    parallel_for(out_dim, parallel_grain((long) batch_size * in_dim), weight_grad_rows, &task);
+    if (rank > 0) {
+        lowrank_weight_kl(layer, 1.0, layer->dW_mean->data, layer->dW_logvar->data, layer->dW_factor, kl_weight);
+    }
+    if (mc_grad) {
+        for (int i = 0; i < out_dim; i++) {
+            layer->db_mean[i] += kl_weight * mc_grad[out_dim * in_dim + i];
+            layer->db_logvar[i] += kl_weight * mc_grad[num_params + out_dim * in_dim + i];
         }
+    } else {
+        prior_grad_kl(layer->prior, 1.0, layer->b_mean, layer->b_logvar, out_dim, layer->db_mean, layer->db_logvar,
+                      kl_weight);
     }
-    fflush(stdout);
-    // --------------------------------------------------
 
-    // Compute gradient with respect to inputs.
-    Matrix *grad_input = matrix_multiply(grad_output, layer->W_mean);
+    // Gradient with respect to the inputs, through the weights the forward pass used (W_sample
+    // equals W_mean on deterministic passes).
+    Matrix *grad_input = matrix_multiply(grad_output, layer->W_sample);
     return grad_input;
 }
 
@@ -149,19 +525,51 @@ Matrix* bayesian_linear_forward(BayesianLinear *layer, const Matrix *input, int
         free_matrix(layer->cached_input);
     }
     layer->cached_input = copy_matrix(input); // or implement a copy function
+    if (layer->matrix_normal) {
+        return matnorm_forward(layer, input, stochastic);
+    }
                 
     
     int input_samples = input->rows;
     int in_dim = layer->input_dim;
     int out_dim = layer->output_dim;
     
-    // Allocate a matrix for the effective weights.
-    Matrix *W_effective = create_matrix(out_dim, in_dim);
+    // The effective weights and biases are kept for the backward pass, which needs
+    // w - mu for the log-variance gradients.
+    Matrix *W_effective = layer->W_sample;
+    double *b_effective = layer->b_sample;
     
-    // Allocate an array for the effective biases.
-    double *b_effective = (double*)malloc(sizeof(double) * out_dim);
-    if (!b_effective) {
-        handle_error("Failed to allocate memory for effective biases.");
+    // Monte Carlo KL: each row of sampled weights is scored right after it is drawn,
+    // while it is still in cache.
+    int rank = layer->posterior_rank;
+    int mc_kl = stochastic && layer->kl_estimator == 1 && rank == 0;
+    int num_params = out_dim * in_dim + out_dim;
+    if (mc_kl) {
+        if (!layer->mc_kl_grad) {
+            layer->mc_kl_grad = (double*)malloc(sizeof(double) * 2 * num_params);
+            if (!layer->mc_kl_grad) {
+                handle_error("Failed to allocate Monte Carlo KL gradients.");
+            }
+        }
+        zero_array(layer->mc_kl_grad, 2 * num_params);
+        layer->mc_kl = 0.0;
+    }
+    // The standard deviations are cached between optimizer updates of the log-variances.
+    if (stochastic && layer->posterior == NULL && layer->sigma_dirty) {
+        compute_sigma(layer->W_logvar->data, layer->W_sigma, out_dim * in_dim);
+        compute_sigma(layer->b_logvar, layer->b_sigma, out_dim);
+        layer->sigma_dirty = 0;
+    }
+    // The factor sample z is shared by all weights of the layer.
+    for (int a = 0; a < rank; a++) {
+        layer->z_sample[a] = stochastic ? random_gaussian(0.0, 1.0) : 0.0;
+    }
+    
+    // Mean-field weights without the Monte Carlo KL are drawn in one call, which splits large
+    // layers over the kernel threads.
+    int bulk = stochastic && layer->posterior == NULL && rank == 0 && !mc_kl;
+    if (bulk) {
+        sample_gaussian_sigma(layer->W_mean->data, layer->W_sigma, W_effective->data, out_dim * in_dim);
     }
     
     // Compute effective weights and biases.
@@ -171,24 +579,45 @@ Matrix* bayesian_linear_forward(BayesianLinear *layer, const Matrix *input, int
             if (layer->posterior != NULL) {
                 b_effective[i] = layer->posterior->sample(layer->posterior, layer->b_mean[i], layer->b_logvar[i]);
             } else {
-                b_effective[i] = sample_gaussian(layer->b_mean[i], layer->b_logvar[i]);
+                b_effective[i] = layer->b_mean[i] + layer->b_sigma[i] * random_gaussian(0.0, 1.0);
             }
         } else {
             b_effective[i] = layer->b_mean[i];
         }
         // Process weights.
-        for (int j = 0; j < in_dim; j++) {
-            int idx = i * in_dim + j;
-            if (stochastic) {
-                if (layer->posterior != NULL) {
-                    W_effective->data[idx] = layer->posterior->sample(layer->posterior, layer->W_mean->data[idx], layer->W_logvar->data[idx]);
+        int row = i * in_dim;
+        if (stochastic && rank > 0) {
+            lowrank_posterior_sample(layer->W_mean->data + row, layer->W_sigma + row,
+                                     layer->W_factor + (size_t) row * rank, layer->z_sample, in_dim, rank,
+                                     W_effective->data + row);
+        } else if (stochastic && layer->posterior == NULL) {
+            // Mean-field: one multiply-add per weight with the cached standard deviations.
+            if (!bulk) {
+                sample_gaussian_sigma(layer->W_mean->data + row, layer->W_sigma + row, W_effective->data + row,
+                                      in_dim);
+            }
+        } else {
+            for (int j = 0; j < in_dim; j++) {
+                int idx = row + j;
+                if (stochastic) {
+                    W_effective->data[idx] = layer->posterior->sample(layer->posterior, layer->W_mean->data[idx],
+                                                                      layer->W_logvar->data[idx]);
                 } else {
-                    W_effective->data[idx] = sample_gaussian(layer->W_mean->data[idx], layer->W_logvar->data[idx]);
+                    W_effective->data[idx] = layer->W_mean->data[idx];
                 }
-            } else {
-                W_effective->data[idx] = layer->W_mean->data[idx];
             }
         }
+        if (mc_kl) {
+            layer->mc_kl += prior_mc_kl_sum(layer->prior, 1.0, layer->W_mean->data + row, layer->W_logvar->data + row,
+                                            W_effective->data + row, in_dim, layer->mc_kl_grad + row,
+                                            layer->mc_kl_grad + num_params + row, 1.0);
+        }
+    }
+    if (mc_kl) {
+        int bias = out_dim * in_dim;
+        layer->mc_kl += prior_mc_kl_sum(layer->prior, 1.0, layer->b_mean, layer->b_logvar, b_effective, out_dim,
+                                        layer->mc_kl_grad + bias, layer->mc_kl_grad + num_params + bias, 1.0);
+        layer->mc_kl_valid = 1;
     }
     
     // Compute output = input * (W_effective)^T + bias.
@@ -196,7 +625,6 @@ Matrix* bayesian_linear_forward(BayesianLinear *layer, const Matrix *input, int
     Matrix *output = matrix_multiply(input, W_transposed);
     
     free_matrix(W_transposed);
-    free_matrix(W_effective);
     
     // Add bias to each row of the output.
     for (int i = 0; i < input_samples; i++) {
@@ -204,41 +632,245 @@ Matrix* bayesian_linear_forward(BayesianLinear *layer, const Matrix *input, int
             output->data[i * out_dim + j] += b_effective[j];
         }
     }
-    free(b_effective);
     return output;
 }
 
-// Compute the total KL divergence for the layer's weights and biases using the Prior interface.
-// For each weight and bias, if a Prior is set, call its compute_kl() function;
-// otherwise, fall back to the Gaussian KL divergence with a default variance of 1.0.
-double bayesian_linear_kl(BayesianLinear *layer, double default_variance) {
-    double kl_total = 0.0;
-    int total_weights = layer->output_dim * layer->input_dim;
-    
-    if (layer->prior == NULL) {
-        // Fallback: use default Gaussian prior with specified variance.
-        for (int i = 0; i < total_weights; i++) {
-            kl_total += kl_divergence_single(layer->W_mean->data[i],
-                                             layer->W_logvar->data[i],
-                                             default_variance);
+// Y = X W^T + bias for batch rows, accumulated as rank-1 updates into the row 'acc'. W^T is given
+// row-major with rows, bias and acc padded to a multiple of 8 entries so that the inner loop needs
+// no scalar remainder.
+static void linear_gemm(const double *restrict X, const double *restrict Wt, const double *restrict bias,
+                        double *restrict acc, double *restrict Y, int batch, int in_dim, int out_dim) {
+    int padded = (out_dim + 7) & ~7;
+    for (int b = 0; b < batch; b++) {
+        memcpy(acc, bias, sizeof(double) * padded);
+        for (int j = 0; j < in_dim; j++) {
+            const double *w = Wt + (size_t) j * padded;
+            double x = X[(size_t) b * in_dim + j];
+            for (int o = 0; o < padded; o++) {
+                acc[o] += x * w[o];
+            }
         }
-        for (int i = 0; i < layer->output_dim; i++) {
-            kl_total += kl_divergence_single(layer->b_mean[i],
-                                             layer->b_logvar[i],
-                                             default_variance);
+        memcpy(Y + (size_t) b * out_dim, acc, sizeof(double) * out_dim);
+    }
+}
+
+// Room for num_samples draws in pred_weights, and for the transposed weights and accumulator.
+static void reserve_pred_storage(BayesianLinear *layer, int num_samples) {
+    int in_dim = layer->input_dim, padded = (layer->output_dim + 7) & ~7;
+    int stride = layer->output_dim * in_dim + padded;
+    if (num_samples <= layer->pred_capacity) {
+        return;
+    }
+    free(layer->pred_weights);
+    // Zeroed so that the bias padding is zero; the transposed weights and accumulator follow.
+    layer->pred_weights = (double*)calloc((size_t) num_samples * stride, sizeof(double));
+    if (!layer->pred_transposed) {
+        layer->pred_transposed = (double*)calloc((size_t) (in_dim + 1) * padded, sizeof(double));
+    }
+    if (!layer->pred_weights || !layer->pred_transposed) {
+        handle_error("Failed to allocate predictive weight samples.");
+    }
+    layer->pred_capacity = num_samples;
+}
+
+// Y = X W^T + bias for 'rows' rows, where w holds W followed by the padded bias.
+static void pred_product(BayesianLinear *layer, const double *w, const double *X, double *Y, int rows) {
+    int in_dim = layer->input_dim, out_dim = layer->output_dim, padded = (out_dim + 7) & ~7;
+    for (int o = 0; o < out_dim; o++) {
+        for (int j = 0; j < in_dim; j++) {
+            layer->pred_transposed[(size_t) j * padded + o] = w[(size_t) o * in_dim + j];
         }
-    } else {
-        // Use the Prior's compute_kl function pointer.
-        for (int i = 0; i < total_weights; i++) {
-            kl_total += layer->prior->compute_kl(layer->prior,
-                                                 layer->W_mean->data[i],
-                                                 layer->W_logvar->data[i]);
+    }
+    linear_gemm(X, layer->pred_transposed, w + (size_t) out_dim * in_dim,
+                layer->pred_transposed + (size_t) in_dim * padded, Y, rows, in_dim, out_dim);
+}
+
+// Truncated predictive pass: each draw's output is the mean output X M^T + b plus a rank-r
+// perturbation. The standard deviations are fitted by an outer product, sigma_oj ~ a_o c_j
+// (exact when they are constant along rows or columns), and the noise sigma o E is replaced by
+// diag(a) (u_1 v_1^T + ... + u_r v_r^T) diag(c) / sqrt(r) with standard normal u_k, v_k, whose
+// entries have the same mean and variance as E and are uncorrelated. Each draw then costs
+// r (B * in + B * out) instead of B * in * out; the bias noise is exact.
+static void forward_mc_truncated(BayesianLinear *layer, const Matrix *input, int num_samples,
+                                 int shared_input, Matrix *output) {
+    int in_dim = layer->input_dim, out_dim = layer->output_dim, rank = layer->mc_rank;
+    int total_weights = out_dim * in_dim;
+    int batch = shared_input ? input->rows : input->rows / num_samples;
+    double *row_scale = layer->mc_scratch, *col_scale = row_scale + out_dim;
+    double *u = col_scale + in_dim;                 // rank x out_dim
+    double *v = u + (size_t) rank * out_dim;        // rank x in_dim
+    double *bias_noise = v + (size_t) rank * in_dim;
+    double *proj = bias_noise + out_dim;            // x . v_k for one row
+
+    double total = 0.0;
+    memset(row_scale, 0, sizeof(double) * (out_dim + in_dim));
+    for (int o = 0; o < out_dim; o++) {
+        for (int j = 0; j < in_dim; j++) {
+            double s2 = layer->W_sigma[o * in_dim + j] * layer->W_sigma[o * in_dim + j];
+            row_scale[o] += s2;
+            col_scale[j] += s2;
+            total += s2;
         }
-        for (int i = 0; i < layer->output_dim; i++) {
-            kl_total += layer->prior->compute_kl(layer->prior,
-                                                 layer->b_mean[i],
-                                                 layer->b_logvar[i]);
+    }
+    for (int o = 0; o < out_dim; o++) {
+        row_scale[o] = sqrt(row_scale[o] / ((double) in_dim * rank));  // Includes 1 / sqrt(r).
+    }
+    for (int j = 0; j < in_dim; j++) {
+        col_scale[j] = (total > 0.0) ? sqrt(col_scale[j] * in_dim / total) : 0.0;
+    }
+
+    // The mean output, once for a shared input.
+    double *w = layer->pred_weights;
+    memcpy(w, layer->W_mean->data, sizeof(double) * total_weights);
+    memcpy(w + total_weights, layer->b_mean, sizeof(double) * out_dim);
+    pred_product(layer, w, input->data, output->data, shared_input ? batch : num_samples * batch);
+    for (int s = 1; shared_input && s < num_samples; s++) {
+        memcpy(output->data + (size_t) s * batch * out_dim, output->data, sizeof(double) * batch * out_dim);
+    }
+
+    for (int s = 0; s < num_samples; s++) {
+        const double *x = input->data + (shared_input ? 0 : (size_t) s * batch * in_dim);
+        double *y = output->data + (size_t) s * batch * out_dim;
+        // u, v and the bias noise are contiguous.
+        random_add_gaussian(u, NULL, rank * (out_dim + in_dim) + out_dim, 0.0, 1.0);
+        for (int k = 0; k < rank; k++) {
+            for (int o = 0; o < out_dim; o++) {
+                u[k * out_dim + o] *= row_scale[o];
+            }
+            for (int j = 0; j < in_dim; j++) {
+                v[k * in_dim + j] *= col_scale[j];
+            }
+        }
+        for (int o = 0; o < out_dim; o++) {
+            bias_noise[o] *= layer->b_sigma[o];
+        }
+        for (int b = 0; b < batch; b++) {
+            const double *x_row = x + (size_t) b * in_dim;
+            double *y_row = y + (size_t) b * out_dim;
+            for (int k = 0; k < rank; k++) {
+                proj[k] = vector_dot(x_row, v + (size_t) k * in_dim, in_dim);
+            }
+            for (int o = 0; o < out_dim; o++) {
+                y_row[o] += bias_noise[o];
+            }
+            for (int k = 0; k < rank; k++) {
+                const double *u_k = u + (size_t) k * out_dim;
+                for (int o = 0; o < out_dim; o++) {
+                    y_row[o] += proj[k] * u_k[o];
+                }
+            }
+        }
+    }
+}
+
+void bayesian_linear_set_mc_rank(BayesianLinear *layer, int rank) {
+    if (rank < 0) {
+        handle_error("Invalid perturbation rank in bayesian_linear_set_mc_rank.");
+    }
+    free(layer->mc_scratch);
+    layer->mc_scratch = NULL;
+    layer->mc_rank = rank;
+    if (rank > 0) {
+        size_t n = (size_t) layer->input_dim + layer->output_dim;
+        layer->mc_scratch = (double*)malloc(sizeof(double) * ((rank + 1) * n + layer->output_dim + rank));
+        if (!layer->mc_scratch) {
+            handle_error("Failed to allocate perturbation buffers.");
+        }
+    }
+}
+
+Matrix* bayesian_linear_forward_mc(BayesianLinear *layer, const Matrix *input, int num_samples, int shared_input) {
+    int in_dim = layer->input_dim, out_dim = layer->output_dim;
+    if (num_samples < 1 || input->cols != in_dim || (!shared_input && input->rows % num_samples != 0)) {
+        handle_error("Input shape mismatch in bayesian_linear_forward_mc.");
+    }
+    int batch = shared_input ? input->rows : input->rows / num_samples;
+    int truncated = layer->mc_rank > 0 && layer->posterior == NULL && layer->posterior_rank == 0 &&
+                    !layer->matrix_normal;
+    if (shared_input && !truncated) {
+        // Only the truncated pass gains from a shared input; the exact one needs a product per draw.
+        Matrix *stacked = create_matrix(num_samples * batch, in_dim);
+        for (int s = 0; s < num_samples; s++) {
+            memcpy(stacked->data + (size_t) s * batch * in_dim, input->data, sizeof(double) * batch * in_dim);
+        }
+        Matrix *output = bayesian_linear_forward_mc(layer, stacked, num_samples, 0);
+        free_matrix(stacked);
+        return output;
+    }
+    Matrix *output = create_matrix(num_samples * batch, out_dim);
+    if (layer->matrix_normal) {
+        for (int s = 0; s < num_samples; s++) {
+            Matrix block = { batch, in_dim, input->data + (size_t) s * batch * in_dim, NULL, 0 };
+            Matrix *y = bayesian_linear_forward(layer, &block, 1);
+            memcpy(output->data + (size_t) s * batch * out_dim, y->data, sizeof(double) * batch * out_dim);
+            free_matrix(y);
+        }
+        return output;
+    }
+    int total_weights = out_dim * in_dim, stride = total_weights + ((out_dim + 7) & ~7);
+    reserve_pred_storage(layer, truncated ? 1 : num_samples);
+    if (layer->posterior == NULL && layer->sigma_dirty) {
+        compute_sigma(layer->W_logvar->data, layer->W_sigma, total_weights);
+        compute_sigma(layer->b_logvar, layer->b_sigma, out_dim);
+        layer->sigma_dirty = 0;
+    }
+    if (truncated) {
+        forward_mc_truncated(layer, input, num_samples, shared_input, output);
+        return output;
+    }
+    // Draw every sample's weights and biases first.
+    for (int s = 0; s < num_samples; s++) {
+        double *w = layer->pred_weights + (size_t) s * stride, *bias = w + total_weights;
+        if (layer->posterior != NULL) {
+            for (int i = 0; i < total_weights; i++) {
+                w[i] = layer->posterior->sample(layer->posterior, layer->W_mean->data[i], layer->W_logvar->data[i]);
+            }
+            for (int i = 0; i < out_dim; i++) {
+                bias[i] = layer->posterior->sample(layer->posterior, layer->b_mean[i], layer->b_logvar[i]);
+            }
+            continue;
+        }
+        if (layer->posterior_rank > 0) {
+            double z[LOWRANK_MAX_RANK];
+            for (int a = 0; a < layer->posterior_rank; a++) {
+                z[a] = random_gaussian(0.0, 1.0);
+            }
+            lowrank_posterior_sample(layer->W_mean->data, layer->W_sigma, layer->W_factor, z, total_weights,
+                                     layer->posterior_rank, w);
+        } else {
+            sample_gaussian_sigma(layer->W_mean->data, layer->W_sigma, w, total_weights);
         }
+        sample_gaussian_sigma(layer->b_mean, layer->b_sigma, bias, out_dim);
+    }
+    // Then evaluate each block with its sample.
+    for (int s = 0; s < num_samples; s++) {
+        pred_product(layer, layer->pred_weights + (size_t) s * stride, input->data + (size_t) s * batch * in_dim,
+                     output->data + (size_t) s * batch * out_dim, batch);
+    }
+    return output;
+}
+
+// Compute the total KL divergence for the layer's weights and biases using the Prior interface.
+// With the Monte Carlo estimator this is the estimate of the last stochastic forward pass.
+// Otherwise each parameter tensor is reduced in one prior_kl_sum() call; without a Prior the Gaussian
+// with the given default variance is used.
+double bayesian_linear_kl(BayesianLinear *layer, double default_variance) {
+    if (layer->kl_estimator == 1 && layer->mc_kl_valid) {
+        return layer->mc_kl;
+    }
+    int total_weights = layer->output_dim * layer->input_dim;
+    if (layer->matrix_normal) {
+        return matnorm_weight_kl(layer, default_variance, NULL, NULL, NULL, 0.0)
+             + prior_kl_sum(layer->prior, default_variance, layer->b_mean, layer->b_logvar, layer->output_dim,
+                            NULL, NULL, 0.0);
+    }
+    if (layer->posterior_rank > 0) {
+        return lowrank_weight_kl(layer, default_variance, NULL, NULL, NULL, 0.0)
+             + prior_kl_sum(layer->prior, default_variance, layer->b_mean, layer->b_logvar, layer->output_dim,
+                            NULL, NULL, 0.0);
     }
-    return kl_total;
+    return prior_kl_sum(layer->prior, default_variance, layer->W_mean->data, layer->W_logvar->data, total_weights,
+                        NULL, NULL, 0.0)
+         + prior_kl_sum(layer->prior, default_variance, layer->b_mean, layer->b_logvar, layer->output_dim,
+                        NULL, NULL, 0.0);
 }
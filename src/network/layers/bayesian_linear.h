@@ -25,7 +25,47 @@ typedef struct {
     double *db_mean;    // Gradient of the loss w.r.t. b_mean
     double *db_logvar;  // Gradient of the loss w.r.t. b_logvar
     Matrix *cached_input; // The input used in the most recent forward pass
-
+    Matrix *W_sample;     // Weights drawn in the most recent forward pass (the means when deterministic)
+    double *b_sample;     // Biases drawn in the most recent forward pass
+    // exp(0.5 * logvar), cached for sampling. Whoever writes W_logvar or b_logvar (the optimizer)
+    // sets sigma_dirty, and the next stochastic forward pass recomputes both arrays.
+    double *W_sigma;
+    double *b_sigma;
+    int sigma_dirty;
+    // Monte Carlo KL (kl_estimator == 1): evaluated on the weights drawn by each stochastic
+    // forward pass while they are sampled, see prior_mc_kl_sum().
+    int kl_estimator;     // 0: closed-form KL, 1: Monte Carlo estimate
+    double mc_kl;         // Estimate from the most recent stochastic forward pass
+    int mc_kl_valid;      // Nonzero once mc_kl and mc_kl_grad hold an estimate
+    double *mc_kl_grad;   // dKL/d(W_mean, b_mean) followed by dKL/d(W_logvar, b_logvar); NULL until used
+    // Low-rank plus diagonal weight posterior (see lowrank_posterior_kl()); rank 0 is mean-field.
+    // Biases stay mean-field. Low-rank layers always use the closed-form KL.
+    int posterior_rank;
+    double *W_factor;     // U: (output_dim * input_dim) x posterior_rank, row-major; NULL for rank 0
+    double *dW_factor;    // Gradient of the loss w.r.t. W_factor
+    double *z_sample;     // Factor sample z of the most recent forward pass (zero when deterministic)
+    // Matrix-normal weight posterior MN(W_mean, L_row L_row^T, L_col L_col^T) (see
+    // matnorm_posterior_kl()); W_logvar is unused then. Biases stay mean-field.
+    int matrix_normal;    // Nonzero when the matrix-normal posterior is in use
+    int local_reparam;    // Sample the pre-activations per example instead of one weight matrix
+    int mn_mode;          // Last pass: 0 deterministic, 1 shared weight sample, 2 local reparameterization
+    double *L_row;        // output_dim x output_dim lower-triangular factor of the row covariance
+    double *L_col;        // input_dim x input_dim lower-triangular factor of the column covariance
+    double *dL_row;       // Gradient of the loss w.r.t. L_row
+    double *dL_col;       // Gradient of the loss w.r.t. L_col
+    double *mn_noise;     // E of the last shared sample (output_dim x input_dim)
+    double *mn_tmp;       // Scratch for the triangular products (output_dim x input_dim)
+    double *mn_eps;       // Per-example output noise of the last local pass (batch x output_dim)
+    double *mn_scale;     // Per-example sqrt(x^T V x) of the last local pass
+    int mn_capacity;      // Batch size mn_eps and mn_scale are allocated for
+    // Scratch of bayesian_linear_forward_mc(): the drawn weights and biases of every sample, and
+    // one sample's weights transposed for the product. P is output_dim rounded up to a multiple of 8.
+    double *pred_weights;   // num_samples x (output_dim * input_dim + P), biases zero-padded to P
+    double *pred_transposed; // input_dim x P, followed by a P-entry accumulator row
+    int pred_capacity;      // Number of samples pred_weights is allocated for
+    // Truncated predictive perturbation, see bayesian_linear_set_mc_rank().
+    int mc_rank;            // 0: exact draws
+    double *mc_scratch;     // Row and column scales, one draw's factors, bias noise and projections
 
 } BayesianLinear;
 
@@ -34,9 +74,27 @@ typedef struct {
 // The Prior and Posterior pointers are initialized to NULL and should be set externally based on configuration.
 BayesianLinear* create_bayesian_linear(int input_dim, int output_dim);
 
+// Switch the weights to a low-rank plus diagonal posterior of the given rank (0 < rank <=
+// LOWRANK_MAX_RANK), with a small random initial factor. The KL then needs a Gaussian prior.
+void bayesian_linear_set_rank(BayesianLinear *layer, int rank);
+
+// Switch the weights to a matrix-normal posterior with identity-shaped initial factors that
+// match the mean-field initial variance. With local_reparam nonzero, stochastic passes sample
+// each example's pre-activations from N(M x, (x^T V x) U) instead of one weight matrix, which
+// keeps the full input correlations. The KL then needs a Gaussian prior.
+void bayesian_linear_set_matrix_normal(BayesianLinear *layer, int local_reparam);
+
 // Free the memory allocated for a Bayesian linear layer.
 void free_bayesian_linear(BayesianLinear *layer);
 
+// Per-call state for running the layer from several threads (see exec_context.h): a new
+// BayesianLinear that shares the parameters, priors, posteriors and cached standard deviations
+// of 'params' and owns its input cache, samples and scratch. Its gradient pointers (dW_mean->data,
+// db_mean, ...) are left NULL for the caller to point at its own storage. Free it with
+// free_bayesian_linear_context(), which leaves the shared arrays alone.
+BayesianLinear* bayesian_linear_create_context(const BayesianLinear *params);
+void free_bayesian_linear_context(BayesianLinear *ctx);
+
 // Forward pass for the Bayesian linear layer.
 // If 'stochastic' is nonzero, sample weights and biases using the reparameterization trick;
 // if a Posterior object is provided, use its sample() function; otherwise, use sample_gaussian() directly.
@@ -44,10 +102,34 @@ void free_bayesian_linear(BayesianLinear *layer);
 // Returns a new Matrix of shape (num_samples x output_dim).
 Matrix* bayesian_linear_forward(BayesianLinear *layer, const Matrix *input, int stochastic);
 
+// Predictive forward pass for num_samples independent posterior draws at once. 'input' stacks
+// num_samples blocks of B rows, and block s is evaluated with the s-th draw of the weights and
+// biases; with shared_input != 0 it is a single block of B rows shared by every draw. All draws
+// are made up front, then each block is one GEMM. Returns a new (num_samples * B) x output_dim
+// Matrix in block order. The state used by the backward pass and by the Monte Carlo KL is left
+// untouched, except with the matrix-normal posterior, which evaluates the blocks through
+// bayesian_linear_forward(). With mc_rank > 0 the draws are truncated, see below.
+Matrix* bayesian_linear_forward_mc(BayesianLinear *layer, const Matrix *input, int num_samples, int shared_input);
+
+// Approximate the weight noise of bayesian_linear_forward_mc() by a rank-'rank' perturbation
+// (0 restores exact draws). The mean output X M^T + b is then computed once per input, or once
+// for all draws when the input is shared, and each draw only adds the rank-'rank' perturbation
+// and the bias noise. Per-output variances match the exact ones when the standard deviations
+// are constant along the rows or columns of W, as in layers that have barely moved from their
+// initial variance. Applies to mean-field layers without a Posterior object; the others keep
+// exact draws.
+void bayesian_linear_set_mc_rank(BayesianLinear *layer, int rank);
+
 // Compute the total KL divergence for this layer using the Prior interface.
-// For each weight and bias, if a Prior is set, use its compute_kl() function; otherwise, fall back to a default Gaussian KL divergence.
+// The weights and biases are summed per tensor with prior_kl_sum(), i.e. the Prior's per-tensor
+// kernel when a Prior is set and a Gaussian KL with default_variance otherwise. Low-rank and
+// matrix-normal weights use their own closed-form KL against the same prior.
+// With kl_estimator == 1 this returns the Monte Carlo estimate of the last stochastic forward pass instead.
 double bayesian_linear_kl(BayesianLinear *layer, double default_variance);
 
+// Backward pass: writes the mean and log-variance gradients of the data loss plus kl_weight times
+// the KL gradient (from the Prior, or from the Monte Carlo estimate) in one sweep over the weights,
+// and returns the gradient w.r.t. the input.
 Matrix* bayesian_linear_backward(BayesianLinear *layer, const Matrix *grad_output, const Config *cfg);
 
 
@@ -1,14 +1,12 @@
 #include "dropout_layer.h"
 #include "../utils/utils.h"         // For handle_error()
-#include "../utils/random_utils.h"        // For random_uniform()
+#include "../utils/random_utils.h"        // For random_bernoulli_bits() and random_add_uniform()
+#include "../utils/fast_math.h"           // For fast_log() and fast_sigmoid()
+#include "../utils/thread_pool.h"         // For parallel_for()
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
-// Helper sigmoid function.
-static double sigmoid(double x) {
-    return 1.0 / (1.0 + exp(-x));
-}
-
 // Create a dropout layer.
 DropoutLayer* create_dropout_layer(DropoutType type, double dropout_prob, double temperature) {
     DropoutLayer *layer = (DropoutLayer*)malloc(sizeof(DropoutLayer));
@@ -19,95 +17,281 @@ DropoutLayer* create_dropout_layer(DropoutType type, double dropout_prob, double
     layer->dropout_prob = dropout_prob;
     layer->temperature = temperature;
     layer->dropout_mask = NULL;  // Initialize mask to NULL
+    layer->p_logit = 0.0;
+    layer->d_p_logit = 0.0;
+    layer->mask_dlogit = NULL;
+    if (type == DROPOUT_CONCRETE) {
+        if (dropout_prob <= 0.0 || dropout_prob >= 1.0 || temperature <= 0.0) {
+            handle_error("Concrete dropout needs 0 < dropout_prob < 1 and a positive temperature.");
+        }
+        layer->p_logit = log(dropout_prob) - log(1.0 - dropout_prob);
+    }
+    layer->mask_bits = NULL;
+    layer->mask_words = 0;
+    layer->mask_rows = 0;
+    layer->mask_cols = 0;
+    layer->mask_scale = 1.0;
     return layer;
 }
 
+// Per-call copy of the layer with its own masks and logit gradient.
+DropoutLayer* dropout_create_context(const DropoutLayer *params) {
+    DropoutLayer *ctx = (DropoutLayer*)malloc(sizeof(DropoutLayer));
+    if (!ctx) {
+        handle_error("Failed to allocate DropoutLayer context.");
+    }
+    *ctx = *params;
+    ctx->d_p_logit = 0.0;
+    ctx->dropout_mask = NULL;
+    ctx->mask_dlogit = NULL;
+    ctx->mask_bits = NULL;
+    ctx->mask_words = 0;
+    ctx->mask_rows = ctx->mask_cols = 0;
+    return ctx;
+}
+
 // Free the dropout layer.
 void free_dropout_layer(DropoutLayer *layer) {
     if (layer) {
         if (layer->dropout_mask) {
             free_matrix(layer->dropout_mask);
         }
+        if (layer->mask_dlogit) {
+            free_matrix(layer->mask_dlogit);
+        }
+        free(layer->mask_bits);
         free(layer);
     }
 }
 
-// Forward pass for dropout layer.
-// Applies dropout element-wise to the input matrix.
-// For standard MC dropout: Each element is dropped (set to zero) with probability dropout_prob,
-// and the remaining elements are scaled by 1/(1-dropout_prob).
-// For concrete dropout: A continuous relaxation is applied.
-// The 'training' flag indicates whether to sample a new dropout mask.
-Matrix* dropout_forward(DropoutLayer *layer, const Matrix *input, int training) {
-    if (!layer || !input) {
-        handle_error("Invalid input to dropout_forward.");
+// Select s * scale where the mask bit is set and 0.0 where it is clear, by AND-ing the
+// bit pattern of the product with an all-ones/all-zeros lane mask. Written without branches
+// so the compiler emits the 64-element loop below as a SIMD blend.
+static inline double masked_scale(double s, uint64_t word, int j, double scale) {
+    double v = s * scale;
+    uint64_t lane = 0 - ((word >> j) & 1u);
+    uint64_t raw;
+    memcpy(&raw, &v, sizeof(raw));
+    raw &= lane;
+    memcpy(&v, &raw, sizeof(v));
+    return v;
+}
+
+// Multiply 'src' by a packed 0/1 mask times 'scale' into 'dst' (n elements).
+static void mask_elements(double *dst, const double *src, const uint64_t *bits, int n, double scale) {
+    int full_words = n / 64;
+    for (int w = 0; w < full_words; w++) {
+        uint64_t word = bits[w];
+        const double *s = src + (size_t) w * 64;
+        double *d = dst + (size_t) w * 64;
+        for (int j = 0; j < 64; j++) {
+            d[j] = masked_scale(s[j], word, j, scale);
+        }
     }
+    int rest = n - full_words * 64;
+    if (rest > 0) {
+        uint64_t word = bits[full_words];
+        const double *s = src + (size_t) full_words * 64;
+        double *d = dst + (size_t) full_words * 64;
+        for (int j = 0; j < rest; j++) {
+            d[j] = masked_scale(s[j], word, j, scale);
+        }
+    }
+}
 
-    // Create an output matrix with the same dimensions as input.
-    Matrix *output = create_matrix(input->rows, input->cols);
-    int total_elements = input->rows * input->cols;
+typedef struct {
+    double *dst;
+    const double *src;
+    const uint64_t *bits;
+    int n;
+    double scale;
+} MaskTask;
+
+static void mask_words(void *arg, int begin, int end) {
+    MaskTask *t = (MaskTask*)arg;
+    size_t first = (size_t) begin * 64;
+    int count = ((size_t) end * 64 < (size_t) t->n) ? (end - begin) * 64 : t->n - (int) first;
+    mask_elements(t->dst + first, t->src + first, t->bits + begin, count, t->scale);
+}
+
+// mask_elements() with the mask words split over the kernel threads.
+static void apply_bit_mask(double *dst, const double *src, const uint64_t *bits, int n, double scale) {
+    MaskTask task = { dst, src, bits, n, scale };
+    parallel_for((n + 63) / 64, parallel_grain(64), mask_words, &task);
+}
+
+// Relaxed drop indicator s = sigmoid((logit(p) + log(u) - log(1-u)) / temperature).
+static inline double concrete_relaxed_drop(double u, double logit_p, double inv_temp) {
+    return fast_sigmoid((logit_p + fast_log(u) - fast_log(1.0 - u)) * inv_temp);
+}
+
+// Turn the uniforms in 'mask' into Concrete dropout mask values and their derivatives with
+// respect to the dropout logit. Only the layer's own (non-overlapping) buffers are touched
+// and the body is branch-free, so the main loop vectorizes (with AVX2 or wider; baseline
+// SSE2 lacks the 64-bit compares used by fast_log/fast_exp).
+static void concrete_mask_kernel(double *restrict mask, double *restrict dlogit, int n,
+                                 double logit_p, double p, double inv_temp, double inv_keep) {
+    // The main loop runs a multiple of 8 iterations so that the vectorizer needs no scalar
+    // epilogue (which the -O2 cost model refuses); the remainder goes through the second loop.
+    int n_main = n & ~7;
+    int i = 0;
+    for (; i < n_main; i++) {
+        double s = concrete_relaxed_drop(mask[i], logit_p, inv_temp);
+        mask[i] = (1.0 - s) * inv_keep;
+        dlogit[i] = mask[i] * (p - s * inv_temp);
+    }
+    for (; i < n; i++) {
+        double s = concrete_relaxed_drop(mask[i], logit_p, inv_temp);
+        mask[i] = (1.0 - s) * inv_keep;
+        dlogit[i] = mask[i] * (p - s * inv_temp);
+    }
+}
+
+typedef struct {
+    double *mask;
+    double *dlogit;
+    double logit_p;
+    double p;
+    double inv_temp;
+    double inv_keep;
+} ConcreteTask;
+
+static void concrete_mask_range(void *arg, int begin, int end) {
+    ConcreteTask *t = (ConcreteTask*)arg;
+    concrete_mask_kernel(t->mask + begin, t->dlogit + begin, end - begin, t->logit_p, t->p, t->inv_temp,
+                         t->inv_keep);
+}
+
+// Shared body of dropout_forward() and dropout_forward_inplace(). 'dst' may alias 'src'.
+static void dropout_apply(DropoutLayer *layer, double *dst, const double *src, int rows, int cols) {
+    int total_elements = rows * cols;
+    
+    if (layer->type == DROPOUT_MC) {
+        int words = (total_elements + 63) / 64;
+        if (words > layer->mask_words) {
+            free(layer->mask_bits);
+            layer->mask_bits = (uint64_t*)malloc(sizeof(uint64_t) * words);
+            if (!layer->mask_bits) {
+                handle_error("Failed to allocate dropout mask bits.");
+            }
+            layer->mask_words = words;
+        }
+        layer->mask_rows = rows;
+        layer->mask_cols = cols;
+        double keep = random_bernoulli_bits(layer->mask_bits, words, 1.0 - layer->dropout_prob);
+        layer->mask_scale = (keep > 0.0) ? 1.0 / keep : 0.0;
+        apply_bit_mask(dst, src, layer->mask_bits, total_elements, layer->mask_scale);
+        return;
+    }
+    
+    if (layer->type != DROPOUT_CONCRETE) {
+        handle_error("Unknown dropout type in dropout_forward.");
+    }
     
-    // Free any existing mask
-    if (layer->dropout_mask) {
+    // Reuse the relaxed mask buffers when the shape is unchanged.
+    if (layer->dropout_mask &&
+        (layer->dropout_mask->rows != rows || layer->dropout_mask->cols != cols)) {
         free_matrix(layer->dropout_mask);
+        free_matrix(layer->mask_dlogit);
+        layer->dropout_mask = NULL;
+        layer->mask_dlogit = NULL;
+    }
+    if (!layer->dropout_mask) {
+        layer->dropout_mask = create_matrix(rows, cols);
+        layer->mask_dlogit = create_matrix(rows, cols);
     }
-    // Create a new mask matrix
-    layer->dropout_mask = create_matrix(input->rows, input->cols);
     
-    // For each element, compute dropout mask and apply it.
+    // Concrete dropout:
+    //   s = sigmoid((logit(p) + log(u) - log(1-u)) / temperature),  u ~ Uniform(0,1)
+    //   mask = (1 - s) / (1 - p)
+    // Since p = sigmoid(p_logit), logit(p) is p_logit itself and is hoisted out of the loop.
+    // d(mask)/d(p_logit) = mask * (p - s / temperature); times the input it is kept for backward.
+    double p = layer->dropout_prob;
+    double logit_p = layer->p_logit;
+    double inv_temp = 1.0 / layer->temperature;
+    double inv_keep = 1.0 / (1.0 - p);
+    double *mask = layer->dropout_mask->data;
+    double *dlogit = layer->mask_dlogit->data;
+    // The uniforms are drawn in bulk into the mask buffer.
+    random_add_uniform(mask, NULL, total_elements, 0.0, 1.0);
+    ConcreteTask task = { mask, dlogit, logit_p, p, inv_temp, inv_keep };
+    parallel_for_elements(total_elements, parallel_grain(32), concrete_mask_range, &task);
+    // Apply the mask; dst may alias src, so this is kept to a separate, cheap loop.
     for (int i = 0; i < total_elements; i++) {
-        double mask = 1.0; // Default: no dropout
-        
-        if (layer->type == DROPOUT_MC) {
-            // Standard Monte Carlo dropout: sample binary mask.
-            // In standard dropout, an element is dropped with probability dropout_prob.
-            // We then scale the output by 1/(1-dropout_prob).
-            double u = random_uniform();
-            if (u < layer->dropout_prob) {
-                mask = 0.0;
-            } else {
-                mask = 1.0 / (1.0 - layer->dropout_prob);
-            }
-        } else if (layer->type == DROPOUT_CONCRETE) {
-            // Concrete dropout:
-            // Sample u ~ Uniform(0,1)
-            double u = random_uniform();
-            // Compute a relaxed mask using the Concrete distribution:
-            // s = sigmoid((log(p) - log(1-p) + log(u) - log(1-u)) / temperature)
-            // Then use mask = 1 - s to approximate dropout.
-            double logit_p = log(layer->dropout_prob) - log(1.0 - layer->dropout_prob);
-            double s = sigmoid((logit_p + log(u) - log(1.0 - u)) / layer->temperature);
-            mask = 1.0 - s;
-            // Optionally, scale by 1/(1-dropout_prob) to maintain the scale.
-            mask /= (1.0 - layer->dropout_prob);
-        } else {
-            handle_error("Unknown dropout type in dropout_forward.");
+        double x = src[i];
+        dlogit[i] *= x;
+        dst[i] = x * mask[i];
+    }
+}
+
+// Shared body of dropout_backward() and dropout_backward_inplace(). 'dst' may alias 'src'.
+static void dropout_apply_grad(DropoutLayer *layer, double *dst, const double *src, int rows, int cols,
+                               const Config *cfg) {
+    int total_elements = rows * cols;
+    
+    if (layer->type == DROPOUT_MC) {
+        if (!layer->mask_bits || layer->mask_rows != rows || layer->mask_cols != cols) {
+            handle_error("Dropout mask does not match gradient in dropout_backward.");
         }
-        
-        // Store the mask
-        layer->dropout_mask->data[i] = mask;
-        // Apply the mask to the input
-        output->data[i] = input->data[i] * mask;
+        apply_bit_mask(dst, src, layer->mask_bits, total_elements, layer->mask_scale);
+        return;
     }
     
+    if (!layer->dropout_mask || layer->dropout_mask->rows != rows || layer->dropout_mask->cols != cols) {
+        handle_error("Invalid input to dropout_backward.");
+    }
+    // Apply the same dropout mask to the gradients and accumulate the dropout logit gradient.
+    const double *mask = layer->dropout_mask->data;
+    const double *dlogit = layer->mask_dlogit->data;
+    double d_logit = 0.0;
+    for (int i = 0; i < total_elements; i++) {
+        d_logit += src[i] * dlogit[i];
+        dst[i] = src[i] * mask[i];
+    }
+    // Entropy regularizer K * (p log p + (1-p) log(1-p)); its derivative w.r.t. the logit is
+    // K * p * (1-p) * logit(p). It keeps the learned rate away from 0, where dropout switches off.
+    double p = layer->dropout_prob;
+    d_logit += cfg->regularization_weight * cols * p * (1.0 - p) * layer->p_logit;
+    layer->d_p_logit += d_logit;
+}
+
+// Forward pass for dropout layer.
+// Applies dropout element-wise to the input matrix.
+// For standard MC dropout: Each element is dropped (set to zero) with probability dropout_prob,
+// and the remaining elements are scaled by 1/(1-dropout_prob). The mask is drawn 64 elements
+// at a time as packed bits.
+// For concrete dropout: A continuous relaxation is applied.
+// The 'training' flag indicates whether to sample a new dropout mask.
+Matrix* dropout_forward(DropoutLayer *layer, const Matrix *input, int training) {
+    if (!layer || !input) {
+        handle_error("Invalid input to dropout_forward.");
+    }
+    Matrix *output = create_matrix(input->rows, input->cols);
+    dropout_apply(layer, output->data, input->data, input->rows, input->cols);
     return output;
 }
 
+void dropout_forward_inplace(DropoutLayer *layer, Matrix *data, int training) {
+    if (!layer || !data) {
+        handle_error("Invalid input to dropout_forward_inplace.");
+    }
+    dropout_apply(layer, data->data, data->data, data->rows, data->cols);
+}
+
 // Backward pass for dropout layer.
 // Applies the same dropout mask to the gradients.
 Matrix* dropout_backward(DropoutLayer *layer, const Matrix *grad_output, const Config *cfg) {
-    if (!layer || !grad_output || !layer->dropout_mask) {
+    if (!layer || !grad_output) {
         handle_error("Invalid input to dropout_backward.");
     }
-    
-    // Create output gradient matrix
     Matrix *grad_input = create_matrix(grad_output->rows, grad_output->cols);
-    int total_elements = grad_output->rows * grad_output->cols;
-    
-    // Apply the same dropout mask to the gradients
-    for (int i = 0; i < total_elements; i++) {
-        grad_input->data[i] = grad_output->data[i] * layer->dropout_mask->data[i];
-    }
-    
+    dropout_apply_grad(layer, grad_input->data, grad_output->data, grad_output->rows, grad_output->cols, cfg);
     return grad_input;
 }
+
+void dropout_backward_inplace(DropoutLayer *layer, Matrix *grad, const Config *cfg) {
+    if (!layer || !grad) {
+        handle_error("Invalid input to dropout_backward_inplace.");
+    }
+    dropout_apply_grad(layer, grad->data, grad->data, grad->rows, grad->cols, cfg);
+}
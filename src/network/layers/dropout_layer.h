@@ -3,6 +3,7 @@
 
 #include "../utils/math_utils.h"  // For the Matrix type
 #include "../../config/config.h"
+#include <stdint.h>
 // Enumeration to distinguish between dropout variants.
 typedef enum {
     DROPOUT_MC,        // Standard Monte Carlo dropout
@@ -14,16 +15,33 @@ typedef struct {
     DropoutType type;       // Type of dropout (MC or Concrete)
     double dropout_prob;    // Dropout probability (for MC dropout, fixed; for concrete, learned)
     double temperature;     // Temperature parameter for concrete dropout (ignored for MC dropout)
-    Matrix *dropout_mask;   // Store the dropout mask for backpropagation
+    Matrix *dropout_mask;   // Concrete dropout: relaxed (real-valued) mask for backpropagation
+    // Concrete dropout: the probability is learned through its logit, dropout_prob = sigmoid(p_logit).
+    double p_logit;
+    double d_p_logit;       // Accumulated gradient w.r.t. p_logit (reset by the optimizer)
+    Matrix *mask_dlogit;    // Per-element d(output)/d(p_logit) from the most recent forward pass
+    // MC dropout: the binary mask is stored as packed bits (1 = keep), one bit per element,
+    // in a buffer that persists across calls and only grows. Kept elements are scaled by mask_scale.
+    uint64_t *mask_bits;
+    int mask_words;         // Number of words allocated for mask_bits
+    int mask_rows;          // Shape of the most recent mask
+    int mask_cols;
+    double mask_scale;      // 1 / keep probability (as quantized by random_bernoulli_bits())
 } DropoutLayer;
 
 // Create a dropout layer with the specified type, dropout probability, and temperature.
 // For MC dropout, temperature can be set to any value (e.g., 0.0).
+// For Concrete dropout, dropout_prob must lie strictly between 0 and 1.
 DropoutLayer* create_dropout_layer(DropoutType type, double dropout_prob, double temperature);
 
 // Free the memory allocated for a dropout layer.
 void free_dropout_layer(DropoutLayer *layer);
 
+// Per-call state for running the layer from several threads (see exec_context.h): a copy of
+// the probability and logit (re-read from the parameters before each pass by the caller) with
+// its own masks and logit gradient. Free it with free_dropout_layer().
+DropoutLayer* dropout_create_context(const DropoutLayer *params);
+
 // Forward pass for the dropout layer.
 // 'input' is a pointer to a Matrix containing activations.
 // 'training' flag can be used to decide whether to sample a new mask.
@@ -32,7 +50,14 @@ void free_dropout_layer(DropoutLayer *layer);
 Matrix* dropout_forward(DropoutLayer *layer, const Matrix *input, int training);
 
 // Backward pass for the dropout layer.
-// Applies the same dropout mask to the gradients.
+// Applies the same dropout mask to the gradients. For Concrete dropout it also accumulates
+// d_p_logit: the data term plus cfg->regularization_weight times the gradient of the
+// entropy regularizer K * (p log p + (1 - p) log(1 - p)), where K is the number of features.
 Matrix* dropout_backward(DropoutLayer *layer, const Matrix *grad_output, const Config *cfg);
 
+// In-place variants: overwrite 'data' / 'grad' with the result instead of allocating a new Matrix.
+// The backward pass only needs the stored mask, so it does not depend on the forward input.
+void dropout_forward_inplace(DropoutLayer *layer, Matrix *data, int training);
+void dropout_backward_inplace(DropoutLayer *layer, Matrix *grad, const Config *cfg);
+
 #endif // DROPOUT_LAYER_H
@@ -22,6 +22,18 @@ void free_noise_injection(NoiseInjection *ni) {
     }
 }
 
+// Shared body of the forward passes: dst = src + noise in a single pass. 'dst' may alias 'src'.
+static void noise_injection_apply(NoiseInjection *ni, double *dst, const double *src, int total_elements) {
+    if (ni->type == NOISE_GAUSSIAN) {
+        random_add_gaussian(dst, src, total_elements, ni->mean, ni->stddev);
+    } else if (ni->type == NOISE_UNIFORM) {
+        // Uniform noise: sample from U(mean - stddev, mean + stddev)
+        random_add_uniform(dst, src, total_elements, ni->mean - ni->stddev, ni->mean + ni->stddev);
+    } else {
+        handle_error("Unknown noise type in noise_injection_forward.");
+    }
+}
+
 // Forward pass for noise injection.
 // If training is nonzero, adds noise to each element of the input matrix based on the specified noise type.
 // For Gaussian noise: noise is sampled from N(mean, stddev).
@@ -32,29 +44,37 @@ Matrix* noise_injection_forward(NoiseInjection *ni, const Matrix *input, int tra
         handle_error("Invalid input to noise_injection_forward.");
     }
     
-    Matrix *output = create_matrix(input->rows, input->cols);
-    int total_elements = input->rows * input->cols;
-    
+    Matrix *output;
     if (training) {
-        for (int i = 0; i < total_elements; i++) {
-            double noise = 0.0;
-            if (ni->type == NOISE_GAUSSIAN) {
-                noise = random_gaussian(ni->mean, ni->stddev);
-            } else if (ni->type == NOISE_UNIFORM) {
-                // Uniform noise: sample from U(mean - stddev, mean + stddev)
-                double u = random_uniform();
-                noise = ni->mean - ni->stddev + 2 * ni->stddev * u;
-            } else {
-                handle_error("Unknown noise type in noise_injection_forward.");
-            }
-            output->data[i] = input->data[i] + noise;
-        }
+        output = create_matrix(input->rows, input->cols);
+        noise_injection_apply(ni, output->data, input->data, input->rows * input->cols);
     } else {
         // In inference mode, return the input unchanged.
-        for (int i = 0; i < total_elements; i++) {
-            output->data[i] = input->data[i];
-        }
+        output = copy_matrix(input);
     }
     
     return output;
 }
+
+void noise_injection_forward_inplace(NoiseInjection *ni, Matrix *data, int training) {
+    if (!ni || !data) {
+        handle_error("Invalid input to noise_injection_forward_inplace.");
+    }
+    if (training) {
+        noise_injection_apply(ni, data->data, data->data, data->rows * data->cols);
+    }
+}
+
+// The noise is additive and independent of the input, so the gradient passes through unchanged.
+Matrix* noise_injection_backward(NoiseInjection *ni, const Matrix *grad_output, const Config *cfg) {
+    if (!ni || !grad_output) {
+        handle_error("Invalid input to noise_injection_backward.");
+    }
+    return copy_matrix(grad_output);
+}
+
+void noise_injection_backward_inplace(NoiseInjection *ni, Matrix *grad, const Config *cfg) {
+    if (!ni || !grad) {
+        handle_error("Invalid input to noise_injection_backward_inplace.");
+    }
+}
@@ -2,6 +2,7 @@
 #define NOISE_INJECTION_H
 
 #include "../utils/math_utils.h"  // For the Matrix type
+#include "../config/config.h"
 
 // Enumeration for different types of noise.
 typedef enum {
@@ -27,4 +28,11 @@ void free_noise_injection(NoiseInjection *ni);
 // If training is nonzero, noise is added; if not, the input is passed unchanged.
 Matrix* noise_injection_forward(NoiseInjection *ni, const Matrix *input, int training);
 
+// Backward pass: the noise does not depend on the input, so the gradient is passed through.
+Matrix* noise_injection_backward(NoiseInjection *ni, const Matrix *grad_output, const Config *cfg);
+
+// In-place variants: overwrite 'data' / 'grad' instead of allocating a new Matrix.
+void noise_injection_forward_inplace(NoiseInjection *ni, Matrix *data, int training);
+void noise_injection_backward_inplace(NoiseInjection *ni, Matrix *grad, const Config *cfg);
+
 #endif // NOISE_INJECTION_H
@@ -0,0 +1,193 @@
+#include "pooling_layer.h"
+#include "../utils/utils.h"         // For handle_error()
+#include <stdlib.h>
+#include <stdio.h>
+
+// Create a pooling layer.
+PoolingLayer* create_pooling_layer(PoolType type, int channels, int input_height, int input_width,
+                                   int pool_size, int stride) {
+    PoolingLayer *layer = (PoolingLayer*)malloc(sizeof(PoolingLayer));
+    if (!layer) {
+        handle_error("Failed to allocate memory for PoolingLayer.");
+    }
+    layer->type = type;
+    layer->channels = channels;
+    layer->input_height = input_height;
+    layer->input_width = input_width;
+    if (type == POOL_GLOBAL_AVG) {
+        layer->pool_size = 0;
+        layer->stride = 0;
+        layer->output_height = 1;
+        layer->output_width = 1;
+    } else {
+        if (pool_size < 1 || stride < 1 || pool_size > input_height || pool_size > input_width) {
+            printf("input: %dx%d, pool_size: %d, stride: %d; ", input_height, input_width, pool_size, stride);
+            handle_error("Invalid pooling window in create_pooling_layer.");
+        }
+        layer->pool_size = pool_size;
+        layer->stride = stride;
+        layer->output_height = (input_height - pool_size) / stride + 1;
+        layer->output_width = (input_width - pool_size) / stride + 1;
+    }
+    layer->argmax = NULL;
+    layer->argmax_capacity = 0;
+    layer->cached_batch = 0;
+    return layer;
+}
+
+// Per-call copy of the layer: the same geometry with its own argmax buffer.
+PoolingLayer* pooling_create_context(const PoolingLayer *params) {
+    PoolingLayer *ctx = (PoolingLayer*)malloc(sizeof(PoolingLayer));
+    if (!ctx) {
+        handle_error("Failed to allocate PoolingLayer context.");
+    }
+    *ctx = *params;
+    ctx->argmax = NULL;
+    ctx->argmax_capacity = 0;
+    ctx->cached_batch = 0;
+    return ctx;
+}
+
+// Free the pooling layer.
+void free_pooling_layer(PoolingLayer *layer) {
+    if (layer) {
+        free(layer->argmax);
+        free(layer);
+    }
+}
+
+// Forward pass for the pooling layer.
+// All variants loop over the window in the outer loops and over contiguous channels
+// in the innermost loop.
+Matrix* pooling_forward(PoolingLayer *layer, const Matrix *input, int stochastic) {
+    (void) stochastic;
+    int C = layer->channels, H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    if (!input || input->cols != H * W * C) {
+        handle_error("Input shape mismatch in pooling_forward.");
+    }
+    int batch_size = input->rows;
+    Matrix *output = create_matrix(batch_size, OH * OW * C);
+    layer->cached_batch = batch_size;
+    
+    if (layer->type == POOL_GLOBAL_AVG) {
+        double scale = 1.0 / (H * W);
+        for (int b = 0; b < batch_size; b++) {
+            const double *in_img = input->data + (size_t) b * H * W * C;
+            double *out_px = output->data + (size_t) b * C;
+            for (int p = 0; p < H * W; p++) {
+                const double *in_px = in_img + p * C;
+                for (int c = 0; c < C; c++) {
+                    out_px[c] += in_px[c];
+                }
+            }
+            for (int c = 0; c < C; c++) {
+                out_px[c] *= scale;
+            }
+        }
+        return output;
+    }
+    
+    int total_out = batch_size * OH * OW * C;
+    if (layer->type == POOL_MAX && layer->argmax_capacity < total_out) {
+        free(layer->argmax);
+        layer->argmax = (int*)malloc(sizeof(int) * total_out);
+        if (!layer->argmax) {
+            handle_error("Failed to allocate pooling argmax buffer.");
+        }
+        layer->argmax_capacity = total_out;
+    }
+    
+    int K = layer->pool_size, S = layer->stride;
+    double scale = 1.0 / (K * K);
+    for (int b = 0; b < batch_size; b++) {
+        size_t in_base = (size_t) b * H * W * C;
+        for (int oh = 0; oh < OH; oh++) {
+            for (int ow = 0; ow < OW; ow++) {
+                size_t out_off = (((size_t) b * OH + oh) * OW + ow) * C;
+                double *out_px = output->data + out_off;
+                int *arg_px = (layer->type == POOL_MAX) ? layer->argmax + out_off : NULL;
+                for (int kh = 0; kh < K; kh++) {
+                    for (int kw = 0; kw < K; kw++) {
+                        int in_off = ((oh * S + kh) * W + (ow * S + kw)) * C;
+                        const double *in_px = input->data + in_base + in_off;
+                        if (layer->type == POOL_MAX) {
+                            if (kh == 0 && kw == 0) {
+                                for (int c = 0; c < C; c++) {
+                                    out_px[c] = in_px[c];
+                                    arg_px[c] = (int) in_base + in_off + c;
+                                }
+                            } else {
+                                for (int c = 0; c < C; c++) {
+                                    int take = in_px[c] > out_px[c];
+                                    out_px[c] = take ? in_px[c] : out_px[c];
+                                    arg_px[c] = take ? (int) in_base + in_off + c : arg_px[c];
+                                }
+                            }
+                        } else {
+                            for (int c = 0; c < C; c++) {
+                                out_px[c] += in_px[c];
+                            }
+                        }
+                    }
+                }
+                if (layer->type == POOL_AVG) {
+                    for (int c = 0; c < C; c++) {
+                        out_px[c] *= scale;
+                    }
+                }
+            }
+        }
+    }
+    return output;
+}
+
+// Backward pass for the pooling layer.
+Matrix* pooling_backward(PoolingLayer *layer, const Matrix *grad_output, const Config *cfg) {
+    (void) cfg;
+    int C = layer->channels, H = layer->input_height, W = layer->input_width;
+    int OH = layer->output_height, OW = layer->output_width;
+    int batch_size = layer->cached_batch;
+    if (!grad_output || grad_output->rows != batch_size || grad_output->cols != OH * OW * C) {
+        handle_error("Invalid input to pooling_backward.");
+    }
+    Matrix *grad_input = create_matrix(batch_size, H * W * C);
+    
+    if (layer->type == POOL_MAX) {
+        int total_out = batch_size * OH * OW * C;
+        for (int i = 0; i < total_out; i++) {
+            grad_input->data[layer->argmax[i]] += grad_output->data[i];
+        }
+    } else if (layer->type == POOL_GLOBAL_AVG) {
+        double scale = 1.0 / (H * W);
+        for (int b = 0; b < batch_size; b++) {
+            const double *g_px = grad_output->data + (size_t) b * C;
+            double *gin_img = grad_input->data + (size_t) b * H * W * C;
+            for (int p = 0; p < H * W; p++) {
+                for (int c = 0; c < C; c++) {
+                    gin_img[p * C + c] = g_px[c] * scale;
+                }
+            }
+        }
+    } else {
+        int K = layer->pool_size, S = layer->stride;
+        double scale = 1.0 / (K * K);
+        for (int b = 0; b < batch_size; b++) {
+            double *gin_img = grad_input->data + (size_t) b * H * W * C;
+            for (int oh = 0; oh < OH; oh++) {
+                for (int ow = 0; ow < OW; ow++) {
+                    const double *g_px = grad_output->data + (((size_t) b * OH + oh) * OW + ow) * C;
+                    for (int kh = 0; kh < K; kh++) {
+                        for (int kw = 0; kw < K; kw++) {
+                            double *gin_px = gin_img + ((oh * S + kh) * W + (ow * S + kw)) * C;
+                            for (int c = 0; c < C; c++) {
+                                gin_px[c] += g_px[c] * scale;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return grad_input;
+}
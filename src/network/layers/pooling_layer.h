@@ -0,0 +1,49 @@
+#ifndef POOLING_LAYER_H
+#define POOLING_LAYER_H
+
+#include "../utils/math_utils.h"  // For the Matrix type
+#include "../../config/config.h"
+
+// Enumeration to distinguish between pooling variants.
+typedef enum {
+    POOL_MAX,          // Max over each window
+    POOL_AVG,          // Mean over each window
+    POOL_GLOBAL_AVG    // Mean over the whole image (one value per channel)
+} PoolType;
+
+// Structure representing a spatial pooling layer.
+// Inputs and outputs are NHWC-flattened image batches (see bayesian_conv.h).
+typedef struct {
+    PoolType type;
+    int channels;
+    int input_height;
+    int input_width;
+    int pool_size;          // Window size (ignored for global average pooling)
+    int stride;             // Window stride (ignored for global average pooling)
+    int output_height;
+    int output_width;
+    int *argmax;            // Max pooling: flat input index of each output element
+    int argmax_capacity;    // Number of ints allocated for argmax
+    int cached_batch;       // Batch size seen by the most recent forward pass
+} PoolingLayer;
+
+// Create a pooling layer for images of the given shape.
+// Calls handle_error() if the window does not fit the input.
+PoolingLayer* create_pooling_layer(PoolType type, int channels, int input_height, int input_width,
+                                   int pool_size, int stride);
+
+// Free the memory allocated for a pooling layer.
+void free_pooling_layer(PoolingLayer *layer);
+
+// Per-call state for running the layer from several threads (see exec_context.h): the same
+// geometry with its own argmax buffer. Free it with free_pooling_layer().
+PoolingLayer* pooling_create_context(const PoolingLayer *params);
+
+// Forward pass: 'input' is (batch_size x input_height*input_width*channels).
+// Returns a new Matrix of shape (batch_size x output_height*output_width*channels).
+Matrix* pooling_forward(PoolingLayer *layer, const Matrix *input, int stochastic);
+
+// Backward pass: routes each output gradient to the window element(s) it came from.
+Matrix* pooling_backward(PoolingLayer *layer, const Matrix *grad_output, const Config *cfg);
+
+#endif // POOLING_LAYER_H
@@ -1,12 +1,15 @@
 #include "stochastic_activation.h"
 #include "../bnn_util.h"   // For sample_gaussian() and kl_divergence_single()
 #include "../utils/utils.h"  // For handle_error()
+#include "../utils/thread_pool.h"  // For parallel_for()
 #include "../config/config.h"
 #include "../priors/prior_laplace.h"
 #include "../priors/prior_mixture.h"
+#include "../priors/prior_gaussian.h"
 #include "../posteriors/posterior_flipout.h"
 #include "../posteriors/posterior_structured.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 // Helper function to clip gradients
@@ -16,137 +19,360 @@ static double clip_gradient(double grad, double clip_value) {
     return grad;
 }
 
-// Backward pass for the stochastic activation layer.
-Matrix* stochastic_activation_backward(void *layer, const Matrix *grad_output, const Config *cfg) {
-    StochasticActivation *act = (StochasticActivation*) layer;
-    if (!act || !act->cached_input || !grad_output) {
+// The elementwise passes over pixels [begin, end), split over the kernel threads.
+typedef struct {
+    double *dst;
+    const double *src;
+    const double *alpha;
+    const uint64_t *bits;
+    int channels;
+} PixelTask;
+
+static void grad_pixels(void *arg, int begin, int end) {
+    PixelTask *t = (PixelTask*)arg;
+    int channels = t->channels;
+    for (int p = begin; p < end; p++) {
+        int base = p * channels;
+        for (int c = 0; c < channels; c++) {
+            int i = base + c;
+            double neg = (double) ((t->bits[i >> 6] >> (i & 63)) & 1u);
+            t->dst[i] = t->src[i] * (1.0 + neg * (t->alpha[c] - 1.0));
+        }
+    }
+}
+
+static void output_pixels(void *arg, int begin, int end) {
+    PixelTask *t = (PixelTask*)arg;
+    int channels = t->channels;
+    for (int p = begin; p < end; p++) {
+        const double *x = t->src + (size_t) p * channels;
+        double *y = t->dst + (size_t) p * channels;
+        for (int c = 0; c < channels; c++) {
+            double slope = (x[c] < 0) ? t->alpha[c] : 1.0;
+            y[c] = x[c] * slope;
+        }
+    }
+}
+
+// Sign-bit words per block of the alpha gradient reduction. The blocks are fixed, so the partial
+// sums are combined in the same order whatever the thread count.
+#define ALPHA_BLOCK_WORDS 64
+
+// Per-block partial sums of the alpha gradient over blocks [begin, end).
+typedef struct {
+    const uint64_t *bits;
+    const double *src;
+    const double *neg_inputs;
+    int words;
+    int channels;
+    int *block_start;      // Index in neg_inputs of the first negative input of each block
+    double *partial;       // 'channels' sums per block
+} AlphaTask;
+
+static void count_block_negatives(void *arg, int begin, int end) {
+    AlphaTask *t = (AlphaTask*)arg;
+    for (int b = begin; b < end; b++) {
+        int last = ((b + 1) * ALPHA_BLOCK_WORDS < t->words) ? (b + 1) * ALPHA_BLOCK_WORDS : t->words;
+        int count = 0;
+        for (int w = b * ALPHA_BLOCK_WORDS; w < last; w++) {
+            count += __builtin_popcountll(t->bits[w]);
+        }
+        t->block_start[b + 1] = count;
+    }
+}
+
+// The derivative of (alpha * x) with respect to alpha is x, so only the negative inputs
+// contribute; walk their set bits and pair them with the packed values.
+static void alpha_grad_blocks(void *arg, int begin, int end) {
+    AlphaTask *t = (AlphaTask*)arg;
+    int channels = t->channels;
+    for (int b = begin; b < end; b++) {
+        double *sum = t->partial + (size_t) b * channels;
+        memset(sum, 0, sizeof(double) * channels);
+        int last = ((b + 1) * ALPHA_BLOCK_WORDS < t->words) ? (b + 1) * ALPHA_BLOCK_WORDS : t->words;
+        int k = t->block_start[b];
+        for (int w = b * ALPHA_BLOCK_WORDS; w < last; w++) {
+            uint64_t word = t->bits[w];
+            while (word) {
+                int i = w * 64 + __builtin_ctzll(word);
+                sum[i % channels] += t->src[i] * t->neg_inputs[k++];
+                word &= word - 1;
+            }
+        }
+    }
+}
+
+// Shared body of the backward passes. 'dst' may alias 'src'.
+static void stochastic_activation_apply_grad(StochasticActivation *act, double *dst, const double *src,
+                                             int rows, int cols, const Config *cfg) {
+    if (act->state_rows == 0 || act->state_rows != rows || act->state_cols != cols) {
         handle_error("Invalid input to stochastic_activation_backward.");
     }
+    int channels = act->num_channels;
+    int total_elements = rows * cols;
+    int words = (total_elements + 63) / 64;
+    const uint64_t *bits = act->neg_bits;
     
-    // Create a matrix to hold the gradient with respect to the input.
-    Matrix *grad_input = create_matrix(act->cached_input->rows, act->cached_input->cols);
-    
-    // Initialize the gradient for the alpha parameter.
-    double grad_alpha = 0.0;
-    
-    int total_elements = act->cached_input->rows * act->cached_input->cols;
-    for (int i = 0; i < total_elements; i++) {
-        double x = act->cached_input->data[i];
-        double grad_out = grad_output->data[i];
-        
-        // Apply noise injection if configured
-        if (cfg->noise_injection > 0.0) {
-            grad_out += sample_gaussian(0.0, cfg->noise_injection);
+    // Per-channel alpha gradient, as partial sums over fixed blocks of the sign bits that the
+    // kernel threads compute in parallel. This must read src before it is overwritten below.
+    double *grad_alpha = act->d_alpha_mean;
+    int num_blocks = (words + ALPHA_BLOCK_WORDS - 1) / ALPHA_BLOCK_WORDS;
+    if (num_blocks <= 1) {
+        int block_start = 0;
+        AlphaTask task = { bits, src, act->neg_inputs, words, channels, &block_start, grad_alpha };
+        alpha_grad_blocks(&task, 0, 1);
+    } else {
+        int *block_start = (int*)malloc(sizeof(int) * (num_blocks + 1));
+        double *partial = (double*)malloc(sizeof(double) * (size_t) num_blocks * channels);
+        if (!block_start || !partial) {
+            handle_error("Failed to allocate StochasticActivation partial sums.");
         }
-        
-        // For x >= 0, derivative is 1; for x < 0, derivative is alpha (sampled value).
-        if (x >= 0) {
-            grad_input->data[i] = grad_out * 1.0;
-        } else {
-            grad_input->data[i] = grad_out * act->alpha_sample;
-            // The derivative of (alpha * x) with respect to alpha is x.
-            grad_alpha += grad_out * x;
+        AlphaTask task = { bits, src, act->neg_inputs, words, channels, block_start, partial };
+        parallel_for(num_blocks, 1, count_block_negatives, &task);
+        block_start[0] = 0;
+        for (int b = 0; b < num_blocks; b++) {
+            block_start[b + 1] += block_start[b];
         }
+        parallel_for(num_blocks, 1, alpha_grad_blocks, &task);
+        memcpy(grad_alpha, partial, sizeof(double) * channels);
+        for (int b = 1; b < num_blocks; b++) {
+            for (int c = 0; c < channels; c++) {
+                grad_alpha[c] += partial[(size_t) b * channels + c];
+            }
+        }
+        free(partial);
+        free(block_start);
     }
     
-    // Apply gradient clipping if configured
-    if (cfg->grad_clip > 0.0) {
-        grad_alpha = clip_gradient(grad_alpha, cfg->grad_clip);
-    }
+    // Gradient w.r.t. the input: 1 for x >= 0 and alpha[c] for x < 0, selected arithmetically
+    // from the sign bit so the channel loop has no branches.
+    PixelTask task = { dst, src, act->alpha_sample, bits, channels };
+    parallel_for(total_elements / channels, parallel_grain(4L * channels), grad_pixels, &task);
     
-    // Incorporate the KL divergence gradient contribution for the parameter.
-    // Use the configured prior variance and KL weight
-    double kl_contrib = cfg->kl_weight * act->alpha_mean;
+    // Incorporate the KL divergence gradient contribution for the parameters.
+    // Use the configured KL weight
+    double kl_scale = cfg->kl_weight;
     if (cfg->kl_annealing) {
         // If KL annealing is enabled, scale the KL contribution
-        kl_contrib *= (1.0 - exp(-cfg->kl_weight * cfg->num_epochs));
+        kl_scale *= (1.0 - exp(-cfg->kl_weight * cfg->num_epochs));
     }
-    grad_alpha += kl_contrib;
-    
-    // Store the computed gradient in the activation layer structure.
-    act->d_alpha_mean = grad_alpha;
-    
-    // Free the cached input as it is no longer needed.
-    free_matrix(act->cached_input);
-    act->cached_input = NULL;
+    // Apply gradient clipping if configured
+    if (cfg->grad_clip > 0.0) {
+        for (int c = 0; c < channels; c++) {
+            grad_alpha[c] = clip_gradient(grad_alpha[c], cfg->grad_clip);
+        }
+    }
+    // The same prior as stochastic_activation_kl(). The log-variances are not learned, so their
+    // gradient only lands in scratch.
+    memset(act->d_alpha_logvar, 0, sizeof(double) * channels);
+    prior_grad_kl(act->prior, act->prior_variance, act->alpha_mean, act->alpha_logvar, channels,
+                  grad_alpha, act->d_alpha_logvar, kl_scale);
     
+    // The cached state is consumed by the backward pass.
+    act->state_rows = 0;
+    act->state_cols = 0;
+}
+
+// Backward pass for the stochastic activation layer.
+Matrix* stochastic_activation_backward(void *layer, const Matrix *grad_output, const Config *cfg) {
+    StochasticActivation *act = (StochasticActivation*) layer;
+    if (!act || !grad_output) {
+        handle_error("Invalid input to stochastic_activation_backward.");
+    }
+    Matrix *grad_input = create_matrix(grad_output->rows, grad_output->cols);
+    stochastic_activation_apply_grad(act, grad_input->data, grad_output->data,
+                                     grad_output->rows, grad_output->cols, cfg);
     return grad_input;
 }
 
-// Create a new stochastic activation (stochastic PReLU).
-StochasticActivation* create_stochastic_activation(double alpha_mean, double alpha_logvar) {
+void stochastic_activation_backward_inplace(void *layer, Matrix *grad, const Config *cfg) {
+    StochasticActivation *act = (StochasticActivation*) layer;
+    if (!act || !grad) {
+        handle_error("Invalid input to stochastic_activation_backward_inplace.");
+    }
+    stochastic_activation_apply_grad(act, grad->data, grad->data, grad->rows, grad->cols, cfg);
+}
+
+// Create a new stochastic activation (stochastic PReLU) with one slope per channel.
+StochasticActivation* create_stochastic_activation(int num_channels, double alpha_mean, double alpha_logvar) {
+    if (num_channels <= 0) {
+        handle_error("StochasticActivation needs at least one channel.");
+    }
     StochasticActivation *act = (StochasticActivation*)malloc(sizeof(StochasticActivation));
     if (!act) {
         handle_error("Failed to allocate StochasticActivation.");
     }
-    act->alpha_mean = alpha_mean;
-    act->alpha_logvar = alpha_logvar;
+    act->num_channels = num_channels;
+    act->alpha_mean = (double*)malloc(sizeof(double) * num_channels);
+    act->alpha_logvar = (double*)malloc(sizeof(double) * num_channels);
+    act->alpha_sample = (double*)malloc(sizeof(double) * num_channels);
+    act->d_alpha_mean = (double*)calloc(num_channels, sizeof(double));
+    act->d_alpha_logvar = (double*)calloc(num_channels, sizeof(double));
+    if (!act->alpha_mean || !act->alpha_logvar || !act->alpha_sample || !act->d_alpha_mean ||
+        !act->d_alpha_logvar) {
+        handle_error("Failed to allocate StochasticActivation parameters.");
+    }
+    for (int c = 0; c < num_channels; c++) {
+        act->alpha_mean[c] = alpha_mean;
+        act->alpha_logvar[c] = alpha_logvar;
+        act->alpha_sample[c] = alpha_mean;
+    }
     act->prior_variance = 1.0;  // Default prior variance
     act->prior = NULL;
     act->posterior = NULL;
-    act->cached_input = NULL;
-    act->alpha_sample = 0.0;
-    act->d_alpha_mean = 0.0;
+    act->neg_bits = NULL;
+    act->neg_inputs = NULL;
+    act->num_neg = 0;
+    act->state_rows = 0;
+    act->state_cols = 0;
+    act->bits_capacity = 0;
+    act->neg_capacity = 0;
     return act;
 }
 
-// Forward pass for stochastic activation.
-Matrix* stochastic_activation_forward(StochasticActivation *act, const Matrix *input, int stochastic) {
-    if (!act || !input) {
-        handle_error("Invalid input to stochastic_activation_forward.");
+// Shared body of the forward passes. 'dst' may alias 'src'.
+// Records the sign bits and the packed negative inputs needed by the backward pass.
+static void stochastic_activation_apply(StochasticActivation *act, double *dst, const double *src,
+                                        int rows, int cols, int stochastic) {
+    int channels = act->num_channels;
+    if (cols % channels != 0) {
+        handle_error("Input width is not a multiple of the StochasticActivation channel count.");
     }
     
-    // Cache the input for the backward pass.
-    if (act->cached_input) {
-        free_matrix(act->cached_input);
+    // Draw one slope per channel and save it for use in the backward pass.
+    double *alpha = act->alpha_sample;
+    for (int c = 0; c < channels; c++) {
+        if (stochastic) {
+            if (act->posterior != NULL) {
+                // Use the configured posterior method for sampling
+                alpha[c] = act->posterior->sample(act->posterior, act->alpha_mean[c], act->alpha_logvar[c]);
+            } else {
+                // Fall back to standard reparameterization trick
+                alpha[c] = sample_gaussian(act->alpha_mean[c], act->alpha_logvar[c]);
+            }
+        } else {
+            alpha[c] = act->alpha_mean[c];
+        }
     }
-    act->cached_input = copy_matrix(input);
     
-    Matrix *output = create_matrix(input->rows, input->cols);
-    double alpha;
+    int total_elements = rows * cols;
+    int words = (total_elements + 63) / 64;
+    if (words > act->bits_capacity) {
+        free(act->neg_bits);
+        act->neg_bits = (uint64_t*)malloc(sizeof(uint64_t) * words);
+        if (!act->neg_bits) {
+            handle_error("Failed to allocate StochasticActivation sign bits.");
+        }
+        act->bits_capacity = words;
+    }
     
-    if (stochastic) {
-        if (act->posterior != NULL) {
-            // Use the configured posterior method for sampling
-            alpha = act->posterior->sample(act->posterior, act->alpha_mean, act->alpha_logvar);
-        } else {
-            // Fall back to standard reparameterization trick
-            alpha = sample_gaussian(act->alpha_mean, act->alpha_logvar);
+    // First pass: sign bits and the number of negative inputs.
+    int num_neg = 0;
+    for (int w = 0; w < words; w++) {
+        int base = w * 64;
+        int count = (total_elements - base < 64) ? total_elements - base : 64;
+        uint64_t word = 0;
+        for (int j = 0; j < count; j++) {
+            word |= (uint64_t) (src[base + j] < 0) << j;
         }
-    } else {
-        alpha = act->alpha_mean;
+        act->neg_bits[w] = word;
+        num_neg += __builtin_popcountll(word);
+    }
+    if (num_neg > act->neg_capacity) {
+        free(act->neg_inputs);
+        act->neg_inputs = (double*)malloc(sizeof(double) * num_neg);
+        if (!act->neg_inputs) {
+            handle_error("Failed to allocate StochasticActivation negative inputs.");
+        }
+        act->neg_capacity = num_neg;
     }
     
-    // Save the sampled alpha for use in the backward pass.
-    act->alpha_sample = alpha;
+    // Second pass: pack the negative inputs in element order.
+    int k = 0;
+    for (int w = 0; w < words; w++) {
+        uint64_t word = act->neg_bits[w];
+        while (word) {
+            act->neg_inputs[k++] = src[w * 64 + __builtin_ctzll(word)];
+            word &= word - 1;
+        }
+    }
     
-    int total_elements = input->rows * input->cols;
-    for (int i = 0; i < total_elements; i++) {
-        double x = input->data[i];
-        output->data[i] = (x >= 0) ? x : alpha * x;
+    // Third pass: write the output (possibly over the input). The channel loop is branch-free.
+    PixelTask task = { dst, src, alpha, act->neg_bits, channels };
+    parallel_for(total_elements / channels, parallel_grain(2L * channels), output_pixels, &task);
+    act->num_neg = num_neg;
+    act->state_rows = rows;
+    act->state_cols = cols;
+}
+
+// Forward pass for stochastic activation.
+Matrix* stochastic_activation_forward(StochasticActivation *act, const Matrix *input, int stochastic) {
+    if (!act || !input) {
+        handle_error("Invalid input to stochastic_activation_forward.");
     }
+    Matrix *output = create_matrix(input->rows, input->cols);
+    stochastic_activation_apply(act, output->data, input->data, input->rows, input->cols, stochastic);
     return output;
 }
 
-// Compute the KL divergence for the stochastic activation parameters.
+void stochastic_activation_forward_inplace(StochasticActivation *act, Matrix *data, int stochastic) {
+    if (!act || !data) {
+        handle_error("Invalid input to stochastic_activation_forward_inplace.");
+    }
+    stochastic_activation_apply(act, data->data, data->data, data->rows, data->cols, stochastic);
+}
+
+// Compute the KL divergence for the stochastic activation parameters, summed over channels.
 double stochastic_activation_kl(StochasticActivation *act) {
     if (!act) {
         handle_error("Invalid StochasticActivation in KL computation.");
     }
-    if (act->prior == NULL) {
-        // Use the configured prior variance instead of hardcoded 1.0
-        return kl_divergence_single(act->alpha_mean, act->alpha_logvar, act->prior_variance);
-    } else {
-        return act->prior->compute_kl(act->prior, act->alpha_mean, act->alpha_logvar);
+    // Without a Prior, use the configured prior variance instead of hardcoded 1.0
+    return prior_kl_sum(act->prior, act->prior_variance, act->alpha_mean, act->alpha_logvar, act->num_channels,
+                        NULL, NULL, 0.0);
+}
+
+// Per-call state sharing the slope parameters and prior of 'params'.
+StochasticActivation* stochastic_activation_create_context(const StochasticActivation *params) {
+    StochasticActivation *ctx = (StochasticActivation*)malloc(sizeof(StochasticActivation));
+    if (!ctx) {
+        handle_error("Failed to allocate StochasticActivation context.");
+    }
+    *ctx = *params;
+    ctx->alpha_sample = (double*)calloc(params->num_channels, sizeof(double));
+    ctx->d_alpha_logvar = (double*)calloc(params->num_channels, sizeof(double));
+    if (!ctx->alpha_sample || !ctx->d_alpha_logvar) {
+        handle_error("Failed to allocate StochasticActivation context.");
+    }
+    ctx->d_alpha_mean = NULL;
+    ctx->neg_bits = NULL;
+    ctx->neg_inputs = NULL;
+    ctx->num_neg = 0;
+    ctx->state_rows = ctx->state_cols = 0;
+    ctx->bits_capacity = ctx->neg_capacity = 0;
+    return ctx;
+}
+
+void free_stochastic_activation_context(StochasticActivation *ctx) {
+    if (ctx) {
+        free(ctx->alpha_sample);
+        free(ctx->d_alpha_logvar);
+        free(ctx->neg_bits);
+        free(ctx->neg_inputs);
+        free(ctx);
     }
 }
 
 // Free the stochastic activation.
 void free_stochastic_activation(StochasticActivation *act) {
     if (act) {
-        if (act->cached_input) {
-            free_matrix(act->cached_input);
-        }
+        free(act->alpha_mean);
+        free(act->alpha_logvar);
+        free(act->alpha_sample);
+        free(act->d_alpha_mean);
+        free(act->d_alpha_logvar);
+        free(act->neg_bits);
+        free(act->neg_inputs);
         // Free the prior and posterior if they exist
         if (act->prior) {
             if (act->prior->data) {
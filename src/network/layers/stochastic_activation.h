@@ -5,42 +5,68 @@
 #include "../priors/prior.h"      // For the common Prior interface
 #include "../posteriors/posterior.h"  // For the common Posterior interface
 #include "../config/config.h"
+#include <stdint.h>
 
 // Structure representing a stochastic activation function (e.g., stochastic PReLU).
 // In this example, we implement a stochastic PReLU where the negative slope is random.
-// In stochastic_activation.h, add these fields:
+// Each channel (each feature, for plain vectors) has its own slope. Activations are NHWC,
+// so element i of a row belongs to channel i % num_channels.
 typedef struct {
-    double alpha_mean;    // Mean value of the negative slope parameter.
-    double alpha_logvar;  // Log variance of the negative slope parameter.
+    int num_channels;     // Number of independent slopes.
+    double *alpha_mean;   // Mean value of the negative slope parameter, per channel.
+    double *alpha_logvar; // Log variance of the negative slope parameter, per channel.
     double prior_variance; // Prior variance for KL divergence computation
     Prior *prior;         // Pointer to Prior interface.
     Posterior *posterior; // Pointer to Posterior interface.
     // --- Added for backward pass ---
-    Matrix *cached_input; // Stores the input passed to forward().
-    double alpha_sample;  // The value of alpha used during the forward pass.
-    double d_alpha_mean;  // Accumulator for the gradient w.r.t. alpha_mean.
-    // Optionally, you might add a d_alpha_logvar if you wish to update log-variance.
+    double *alpha_sample; // The values of alpha used during the forward pass, per channel.
+    double *d_alpha_mean; // Accumulator for the gradient w.r.t. alpha_mean, per channel.
+    double *d_alpha_logvar; // KL gradient w.r.t. alpha_logvar, per channel (scratch: not learned).
+    // Compact state from the most recent forward pass. The backward pass needs the sign of
+    // each input and, for the alpha gradient, the value of the negative ones only.
+    uint64_t *neg_bits;   // One bit per element, set where the input was negative.
+    double *neg_inputs;   // The negative inputs, packed in element order.
+    int num_neg;          // Number of entries used in neg_inputs.
+    int state_rows;       // Shape of the cached state (0 when there is none).
+    int state_cols;
+    int bits_capacity;    // Allocated words in neg_bits.
+    int neg_capacity;     // Allocated entries in neg_inputs.
 } StochasticActivation;
 
 
-// Create a new stochastic activation (stochastic PReLU) with given parameters.
-StochasticActivation* create_stochastic_activation(double alpha_mean, double alpha_logvar);
+// Create a new stochastic activation (stochastic PReLU) with 'num_channels' slopes,
+// all initialized to the given mean and log variance.
+StochasticActivation* create_stochastic_activation(int num_channels, double alpha_mean, double alpha_logvar);
 
 // Free the memory allocated for a stochastic activation function.
 void free_stochastic_activation(StochasticActivation *act);
 
+// Per-call state for running the layer from several threads (see exec_context.h): shares the
+// slopes' parameters and prior, owns the sampled slopes, sign state and d_alpha_logvar; d_alpha_mean is left
+// NULL for the caller to point at its own storage.
+StochasticActivation* stochastic_activation_create_context(const StochasticActivation *params);
+void free_stochastic_activation_context(StochasticActivation *ctx);
+
 // Forward pass for the stochastic activation function applied element-wise to a matrix.
-// For each element x:
+// For each element x in channel c:
 //    if x >= 0, output = x;
-//    if x < 0, output = alpha * x, where alpha is sampled using the reparameterization trick if stochastic is nonzero,
-//    otherwise, alpha = alpha_mean.
+//    if x < 0, output = alpha[c] * x, where alpha[c] is sampled using the reparameterization trick if
+//    stochastic is nonzero, otherwise, alpha[c] = alpha_mean[c].
 // If a Posterior object is provided, its sample() function is used for sampling.
+// The number of columns must be a multiple of num_channels.
 Matrix* stochastic_activation_forward(StochasticActivation *act, const Matrix *input, int stochastic);
 
 // Compute the KL divergence for the stochastic activation parameters using the Prior interface.
-// If a Prior is set, it uses its compute_kl() function; otherwise, it falls back to a default Gaussian KL divergence.
+// The slopes are summed over channels in one prior_kl_sum() call: the Prior's per-tensor kernel
+// when a Prior is set, otherwise a Gaussian KL with variance prior_variance.
 double stochastic_activation_kl(StochasticActivation *act);
 
+// Backward pass: returns the gradient w.r.t. the input and stores the per-channel alpha gradient
+// (data term plus KL contribution) in d_alpha_mean.
 Matrix* stochastic_activation_backward(void *layer, const Matrix *grad_output, const Config *cfg);
 
+// In-place variants: overwrite 'data' / 'grad' with the result instead of allocating a new Matrix.
+void stochastic_activation_forward_inplace(StochasticActivation *act, Matrix *data, int stochastic);
+void stochastic_activation_backward_inplace(void *layer, Matrix *grad, const Config *cfg);
+
 #endif // STOCHASTIC_ACTIVATION_H
@@ -0,0 +1,76 @@
+#include "mc_inference.h"
+#include "../utils/utils.h"          // For handle_error().
+#include "../utils/random_utils.h"
+#include <stdlib.h>
+
+// Each worker builds its context on its own thread, so its buffers are first touched there and
+// the caller's generator is left alone.
+static void create_context(void *arg, int worker) {
+    MCInference *mc = (MCInference*)arg;
+    mc->contexts[worker] = exec_context_create(mc->net);
+}
+
+static void free_context(void *arg, int worker) {
+    MCInference *mc = (MCInference*)arg;
+    exec_context_free(mc->contexts[worker]);
+}
+
+static void predict_chunks(void *arg, int worker) {
+    MCInference *mc = (MCInference*)arg;
+    ExecContext *ctx = mc->contexts[worker];
+    int batch = mc->input->rows, cols = mc->output->cols;
+    int num_chunks = (mc->num_samples + MC_INFERENCE_CHUNK - 1) / MC_INFERENCE_CHUNK;
+    for (;;) {
+        int chunk = __atomic_fetch_add(&mc->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= num_chunks) {
+            break;
+        }
+        int first = chunk * MC_INFERENCE_CHUNK;
+        int count = (mc->num_samples - first < MC_INFERENCE_CHUNK) ? mc->num_samples - first : MC_INFERENCE_CHUNK;
+        Matrix block = { count * batch, cols, mc->output->data + (size_t) first * batch * cols, NULL, 0 };
+        exec_context_seed(ctx, mc->seed, (uint64_t) chunk);
+        exec_forward_mc(ctx, mc->input, count, &block);
+    }
+}
+
+MCInference* mc_inference_create(Network *net, int num_threads) {
+    if (!net) {
+        handle_error("Null network in mc_inference_create.");
+    }
+    MCInference *mc = (MCInference*)malloc(sizeof(MCInference));
+    if (!mc) {
+        handle_error("Failed to allocate MC inference.");
+    }
+    mc->net = net;
+    mc->pool = thread_pool_create(num_threads);
+    mc->contexts = (ExecContext**)calloc(mc->pool->num_threads, sizeof(ExecContext*));
+    if (!mc->contexts) {
+        handle_error("Failed to allocate MC inference contexts.");
+    }
+    network_refresh_caches(net);
+    thread_pool_run(mc->pool, create_context, mc);
+    return mc;
+}
+
+void mc_inference_predict(MCInference *mc, const Matrix *input, int num_samples, Matrix *out) {
+    if (!mc || !input || !out || num_samples < 1 || out->rows != num_samples * input->rows) {
+        handle_error("Invalid arguments in mc_inference_predict.");
+    }
+    network_refresh_caches(mc->net);
+    mc->input = input;
+    mc->output = out;
+    mc->num_samples = num_samples;
+    mc->seed = random_u64();
+    mc->next_chunk = 0;
+    thread_pool_run(mc->pool, predict_chunks, mc);
+}
+
+void mc_inference_free(MCInference *mc) {
+    if (!mc) {
+        return;
+    }
+    thread_pool_run(mc->pool, free_context, mc);
+    thread_pool_free(mc->pool);
+    free(mc->contexts);
+    free(mc);
+}
@@ -0,0 +1,44 @@
+#ifndef MC_INFERENCE_H
+#define MC_INFERENCE_H
+
+#include <stdint.h>
+#include "network.h"
+#include "exec_context.h"
+#include "../utils/thread_pool.h"
+
+// Multithreaded Monte Carlo prediction. The draws of a request are split into chunks of
+// MC_INFERENCE_CHUNK, which the workers of a thread pool take in turn. Every worker runs the
+// network through its own ExecContext, so the weights are stored once however many workers
+// there are.
+//
+// Chunk c draws from random stream c of a seed taken from the caller's generator, see
+// random_seed_stream(). The output therefore depends only on that seed, not on the number of
+// threads or on which worker ran which chunk.
+
+// Draws evaluated together by network_forward_mc() in one task.
+#define MC_INFERENCE_CHUNK 4
+
+typedef struct MCInference {
+    ThreadPool *pool;
+    ExecContext **contexts;    // One per worker
+    Network *net;              // The network the contexts run
+    // The request being served
+    const Matrix *input;
+    Matrix *output;
+    int num_samples;
+    uint64_t seed;
+    int next_chunk;            // Next chunk to hand out, taken atomically
+} MCInference;
+
+// Start num_threads workers (one per online CPU when num_threads <= 0), each with a context
+// of 'net'.
+MCInference* mc_inference_create(Network *net, int num_threads);
+
+// Evaluate 'input' (B rows) under num_samples posterior draws of the network. 'out' is
+// (num_samples * B) x output_dim with the rows of draw s at s * B, as in network_forward_mc().
+// The network's parameters are only read, and may change between calls.
+void mc_inference_predict(MCInference *mc, const Matrix *input, int num_samples, Matrix *out);
+
+void mc_inference_free(MCInference *mc);
+
+#endif // MC_INFERENCE_H
@@ -0,0 +1,193 @@
+#include "micro_batcher.h"
+#include "../utils/utils.h"          // For handle_error().
+#include "../utils/random_utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Weight of the latest batch in the service time estimate.
+#define SERVICE_SMOOTHING 0.2
+
+typedef struct {
+    MicroBatcher *batcher;
+    uint64_t seed;
+} BatcherStart;
+
+static long elapsed_us(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000L + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+static struct timespec add_us(struct timespec t, long us) {
+    t.tv_sec += us / 1000000L;
+    t.tv_nsec += (us % 1000000L) * 1000;
+    if (t.tv_nsec >= 1000000000L) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000L;
+    } else if (t.tv_nsec < 0) {
+        t.tv_sec--;
+        t.tv_nsec += 1000000000L;
+    }
+    return t;
+}
+
+// Evaluate 'count' requests and complete them: per output, the mean and the (biased) variance
+// over the draws, as in tests/regression_test.c.
+static void run_batch(MicroBatcher *batcher, ServeRequest **batch, int count) {
+    int in = batcher->input_dim, out = batcher->output_dim, S = batcher->num_samples;
+    Matrix input = { count, in, batcher->input->data, NULL, 0 };
+    Matrix draws = { S * count, out, batcher->draws->data, NULL, 0 };
+    for (int r = 0; r < count; r++) {
+        memcpy(input.data + (size_t) r * in, batch[r]->input, sizeof(double) * in);
+    }
+    mc_inference_predict(batcher->mc, &input, S, &draws);
+    for (int r = 0; r < count; r++) {
+        ServeRequest *req = batch[r];
+        for (int j = 0; j < out; j++) {
+            double sum = 0.0;
+            for (int s = 0; s < S; s++) {
+                sum += draws.data[((size_t) s * count + r) * out + j];
+            }
+            double mean = sum / S, sq_sum = 0.0;
+            for (int s = 0; s < S; s++) {
+                double diff = draws.data[((size_t) s * count + r) * out + j] - mean;
+                sq_sum += diff * diff;
+            }
+            req->mean[j] = mean;
+            req->variance[j] = sq_sum / S;
+        }
+    }
+    // complete() may free the request, so the links are not touched afterwards.
+    for (int r = 0; r < count; r++) {
+        batch[r]->complete(batch[r]);
+    }
+}
+
+static void* batcher_main(void *p) {
+    BatcherStart start = *(BatcherStart*)p;
+    free(p);
+    MicroBatcher *batcher = start.batcher;
+    random_seed_stream(start.seed, 0);
+    ServeRequest **batch = (ServeRequest**)malloc(sizeof(ServeRequest*) * batcher->max_batch);
+    if (!batch) {
+        handle_error("Failed to allocate micro-batch.");
+    }
+    pthread_mutex_lock(&batcher->lock);
+    for (;;) {
+        while (!batcher->head && !batcher->shutdown) {
+            pthread_cond_wait(&batcher->arrived, &batcher->lock);
+        }
+        if (!batcher->head) {
+            break;
+        }
+        // Wait for more requests until the batch is full or its oldest request must leave.
+        while (batcher->queued < batcher->max_batch && !batcher->shutdown) {
+            long wait_us = batcher->max_latency_us - (long) batcher->service_us;
+            struct timespec deadline = add_us(batcher->head->arrival, wait_us > 0 ? wait_us : 0), now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (elapsed_us(&now, &deadline) <= 0 ||
+                pthread_cond_timedwait(&batcher->arrived, &batcher->lock, &deadline) != 0) {
+                break;
+            }
+        }
+        int count = 0;
+        while (batcher->head && count < batcher->max_batch) {
+            batch[count++] = batcher->head;
+            batcher->head = batcher->head->next;
+        }
+        if (!batcher->head) {
+            batcher->tail = NULL;
+        }
+        batcher->queued -= count;
+        pthread_mutex_unlock(&batcher->lock);
+
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        run_batch(batcher, batch, count);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        pthread_mutex_lock(&batcher->lock);
+        double took = (double) elapsed_us(&begin, &end);
+        batcher->service_us = (batcher->batches == 0) ? took :
+                              (1.0 - SERVICE_SMOOTHING) * batcher->service_us + SERVICE_SMOOTHING * took;
+        batcher->batches++;
+        batcher->requests += count;
+    }
+    pthread_mutex_unlock(&batcher->lock);
+    free(batch);
+    return NULL;
+}
+
+MicroBatcher* micro_batcher_create(Network *net, int num_samples, int max_batch, long max_latency_us,
+                                   int num_threads) {
+    if (!net || num_samples < 1 || max_batch < 1 || max_latency_us < 0) {
+        handle_error("Invalid arguments in micro_batcher_create.");
+    }
+    MicroBatcher *batcher = (MicroBatcher*)malloc(sizeof(MicroBatcher));
+    BatcherStart *start = (BatcherStart*)malloc(sizeof(BatcherStart));
+    if (!batcher || !start) {
+        handle_error("Failed to allocate micro-batcher.");
+    }
+    const ActivationShape *in = &net->shapes[0], *out = &net->shapes[net->num_layers];
+    batcher->net = net;
+    batcher->mc = mc_inference_create(net, num_threads);
+    batcher->input_dim = in->channels * in->height * in->width;
+    batcher->output_dim = out->channels * out->height * out->width;
+    batcher->num_samples = num_samples;
+    batcher->max_batch = max_batch;
+    batcher->max_latency_us = max_latency_us;
+    batcher->service_us = 0.0;
+    batcher->head = batcher->tail = NULL;
+    batcher->queued = 0;
+    batcher->shutdown = 0;
+    batcher->batches = 0;
+    batcher->requests = 0;
+    batcher->input = create_matrix(max_batch, batcher->input_dim);
+    batcher->draws = create_matrix(num_samples * max_batch, batcher->output_dim);
+    // The deadlines are on the monotonic clock.
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&batcher->arrived, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&batcher->lock, NULL);
+    start->batcher = batcher;
+    start->seed = random_u64();
+    if (pthread_create(&batcher->thread, NULL, batcher_main, start) != 0) {
+        handle_error("Failed to start micro-batcher thread.");
+    }
+    return batcher;
+}
+
+void micro_batcher_submit(MicroBatcher *batcher, ServeRequest *req) {
+    clock_gettime(CLOCK_MONOTONIC, &req->arrival);
+    req->next = NULL;
+    pthread_mutex_lock(&batcher->lock);
+    if (batcher->tail) {
+        batcher->tail->next = req;
+    } else {
+        batcher->head = req;
+    }
+    batcher->tail = req;
+    batcher->queued++;
+    // The batcher only needs waking for the first request of a batch or the one that fills it.
+    if (batcher->queued == 1 || batcher->queued >= batcher->max_batch) {
+        pthread_cond_signal(&batcher->arrived);
+    }
+    pthread_mutex_unlock(&batcher->lock);
+}
+
+void micro_batcher_free(MicroBatcher *batcher) {
+    if (!batcher) {
+        return;
+    }
+    pthread_mutex_lock(&batcher->lock);
+    batcher->shutdown = 1;
+    pthread_cond_signal(&batcher->arrived);
+    pthread_mutex_unlock(&batcher->lock);
+    pthread_join(batcher->thread, NULL);
+    mc_inference_free(batcher->mc);
+    free_matrix(batcher->input);
+    free_matrix(batcher->draws);
+    pthread_mutex_destroy(&batcher->lock);
+    pthread_cond_destroy(&batcher->arrived);
+    free(batcher);
+}
@@ -0,0 +1,68 @@
+#ifndef MICRO_BATCHER_H
+#define MICRO_BATCHER_H
+
+#include <pthread.h>
+#include <time.h>
+#include "network.h"
+#include "mc_inference.h"
+
+// Dynamic micro-batching of single-example prediction requests, the core of bnn_serve.
+// Submitted requests wait in a queue; one batcher thread takes up to max_batch of them at a
+// time, evaluates them together under num_samples posterior draws (mc_inference_predict(), so
+// the draws are split over the inference workers) and completes each with the predictive mean
+// and variance of every output.
+//
+// A batch is dispatched as soon as it is full, or when waiting any longer would make its oldest
+// request miss the latency budget: the budget minus an estimate of how long the batch will take
+// to evaluate (an exponential average of recent batches). Under light load requests therefore
+// go out almost alone, and under heavy load the batches grow and amortize the weight draws.
+
+typedef struct ServeRequest {
+    double *input;                 // input_dim values, owned by the submitter
+    double *mean;                  // output_dim values each, filled before complete() is called
+    double *variance;
+    // Called on the batcher thread once mean and variance are filled. The request is no longer
+    // used by the batcher afterwards.
+    void (*complete)(struct ServeRequest *req);
+    void *user;                    // For complete()
+    struct timespec arrival;       // Set by micro_batcher_submit()
+    struct ServeRequest *next;     // Queue link
+} ServeRequest;
+
+typedef struct MicroBatcher {
+    Network *net;
+    MCInference *mc;
+    int input_dim;
+    int output_dim;
+    int num_samples;               // Posterior draws per request
+    int max_batch;
+    long max_latency_us;
+    double service_us;             // Running estimate of a batch's evaluation time
+    // Queue of pending requests, guarded by 'lock'
+    pthread_mutex_t lock;
+    pthread_cond_t arrived;        // Signalled on submit and on shutdown
+    ServeRequest *head;
+    ServeRequest *tail;
+    int queued;
+    int shutdown;
+    pthread_t thread;
+    // Batch buffers, max_batch rows
+    Matrix *input;
+    Matrix *draws;
+    // Statistics, guarded by 'lock'
+    long batches;
+    long requests;
+} MicroBatcher;
+
+// Start a batcher for 'net' with num_threads inference workers (one per online CPU when
+// num_threads <= 0). The network's parameters must not change while the batcher runs.
+MicroBatcher* micro_batcher_create(Network *net, int num_samples, int max_batch, long max_latency_us,
+                                   int num_threads);
+
+// Queue a request. Thread-safe. req->complete() runs later on the batcher thread.
+void micro_batcher_submit(MicroBatcher *batcher, ServeRequest *req);
+
+// Complete every queued request, then stop the batcher and free it.
+void micro_batcher_free(MicroBatcher *batcher);
+
+#endif // MICRO_BATCHER_H
@@ -1,6 +1,7 @@
 #include "network.h"
 #include "../config/config.h"
 #include "../utils/utils.h"
+#include "../utils/thread_pool.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -8,16 +9,21 @@
 // Include layer headers.
 #include "layers/bayesian_linear.h"
 #include "layers/bayesian_conv.h"
+#include "layers/bayesian_dwconv.h"
 #include "layers/dropout_layer.h"
 #include "layers/stochastic_activation.h"
+#include "layers/pooling_layer.h"
+#include "layers/noise_injection.h"
 
 // Include Prior and Posterior creation functions.
 #include "priors/prior_laplace.h"
 #include "priors/prior_mixture.h"
+#include "priors/prior_gaussian.h"
 #include "posteriors/posterior_flipout.h"
 #include "posteriors/posterior_structured.h"
 
 #include "../optimizer/optimizer.h"
+#include "network_plan.h"
 
 // ==================
 // Helper Functions for Layer Wrappers
@@ -27,61 +33,88 @@ static double linear_kl_wrapper(void *layer_ptr) {
 }
 static Layer* create_linear_layer(BayesianLinear *bl, const Config *cfg) {
     Layer *l = (Layer*)malloc(sizeof(Layer));
+    bl->kl_estimator = cfg->kl_estimator;
+    if (cfg->mc_perturbation_rank > 0) {
+        bayesian_linear_set_mc_rank(bl, cfg->mc_perturbation_rank);
+    }
     l->layer = (void*)bl;
     l->type = LAYER_BAYESIAN_LINEAR;
+    l->optimizer_state = NULL;
     l->forward = (Matrix* (*)(void*, const Matrix*, int)) bayesian_linear_forward;
     l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) bayesian_linear_backward;
+    l->forward_inplace = NULL;
+    l->forward_mc = (Matrix* (*)(void*, const Matrix*, int, int)) bayesian_linear_forward_mc;
+    l->backward_inplace = NULL;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = (cfg->kl_estimator == 1);
     l->kl = linear_kl_wrapper;
     l->free_layer = (void (*)(void*)) free_bayesian_linear;
+    l->create_context = (void* (*)(const void*)) bayesian_linear_create_context;
+    l->free_context = (void (*)(void*)) free_bayesian_linear_context;
     return l;
 }
 
-static Matrix* conv_forward_wrapper(void *layer, const Matrix *input, int stochastic) {
-    // Cast the layer pointer to BayesianConv.
-    BayesianConv *bc = (BayesianConv*) layer;
-    
-    // Infer the Tensor shape from the input Matrix.
-    // Assume that the input Matrix has dimensions: [batch_size x flat_dim],
-    // where flat_dim = input_channels * (height * width).
-    int channels = bc->input_channels;
-    int flat = input->cols;
-    int spatial = flat / channels;
-    int side = (int) sqrt((double) spatial);
-    if (side * side * channels != flat) {
-        handle_error("Cannot infer Tensor shape for conv layer from Matrix input.");
-    }
-    
-    // Convert the Matrix to a Tensor.
-    Tensor *tensor_input = matrix_to_tensor(input, channels, side, side);
-    
-    // Call the actual convolution forward function.
-    Matrix *output = bayesian_conv_forward(bc, tensor_input, stochastic);
-    
-    // Free the temporary Tensor.
-    free_tensor(tensor_input);
-    
-    return output;
-}
-
 static double conv_kl_wrapper(void *layer_ptr) {
     return bayesian_conv_kl((BayesianConv*)layer_ptr);
 }
-static Layer* create_conv_layer(BayesianConv *bc) {
+static Layer* create_conv_layer(BayesianConv *bc, const Config *cfg) {
     Layer *l = (Layer*)malloc(sizeof(Layer));
     if (!l) {
         handle_error("Failed to allocate Layer for BayesianConv.");
     }
+    bc->kl_estimator = cfg->kl_estimator;
     l->layer = (void*)bc;
     l->type = LAYER_BAYESIAN_CONV;
-    // Use conv_forward_wrapper to convert Matrix to Tensor before calling bayesian_conv_forward.
-    l->forward = conv_forward_wrapper;
+    l->optimizer_state = NULL;
+    l->forward = (Matrix* (*)(void*, const Matrix*, int)) bayesian_conv_forward;
+    l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) bayesian_conv_backward;
+    l->forward_inplace = NULL;
+    l->forward_mc = NULL;
+    l->backward_inplace = NULL;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = (cfg->kl_estimator == 1);
     l->kl = conv_kl_wrapper;
     l->free_layer = (void (*)(void*)) free_bayesian_conv;
+    l->create_context = (void* (*)(const void*)) bayesian_conv_create_context;
+    l->free_context = (void (*)(void*)) free_bayesian_conv_context;
     return l;
 }
 
 
-
+static double dwconv_kl_wrapper(void *layer_ptr) {
+    return bayesian_dwconv_kl((BayesianDWConv*)layer_ptr);
+}
+static Layer* create_dwconv_layer(BayesianDWConv *dc, const Config *cfg) {
+    Layer *l = (Layer*)malloc(sizeof(Layer));
+    if (!l) {
+        handle_error("Failed to allocate Layer for BayesianDWConv.");
+    }
+    dc->kl_estimator = cfg->kl_estimator;
+    l->layer = (void*)dc;
+    l->type = LAYER_BAYESIAN_DWCONV;
+    l->optimizer_state = NULL;
+    l->forward = (Matrix* (*)(void*, const Matrix*, int)) bayesian_dwconv_forward;
+    l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) bayesian_dwconv_backward;
+    l->forward_inplace = NULL;
+    l->forward_mc = NULL;
+    l->backward_inplace = NULL;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = (cfg->kl_estimator == 1);
+    l->kl = dwconv_kl_wrapper;
+    l->free_layer = (void (*)(void*)) free_bayesian_dwconv;
+    l->create_context = (void* (*)(const void*)) bayesian_dwconv_create_context;
+    l->free_context = (void (*)(void*)) free_bayesian_dwconv_context;
+    return l;
+}
 
 static double dropout_kl_wrapper(void *layer_ptr) {
     return 0.0;
@@ -93,10 +126,21 @@ static Layer* create_dropout_layer_wrapper(DropoutLayer *dl) {
     }
     l->layer = (void*)dl;
     l->type = LAYER_DROPOUT;
+    l->optimizer_state = NULL;
     l->forward = (Matrix* (*)(void*, const Matrix*, int)) dropout_forward;
     l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) dropout_backward;
+    l->forward_inplace = (void (*)(void*, Matrix*, int)) dropout_forward_inplace;
+    l->forward_mc = NULL;
+    l->backward_inplace = (void (*)(void*, Matrix*, const Config*)) dropout_backward_inplace;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = 0;
     l->kl = dropout_kl_wrapper;
     l->free_layer = (void (*)(void*)) free_dropout_layer;
+    l->create_context = (void* (*)(const void*)) dropout_create_context;
+    l->free_context = (void (*)(void*)) free_dropout_layer;
     return l;
 }
 
@@ -112,18 +156,89 @@ static Layer* create_stochastic_act_layer_wrapper(StochasticActivation *sa) {
     }
     l->layer = (void*)sa;
     l->type = LAYER_STOCHASTIC_ACTIVATION;
+    l->optimizer_state = NULL;
     l->forward = (Matrix* (*)(void*, const Matrix*, int)) stochastic_activation_forward;
     l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) stochastic_activation_backward;
+    l->forward_inplace = (void (*)(void*, Matrix*, int)) stochastic_activation_forward_inplace;
+    l->forward_mc = NULL;
+    l->backward_inplace = (void (*)(void*, Matrix*, const Config*)) stochastic_activation_backward_inplace;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = 0;
     l->kl = stochastic_act_kl_wrapper;
     l->free_layer = (void (*)(void*)) free_stochastic_activation;
+    l->create_context = (void* (*)(const void*)) stochastic_activation_create_context;
+    l->free_context = (void (*)(void*)) free_stochastic_activation_context;
     return l;
 }
 
+static double pooling_kl_wrapper(void *layer_ptr) {
+    return 0.0;
+}
+static Layer* create_pooling_layer_wrapper(PoolingLayer *pl) {
+    Layer *l = (Layer*)malloc(sizeof(Layer));
+    if (!l) {
+        handle_error("Failed to allocate Layer for PoolingLayer.");
+    }
+    l->layer = (void*)pl;
+    l->type = LAYER_POOLING;
+    l->optimizer_state = NULL;
+    l->forward = (Matrix* (*)(void*, const Matrix*, int)) pooling_forward;
+    l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) pooling_backward;
+    l->forward_inplace = NULL;
+    l->forward_mc = NULL;
+    l->backward_inplace = NULL;
+    l->passthrough = 0;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = 0;
+    l->kl = pooling_kl_wrapper;
+    l->free_layer = (void (*)(void*)) free_pooling_layer;
+    l->create_context = (void* (*)(const void*)) pooling_create_context;
+    l->free_context = (void (*)(void*)) free_pooling_layer;
+    return l;
+}
 
-
+static double noise_kl_wrapper(void *layer_ptr) {
+    return 0.0;
+}
+// Noise injection has no per-call state; a context gets a copy of the settings.
+static void* noise_create_context(const void *layer_ptr) {
+    const NoiseInjection *ni = (const NoiseInjection*)layer_ptr;
+    return create_noise_injection(ni->type, ni->mean, ni->stddev);
+}
+static Layer* create_noise_layer_wrapper(NoiseInjection *ni) {
+    Layer *l = (Layer*)malloc(sizeof(Layer));
+    if (!l) {
+        handle_error("Failed to allocate Layer for NoiseInjection.");
+    }
+    l->layer = (void*)ni;
+    l->type = LAYER_NOISE;
+    l->optimizer_state = NULL;
+    l->forward = (Matrix* (*)(void*, const Matrix*, int)) noise_injection_forward;
+    l->backward = (Matrix* (*)(void*, const Matrix*, const Config*)) noise_injection_backward;
+    l->forward_inplace = (void (*)(void*, Matrix*, int)) noise_injection_forward_inplace;
+    l->forward_mc = NULL;
+    l->backward_inplace = (void (*)(void*, Matrix*, const Config*)) noise_injection_backward_inplace;
+    l->passthrough = 1;
+    l->frozen = 0;
+    l->kl_dirty = 1;
+    l->kl_cache = 0.0;
+    l->kl_per_sample = 0;
+    l->kl = noise_kl_wrapper;
+    l->free_layer = (void (*)(void*)) free_noise_injection;
+    l->create_context = noise_create_context;
+    l->free_context = (void (*)(void*)) free_noise_injection;
+    return l;
+}
 
 Matrix* network_backward(Network *net, const Matrix *grad_output, const Config *cfg) {
     Matrix *grad = (Matrix*)grad_output;
+    // Gradients are drawn from the same arena as the activations of the forward pass.
+    MatrixArena *previous_arena = matrix_arena_activate(net->activations);
     //printf("net->num_layers: %d", net->num_layers);
     fflush(stdout);
     for (int i = net->num_layers - 1; i >= 0; i--) {
@@ -143,14 +258,27 @@ Matrix* network_backward(Network *net, const Matrix *grad_output, const Config *
 
         fflush(stdout);
 
+        if (net->layers[i]->passthrough) {
+            continue;
+        }
+        // Intermediate gradients belong to the network, so elementwise layers may overwrite them.
+        if (net->layers[i]->backward_inplace && grad != grad_output) {
+            net->layers[i]->backward_inplace(net->layers[i]->layer, grad, cfg);
+            continue;
+        }
         Matrix *new_grad = net->layers[i]->backward(net->layers[i]->layer, grad, cfg);
        // printf("matrix pointer: %p", new_grad);
         fflush(stdout);
-        if (i < net->num_layers - 1) {
+        if (grad != grad_output) {
             free_matrix(grad); // free the old gradient
         }
         grad = new_grad;
     }
+    if (grad == grad_output) {
+        // Every layer was skipped; the caller owns grad_output, so return a copy.
+        grad = copy_matrix(grad_output);
+    }
+    matrix_arena_activate(previous_arena);
     return grad; // gradient w.r.t. the original input, if needed
 }
 
@@ -167,6 +295,96 @@ static Layer* create_projection_layer(int input_dim, int target_dim, const Confi
     return create_linear_layer(proj, cfg);
 }
 
+// ==================
+// Parameter arena
+// ==================
+
+int network_layer_param_blocks(Layer *l, ParamBlock *means, ParamBlock *logvars, int *num_logvars) {
+    *num_logvars = 0;
+    switch (l->type) {
+        case LAYER_BAYESIAN_LINEAR: {
+            BayesianLinear *bl = (BayesianLinear*)l->layer;
+            int total_weights = bl->output_dim * bl->input_dim;
+            means[0] = (ParamBlock){ &bl->W_mean->data, &bl->dW_mean->data, total_weights };
+            means[1] = (ParamBlock){ &bl->b_mean, &bl->db_mean, bl->output_dim };
+            logvars[0] = (ParamBlock){ &bl->W_logvar->data, &bl->dW_logvar->data, total_weights };
+            logvars[1] = (ParamBlock){ &bl->b_logvar, &bl->db_logvar, bl->output_dim };
+            int n = 2;
+            if (bl->posterior_rank > 0) {
+                logvars[n++] = (ParamBlock){ &bl->W_factor, &bl->dW_factor, total_weights * bl->posterior_rank };
+            }
+            if (bl->matrix_normal) {
+                logvars[n++] = (ParamBlock){ &bl->L_row, &bl->dL_row, bl->output_dim * bl->output_dim };
+                logvars[n++] = (ParamBlock){ &bl->L_col, &bl->dL_col, bl->input_dim * bl->input_dim };
+            }
+            *num_logvars = n;
+            return 2;
+        }
+        case LAYER_BAYESIAN_CONV: {
+            BayesianConv *bc = (BayesianConv*)l->layer;
+            int total_weights = bc->output_channels * bc->input_channels * bc->kernel_height * bc->kernel_width;
+            means[0] = (ParamBlock){ &bc->W_mean, &bc->dW_mean, total_weights };
+            means[1] = (ParamBlock){ &bc->b_mean, &bc->db_mean, bc->output_channels };
+            logvars[0] = (ParamBlock){ &bc->W_logvar, &bc->dW_logvar, total_weights };
+            logvars[1] = (ParamBlock){ &bc->b_logvar, &bc->db_logvar, bc->output_channels };
+            *num_logvars = 2;
+            return 2;
+        }
+        case LAYER_BAYESIAN_DWCONV: {
+            BayesianDWConv *dc = (BayesianDWConv*)l->layer;
+            int dw_size = dc->kernel_height * dc->kernel_width * dc->input_channels;
+            int pw_size = dc->input_channels * dc->output_channels;
+            means[0] = (ParamBlock){ &dc->dw_mean, &dc->d_dw_mean, dw_size };
+            means[1] = (ParamBlock){ &dc->pw_mean, &dc->d_pw_mean, pw_size };
+            means[2] = (ParamBlock){ &dc->b_mean, &dc->db_mean, dc->output_channels };
+            logvars[0] = (ParamBlock){ &dc->dw_logvar, &dc->d_dw_logvar, dw_size };
+            logvars[1] = (ParamBlock){ &dc->pw_logvar, &dc->d_pw_logvar, pw_size };
+            logvars[2] = (ParamBlock){ &dc->b_logvar, &dc->db_logvar, dc->output_channels };
+            *num_logvars = 3;
+            return 3;
+        }
+        case LAYER_STOCHASTIC_ACTIVATION: {
+            // Only the slopes' means are learned.
+            StochasticActivation *sa = (StochasticActivation*)l->layer;
+            means[0] = (ParamBlock){ &sa->alpha_mean, &sa->d_alpha_mean, sa->num_channels };
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int block_total(const ParamBlock *blocks, int num_blocks) {
+    int total = 0;
+    for (int i = 0; i < num_blocks; i++) {
+        total += blocks[i].count;
+    }
+    return total;
+}
+
+// Move every layer's parameters into one ParamArena, in layer order.
+static void build_param_arena(Network *net) {
+    ParamBlock means[MAX_PARAM_BLOCKS], logvars[MAX_PARAM_BLOCKS];
+    int num_means = 0, num_logvars = 0;
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = net->layers[i];
+        int nl, nm = network_layer_param_blocks(l, means, logvars, &nl);
+        l->arena_mean_offset = num_means;
+        l->arena_mean_count = block_total(means, nm);
+        l->arena_logvar_offset = num_logvars;
+        l->arena_logvar_count = block_total(logvars, nl);
+        num_means += param_arena_round(l->arena_mean_count);
+        num_logvars += param_arena_round(l->arena_logvar_count);
+    }
+    net->arena = param_arena_create(num_means, num_logvars);
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = net->layers[i];
+        int nl, nm = network_layer_param_blocks(l, means, logvars, &nl);
+        param_arena_adopt(net->arena->mean, net->arena->grad_mean, l->arena_mean_offset, means, nm);
+        param_arena_adopt(net->arena->logvar, net->arena->grad_logvar, l->arena_logvar_offset, logvars, nl);
+    }
+}
+
 // ==================
 // create_network: Constructs the network from config settings.
 // ==================
@@ -174,6 +392,7 @@ Network* create_network(const Config *cfg) {
     if (!cfg) {
         handle_error("Config is NULL in create_network.");
     }
+    parallel_set_threads(cfg->threads);
     
     // Allocate the network structure.
     Network *net = (Network*)malloc(sizeof(Network));
@@ -221,9 +440,37 @@ Network* create_network(const Config *cfg) {
     int current_index = 0;
     int current_dim = cfg->input_dim;  // Use configured input dimension
     
+    // Track the activation shape as an NHWC image (channels, height, width).
+    // A plain feature vector is treated as a 1x1 image with current_dim channels.
+    int cur_c = (cfg->input_channels > 0) ? cfg->input_channels : 1;
+    int cur_h = cfg->input_height, cur_w = cfg->input_width;
+    if (cur_h <= 0 || cur_w <= 0) {
+        int spatial = current_dim / cur_c;
+        int side = (int) sqrt((double) spatial);
+        if (side * side * cur_c == current_dim) {
+            cur_h = side;
+            cur_w = side;
+        } else {
+            cur_h = 1;
+            cur_w = spatial;
+        }
+    }
+    if (cur_c * cur_h * cur_w != current_dim) {
+        handle_error("input_channels/input_height/input_width do not match input_dim.");
+    }
+    
+    // Shapes at every layer boundary; shapes[0] is the input.
+    ActivationShape *shapes = (ActivationShape*)malloc(sizeof(ActivationShape) * (2 * logical_layers + 1));
+    if (!shapes) {
+        handle_error("Failed to allocate activation shapes in create_network.");
+    }
+    shapes[0] = (ActivationShape){ cur_c, cur_h, cur_w };
+    
     // Iterate over the logical layers.
     for (int i = 0; i < logical_layers; i++) {
         int target_dim = layer_sizes[i];
+        int first_index = current_index;
+        ActivationShape in_shape = { cur_c, cur_h, cur_w };
         // Get the specified layer type.
         char *type = layer_types[i];
         
@@ -235,10 +482,24 @@ Network* create_network(const Config *cfg) {
             } else if (cfg->prior_type == 2) {
                 bl->prior = create_mixture_prior(0.0, 1.0, 0.0, 1.0, 0.5);
             } else {
-                bl->prior = NULL;
+                bl->prior = create_gaussian_prior(0.0, cfg->prior_variance);
             }
             if (cfg->posterior_method == 2) {
                 bl->posterior = create_flipout_posterior();
+            } else if (cfg->posterior_method == 1 && cfg->covariance_structure == 2) {
+                // Low-rank plus diagonal posterior: sampled and scored by the layer itself.
+                if (cfg->prior_type != 0) {
+                    handle_error("covariance_structure = 2 needs the Gaussian prior (prior_type = 0).");
+                }
+                bayesian_linear_set_rank(bl, cfg->posterior_rank);
+                bl->posterior = NULL;
+            } else if (cfg->posterior_method == 1 && cfg->covariance_structure == 3) {
+                // Matrix-normal posterior: sampled and scored by the layer itself.
+                if (cfg->prior_type != 0) {
+                    handle_error("covariance_structure = 3 needs the Gaussian prior (prior_type = 0).");
+                }
+                bayesian_linear_set_matrix_normal(bl, cfg->local_reparam);
+                bl->posterior = NULL;
             } else if (cfg->posterior_method == 1) {
                 bl->posterior = create_structured_posterior(1.0);
             } else {
@@ -246,16 +507,19 @@ Network* create_network(const Config *cfg) {
             }
             full_layers[current_index++] = create_linear_layer(bl, cfg);
             current_dim = target_dim;
+            cur_c = target_dim; cur_h = 1; cur_w = 1;
         } else if (strcmp(type, "conv") == 0) {
-            // Create a BayesianConv layer.
+            // Create a BayesianConv layer: target_dim output channels over the current image.
             int kernel_h = 3, kernel_w = 3;
-            BayesianConv *bc = create_bayesian_conv(current_dim, target_dim, kernel_h, kernel_w);
+            BayesianConv *bc = create_bayesian_conv(cur_c, target_dim, kernel_h, kernel_w,
+                                                    cfg->conv_stride, cfg->conv_padding);
+            bayesian_conv_set_input_size(bc, cur_h, cur_w);
             if (cfg->prior_type == 1) {
                 bc->prior = create_laplace_prior(0.0, cfg->prior_variance);
             } else if (cfg->prior_type == 2) {
                 bc->prior = create_mixture_prior(0.0, 1.0, 0.0, 1.0, 0.5);
             } else {
-                bc->prior = NULL;
+                bc->prior = create_gaussian_prior(0.0, cfg->prior_variance);
             }
             if (cfg->posterior_method == 2) {
                 bc->posterior = create_flipout_posterior();
@@ -264,22 +528,74 @@ Network* create_network(const Config *cfg) {
             } else {
                 bc->posterior = NULL;
             }
-            full_layers[current_index++] = create_conv_layer(bc);
-            current_dim = target_dim;
-        } else if (strcmp(type, "dropout") == 0) {
-            // Create a Dropout layer.
-            DropoutLayer *dl = create_dropout_layer(DROPOUT_MC, cfg->dropout_prob, 0.0);
+            full_layers[current_index++] = create_conv_layer(bc, cfg);
+            cur_c = target_dim; cur_h = bc->output_height; cur_w = bc->output_width;
+            current_dim = cur_c * cur_h * cur_w;
+        } else if (strcmp(type, "dwconv") == 0) {
+            // Create a depthwise-separable BayesianDWConv layer with target_dim output channels.
+            int kernel_h = 3, kernel_w = 3;
+            BayesianDWConv *dc = create_bayesian_dwconv(cur_c, target_dim, kernel_h, kernel_w,
+                                                        cfg->conv_stride, cfg->conv_padding);
+            bayesian_dwconv_set_input_size(dc, cur_h, cur_w);
+            if (cfg->prior_type == 1) {
+                dc->prior = create_laplace_prior(0.0, cfg->prior_variance);
+            } else if (cfg->prior_type == 2) {
+                dc->prior = create_mixture_prior(0.0, 1.0, 0.0, 1.0, 0.5);
+            } else {
+                dc->prior = create_gaussian_prior(0.0, cfg->prior_variance);
+            }
+            if (cfg->posterior_method == 2) {
+                dc->posterior = create_flipout_posterior();
+            } else if (cfg->posterior_method == 1) {
+                dc->posterior = create_structured_posterior(1.0);
+            } else {
+                dc->posterior = NULL;
+            }
+            full_layers[current_index++] = create_dwconv_layer(dc, cfg);
+            cur_c = target_dim; cur_h = dc->output_height; cur_w = dc->output_width;
+            current_dim = cur_c * cur_h * cur_w;
+        } else if (strcmp(type, "maxpool") == 0 || strcmp(type, "avgpool") == 0 || strcmp(type, "gap") == 0) {
+            // Create a pooling layer. Its output size follows from the window geometry,
+            // so the neurons_per_layer entry for this position is ignored.
+            PoolType pool_type = POOL_GLOBAL_AVG;
+            if (strcmp(type, "maxpool") == 0) {
+                pool_type = POOL_MAX;
+            } else if (strcmp(type, "avgpool") == 0) {
+                pool_type = POOL_AVG;
+            }
+            PoolingLayer *pl = create_pooling_layer(pool_type, cur_c, cur_h, cur_w, cfg->pool_size, cfg->pool_stride);
+            full_layers[current_index++] = create_pooling_layer_wrapper(pl);
+            cur_h = pl->output_height; cur_w = pl->output_width;
+            current_dim = cur_c * cur_h * cur_w;
+        } else if (strcmp(type, "dropout") == 0 || strcmp(type, "concrete") == 0) {
+            // Create a Dropout layer: "dropout" is MC dropout with a fixed rate, "concrete" learns
+            // the rate starting from cfg->dropout_prob (relaxation temperature 0.1).
+            DropoutLayer *dl = (strcmp(type, "concrete") == 0)
+                ? create_dropout_layer(DROPOUT_CONCRETE, cfg->dropout_prob, 0.1)
+                : create_dropout_layer(DROPOUT_MC, cfg->dropout_prob, 0.0);
             full_layers[current_index++] = create_dropout_layer_wrapper(dl);
             // Dropout does not change dimensions.
             if (current_dim != target_dim) {
                 // Insert an internal projection layer, but do not count it toward logical_layers.
                 full_layers[current_index++] = create_projection_layer(current_dim, target_dim, cfg);
                 current_dim = target_dim;
+                cur_c = target_dim; cur_h = 1; cur_w = 1;
+            }
+        } else if (strcmp(type, "noise") == 0) {
+            // Create a Gaussian noise injection layer with stddev cfg->noise_injection.
+            // It is active only in stochastic passes and does not change dimensions.
+            NoiseInjection *ni = create_noise_injection(NOISE_GAUSSIAN, 0.0, cfg->noise_injection);
+            full_layers[current_index++] = create_noise_layer_wrapper(ni);
+            if (current_dim != target_dim) {
+                full_layers[current_index++] = create_projection_layer(current_dim, target_dim, cfg);
+                current_dim = target_dim;
+                cur_c = target_dim; cur_h = 1; cur_w = 1;
             }
         } else if (strcmp(type, "stochastic") == 0) {
             // Create a StochasticActivation layer.
+            // One slope per channel (per feature for plain vectors).
             double alpha_mean = 0.25, alpha_logvar = -5.0;
-            StochasticActivation *sa = create_stochastic_activation(alpha_mean, alpha_logvar);
+            StochasticActivation *sa = create_stochastic_activation(cur_c, alpha_mean, alpha_logvar);
             if (cfg->prior_type == 1) {
                 sa->prior = create_laplace_prior(0.0, cfg->prior_variance);
             } else if (cfg->prior_type == 2) {
@@ -299,6 +615,7 @@ Network* create_network(const Config *cfg) {
             if (current_dim != target_dim) {
                 full_layers[current_index++] = create_projection_layer(current_dim, target_dim, cfg);
                 current_dim = target_dim;
+                cur_c = target_dim; cur_h = 1; cur_w = 1;
             }
         } else {
             // Default to BayesianLinear.
@@ -307,6 +624,11 @@ Network* create_network(const Config *cfg) {
             bl->posterior = NULL;
             full_layers[current_index++] = create_linear_layer(bl, cfg);
             current_dim = target_dim;
+            cur_c = target_dim; cur_h = 1; cur_w = 1;
+        }
+        // Only the last layer added for this entry (an inserted projection) changes the shape.
+        for (int k = first_index; k < current_index; k++) {
+            shapes[k + 1] = (k == current_index - 1) ? (ActivationShape){ cur_c, cur_h, cur_w } : in_shape;
         }
     }
     
@@ -315,15 +637,23 @@ Network* create_network(const Config *cfg) {
     // The logical number of layers is as per config.
     // (You could report this separately if needed.)
     net->layers = full_layers;
+    net->shapes = shapes;
     
     // Free the temporary layer type strings.
     for (int i = 0; i < num_types; i++) {
         free(layer_types[i]);
     }
     
+    build_param_arena(net);
+    net->activations = matrix_arena_create();
+    
+    // Plan the activation memory of a training step at the configured batch size and set the
+    // buffers aside, so the first step finds them in the arena.
+    int plan_batch = get_mini_batch_size(cfg);
+    net->plan = plan_network(net, plan_batch > 0 ? plan_batch : 1);
+    network_plan_reserve(net, net->plan);
     return net;
 }
-// Conv forward wrapper: converts Matrix input to Tensor, calls bayesian_conv_forward, then returns the output Matrix.
 
 
 // ==================
@@ -335,24 +665,112 @@ Matrix* network_forward(Network *net, const Matrix *input, int stochastic) {
     }
     Matrix *current = (Matrix*)input;  // Do not free the original input.
     
+    // Every pass reuses the matrices released by the previous ones; a new step starts here.
+    MatrixArena *previous_arena = matrix_arena_activate(net->activations);
+    net->activations->bytes_allocated = 0;
+    
     for (int i = 0; i < net->num_layers; i++) {
-        Matrix *next;
-        // Check if the layer is a conv layer by comparing the forward pointer.
-        if (net->layers[i]->forward == conv_forward_wrapper) {
-            // Call the conv forward wrapper directly.
-            next = conv_forward_wrapper(net->layers[i]->layer, current, stochastic);
-        } else {
-            next = net->layers[i]->forward(net->layers[i]->layer, current, stochastic);
+        if (!stochastic && net->layers[i]->passthrough) {
+            continue;
+        }
+        // Intermediate outputs belong to the network, so elementwise layers may overwrite them.
+        if (net->layers[i]->forward_inplace && current != input) {
+            net->layers[i]->forward_inplace(net->layers[i]->layer, current, stochastic);
+            continue;
         }
-        if (i > 0) {  // Free intermediate outputs.
+        Matrix *next = net->layers[i]->forward(net->layers[i]->layer, current, stochastic);
+        if (stochastic && net->layers[i]->kl_per_sample) {
+            net->layers[i]->kl_dirty = 1;  // The layer's KL estimate was redrawn with its weights.
+        }
+        if (current != input) {  // Free intermediate outputs.
             free_matrix(current);
         }
         current = next;
     }
+    if (current == input) {
+        // Every layer was skipped; the caller owns input, so return a copy.
+        current = copy_matrix(input);
+    }
+    matrix_arena_activate(previous_arena);
     return current;
 }
 
 
+// ==================
+// Monte Carlo predictive pass over num_samples stacked copies of the input.
+// ==================
+void network_forward_mc(Network *net, const Matrix *input, int num_samples, Matrix *out) {
+    if (!net || !input || !out || num_samples < 1) {
+        handle_error("Invalid arguments in network_forward_mc.");
+    }
+    int batch = input->rows;
+    if (out->rows != num_samples * batch) {
+        handle_error("Output shape mismatch in network_forward_mc.");
+    }
+    MatrixArena *previous_arena = matrix_arena_activate(net->activations);
+    net->activations->bytes_allocated = 0;
+
+    // The draws share the input until the first layer that needs one block per draw.
+    Matrix *current = (Matrix*)input;
+    int shared = 1;
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = net->layers[i];
+        if (l->forward_mc) {
+            Matrix *next = l->forward_mc(l->layer, current, num_samples, shared);
+            if (current != input) {
+                free_matrix(current);
+            }
+            current = next;
+            shared = 0;
+            continue;
+        }
+        if (shared) {
+            Matrix *stacked = create_matrix(num_samples * batch, current->cols);
+            size_t block_size = (size_t) batch * current->cols;
+            for (int s = 0; s < num_samples; s++) {
+                memcpy(stacked->data + s * block_size, current->data, sizeof(double) * block_size);
+            }
+            if (current != input) {
+                free_matrix(current);
+            }
+            current = stacked;
+            shared = 0;
+        }
+        if (l->forward_inplace) {
+            for (int s = 0; s < num_samples; s++) {
+                Matrix block = { batch, current->cols, current->data + (size_t) s * batch * current->cols, NULL, 0 };
+                l->forward_inplace(l->layer, &block, 1);
+            }
+        } else {
+            Matrix *next = NULL;
+            for (int s = 0; s < num_samples; s++) {
+                Matrix block = { batch, current->cols, current->data + (size_t) s * batch * current->cols, NULL, 0 };
+                Matrix *y = l->forward(l->layer, &block, 1);
+                if (!next) {
+                    next = create_matrix(num_samples * batch, y->cols);
+                }
+                memcpy(next->data + (size_t) s * batch * y->cols, y->data, sizeof(double) * batch * y->cols);
+                free_matrix(y);
+            }
+            free_matrix(current);
+            current = next;
+        }
+        if (l->kl_per_sample) {
+            l->kl_dirty = 1;  // The layer's KL estimate was redrawn with its weights.
+        }
+    }
+    if (current->cols != out->cols) {
+        handle_error("Output shape mismatch in network_forward_mc.");
+    }
+    for (int s = 0; s < (shared ? num_samples : 1); s++) {
+        memcpy(out->data + (size_t) s * current->rows * current->cols, current->data,
+               sizeof(double) * current->rows * current->cols);
+    }
+    if (current != input) {
+        free_matrix(current);
+    }
+    matrix_arena_activate(previous_arena);
+}
 
 // ==================
 // Total KL divergence: Sum KL contributions from each Bayesian layer.
@@ -363,11 +781,201 @@ double network_total_kl(Network *net) {
     }
     double total_kl = 0.0;
     for (int i = 0; i < net->num_layers; i++) {
-        total_kl += net->layers[i]->kl(net->layers[i]->layer);
+        Layer *l = net->layers[i];
+        // Only layers whose parameters changed since the last call are recomputed.
+        if (l->kl_dirty) {
+            l->kl_cache = l->kl(l->layer);
+            l->kl_dirty = 0;
+        }
+        total_kl += l->kl_cache;
     }
     return total_kl;
 }
 
+void network_refresh_caches(Network *net) {
+    if (!net) {
+        handle_error("Null network in network_refresh_caches.");
+    }
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = net->layers[i];
+        if (l->type == LAYER_BAYESIAN_LINEAR) {
+            BayesianLinear *bl = (BayesianLinear*)l->layer;
+            if (bl->sigma_dirty) {
+                compute_sigma(bl->W_logvar->data, bl->W_sigma, bl->output_dim * bl->input_dim);
+                compute_sigma(bl->b_logvar, bl->b_sigma, bl->output_dim);
+                bl->sigma_dirty = 0;
+            }
+        } else if (l->type == LAYER_BAYESIAN_CONV) {
+            BayesianConv *bc = (BayesianConv*)l->layer;
+            if (bc->sigma_dirty) {
+                compute_sigma(bc->W_logvar, bc->W_sigma,
+                              bc->output_channels * bc->input_channels * bc->kernel_height * bc->kernel_width);
+                compute_sigma(bc->b_logvar, bc->b_sigma, bc->output_channels);
+                bc->sigma_dirty = 0;
+            }
+        }
+    }
+}
+
+void network_invalidate_kl(Network *net) {
+    if (!net) {
+        handle_error("Null network in network_invalidate_kl.");
+    }
+    for (int i = 0; i < net->num_layers; i++) {
+        net->layers[i]->kl_dirty = 1;
+    }
+}
+
+void network_copy_params(Network *dst, const Network *src) {
+    if (!dst || !src || dst->num_layers != src->num_layers || !dst->arena != !src->arena ||
+        (src->arena && (dst->arena->num_means != src->arena->num_means ||
+                        dst->arena->num_logvars != src->arena->num_logvars))) {
+        handle_error("Networks of different structure in network_copy_params.");
+    }
+    if (src->arena) {
+        memcpy(dst->arena->mean, src->arena->mean, sizeof(double) * src->arena->num_means);
+        memcpy(dst->arena->logvar, src->arena->logvar, sizeof(double) * src->arena->num_logvars);
+    }
+    for (int i = 0; i < dst->num_layers; i++) {
+        Layer *l = dst->layers[i];
+        if (l->type != src->layers[i]->type) {
+            handle_error("Networks of different structure in network_copy_params.");
+        }
+        if (l->type == LAYER_BAYESIAN_LINEAR) {
+            ((BayesianLinear*)l->layer)->sigma_dirty = 1;
+        } else if (l->type == LAYER_BAYESIAN_CONV) {
+            ((BayesianConv*)l->layer)->sigma_dirty = 1;
+        } else if (l->type == LAYER_DROPOUT) {
+            // The Concrete dropout logit lives outside the arena.
+            DropoutLayer *d = (DropoutLayer*)l->layer;
+            const DropoutLayer *from = (const DropoutLayer*)src->layers[i]->layer;
+            d->p_logit = from->p_logit;
+            d->dropout_prob = from->dropout_prob;
+        }
+        l->kl_dirty = 1;
+    }
+}
+
+// File layout: header, the layer types, the mean and log-variance slabs, then the dropout
+// probability and logit of every dropout layer.
+#define MODEL_FILE_MAGIC 0x504e4e42u   // "BNNP"
+#define MODEL_FILE_VERSION 1
+
+typedef struct {
+    unsigned int magic;
+    int version;
+    int num_layers;
+    int num_means;
+    int num_logvars;
+} ModelFileHeader;
+
+int network_save(const Network *net, const char *path) {
+    if (!net || !net->arena || !path) {
+        handle_error("Invalid arguments in network_save.");
+    }
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "Could not open model file for writing: %s\n", path);
+        return -1;
+    }
+    ModelFileHeader header = { MODEL_FILE_MAGIC, MODEL_FILE_VERSION, net->num_layers,
+                               net->arena->num_means, net->arena->num_logvars };
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (int i = 0; ok && i < net->num_layers; i++) {
+        int type = (int) net->layers[i]->type;
+        ok = fwrite(&type, sizeof(int), 1, fp) == 1;
+    }
+    ok = ok && fwrite(net->arena->mean, sizeof(double), net->arena->num_means, fp) == (size_t) net->arena->num_means;
+    ok = ok && fwrite(net->arena->logvar, sizeof(double), net->arena->num_logvars, fp) == (size_t) net->arena->num_logvars;
+    for (int i = 0; ok && i < net->num_layers; i++) {
+        if (net->layers[i]->type == LAYER_DROPOUT) {
+            const DropoutLayer *d = (const DropoutLayer*)net->layers[i]->layer;
+            ok = fwrite(&d->dropout_prob, sizeof(double), 1, fp) == 1 &&
+                 fwrite(&d->p_logit, sizeof(double), 1, fp) == 1;
+        }
+    }
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Failed to write model file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int network_load(Network *net, const char *path) {
+    if (!net || !net->arena || !path) {
+        handle_error("Invalid arguments in network_load.");
+    }
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "Could not open model file: %s\n", path);
+        return -1;
+    }
+    ModelFileHeader header;
+    int ok = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == MODEL_FILE_MAGIC &&
+             header.version == MODEL_FILE_VERSION && header.num_layers == net->num_layers &&
+             header.num_means == net->arena->num_means && header.num_logvars == net->arena->num_logvars;
+    for (int i = 0; ok && i < net->num_layers; i++) {
+        int type;
+        ok = fread(&type, sizeof(int), 1, fp) == 1 && type == (int) net->layers[i]->type;
+    }
+    if (!ok) {
+        fprintf(stderr, "Model file %s does not match the network.\n", path);
+        fclose(fp);
+        return -1;
+    }
+    // Read into scratch first, so that a truncated file leaves the network as it was.
+    size_t count = (size_t) header.num_means + header.num_logvars;
+    double *values = (double*)malloc(sizeof(double) * (count + 2 * net->num_layers));
+    if (!values) {
+        handle_error("Failed to allocate model buffer.");
+    }
+    double *dropout = values + count;
+    ok = fread(values, sizeof(double), count, fp) == count;
+    int num_dropout = 0;
+    for (int i = 0; ok && i < net->num_layers; i++) {
+        if (net->layers[i]->type == LAYER_DROPOUT) {
+            ok = fread(dropout + 2 * num_dropout, sizeof(double), 2, fp) == 2;
+            num_dropout++;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        fprintf(stderr, "Model file %s is truncated.\n", path);
+        free(values);
+        return -1;
+    }
+    memcpy(net->arena->mean, values, sizeof(double) * header.num_means);
+    memcpy(net->arena->logvar, values + header.num_means, sizeof(double) * header.num_logvars);
+    num_dropout = 0;
+    for (int i = 0; i < net->num_layers; i++) {
+        Layer *l = net->layers[i];
+        if (l->type == LAYER_BAYESIAN_LINEAR) {
+            ((BayesianLinear*)l->layer)->sigma_dirty = 1;
+        } else if (l->type == LAYER_BAYESIAN_CONV) {
+            ((BayesianConv*)l->layer)->sigma_dirty = 1;
+        } else if (l->type == LAYER_DROPOUT) {
+            DropoutLayer *d = (DropoutLayer*)l->layer;
+            d->dropout_prob = dropout[2 * num_dropout];
+            d->p_logit = dropout[2 * num_dropout + 1];
+            num_dropout++;
+        }
+        l->kl_dirty = 1;
+    }
+    free(values);
+    return 0;
+}
+
+size_t network_step_alloc_bytes(const Network *net) {
+    return net->activations->bytes_allocated;
+}
+
+void network_set_frozen(Network *net, int layer_index, int frozen) {
+    if (!net || layer_index < 0 || layer_index >= net->num_layers) {
+        handle_error("Invalid layer index in network_set_frozen.");
+    }
+    net->layers[layer_index]->frozen = frozen;
+}
+
 // ==================
 // Free the network and all its layers.
 // ==================
@@ -375,11 +983,21 @@ void free_network(Network *net) {
     if (net) {
         for (int i = 0; i < net->num_layers; i++) {
             if (net->layers[i]) {
+                // The parameters belong to the arena, which is freed below.
+                ParamBlock means[MAX_PARAM_BLOCKS], logvars[MAX_PARAM_BLOCKS];
+                int nl, nm = network_layer_param_blocks(net->layers[i], means, logvars, &nl);
+                param_arena_release(means, nm);
+                param_arena_release(logvars, nl);
+                free_adam_state(net->layers[i]->optimizer_state);
                 net->layers[i]->free_layer(net->layers[i]->layer);
                 free(net->layers[i]);
             }
         }
         free(net->layers);
+        free(net->shapes);
+        free_network_plan(net->plan);
+        param_arena_free(net->arena);
+        matrix_arena_free(net->activations);
         free(net);
     }
 }
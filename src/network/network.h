@@ -4,13 +4,17 @@
 #include "../config/config.h"
 #include "../utils/math_utils.h"
 #include "../optimizer/adam_optimizer.h"
+#include "param_arena.h"
 
 // Enumeration for different layer types
 typedef enum {
     LAYER_BAYESIAN_LINEAR,
     LAYER_BAYESIAN_CONV,
+    LAYER_BAYESIAN_DWCONV,
     LAYER_DROPOUT,
     LAYER_STOCHASTIC_ACTIVATION,
+    LAYER_POOLING,
+    LAYER_NOISE,
     LAYER_PROJECTION
 } LayerType;
 
@@ -29,27 +33,124 @@ typedef struct Layer {
     //   - returns the gradient w.r.t. this layer's input (so it can be passed to the previous layer)
     Matrix* (*backward)(void *layer, const Matrix *grad_output, const Config *cfg);
 
+    // Optional in-place variants for elementwise layers (NULL when unsupported).
+    // network_forward()/network_backward() call these instead of forward/backward when the
+    // incoming Matrix is an intermediate buffer owned by the network, overwriting it rather
+    // than allocating a new one. The caller's input and grad_output are never modified.
+    void (*forward_inplace)(void *layer, Matrix *data, int stochastic);
+    void (*backward_inplace)(void *layer, Matrix *grad, const Config *cfg);
+
+    // Optional batched predictive pass (NULL when unsupported): 'input' stacks num_samples
+    // blocks of equal size, or is one block shared by every draw when shared_input is nonzero,
+    // and each block is evaluated with its own posterior draw, as by num_samples stochastic
+    // forward calls. Returns the stacked outputs. Used by network_forward_mc().
+    Matrix* (*forward_mc)(void *layer, const Matrix *input, int num_samples, int shared_input);
+
+    // Nonzero for layers that are the identity at inference (stochastic == 0) and whose
+    // backward pass is always the identity, such as additive noise. The network skips
+    // them in those cases instead of copying the activations or gradients.
+    int passthrough;
+
+    // Nonzero when the optimizer must leave this layer's parameters untouched (for example
+    // during partial fine-tuning). Gradients are still propagated through the layer.
+    int frozen;
+
+    // Cached result of kl(), valid while kl_dirty is zero. The optimizer sets kl_dirty after
+    // updating the layer, so network_total_kl() only recomputes layers that changed.
+    int kl_dirty;
+    double kl_cache;
+    // Nonzero when kl() is a Monte Carlo estimate on the weights of the latest stochastic
+    // forward pass; such passes invalidate the cache as well.
+    int kl_per_sample;
+
+    // Where this layer's parameters live in the network's ParamArena: its means (and their
+    // gradients) occupy [arena_mean_offset, arena_mean_offset + arena_mean_count) of the mean
+    // slabs, its log-variances and covariance factors the same range of the log-variance slabs.
+    // Counts are zero for parameter-free layers and for Concrete dropout, whose single logit
+    // stays in the layer.
+    int arena_mean_offset;
+    int arena_mean_count;
+    int arena_logvar_offset;
+    int arena_logvar_count;
+
     // KL divergence
     double (*kl)(void *layer);
 
     // Free resources
     void (*free_layer)(void *layer);
+
+    // Per-call state for an ExecContext (see exec_context.h): create_context() returns a new
+    // instance of the layer that shares this one's parameters and owns its own caches, masks,
+    // samples and scratch, with its gradient pointers left for the context to bind;
+    // free_context() frees such an instance and nothing it shares.
+    void* (*create_context)(const void *layer);
+    void (*free_context)(void *context);
 } Layer;
 
 
 
+// Shape of the activations at a layer boundary, as an NHWC image; a plain feature vector
+// of n values is n x 1 x 1.
+typedef struct {
+    int channels;
+    int height;
+    int width;
+} ActivationShape;
+
+struct NetworkPlan;
+
 // Network structure.
 typedef struct Network {
     Layer **layers;        // Array of pointers to all (internal) layers (including projection layers).
     int num_layers;        // Total number of layers (including extra projection layers).
     int logical_num_layers; // The number of layers as specified by the configuration (i.e. neurons_per_layer count).
+    ParamArena *arena;     // Storage of every layer's parameters, gradients and optimizer moments.
+    MatrixArena *activations; // Reused storage of the activations and gradients of each pass.
+    ActivationShape *shapes; // num_layers + 1 entries: shapes[0] is the input, shapes[i + 1] the output of layers[i].
+    struct NetworkPlan *plan; // Memory plan of a training step at the configured mini-batch size.
     // (Optional) Additional metadata can be added here.
 } Network;
 
 // Function prototypes.
 Network* create_network(const Config *cfg);
 Matrix* network_forward(Network *net, const Matrix *input, int stochastic);
+// Monte Carlo predictive pass: evaluate 'input' (B rows) under num_samples independent
+// posterior draws, as num_samples calls of network_forward(net, input, 1) would, and write the
+// results to 'out', a (num_samples * B) x output_dim Matrix whose rows s * B .. s * B + B - 1
+// belong to draw s. Layers with forward_mc evaluate all draws in one call; the others run once
+// per block. Layers before the first stochastic one see the input itself, so the first linear
+// layer can share work between the draws (see bayesian_linear_set_mc_rank()). A
+// network_backward() may not follow this pass.
+void network_forward_mc(Network *net, const Matrix *input, int num_samples, Matrix *out);
 double network_total_kl(Network *net);
+// Mark every layer's cached KL as stale. Call this after modifying parameters or priors
+// outside of network_update_params().
+void network_invalidate_kl(Network *net);
+// Copy every learned parameter of 'src' into 'dst', a network created from the same
+// configuration (for example a replica used by another thread).
+void network_copy_params(Network *dst, const Network *src);
+// Write every learned parameter (the arena's mean and log-variance slabs and the Concrete
+// dropout logits) to 'path', in the machine's byte order. Returns 0 on success, -1 on failure.
+int network_save(const Network *net, const char *path);
+// Read parameters written by network_save() into 'net', which must have been created from the
+// same configuration. Returns 0 on success, -1 if the file cannot be read or was saved from a
+// network of another structure.
+int network_load(Network *net, const char *path);
+// Bytes of activation and gradient storage newly allocated since the start of the latest
+// network_forward() (including any network_backward() after it). Zero after the first couple
+// of training steps, since later steps reuse the same matrices.
+size_t network_step_alloc_bytes(const Network *net);
+// Recompute the parameter caches that layers otherwise refresh lazily on their next stochastic
+// pass (the standard deviations exp(logvar / 2)). ExecContexts only read these caches, so call
+// this after changing the parameters and before contexts of the network run again.
+void network_refresh_caches(Network *net);
+// The learnable arrays of a layer in arena order, see param_arena_adopt(): means into 'means',
+// log-variances and covariance factors into 'logvars' (at most MAX_PARAM_BLOCKS each). Returns
+// the number of mean blocks; *num_logvars gets the number of log-variance blocks.
+#define MAX_PARAM_BLOCKS 5
+int network_layer_param_blocks(Layer *l, ParamBlock *means, ParamBlock *logvars, int *num_logvars);
+// Freeze (frozen != 0) or unfreeze the layer at 'layer_index' in net->layers.
+void network_set_frozen(Network *net, int layer_index, int frozen);
 void free_network(Network *net);
 Matrix* network_backward(Network *net, const Matrix *grad_output, const Config *cfg);
 
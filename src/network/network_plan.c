@@ -0,0 +1,196 @@
+#include "network_plan.h"
+#include "../utils/utils.h"   // For handle_error().
+#include <stdio.h>
+#include <stdlib.h>
+
+static int shape_size(ActivationShape s) {
+    return s.channels * s.height * s.width;
+}
+
+// Layers that keep a copy of their input Matrix for the backward pass.
+static int caches_input(const Layer *l) {
+    return l->type == LAYER_BAYESIAN_LINEAR || l->type == LAYER_BAYESIAN_CONV ||
+           l->type == LAYER_BAYESIAN_DWCONV;
+}
+
+static int add_value(NetworkPlan *plan, int size, int start) {
+    PlanValue *v = &plan->values[plan->num_values];
+    v->size = size;
+    v->start = start;
+    v->end = start;
+    v->buffer = -1;
+    return plan->num_values++;
+}
+
+// Live ranges of every Matrix of a training step, mirroring network_forward() and
+// network_backward() with stochastic != 0. -1 stands for the caller's input and grad_output.
+static void plan_live_ranges(NetworkPlan *plan, const Network *net) {
+    int L = net->num_layers, last_step = 2 * L - 1;
+    int current = -1;
+    for (int i = 0; i < L; i++) {
+        Layer *l = net->layers[i];
+        int rows_in = plan->max_batch * shape_size(net->shapes[i]);
+        plan->cache_value[i] = caches_input(l) ? add_value(plan, rows_in, i) : -1;
+        if (l->forward_inplace && current >= 0) {
+            plan->values[current].end = i;
+            plan->output_value[i] = current;
+            continue;
+        }
+        int next = add_value(plan, plan->max_batch * shape_size(net->shapes[i + 1]), i);
+        if (current >= 0) {
+            plan->values[current].end = i;  // Freed right after the layer has read it.
+        }
+        plan->output_value[i] = current = next;
+    }
+    if (current >= 0) {
+        plan->values[current].end = last_step;  // The output belongs to the caller.
+    }
+    int grad = -1;
+    for (int i = L - 1; i >= 0; i--) {
+        int step = last_step - i;
+        if (plan->cache_value[i] >= 0) {
+            plan->values[plan->cache_value[i]].end = step;
+        }
+        if (net->layers[i]->passthrough) {
+            plan->grad_value[i] = -1;
+            continue;
+        }
+        if (net->layers[i]->backward_inplace && grad >= 0) {
+            plan->values[grad].end = step;
+            plan->grad_value[i] = grad;
+            continue;
+        }
+        int next = add_value(plan, plan->max_batch * shape_size(net->shapes[i]), step);
+        if (grad >= 0) {
+            plan->values[grad].end = step;
+        }
+        plan->grad_value[i] = grad = next;
+    }
+    if (grad >= 0) {
+        plan->values[grad].end = last_step;  // The input gradient belongs to the caller.
+    }
+}
+
+// Greedy buffer assignment in creation order. A buffer becomes free after the step in which
+// its last value is read; values created in that same step still overlap it.
+static void plan_buffers(NetworkPlan *plan) {
+    int *free_after = (int*)malloc(sizeof(int) * (plan->num_values + 1));
+    plan->buffer_size = (int*)malloc(sizeof(int) * (plan->num_values + 1));
+    if (!free_after || !plan->buffer_size) {
+        handle_error("Failed to allocate network plan buffers.");
+    }
+    plan->num_buffers = 0;
+    for (int v = 0; v < plan->num_values; v++) {
+        PlanValue *value = &plan->values[v];
+        int fit = -1, largest = -1;
+        for (int b = 0; b < plan->num_buffers; b++) {
+            if (free_after[b] >= value->start) {
+                continue;
+            }
+            if (plan->buffer_size[b] >= value->size &&
+                (fit < 0 || plan->buffer_size[b] < plan->buffer_size[fit])) {
+                fit = b;
+            }
+            if (largest < 0 || plan->buffer_size[b] > plan->buffer_size[largest]) {
+                largest = b;
+            }
+        }
+        int b = (fit >= 0) ? fit : largest;
+        if (b < 0) {
+            b = plan->num_buffers++;
+            plan->buffer_size[b] = 0;
+        }
+        if (plan->buffer_size[b] < value->size) {
+            plan->buffer_size[b] = value->size;
+        }
+        free_after[b] = value->end;
+        value->buffer = b;
+    }
+    free(free_after);
+}
+
+NetworkPlan* plan_network(const Network *net, int max_batch) {
+    if (!net || max_batch < 1) {
+        handle_error("Invalid network or batch size in plan_network.");
+    }
+    int L = net->num_layers;
+    NetworkPlan *plan = (NetworkPlan*)malloc(sizeof(NetworkPlan));
+    if (!plan) {
+        handle_error("Failed to allocate network plan.");
+    }
+    plan->max_batch = max_batch;
+    plan->num_layers = L;
+    plan->num_values = 0;
+    // At most an output, a cache and a gradient per layer.
+    plan->values = (PlanValue*)malloc(sizeof(PlanValue) * (3 * L + 1));
+    plan->output_value = (int*)malloc(sizeof(int) * (L + 1));
+    plan->cache_value = (int*)malloc(sizeof(int) * (L + 1));
+    plan->grad_value = (int*)malloc(sizeof(int) * (L + 1));
+    if (!plan->values || !plan->output_value || !plan->cache_value || !plan->grad_value) {
+        handle_error("Failed to allocate network plan.");
+    }
+    plan_live_ranges(plan, net);
+    plan_buffers(plan);
+
+    plan->peak_bytes = 0;
+    plan->unplanned_bytes = 0;
+    for (int b = 0; b < plan->num_buffers; b++) {
+        plan->peak_bytes += sizeof(double) * plan->buffer_size[b];
+    }
+    for (int v = 0; v < plan->num_values; v++) {
+        plan->unplanned_bytes += sizeof(double) * plan->values[v].size;
+    }
+    plan->live_bytes = 0;
+    for (int step = 0; step < 2 * L; step++) {
+        size_t live = 0;
+        for (int v = 0; v < plan->num_values; v++) {
+            if (plan->values[v].start <= step && step <= plan->values[v].end) {
+                live += sizeof(double) * plan->values[v].size;
+            }
+        }
+        plan->live_bytes = (live > plan->live_bytes) ? live : plan->live_bytes;
+    }
+    size_t arena_doubles = net->arena ? (size_t) net->arena->num_means + net->arena->num_logvars : 0;
+    plan->param_bytes = 2 * sizeof(double) * arena_doubles;
+    plan->optimizer_bytes = 2 * sizeof(double) * arena_doubles;
+    return plan;
+}
+
+void network_plan_reserve(Network *net, const NetworkPlan *plan) {
+    for (int b = 0; b < plan->num_buffers; b++) {
+        matrix_arena_reserve(net->activations, plan->buffer_size[b]);
+    }
+}
+
+void print_network_plan(const Network *net, const NetworkPlan *plan) {
+    printf("Memory plan for batches of up to %d rows:\n", plan->max_batch);
+    printf("  input       %4d x %3d x %3d\n", net->shapes[0].channels, net->shapes[0].height, net->shapes[0].width);
+    for (int i = 0; i < plan->num_layers; i++) {
+        ActivationShape s = net->shapes[i + 1];
+        printf("  layer %2d    %4d x %3d x %3d  output buffer %d", i, s.channels, s.height, s.width,
+               plan->values[plan->output_value[i]].buffer);
+        if (plan->cache_value[i] >= 0) {
+            printf(", input cache buffer %d", plan->values[plan->cache_value[i]].buffer);
+        }
+        if (plan->grad_value[i] >= 0) {
+            printf(", input gradient buffer %d", plan->values[plan->grad_value[i]].buffer);
+        }
+        printf("\n");
+    }
+    printf("  %d values in %d buffers: %zu bytes (at most %zu live at once, %zu without reuse)\n",
+           plan->num_values, plan->num_buffers, plan->peak_bytes, plan->live_bytes, plan->unplanned_bytes);
+    printf("  parameters and gradients: %zu bytes, Adam moments: %zu bytes\n",
+           plan->param_bytes, plan->optimizer_bytes);
+}
+
+void free_network_plan(NetworkPlan *plan) {
+    if (!plan) {
+        return;
+    }
+    free(plan->values);
+    free(plan->output_value);
+    free(plan->cache_value);
+    free(plan->grad_value);
+    free(plan->buffer_size);
+    free(plan);
+}
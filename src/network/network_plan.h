@@ -0,0 +1,59 @@
+#ifndef NETWORK_PLAN_H
+#define NETWORK_PLAN_H
+
+#include <stddef.h>
+#include "network.h"
+
+// Static memory plan of one training step (a stochastic network_forward() followed by
+// network_backward()) for batches of up to max_batch rows, computed from the shapes that
+// create_network() records. The step is laid out as 2 * num_layers time steps: the forward pass
+// of layers[i] runs at step i and its backward pass at step 2 * num_layers - 1 - i.
+//
+// The plan follows every Matrix the network owns during the step: each layer's output, the
+// copy of its input that linear and convolution layers keep for their backward pass, and each
+// gradient. In-place layers reuse the incoming buffer, and passthrough layers are skipped in the
+// backward pass, as in network_forward() and network_backward(). The output and the input
+// gradient that are handed to the caller stay live until the end of the step. Layer-private
+// scratch (dropout masks, sampled weights) is not included.
+//
+// Values whose live ranges do not overlap share a buffer. Buffers are assigned greedily in
+// creation order, reusing the smallest free buffer that fits (or growing the largest free one),
+// so the number of buffers equals the largest number of values live at once.
+
+// One planned Matrix: its size and the steps during which it is live.
+typedef struct {
+    int size;     // Doubles, for max_batch rows
+    int start;    // Step that creates it
+    int end;      // Last step that reads it
+    int buffer;   // Index of the buffer it is assigned to
+} PlanValue;
+
+typedef struct NetworkPlan {
+    int max_batch;
+    int num_layers;
+    int num_values;
+    PlanValue *values;
+    int *output_value;     // Per layer: value holding its output
+    int *cache_value;      // Per layer: value holding its cached input, or -1
+    int *grad_value;       // Per layer: value holding the gradient w.r.t. its input, or -1 if skipped
+    int num_buffers;
+    int *buffer_size;      // Doubles per buffer
+    size_t peak_bytes;     // Total size of the buffers: the activation memory of a training step
+    size_t live_bytes;     // Largest total size of the values live at one step (a lower bound)
+    size_t unplanned_bytes; // Total size of all values, as if none shared a buffer
+    size_t param_bytes;    // Parameter arena: values and gradients
+    size_t optimizer_bytes; // Parameter arena: Adam moments
+} NetworkPlan;
+
+// Plan a training step of 'net' for batches of up to max_batch (>= 1) rows.
+NetworkPlan* plan_network(const Network *net, int max_batch);
+
+// Set one matrix per planned buffer aside in the network's activation arena.
+void network_plan_reserve(Network *net, const NetworkPlan *plan);
+
+// Print the shapes, buffer assignment and memory totals.
+void print_network_plan(const Network *net, const NetworkPlan *plan);
+
+void free_network_plan(NetworkPlan *plan);
+
+#endif // NETWORK_PLAN_H
@@ -0,0 +1,110 @@
+#include "param_arena.h"
+#include "../utils/utils.h"   // For handle_error().
+#include <stdlib.h>
+#include <string.h>
+
+int param_arena_round(int n) {
+    return (n + PARAM_ARENA_ALIGN - 1) / PARAM_ARENA_ALIGN * PARAM_ARENA_ALIGN;
+}
+
+// A zeroed, 64-byte aligned slab of n doubles (n a multiple of PARAM_ARENA_ALIGN).
+static double* alloc_slab(int n) {
+    size_t bytes = sizeof(double) * (size_t) (n > 0 ? n : PARAM_ARENA_ALIGN);
+    double *slab = (double*)aligned_alloc(PARAM_ARENA_ALIGN * sizeof(double), bytes);
+    if (!slab) {
+        handle_error("Failed to allocate parameter arena.");
+    }
+    memset(slab, 0, bytes);
+    return slab;
+}
+
+ParamArena* param_arena_create(int num_means, int num_logvars) {
+    ParamArena *arena = (ParamArena*)malloc(sizeof(ParamArena));
+    if (!arena) {
+        handle_error("Failed to allocate parameter arena.");
+    }
+    arena->num_means = num_means;
+    arena->num_logvars = num_logvars;
+    arena->mean = alloc_slab(num_means);
+    arena->grad_mean = alloc_slab(num_means);
+    arena->logvar = alloc_slab(num_logvars);
+    arena->grad_logvar = alloc_slab(num_logvars);
+    arena->m_mean = arena->v_mean = arena->m_logvar = arena->v_logvar = NULL;
+    arena->adam_t = 0;
+    return arena;
+}
+
+int param_arena_adopt(double *slab, double *grad_slab, int offset, const ParamBlock *blocks, int num_blocks) {
+    for (int i = 0; i < num_blocks; i++) {
+        int count = blocks[i].count;
+        memcpy(slab + offset, *blocks[i].value, sizeof(double) * count);
+        memcpy(grad_slab + offset, *blocks[i].grad, sizeof(double) * count);
+        free(*blocks[i].value);
+        free(*blocks[i].grad);
+        *blocks[i].value = slab + offset;
+        *blocks[i].grad = grad_slab + offset;
+        offset += count;
+    }
+    return offset;
+}
+
+int param_arena_bind_grads(double *grad_slab, int offset, const ParamBlock *blocks, int num_blocks) {
+    for (int i = 0; i < num_blocks; i++) {
+        *blocks[i].grad = grad_slab + offset;
+        offset += blocks[i].count;
+    }
+    return offset;
+}
+
+ParamArena* param_arena_create_view(const ParamArena *params) {
+    ParamArena *view = (ParamArena*)malloc(sizeof(ParamArena));
+    if (!view) {
+        handle_error("Failed to allocate parameter arena view.");
+    }
+    *view = *params;
+    view->grad_mean = alloc_slab(params->num_means);
+    view->grad_logvar = alloc_slab(params->num_logvars);
+    view->m_mean = view->v_mean = view->m_logvar = view->v_logvar = NULL;
+    return view;
+}
+
+void param_arena_free_view(ParamArena *view) {
+    if (!view) {
+        return;
+    }
+    free(view->grad_mean);
+    free(view->grad_logvar);
+    free(view);
+}
+
+void param_arena_release(const ParamBlock *blocks, int num_blocks) {
+    for (int i = 0; i < num_blocks; i++) {
+        *blocks[i].value = NULL;
+        *blocks[i].grad = NULL;
+    }
+}
+
+void param_arena_init_adam(ParamArena *arena) {
+    if (arena->m_mean) {
+        return;
+    }
+    arena->m_mean = alloc_slab(arena->num_means);
+    arena->v_mean = alloc_slab(arena->num_means);
+    arena->m_logvar = alloc_slab(arena->num_logvars);
+    arena->v_logvar = alloc_slab(arena->num_logvars);
+}
+
+void param_arena_free(ParamArena *arena) {
+    if (!arena) {
+        return;
+    }
+    free(arena->mean);
+    free(arena->grad_mean);
+    free(arena->logvar);
+    free(arena->grad_logvar);
+    free(arena->m_mean);
+    free(arena->v_mean);
+    free(arena->m_logvar);
+    free(arena->v_logvar);
+    free(arena);
+}
@@ -0,0 +1,68 @@
+#ifndef PARAM_ARENA_H
+#define PARAM_ARENA_H
+
+// Network-wide parameter storage. Every learnable array of every layer lives in a few flat,
+// 64-byte aligned slabs; a layer's arrays are consecutive blocks of a slab and its Layer
+// records where they start (see Layer.arena_mean_offset). Layers keep their usual pointers,
+// which point into the slabs, so the layer code is unchanged, while the optimizer (and
+// anything else that treats the parameters as one vector) sweeps whole slabs at once.
+//
+// Each layer's blocks start on a PARAM_ARENA_ALIGN boundary; the padding in between is zero
+// and stays zero under the SGD and Adam updates.
+
+// Alignment of each layer's blocks, in doubles (64 bytes).
+#define PARAM_ARENA_ALIGN 8
+
+typedef struct ParamArena {
+    int num_means;         // Length of the mean slabs
+    int num_logvars;       // Length of the log-variance slabs
+    double *mean;          // Means of every layer (weights, then biases)
+    double *grad_mean;     // Gradient of the loss w.r.t. mean
+    double *logvar;        // Log-variances, followed by any covariance factors; only updated
+                           // when the posterior variance is learned
+    double *grad_logvar;   // Gradient of the loss w.r.t. logvar
+    double *m_mean;        // Adam moments of mean and logvar; NULL until Adam first runs
+    double *v_mean;
+    double *m_logvar;
+    double *v_logvar;
+    int adam_t;            // Adam time step, shared by every layer
+} ParamArena;
+
+// One parameter array of a layer together with its gradient, both of length count.
+typedef struct {
+    double **value;
+    double **grad;
+    int count;
+} ParamBlock;
+
+// Round n up to a multiple of PARAM_ARENA_ALIGN.
+int param_arena_round(int n);
+
+// Allocate zeroed slabs of the given lengths (multiples of PARAM_ARENA_ALIGN).
+ParamArena* param_arena_create(int num_means, int num_logvars);
+
+// Move the blocks into the slabs starting at 'offset': their contents are copied, the layer's
+// own arrays are freed, and the layer's pointers are redirected into the slabs.
+// Returns the offset just past the last block.
+int param_arena_adopt(double *slab, double *grad_slab, int offset, const ParamBlock *blocks, int num_blocks);
+
+// Point the blocks' gradients at consecutive ranges of grad_slab starting at 'offset', the
+// layout param_arena_adopt() gives them, and leave their values alone. Returns the offset just
+// past the last block.
+int param_arena_bind_grads(double *grad_slab, int offset, const ParamBlock *blocks, int num_blocks);
+
+// An arena whose mean and logvar slabs are those of 'params', with its own zeroed gradient slabs
+// of the same layout and no Adam moments, for an ExecContext (see exec_context.h). Free it with
+// param_arena_free_view(), which leaves the shared slabs alone.
+ParamArena* param_arena_create_view(const ParamArena *params);
+void param_arena_free_view(ParamArena *view);
+
+// Clear the layer's pointers to arena memory so that its free function leaves them alone.
+void param_arena_release(const ParamBlock *blocks, int num_blocks);
+
+// Allocate the Adam moment slabs on first use.
+void param_arena_init_adam(ParamArena *arena);
+
+void param_arena_free(ParamArena *arena);
+
+#endif // PARAM_ARENA_H
@@ -39,3 +39,234 @@ Posterior* create_structured_posterior(double structure_scale) {
     
     return posterior;
 }
+
+void lowrank_posterior_sample(const double *mu, const double *sigma, const double *U, const double *z,
+                              int n, int rank, double *w) {
+    sample_gaussian_sigma(mu, sigma, w, n);
+    for (int j = 0; j < n; j++) {
+        const double *u = U + (size_t) j * rank;
+        double uz = 0.0;
+        for (int a = 0; a < rank; a++) {
+            uz += u[a] * z[a];
+        }
+        w[j] += uz;
+    }
+}
+
+// In-place Cholesky factorization A = L L^T of a symmetric positive definite rank x rank
+// matrix (lower triangle used and overwritten). Returns log det A.
+static double cholesky_logdet(double *A, int rank) {
+    double logdet = 0.0;
+    for (int a = 0; a < rank; a++) {
+        for (int b = 0; b <= a; b++) {
+            double sum = A[a * rank + b];
+            for (int c = 0; c < b; c++) {
+                sum -= A[a * rank + c] * A[b * rank + c];
+            }
+            if (a == b) {
+                if (!(sum > 0.0)) {
+                    handle_error("Low-rank posterior covariance is not positive definite.");
+                }
+                A[a * rank + a] = sqrt(sum);
+                logdet += 2.0 * log(A[a * rank + a]);
+            } else {
+                A[a * rank + b] = sum / A[b * rank + b];
+            }
+        }
+    }
+    return logdet;
+}
+
+// Solve L L^T x = b in place, with L from cholesky_logdet().
+static void cholesky_solve(const double *L, int rank, double *x) {
+    for (int a = 0; a < rank; a++) {
+        for (int c = 0; c < a; c++) {
+            x[a] -= L[a * rank + c] * x[c];
+        }
+        x[a] /= L[a * rank + a];
+    }
+    for (int a = rank - 1; a >= 0; a--) {
+        for (int c = a + 1; c < rank; c++) {
+            x[a] -= L[c * rank + a] * x[c];
+        }
+        x[a] /= L[a * rank + a];
+    }
+}
+
+double lowrank_posterior_kl(const double *mu, const double *logvar, const double *U, int n, int rank,
+                            double prior_mean, double prior_variance,
+                            double *grad_mu, double *grad_logvar, double *grad_U, double scale) {
+    if (rank < 1 || rank > LOWRANK_MAX_RANK) {
+        handle_error("Low-rank posterior rank out of range.");
+    }
+    double A[LOWRANK_MAX_RANK * LOWRANK_MAX_RANK];
+    double t[LOWRANK_MAX_RANK];
+    double inv_v = 1.0 / prior_variance;
+    
+    // One pass for the trace, the mean term, sum(logvar) and A = I + U^T D^-1 U.
+    for (int a = 0; a < rank * rank; a++) {
+        A[a] = 0.0;
+    }
+    double trace = 0.0, dist = 0.0, sum_logvar = 0.0;
+    for (int j = 0; j < n; j++) {
+        const double *u = U + (size_t) j * rank;
+        double inv_s = exp(-logvar[j]);
+        double d = mu[j] - prior_mean;
+        trace += exp(logvar[j]);
+        dist += d * d;
+        sum_logvar += logvar[j];
+        for (int a = 0; a < rank; a++) {
+            trace += u[a] * u[a];
+            double ua = inv_s * u[a];
+            for (int b = 0; b <= a; b++) {
+                A[a * rank + b] += ua * u[b];
+            }
+        }
+    }
+    for (int a = 0; a < rank; a++) {
+        A[a * rank + a] += 1.0;
+    }
+    double logdet_A = cholesky_logdet(A, rank);
+    double kl = 0.5 * ((trace + dist) * inv_v - n + n * log(prior_variance) - sum_logvar - logdet_A);
+    
+    if (grad_mu && grad_logvar && grad_U) {
+        for (int j = 0; j < n; j++) {
+            const double *u = U + (size_t) j * rank;
+            double *gu = grad_U + (size_t) j * rank;
+            double s = exp(logvar[j]);
+            double inv_s = 1.0 / s;
+            // t = A^-1 u_j, so that u_j^T A^-1 u_j and row j of D^-1 U A^-1 are both at hand.
+            double q = 0.0;
+            for (int a = 0; a < rank; a++) {
+                t[a] = u[a];
+            }
+            cholesky_solve(A, rank, t);
+            for (int a = 0; a < rank; a++) {
+                q += u[a] * t[a];
+                gu[a] += scale * (u[a] * inv_v - inv_s * t[a]);
+            }
+            grad_mu[j] += scale * (mu[j] - prior_mean) * inv_v;
+            grad_logvar[j] += scale * 0.5 * (s * inv_v - 1.0 + q * inv_s);
+        }
+    }
+    return kl;
+}
+
+// tmp = E L_col^T: tmp[i][j] = sum_{k <= j} E[i][k] * L_col[j][k].
+static void times_lower_transpose(const double *E, const double *L_col, int rows, int cols, double *tmp) {
+    for (int i = 0; i < rows; i++) {
+        const double *e = E + (size_t) i * cols;
+        double *t = tmp + (size_t) i * cols;
+        for (int j = 0; j < cols; j++) {
+            const double *l = L_col + (size_t) j * cols;
+            double sum = 0.0;
+            for (int k = 0; k <= j; k++) {
+                sum += e[k] * l[k];
+            }
+            t[j] = sum;
+        }
+    }
+}
+
+// out = L_row A: out[i][j] = sum_{k <= i} L_row[i][k] * A[k][j], accumulated row by row.
+static void lower_times(const double *L_row, const double *A, int rows, int cols, double *out) {
+    for (int i = 0; i < rows; i++) {
+        double *o = out + (size_t) i * cols;
+        for (int j = 0; j < cols; j++) {
+            o[j] = 0.0;
+        }
+        for (int k = 0; k <= i; k++) {
+            double l = L_row[(size_t) i * rows + k];
+            const double *a = A + (size_t) k * cols;
+            for (int j = 0; j < cols; j++) {
+                o[j] += l * a[j];
+            }
+        }
+    }
+}
+
+void matnorm_posterior_sample(const double *M, const double *L_row, const double *L_col, int rows, int cols,
+                              double *noise, double *tmp, double *W) {
+    int n = rows * cols;
+    for (int i = 0; i < n; i++) {
+        noise[i] = random_gaussian(0.0, 1.0);
+    }
+    times_lower_transpose(noise, L_col, rows, cols, tmp);
+    lower_times(L_row, tmp, rows, cols, W);
+    for (int i = 0; i < n; i++) {
+        W[i] += M[i];
+    }
+}
+
+void matnorm_posterior_factor_grads(const double *G, const double *noise, const double *L_row, const double *L_col,
+                                    int rows, int cols, double *tmp, double *grad_L_row, double *grad_L_col) {
+    // dL/dL_row = G (E L_col^T)^T, lower triangle.
+    times_lower_transpose(noise, L_col, rows, cols, tmp);
+    for (int i = 0; i < rows; i++) {
+        const double *g = G + (size_t) i * cols;
+        for (int k = 0; k <= i; k++) {
+            const double *t = tmp + (size_t) k * cols;
+            double sum = 0.0;
+            for (int j = 0; j < cols; j++) {
+                sum += g[j] * t[j];
+            }
+            grad_L_row[(size_t) i * rows + k] += sum;
+        }
+    }
+    // dL/dL_col = G^T (L_row E), lower triangle, accumulated one row of G at a time.
+    lower_times(L_row, noise, rows, cols, tmp);
+    for (int i = 0; i < rows; i++) {
+        const double *g = G + (size_t) i * cols;
+        const double *t = tmp + (size_t) i * cols;
+        for (int j = 0; j < cols; j++) {
+            double *gl = grad_L_col + (size_t) j * cols;
+            for (int k = 0; k <= j; k++) {
+                gl[k] += g[j] * t[k];
+            }
+        }
+    }
+}
+
+double matnorm_posterior_kl(const double *M, const double *L_row, const double *L_col, int rows, int cols,
+                            double prior_mean, double prior_variance,
+                            double *grad_M, double *grad_L_row, double *grad_L_col, double scale) {
+    int n = rows * cols;
+    double inv_v = 1.0 / prior_variance;
+    double norm_row = 0.0, norm_col = 0.0, logdet = 0.0, dist = 0.0;
+    for (int i = 0; i < rows; i++) {
+        for (int k = 0; k <= i; k++) {
+            norm_row += L_row[(size_t) i * rows + k] * L_row[(size_t) i * rows + k];
+        }
+        logdet += 2.0 * cols * log(fabs(L_row[(size_t) i * rows + i]));
+    }
+    for (int j = 0; j < cols; j++) {
+        for (int k = 0; k <= j; k++) {
+            norm_col += L_col[(size_t) j * cols + k] * L_col[(size_t) j * cols + k];
+        }
+        logdet += 2.0 * rows * log(fabs(L_col[(size_t) j * cols + j]));
+    }
+    for (int i = 0; i < n; i++) {
+        double d = M[i] - prior_mean;
+        dist += d * d;
+    }
+    double kl = 0.5 * ((norm_row * norm_col + dist) * inv_v - n + n * log(prior_variance) - logdet);
+    
+    if (grad_M && grad_L_row && grad_L_col) {
+        for (int i = 0; i < n; i++) {
+            grad_M[i] += scale * (M[i] - prior_mean) * inv_v;
+        }
+        for (int i = 0; i < rows; i++) {
+            for (int k = 0; k <= i; k++) {
+                grad_L_row[(size_t) i * rows + k] += scale * norm_col * inv_v * L_row[(size_t) i * rows + k];
+            }
+            grad_L_row[(size_t) i * rows + i] -= scale * cols / L_row[(size_t) i * rows + i];
+        }
+        for (int j = 0; j < cols; j++) {
+            for (int k = 0; k <= j; k++) {
+                grad_L_col[(size_t) j * cols + k] += scale * norm_row * inv_v * L_col[(size_t) j * cols + k];
+            }
+            grad_L_col[(size_t) j * cols + j] -= scale * rows / L_col[(size_t) j * cols + j];
+        }
+    }
+    return kl;
+}
@@ -12,4 +12,54 @@ typedef struct {
 // Create a structured posterior object with the specified structure_scale.
 Posterior* create_structured_posterior(double structure_scale);
 
+// Low-rank plus diagonal Gaussian posterior over n weights (covariance_structure == 2),
+//   q(w) = N(mu, diag(exp(logvar)) + U U^T),  U: n x rank, row-major,
+// sampled as w = mu + exp(logvar / 2) * eps + U z with eps ~ N(0, I_n) and z ~ N(0, I_rank).
+// The layer owns mu, logvar and U; these kernels only read them.
+
+// Largest supported rank.
+#define LOWRANK_MAX_RANK 64
+
+// Draw w given the shared factor sample z: each weight gets its own diagonal noise, scaled by
+// sigma = exp(logvar / 2), plus the dot product of its row of U with z (together one
+// n x rank by rank x 1 product).
+void lowrank_posterior_sample(const double *mu, const double *sigma, const double *U, const double *z,
+                              int n, int rank, double *w);
+
+// Closed-form KL(q || N(prior_mean, prior_variance * I)):
+//   KL = 0.5 * ((tr(S) + |mu - m|^2) / v - n + n log(v) - log det S),  S = D + U U^T,
+// with log det S = sum(logvar) + log det(I + U^T D^-1 U) by the matrix determinant lemma,
+// so only a rank x rank matrix is factorized. If grad_mu / grad_logvar / grad_U are non-NULL,
+// scale times the gradients are added to them:
+//   dKL/dmu = (mu - m) / v,  dKL/dlogvar_j = 0.5 * (s_j / v - 1 + u_j^T A^-1 u_j / s_j),
+//   dKL/dU = U / v - D^-1 U A^-1,  A = I + U^T D^-1 U,  s_j = exp(logvar_j).
+double lowrank_posterior_kl(const double *mu, const double *logvar, const double *U, int n, int rank,
+                            double prior_mean, double prior_variance,
+                            double *grad_mu, double *grad_logvar, double *grad_U, double scale);
+
+// Matrix-normal posterior over a rows x cols weight matrix (covariance_structure == 3),
+//   W ~ MN(M, U, V),  i.e. vec(W) ~ N(vec(M), V kron U),  U = L_row L_row^T,  V = L_col L_col^T,
+// with L_row (rows x rows) and L_col (cols x cols) lower-triangular Cholesky factors stored
+// as full row-major squares whose upper triangles stay zero. Samples are
+// W = M + L_row E L_col^T with E ~ N(0, I).
+
+// Draw E into 'noise' and write W = M + L_row E L_col^T (two triangular products).
+// 'tmp' is rows x cols scratch.
+void matnorm_posterior_sample(const double *M, const double *L_row, const double *L_col, int rows, int cols,
+                              double *noise, double *tmp, double *W);
+
+// Add the gradients of the loss with respect to L_row and L_col for a sample drawn with
+// 'noise', given G = dL/dW: tril(G L_col E^T) and tril(G^T L_row E). 'tmp' is rows x cols scratch.
+void matnorm_posterior_factor_grads(const double *G, const double *noise, const double *L_row, const double *L_col,
+                                    int rows, int cols, double *tmp, double *grad_L_row, double *grad_L_col);
+
+// Closed-form KL(MN(M, U, V) || N(prior_mean, prior_variance * I)). By the Kronecker identities
+// tr(V kron U) = tr(U) tr(V) = |L_row|^2 |L_col|^2 and
+// log det(V kron U) = cols * log det U + rows * log det V, both read off the factors:
+//   KL = 0.5 * ((|L_row|^2 |L_col|^2 + |M - m|^2) / v - n + n log(v) - log det(V kron U)),  n = rows * cols.
+// If the gradient arrays are non-NULL, scale times the gradients are added to them.
+double matnorm_posterior_kl(const double *M, const double *L_row, const double *L_col, int rows, int cols,
+                            double prior_mean, double prior_variance,
+                            double *grad_M, double *grad_L_row, double *grad_L_col, double scale);
+
 #endif // POSTERIOR_STRUCTURED_H
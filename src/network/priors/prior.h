@@ -11,6 +11,25 @@ typedef struct Prior {
     
     // Function pointer to compute the log-probability of a value under the prior.
     double (*log_prob)(struct Prior *prior, double x);
+    
+    // Function pointer to compute the KL divergence summed over a contiguous tensor of n
+    // parameters in one pass. If grad_mu and grad_logvar are non-NULL, scale * dKL/dmu[i] and
+    // scale * dKL/dlogvar[i] are added to them. May be NULL, in which case callers fall back
+    // to compute_kl() per parameter (see prior_kl_sum() in prior_gaussian.h).
+    double (*kl_sum)(struct Prior *prior, const double *mu, const double *logvar, int n,
+                     double *grad_mu, double *grad_logvar, double scale);
+    
+    // Function pointer to compute the log-probability summed over n values w[i]. If grad_w is
+    // non-NULL, d log p / dw[i] is stored in it. Used by the Monte Carlo KL estimator
+    // (prior_mc_kl_sum() in prior_gaussian.h); may be NULL, in which case log_prob() is
+    // called per value and no gradient is available.
+    double (*log_prob_sum)(struct Prior *prior, const double *w, int n, double *grad_w);
+    
+    // Function pointer to add scale * dKL/dmu[i] and scale * dKL/dlogvar[i] to grad_mu and
+    // grad_logvar without computing the KL itself. Layer backward passes call it (through
+    // prior_grad_kl()) on each block of gradients they have just written.
+    void (*grad_kl)(struct Prior *prior, const double *mu, const double *logvar, int n,
+                    double *grad_mu, double *grad_logvar, double scale);
 } Prior;
 
 #endif // PRIOR_H
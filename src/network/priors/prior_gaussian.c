@@ -0,0 +1,273 @@
+#include "prior_gaussian.h"
+#include "../utils/fast_math.h"
+#include "../utils/thread_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+// Define a structure to hold Gaussian-specific parameters.
+typedef struct {
+    double mean;
+    double variance;
+} GaussianPriorData;
+
+// One term of the Gaussian KL:
+//   KL = 0.5 * ((sigma^2 + (mu - m)^2) / v - 1 + log(v) - logvar)
+//   dKL/dmu = (mu - m) / v,  dKL/dlogvar = 0.5 * (sigma^2 / v - 1)
+// 'c' is the hoisted constant log(v) - 1.
+static inline double gaussian_kl_term(double mu, double logvar, double m, double inv_v, double c,
+                                      double *g_mu, double *g_logvar) {
+    double sigma2 = fast_exp(logvar);
+    double d = mu - m;
+    *g_mu = d * inv_v;
+    *g_logvar = 0.5 * (sigma2 * inv_v - 1.0);
+    return 0.5 * ((sigma2 + d * d) * inv_v + c - logvar);
+}
+
+double gaussian_kl_sum(double prior_mean, double prior_variance, const double *mu, const double *logvar, int n,
+                       double *grad_mu, double *grad_logvar, double scale) {
+    double inv_v = 1.0 / prior_variance;
+    double c = log(prior_variance) - 1.0;
+    int with_grad = (grad_mu != NULL && grad_logvar != NULL);
+    // Four independent accumulators so consecutive terms do not serialize on one add.
+    double acc[4] = {0.0, 0.0, 0.0, 0.0};
+    double gm, gl;
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            acc[j] += gaussian_kl_term(mu[i + j], logvar[i + j], prior_mean, inv_v, c, &gm, &gl);
+            if (with_grad) {
+                grad_mu[i + j] += scale * gm;
+                grad_logvar[i + j] += scale * gl;
+            }
+        }
+    }
+    for (; i < n; i++) {
+        acc[0] += gaussian_kl_term(mu[i], logvar[i], prior_mean, inv_v, c, &gm, &gl);
+        if (with_grad) {
+            grad_mu[i] += scale * gm;
+            grad_logvar[i] += scale * gl;
+        }
+    }
+    return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+void gaussian_grad_kl(double prior_mean, double prior_variance, const double *mu, const double *logvar, int n,
+                      double *grad_mu, double *grad_logvar, double scale) {
+    double inv_v = 1.0 / prior_variance;
+    for (int i = 0; i < n; i++) {
+        grad_mu[i] += scale * (mu[i] - prior_mean) * inv_v;
+        grad_logvar[i] += scale * 0.5 * (fast_exp(logvar[i]) * inv_v - 1.0);
+    }
+}
+
+static void grad_kl_serial(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                           double *grad_mu, double *grad_logvar, double scale) {
+    if (prior == NULL) {
+        gaussian_grad_kl(0.0, default_variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+    } else if (prior->grad_kl) {
+        prior->grad_kl(prior, mu, logvar, n, grad_mu, grad_logvar, scale);
+    } else if (prior->kl_sum) {
+        prior->kl_sum(prior, mu, logvar, n, grad_mu, grad_logvar, scale);
+    }
+}
+
+static double kl_sum_serial(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                            double *grad_mu, double *grad_logvar, double scale) {
+    if (prior == NULL) {
+        return gaussian_kl_sum(0.0, default_variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+    }
+    if (prior->kl_sum) {
+        return prior->kl_sum(prior, mu, logvar, n, grad_mu, grad_logvar, scale);
+    }
+    double kl_total = 0.0;
+    for (int i = 0; i < n; i++) {
+        kl_total += prior->compute_kl(prior, mu[i], logvar[i]);
+    }
+    return kl_total;
+}
+
+// Tensors longer than KL_BLOCK are reduced in blocks of that size on the kernel threads (see
+// parallel_sum()). The priors keep no per-call state, so blocks can run concurrently.
+#define KL_BLOCK 8192
+
+typedef struct {
+    Prior *prior;
+    double default_variance;
+    const double *mu;
+    const double *logvar;
+    double *grad_mu;
+    double *grad_logvar;
+    double scale;
+} KLTask;
+
+static double kl_block(void *arg, int begin, int end) {
+    KLTask *t = (KLTask*)arg;
+    return kl_sum_serial(t->prior, t->default_variance, t->mu + begin, t->logvar + begin, end - begin,
+                         t->grad_mu ? t->grad_mu + begin : NULL, t->grad_logvar ? t->grad_logvar + begin : NULL,
+                         t->scale);
+}
+
+static void grad_kl_block(void *arg, int begin, int end) {
+    KLTask *t = (KLTask*)arg;
+    grad_kl_serial(t->prior, t->default_variance, t->mu + begin, t->logvar + begin, end - begin,
+                   t->grad_mu + begin, t->grad_logvar + begin, t->scale);
+}
+
+void prior_grad_kl(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                   double *grad_mu, double *grad_logvar, double scale) {
+    if (n <= KL_BLOCK) {
+        grad_kl_serial(prior, default_variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+        return;
+    }
+    KLTask task = { prior, default_variance, mu, logvar, grad_mu, grad_logvar, scale };
+    parallel_for_elements(n, KL_BLOCK, grad_kl_block, &task);
+}
+
+double prior_kl_sum(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                    double *grad_mu, double *grad_logvar, double scale) {
+    if (n <= KL_BLOCK) {
+        return kl_sum_serial(prior, default_variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+    }
+    KLTask task = { prior, default_variance, mu, logvar, grad_mu, grad_logvar, scale };
+    return parallel_sum(n, KL_BLOCK, kl_block, &task);
+}
+
+// Sum of log N(w_i | mean, variance), with d/dw_i stored in grad_w when it is non-NULL.
+static double gaussian_log_prob_sum(double mean, double variance, const double *w, int n, double *grad_w) {
+    double inv_v = 1.0 / variance;
+    double acc[4] = {0.0, 0.0, 0.0, 0.0};
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            double d = w[i + j] - mean;
+            acc[j] += d * d;
+            if (grad_w) {
+                grad_w[i + j] = -d * inv_v;
+            }
+        }
+    }
+    for (; i < n; i++) {
+        double d = w[i] - mean;
+        acc[0] += d * d;
+        if (grad_w) {
+            grad_w[i] = -d * inv_v;
+        }
+    }
+    return -0.5 * (n * log(2 * M_PI * variance) + ((acc[0] + acc[1]) + (acc[2] + acc[3])) * inv_v);
+}
+
+// The prior's log-density over a chunk of weights (see prior_mc_kl_sum()).
+static double chunk_log_prob(Prior *prior, double default_variance, const double *w, int n, double *grad_w) {
+    if (prior == NULL) {
+        return gaussian_log_prob_sum(0.0, default_variance, w, n, grad_w);
+    }
+    if (prior->log_prob_sum) {
+        return prior->log_prob_sum(prior, w, n, grad_w);
+    }
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        total += prior->log_prob(prior, w[i]);
+        if (grad_w) {
+            grad_w[i] = 0.0;
+        }
+    }
+    return total;
+}
+
+// Weights are processed in chunks so the prior's gradient fits in a stack buffer that is still
+// in L1 when the posterior terms are added.
+#define MC_KL_CHUNK 256
+
+double prior_mc_kl_sum(Prior *prior, double default_variance, const double *mu, const double *logvar,
+                       const double *w, int n, double *grad_mu, double *grad_logvar, double scale) {
+    double g[MC_KL_CHUNK];
+    int with_grad = (grad_mu != NULL && grad_logvar != NULL);
+    double log_p = 0.0;
+    double log_q = 0.0;
+    for (int start = 0; start < n; start += MC_KL_CHUNK) {
+        int len = (n - start < MC_KL_CHUNK) ? n - start : MC_KL_CHUNK;
+        log_p += chunk_log_prob(prior, default_variance, w + start, len, with_grad ? g : NULL);
+        // log q(w) = -0.5 * (log(2*pi) + logvar + eps^2) with eps^2 = (w - mu)^2 / exp(logvar).
+        // Along the reparameterization path dlog q/dmu = 0 and dlog q/dlogvar = -0.5, and
+        // dw/dmu = 1, dw/dlogvar = 0.5 * (w - mu).
+        for (int j = 0; j < len; j++) {
+            int i = start + j;
+            double d = w[i] - mu[i];
+            log_q -= 0.5 * (logvar[i] + d * d * fast_exp(-logvar[i]));
+            if (with_grad) {
+                grad_mu[i] -= scale * g[j];
+                grad_logvar[i] -= scale * (0.5 + 0.5 * g[j] * d);
+            }
+        }
+    }
+    return log_q - 0.5 * n * log(2 * M_PI) - log_p;
+}
+
+static double gaussian_log_prob_sum_impl(Prior *prior, const double *w, int n, double *grad_w) {
+    GaussianPriorData *data = (GaussianPriorData*) prior->data;
+    return gaussian_log_prob_sum(data->mean, data->variance, w, n, grad_w);
+}
+
+static double gaussian_kl_sum_impl(Prior *prior, const double *mu, const double *logvar, int n,
+                                   double *grad_mu, double *grad_logvar, double scale) {
+    GaussianPriorData *data = (GaussianPriorData*) prior->data;
+    return gaussian_kl_sum(data->mean, data->variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+}
+
+static void gaussian_grad_kl_impl(Prior *prior, const double *mu, const double *logvar, int n,
+                                  double *grad_mu, double *grad_logvar, double scale) {
+    GaussianPriorData *data = (GaussianPriorData*) prior->data;
+    gaussian_grad_kl(data->mean, data->variance, mu, logvar, n, grad_mu, grad_logvar, scale);
+}
+
+// Implementation of the KL divergence function pointer for the Gaussian prior.
+static double gaussian_compute_kl(Prior *prior, double mu, double logvar) {
+    return gaussian_kl_sum_impl(prior, &mu, &logvar, 1, NULL, NULL, 0.0);
+}
+
+// Implementation of the log-probability function pointer for the Gaussian prior.
+static double gaussian_log_prob(Prior *prior, double x) {
+    GaussianPriorData *data = (GaussianPriorData*) prior->data;
+    double d = x - data->mean;
+    return -0.5 * (log(2 * M_PI * data->variance) + d * d / data->variance);
+}
+
+// Create a Gaussian prior object.
+Prior* create_gaussian_prior(double mean, double variance) {
+    Prior *prior = (Prior*) malloc(sizeof(Prior));
+    if (!prior) {
+        fprintf(stderr, "Failed to allocate Gaussian prior.\n");
+        exit(EXIT_FAILURE);
+    }
+    GaussianPriorData *data = (GaussianPriorData*) malloc(sizeof(GaussianPriorData));
+    if (!data) {
+        fprintf(stderr, "Failed to allocate Gaussian prior data.\n");
+        exit(EXIT_FAILURE);
+    }
+    data->mean = mean;
+    data->variance = variance;
+    
+    prior->data = data;
+    prior->compute_kl = gaussian_compute_kl;
+    prior->log_prob = gaussian_log_prob;
+    prior->kl_sum = gaussian_kl_sum_impl;
+    prior->log_prob_sum = gaussian_log_prob_sum_impl;
+    prior->grad_kl = gaussian_grad_kl_impl;
+    return prior;
+}
+
+int prior_gaussian_params(const Prior *prior, double default_variance, double *mean, double *variance) {
+    if (prior == NULL) {
+        *mean = 0.0;
+        *variance = default_variance;
+        return 1;
+    }
+    if (prior->kl_sum != gaussian_kl_sum_impl) {
+        return 0;
+    }
+    const GaussianPriorData *data = (const GaussianPriorData*) prior->data;
+    *mean = data->mean;
+    *variance = data->variance;
+    return 1;
+}
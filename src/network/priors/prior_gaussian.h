@@ -0,0 +1,45 @@
+#ifndef PRIOR_GAUSSIAN_H
+#define PRIOR_GAUSSIAN_H
+
+#include "prior.h"
+
+// Create a Gaussian prior N(mean, variance).
+Prior* create_gaussian_prior(double mean, double variance);
+
+// Mean and variance of a Gaussian prior (N(0, default_variance) for a NULL prior). Returns 0,
+// leaving mean and variance untouched, when the prior is not Gaussian.
+int prior_gaussian_params(const Prior *prior, double default_variance, double *mean, double *variance);
+
+// Closed-form KL(N(mu_i, exp(logvar_i)) || N(prior_mean, prior_variance)) summed over n
+// parameters. If grad_mu / grad_logvar are non-NULL, scale * dKL/dmu_i and scale * dKL/dlogvar_i
+// are added to them. This is the kernel behind the Gaussian prior's kl_sum and the fallback
+// used by layers without a prior.
+double gaussian_kl_sum(double prior_mean, double prior_variance, const double *mu, const double *logvar, int n,
+                       double *grad_mu, double *grad_logvar, double scale);
+
+// Gradient-only counterpart of gaussian_kl_sum(): adds scale * dKL/dmu_i and scale * dKL/dlogvar_i.
+void gaussian_grad_kl(double prior_mean, double prior_variance, const double *mu, const double *logvar, int n,
+                      double *grad_mu, double *grad_logvar, double scale);
+
+// KL sum over one parameter tensor for any prior: uses prior->kl_sum when the prior has one,
+// falls back to per-parameter compute_kl() calls otherwise (no gradients), and to
+// gaussian_kl_sum() with N(0, default_variance) when prior is NULL.
+double prior_kl_sum(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                    double *grad_mu, double *grad_logvar, double scale);
+
+// Add scale * dKL/dmu and scale * dKL/dlogvar for any prior: uses prior->grad_kl, then
+// prior->kl_sum, and gaussian_grad_kl() with N(0, default_variance) when prior is NULL.
+// Priors with neither contribute nothing.
+void prior_grad_kl(Prior *prior, double default_variance, const double *mu, const double *logvar, int n,
+                   double *grad_mu, double *grad_logvar, double scale);
+
+// Monte Carlo estimate of the same KL from one posterior sample per parameter,
+//   KL ~= sum_i log q(w_i) - log p(w_i),  q = N(mu_i, exp(logvar_i)),
+// where w are the weights drawn in the forward pass. It is unbiased for any prior with a
+// log_prob_sum, including those without a closed-form KL. If grad_mu / grad_logvar are
+// non-NULL, scale times the reparameterization gradients (w = mu + exp(logvar / 2) * eps with
+// eps held fixed) are added to them. Without a prior N(0, default_variance) is used.
+double prior_mc_kl_sum(Prior *prior, double default_variance, const double *mu, const double *logvar,
+                       const double *w, int n, double *grad_mu, double *grad_logvar, double scale);
+
+#endif // PRIOR_GAUSSIAN_H
@@ -1,55 +1,238 @@
 #include "prior_mixture.h"
+#include "../utils/fast_math.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
 
-// Define a structure to hold parameters for a two-component mixture-of-Gaussians.
+// Parameters of a K-component mixture of Gaussians, plus the per-component constants used by
+// the kernels, computed once in create_mixture_prior_k().
 typedef struct {
-    double mu1, sigma1;
-    double mu2, sigma2;
-    double lambda; // Mixing coefficient for the first component (the weight for the second is 1 - lambda).
+    int num_components;
+    double weight[MIXTURE_MAX_COMPONENTS]; // Mixing weights, normalized to sum to 1.
+    double mean[MIXTURE_MAX_COMPONENTS];
+    double sigma[MIXTURE_MAX_COMPONENTS];
+    double log_weight[MIXTURE_MAX_COMPONENTS]; // log(w_k)
+    double log_norm[MIXTURE_MAX_COMPONENTS];   // log(w_k) - 0.5 * log(2*pi*v_k), v_k = sigma_k^2
+    double inv_var[MIXTURE_MAX_COMPONENTS];    // 1 / v_k
+    double kl_const[MIXTURE_MAX_COMPONENTS];   // log(v_k) - 1
 } MixturePriorData;
 
-// Compute the log-density for a single Gaussian.
-static double gaussian_log_density(double x, double mu, double sigma) {
-    return -0.5 * (log(2 * M_PI) + 2 * log(sigma) + pow((x - mu) / sigma, 2));
+// The kernels work on chunks of MIXTURE_CHUNK values with the components in the outer loop and
+// the values in the inner one. Per-value state lives in stack buffers of this size.
+#define MIXTURE_CHUNK 256
+
+// Branch-free max (a floating-point compare would keep the loops from being if-converted).
+static inline double branchless_max(double a, double b) {
+    return 0.5 * (a + b + fabs(a - b));
 }
 
-// Compute the log-density of a two-component mixture-of-Gaussians.
-// p(x) = lambda * N(x|mu1, sigma1^2) + (1-lambda) * N(x|mu2, sigma2^2)
-// For numerical stability, use log-sum-exp.
-static double mixture_log_density(double x, MixturePriorData *data) {
-    double log_prob1 = log(data->lambda) + gaussian_log_density(x, data->mu1, data->sigma1);
-    double log_prob2 = log(1.0 - data->lambda) + gaussian_log_density(x, data->mu2, data->sigma2);
-    // Use log-sum-exp:
-    double max_log = (log_prob1 > log_prob2) ? log_prob1 : log_prob2;
-    return max_log + log(exp(log_prob1 - max_log) + exp(log_prob2 - max_log));
+// The passes below are branch-free sweeps over non-overlapping buffers, one inner loop per
+// component. Their main loops run a multiple of 8 iterations so that the vectorizer needs no
+// scalar epilogue (which the -O2 cost model refuses); the remainder goes through a second loop.
+// The component loop sits inside each pass so that the inner loops keep their restrict
+// pointers when the pass is inlined into the chunk loop.
+
+// amax[j] = max_k (c_k - 0.5 * (x[j] - m_k)^2 / v_k), with c_k = log_norm[k].
+static void log_density_max(double *restrict amax, const double *restrict x, int n,
+                            const MixturePriorData *data) {
+    int n_main = n & ~7;
+    for (int j = 0; j < n; j++) {
+        double d = x[j] - data->mean[0];
+        amax[j] = data->log_norm[0] - 0.5 * d * d * data->inv_var[0];
+    }
+    for (int k = 1; k < data->num_components; k++) {
+        double c = data->log_norm[k], m = data->mean[k], iv = data->inv_var[k];
+        int j = 0;
+        for (; j < n_main; j++) {
+            double d = x[j] - m;
+            amax[j] = branchless_max(amax[j], c - 0.5 * d * d * iv);
+        }
+        for (; j < n; j++) {
+            double d = x[j] - m;
+            amax[j] = branchless_max(amax[j], c - 0.5 * d * d * iv);
+        }
+    }
 }
 
-// A simple approximation for the KL divergence between a Gaussian variational posterior N(mu, sigma^2)
-// and the mixture prior can be done by: KL ≈ E_q[log q(x)] - E_q[log p(x)]
-// Here we approximate E_q[log p(x)] by evaluating at mu.
-static double kl_divergence_mixture(double mu, double logvar, MixturePriorData *data) {
-    double sigma2 = exp(logvar);
-    double log_q = -0.5 * log(2 * M_PI * M_E * sigma2);
-    double log_p = mixture_log_density(mu, data);
-    return log_q - log_p;
+// sum[j] = sum_k exp(c_k - 0.5 * (x[j] - m_k)^2 / v_k - amax[j]) and gsum[j] its x-derivative.
+static void log_density_sum(double *restrict sum, double *restrict gsum, const double *restrict x,
+                            const double *restrict amax, int n, const MixturePriorData *data) {
+    int n_main = n & ~7;
+    for (int j = 0; j < n; j++) {
+        sum[j] = 0.0;
+        gsum[j] = 0.0;
+    }
+    for (int k = 0; k < data->num_components; k++) {
+        double c = data->log_norm[k], m = data->mean[k], iv = data->inv_var[k];
+        int j = 0;
+        for (; j < n_main; j++) {
+            double d = x[j] - m;
+            double e = fast_exp(c - 0.5 * d * d * iv - amax[j]);
+            sum[j] += e;
+            gsum[j] -= e * d * iv;
+        }
+        for (; j < n; j++) {
+            double d = x[j] - m;
+            double e = fast_exp(c - 0.5 * d * d * iv - amax[j]);
+            sum[j] += e;
+            gsum[j] -= e * d * iv;
+        }
+    }
+}
+
+// amax[j] = max_k (log w_k - KL_k[j]) (see mixture_kl_sum()); s2 = exp(logvar).
+static void kl_term_max(double *restrict amax, const double *restrict mu, const double *restrict logvar,
+                        const double *restrict s2, int n, const MixturePriorData *data) {
+    int n_main = n & ~7;
+    for (int j = 0; j < n; j++) {
+        double d = mu[j] - data->mean[0];
+        amax[j] = data->log_weight[0]
+                  - 0.5 * ((s2[j] + d * d) * data->inv_var[0] + data->kl_const[0] - logvar[j]);
+    }
+    for (int k = 1; k < data->num_components; k++) {
+        double lw = data->log_weight[k], m = data->mean[k], iv = data->inv_var[k], c = data->kl_const[k];
+        int j = 0;
+        for (; j < n_main; j++) {
+            double d = mu[j] - m;
+            amax[j] = branchless_max(amax[j], lw - 0.5 * ((s2[j] + d * d) * iv + c - logvar[j]));
+        }
+        for (; j < n; j++) {
+            double d = mu[j] - m;
+            amax[j] = branchless_max(amax[j], lw - 0.5 * ((s2[j] + d * d) * iv + c - logvar[j]));
+        }
+    }
+}
+
+// Unnormalized responsibilities sum[j] and the responsibility-weighted KL_k gradients gm, gl.
+static void kl_term_sum(double *restrict sum, double *restrict gm, double *restrict gl,
+                        const double *restrict mu, const double *restrict logvar,
+                        const double *restrict s2, const double *restrict amax, int n,
+                        const MixturePriorData *data) {
+    int n_main = n & ~7;
+    for (int j = 0; j < n; j++) {
+        sum[j] = 0.0;
+        gm[j] = 0.0;
+        gl[j] = 0.0;
+    }
+    for (int k = 0; k < data->num_components; k++) {
+        double lw = data->log_weight[k], m = data->mean[k], iv = data->inv_var[k], c = data->kl_const[k];
+        int j = 0;
+        for (; j < n_main; j++) {
+            double d = mu[j] - m;
+            double e = fast_exp(lw - 0.5 * ((s2[j] + d * d) * iv + c - logvar[j]) - amax[j]);
+            sum[j] += e;
+            gm[j] += e * d * iv;
+            gl[j] += e * 0.5 * (s2[j] * iv - 1.0);
+        }
+        for (; j < n; j++) {
+            double d = mu[j] - m;
+            double e = fast_exp(lw - 0.5 * ((s2[j] + d * d) * iv + c - logvar[j]) - amax[j]);
+            sum[j] += e;
+            gm[j] += e * d * iv;
+            gl[j] += e * 0.5 * (s2[j] * iv - 1.0);
+        }
+    }
+}
+
+// Log-density of the mixture, log sum_k w_k N(x | m_k, v_k), by log-sum-exp over the
+// components. With a non-NULL grad_w the derivative, the responsibility-weighted sum of
+// -(x - m_k) / v_k, is stored too.
+static double mixture_log_prob_sum(Prior *prior, const double *w, int n, double *grad_w) {
+    const MixturePriorData *data = (const MixturePriorData*) prior->data;
+    double amax[MIXTURE_CHUNK], sum[MIXTURE_CHUNK], gsum[MIXTURE_CHUNK];
+    double total = 0.0;
+    for (int start = 0; start < n; start += MIXTURE_CHUNK) {
+        int len = (n - start < MIXTURE_CHUNK) ? n - start : MIXTURE_CHUNK;
+        const double *x = w + start;
+        // Pass 1: the largest component term of each value, for a stable log-sum-exp.
+        log_density_max(amax, x, len, data);
+        // Pass 2: the scaled component densities and their derivatives.
+        log_density_sum(sum, gsum, x, amax, len, data);
+        for (int j = 0; j < len; j++) {
+            total += amax[j] + fast_log(sum[j]);
+        }
+        if (grad_w) {
+            for (int j = 0; j < len; j++) {
+                grad_w[start + j] = gsum[j] / sum[j];
+            }
+        }
+    }
+    return total;
+}
+
+// KL between a Gaussian posterior N(mu, s2) (s2 = exp(logvar)) and the mixture has no closed
+// form. We use the variational approximation of Hershey & Olsen (2007), which for a
+// single-Gaussian q reduces to
+//   KL ~= -log(sum_k w_k * exp(-KL_k)),  KL_k = 0.5 * ((s2 + (mu - m_k)^2) / v_k - 1 + log(v_k) - logvar)
+// with KL_k the closed-form KL to component k. Its gradient is the responsibility-weighted
+// sum of the component gradients dKL_k/dmu = (mu - m_k) / v_k and dKL_k/dlogvar = 0.5 * (s2 / v_k - 1).
+static double mixture_kl_sum(Prior *prior, const double *mu, const double *logvar, int n,
+                             double *grad_mu, double *grad_logvar, double scale) {
+    const MixturePriorData *data = (const MixturePriorData*) prior->data;
+    int with_grad = (grad_mu != NULL && grad_logvar != NULL);
+    double s2[MIXTURE_CHUNK], amax[MIXTURE_CHUNK], sum[MIXTURE_CHUNK];
+    double gm[MIXTURE_CHUNK], gl[MIXTURE_CHUNK];
+    double total = 0.0;
+    for (int start = 0; start < n; start += MIXTURE_CHUNK) {
+        int len = (n - start < MIXTURE_CHUNK) ? n - start : MIXTURE_CHUNK;
+        const double *m_q = mu + start;
+        const double *lv_q = logvar + start;
+        // Pass 1: posterior variances and the largest log w_k - KL_k of each parameter.
+        for (int j = 0; j < len; j++) {
+            s2[j] = fast_exp(lv_q[j]);
+        }
+        kl_term_max(amax, m_q, lv_q, s2, len, data);
+        // Pass 2: unnormalized responsibilities and the weighted component gradients.
+        kl_term_sum(sum, gm, gl, m_q, lv_q, s2, amax, len, data);
+        for (int j = 0; j < len; j++) {
+            total -= amax[j] + fast_log(sum[j]);
+        }
+        if (with_grad) {
+            for (int j = 0; j < len; j++) {
+                double r = scale / sum[j];
+                grad_mu[start + j] += gm[j] * r;
+                grad_logvar[start + j] += gl[j] * r;
+            }
+        }
+    }
+    return total;
+}
+
+// Implementation of the grad_kl function pointer: the kl_sum kernel with its result unused
+// (the KL terms share nearly all their work with the gradients).
+static void mixture_grad_kl(Prior *prior, const double *mu, const double *logvar, int n,
+                            double *grad_mu, double *grad_logvar, double scale) {
+    mixture_kl_sum(prior, mu, logvar, n, grad_mu, grad_logvar, scale);
 }
 
 // Implementation of the KL divergence function pointer for the mixture prior.
 static double mixture_compute_kl(Prior *prior, double mu, double logvar) {
-    MixturePriorData *data = (MixturePriorData*) prior->data;
-    return kl_divergence_mixture(mu, logvar, data);
+    return mixture_kl_sum(prior, &mu, &logvar, 1, NULL, NULL, 0.0);
 }
 
 // Implementation of the log-probability function pointer for the mixture prior.
 static double mixture_log_prob(Prior *prior, double x) {
-    MixturePriorData *data = (MixturePriorData*) prior->data;
-    return mixture_log_density(x, data);
+    return mixture_log_prob_sum(prior, &x, 1, NULL);
 }
 
-// Create a mixture-of-Gaussians prior object.
-Prior* create_mixture_prior(double mu1, double sigma1, double mu2, double sigma2, double lambda) {
+// Create a K-component mixture-of-Gaussians prior object.
+Prior* create_mixture_prior_k(int num_components, const double *weights, const double *means, const double *sigmas) {
+    if (num_components < 1 || num_components > MIXTURE_MAX_COMPONENTS) {
+        fprintf(stderr, "Mixture prior needs 1 to %d components, got %d.\n", MIXTURE_MAX_COMPONENTS, num_components);
+        exit(EXIT_FAILURE);
+    }
+    double weight_sum = 0.0;
+    for (int k = 0; k < num_components; k++) {
+        if (!(sigmas[k] > 0.0) || !(weights[k] >= 0.0)) {
+            fprintf(stderr, "Mixture prior component %d needs sigma > 0 and weight >= 0.\n", k);
+            exit(EXIT_FAILURE);
+        }
+        weight_sum += weights[k];
+    }
+    if (!(weight_sum > 0.0)) {
+        fprintf(stderr, "Mixture prior weights must not all be zero.\n");
+        exit(EXIT_FAILURE);
+    }
     Prior *prior = (Prior*) malloc(sizeof(Prior));
     if (!prior) {
         fprintf(stderr, "Failed to allocate Mixture prior.\n");
@@ -60,14 +243,32 @@ Prior* create_mixture_prior(double mu1, double sigma1, double mu2, double sigma2
         fprintf(stderr, "Failed to allocate Mixture prior data.\n");
         exit(EXIT_FAILURE);
     }
-    data->mu1 = mu1;
-    data->sigma1 = sigma1;
-    data->mu2 = mu2;
-    data->sigma2 = sigma2;
-    data->lambda = lambda;
-    
+    data->num_components = num_components;
+    for (int k = 0; k < num_components; k++) {
+        double v = sigmas[k] * sigmas[k];
+        data->weight[k] = weights[k] / weight_sum;
+        data->mean[k] = means[k];
+        data->sigma[k] = sigmas[k];
+        // Empty components keep a finite log weight; they still contribute nothing measurable.
+        data->log_weight[k] = log(data->weight[k] > 1e-12 ? data->weight[k] : 1e-12);
+        data->log_norm[k] = data->log_weight[k] - 0.5 * log(2 * M_PI * v);
+        data->inv_var[k] = 1.0 / v;
+        data->kl_const[k] = log(v) - 1.0;
+    }
+
     prior->data = data;
     prior->compute_kl = mixture_compute_kl;
     prior->log_prob = mixture_log_prob;
+    prior->kl_sum = mixture_kl_sum;
+    prior->log_prob_sum = mixture_log_prob_sum;
+    prior->grad_kl = mixture_grad_kl;
     return prior;
 }
+
+// Create a two-component mixture-of-Gaussians prior object.
+Prior* create_mixture_prior(double mu1, double sigma1, double mu2, double sigma2, double lambda) {
+    const double weights[2] = {lambda, 1.0 - lambda};
+    const double means[2] = {mu1, mu2};
+    const double sigmas[2] = {sigma1, sigma2};
+    return create_mixture_prior_k(2, weights, means, sigmas);
+}
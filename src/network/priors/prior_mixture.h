@@ -3,8 +3,16 @@
 
 #include "prior.h"
 
-// Create a mixture-of-Gaussians prior with specified parameters.
-// For simplicity, this example uses a two-component mixture.
+// Largest number of components a mixture prior may have.
+#define MIXTURE_MAX_COMPONENTS 8
+
+// Create a mixture-of-Gaussians prior sum_k w_k N(m_k, sigma_k^2) with 1 to
+// MIXTURE_MAX_COMPONENTS components. The weights are normalized to sum to 1. A scale
+// mixture (spike-and-slab style) uses equal means and a small and a large sigma.
+// Exits with an error on invalid parameters.
+Prior* create_mixture_prior_k(int num_components, const double *weights, const double *means, const double *sigmas);
+
+// Create a two-component mixture-of-Gaussians prior.
 // Inputs: mu1, sigma1 (for first Gaussian), mu2, sigma2 (for second Gaussian),
 // and a mixing coefficient lambda (0 <= lambda <= 1) for the first component.
 Prior* create_mixture_prior(double mu1, double sigma1, double mu2, double sigma2, double lambda);
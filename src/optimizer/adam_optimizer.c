@@ -32,12 +32,13 @@ void free_adam_state(AdamState* state) {
     free(state);
 }
 
-// Helper function to update moments and parameters for a vector of parameters
+// Helper function to update moments and parameters for a vector of parameters.
+// The four arrays must not overlap; the main loop then vectorizes.
 void update_moments_and_params(
-    double* params,
-    double* grads,
-    double* m,
-    double* v,
+    double* restrict params,
+    const double* restrict grads,
+    double* restrict m,
+    double* restrict v,
     int size,
     const Config* cfg,
     int t
@@ -47,83 +48,34 @@ void update_moments_and_params(
     double epsilon = cfg->adam_epsilon;
     double lr = cfg->learning_rate;
     
-    // Compute bias correction terms
-    double m_hat, v_hat;
-    double beta1_t = pow(beta1, t);
-    double beta2_t = pow(beta2, t);
+    // Bias corrections m_hat = m / (1 - beta1^t) and v_hat = v / (1 - beta2^t), as factors
+    double m_scale = 1.0 / (1.0 - pow(beta1, t));
+    double v_scale = 1.0 / (1.0 - pow(beta2, t));
     
-    for (int i = 0; i < size; i++) {
-        // Update biased first moment estimate
+    // Split at a multiple of 8 so that the main loop vectorizes (see vector_axpy()).
+    int i = 0;
+    for (; i < (size & ~7); i++) {
         m[i] = beta1 * m[i] + (1.0 - beta1) * grads[i];
-        
-        // Update biased second raw moment estimate
         v[i] = beta2 * v[i] + (1.0 - beta2) * grads[i] * grads[i];
-        
-        // Compute bias-corrected first moment estimate
-        m_hat = m[i] / (1.0 - beta1_t);
-        
-        // Compute bias-corrected second raw moment estimate
-        v_hat = v[i] / (1.0 - beta2_t);
-        
-        // Update parameters
-        params[i] -= lr * m_hat / (sqrt(v_hat) + epsilon);
+        params[i] -= lr * (m[i] * m_scale) / (sqrt(v[i] * v_scale) + epsilon);
+    }
+    for (; i < size; i++) {
+        m[i] = beta1 * m[i] + (1.0 - beta1) * grads[i];
+        v[i] = beta2 * v[i] + (1.0 - beta2) * grads[i] * grads[i];
+        params[i] -= lr * (m[i] * m_scale) / (sqrt(v[i] * v_scale) + epsilon);
     }
 }
 
-// Update parameters for BayesianLinear layer using Adam
-void adam_update_bayesian_linear(BayesianLinear *layer, AdamState *state, const Config *cfg) {
-    if (!layer || !state || !cfg) return;
-    
-    // Increment time step
-    state->t++;
-    
-    int total_weights = layer->output_dim * layer->input_dim;
-    
-    // Update weights
-    update_moments_and_params(
-        layer->W_mean->data,
-        layer->dW_mean->data,
-        state->m,
-        state->v,
-        total_weights,
-        cfg,
-        state->t
-    );
-    
-    // Update biases
-    update_moments_and_params(
-        layer->b_mean,
-        layer->db_mean,
-        state->m + total_weights,
-        state->v + total_weights,
-        layer->output_dim,
-        cfg,
-        state->t
-    );
-    
-    // Reset gradients
-    memset(layer->dW_mean->data, 0, total_weights * sizeof(double));
-    memset(layer->db_mean, 0, layer->output_dim * sizeof(double));
-}
-
-// Update parameters for StochasticActivation layer using Adam
-void adam_update_stochastic_activation(StochasticActivation *layer, AdamState *state, const Config *cfg) {
+// Update the dropout logit of a Concrete dropout layer using Adam
+void adam_update_concrete_dropout(DropoutLayer *layer, AdamState *state, const Config *cfg) {
     if (!layer || !state || !cfg) return;
     
     // Increment time step
     state->t++;
     
-    // Update alpha parameter
-    update_moments_and_params(
-        &layer->alpha_mean,
-        &layer->d_alpha_mean,
-        state->m,
-        state->v,
-        1,  // Only one parameter to update
-        cfg,
-        state->t
-    );
+    update_moments_and_params(&layer->p_logit, &layer->d_p_logit, state->m, state->v, 1, cfg, state->t);
+    layer->dropout_prob = 1.0 / (1.0 + exp(-layer->p_logit));
     
     // Reset gradient
-    layer->d_alpha_mean = 0.0;
-} 
\ No newline at end of file
+    layer->d_p_logit = 0.0;
+}
@@ -1,8 +1,7 @@
 #ifndef ADAM_OPTIMIZER_H
 #define ADAM_OPTIMIZER_H
 
-#include "../network/layers/bayesian_linear.h"
-#include "../network/layers/stochastic_activation.h"
+#include "../network/layers/dropout_layer.h"
 #include "../config/config.h"
 
 // Adam optimizer state structure
@@ -19,19 +18,18 @@ AdamState* init_adam_state(int size);
 // Free Adam state
 void free_adam_state(AdamState* state);
 
-// Update moments and parameters using Adam optimizer
+// Update moments and parameters using Adam optimizer (params, grads, m and v must not overlap)
 void update_moments_and_params(
-    double* params,
-    double* grads,
-    double* m,
-    double* v,
+    double* restrict params,
+    const double* restrict grads,
+    double* restrict m,
+    double* restrict v,
     int size,
     const Config* cfg,
     int t
 );
 
-// Update parameters using Adam optimizer
-void adam_update_bayesian_linear(BayesianLinear *layer, AdamState *state, const Config *cfg);
-void adam_update_stochastic_activation(StochasticActivation *layer, AdamState *state, const Config *cfg);
+// Update the Concrete dropout logit, the one parameter kept outside the network's ParamArena
+void adam_update_concrete_dropout(DropoutLayer *layer, AdamState *state, const Config *cfg);
 
 #endif // ADAM_OPTIMIZER_H 
\ No newline at end of file
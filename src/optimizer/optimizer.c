@@ -1,47 +1,28 @@
 #include "optimizer.h"
 #include "adam_optimizer.h"
 #include "../network/layers/bayesian_linear.h"
-#include "../network/layers/stochastic_activation.h"
+#include "../network/layers/bayesian_conv.h"
+#include "../network/layers/dropout_layer.h"
+#include "../utils/thread_pool.h"
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 
-// Update function for BayesianLinear layers using SGD.
-void update_bayesian_linear(BayesianLinear *layer, double lr) {
-    int total_weights = layer->output_dim * layer->input_dim;
-    
-    // Debug: print some parameter and gradient values before update.
-    // printf("Before update: W_mean[0] = %f, dW_mean[0] = %f\n", 
-    //        layer->W_mean->data[0], layer->dW_mean->data[0]);
-    // printf("Before update: b_mean[0] = %f, db_mean[0] = %f\n", 
-    //        layer->b_mean[0], layer->db_mean[0]);
-    
-    // Update weight parameters.
-    for (int i = 0; i < total_weights; i++) {
-        layer->W_mean->data[i] -= lr * layer->dW_mean->data[i];
-    }
-    // Update bias parameters.
-    for (int i = 0; i < layer->output_dim; i++) {
-        layer->b_mean[i] -= lr * layer->db_mean[i];
-    }
-    
-    // Debug: print parameters after update.
-    // printf("After update: W_mean[0] = %f\n", layer->W_mean->data[0]);
-    // printf("After update: b_mean[0] = %f\n", layer->b_mean[0]);
-    // fflush(stdout);
+// Update the dropout logit of a Concrete dropout layer using SGD.
+void update_concrete_dropout(DropoutLayer *layer, double lr) {
+    layer->p_logit -= lr * layer->d_p_logit;
+    layer->dropout_prob = 1.0 / (1.0 + exp(-layer->p_logit));
+    layer->d_p_logit = 0.0;
 }
 
-// Update function for StochasticActivation layers using SGD.
-void update_stochastic_activation(StochasticActivation *layer, double lr) {
-    if (!layer) {
-        printf("Warning: Invalid StochasticActivation layer in update.\n");
-        return;
+// Layers that cache exp(logvar / 2) recompute it after their log-variances change.
+static void mark_sigma_dirty(Layer *l) {
+    if (l->type == LAYER_BAYESIAN_LINEAR) {
+        ((BayesianLinear*)l->layer)->sigma_dirty = 1;
+    } else if (l->type == LAYER_BAYESIAN_CONV) {
+        ((BayesianConv*)l->layer)->sigma_dirty = 1;
     }
-    
-    // Update the alpha_mean parameter using the stored gradient
-    layer->alpha_mean -= lr * layer->d_alpha_mean;
-    
-    // Reset the gradient after update
-    layer->d_alpha_mean = 0.0;
 }
 
 // Calculate the decayed learning rate based on the current epoch
@@ -54,51 +35,113 @@ double calculate_decayed_lr(const Config *cfg, int current_epoch) {
     return cfg->learning_rate / (1.0 + cfg->lr_decay * current_epoch);
 }
 
+typedef struct {
+    double *params;
+    double *grads;
+    double *m;
+    double *v;
+    const Config *cfg;
+    int adam_t;
+    double lr;
+    int clear_grads;
+} SweepTask;
+
+// Update [begin, end) of one run of the arena; the kernel threads take disjoint ranges.
+static void sweep_range(void *arg, int begin, int end) {
+    SweepTask *t = (SweepTask*)arg;
+    if (t->cfg->optimizer == 1) {
+        update_moments_and_params(t->params + begin, t->grads + begin, t->m + begin, t->v + begin,
+                                  end - begin, t->cfg, t->adam_t);
+    } else {
+        vector_axpy(t->params + begin, -t->lr, t->grads + begin, end - begin);  // p -= lr * g
+    }
+    if (t->clear_grads) {
+        memset(t->grads + begin, 0, sizeof(double) * (end - begin));
+    }
+}
+
+// Update one slab of the parameter arena (logvar == 0: the means, otherwise the log-variances
+// and covariance factors) with a single flat sweep per run of consecutive layers that are not
+// frozen. Parameter-free layers do not break a run, and the zero padding between layers is
+// swept along. The mean gradients of the swept ranges are cleared afterwards.
+static void update_arena_slab(Network *net, const Config *cfg, double lr, int logvar) {
+    ParamArena *arena = net->arena;
+    double *params = logvar ? arena->logvar : arena->mean;
+    double *grads = logvar ? arena->grad_logvar : arena->grad_mean;
+    double *m = logvar ? arena->m_logvar : arena->m_mean;
+    double *v = logvar ? arena->v_logvar : arena->v_mean;
+    int start = -1, end = 0;
+    for (int i = 0; i <= net->num_layers; i++) {
+        Layer *l = (i < net->num_layers) ? net->layers[i] : NULL;
+        if (l) {
+            int count = logvar ? l->arena_logvar_count : l->arena_mean_count;
+            if (count == 0) {
+                continue;
+            }
+            if (!l->frozen) {
+                int offset = logvar ? l->arena_logvar_offset : l->arena_mean_offset;
+                start = (start < 0) ? offset : start;
+                end = offset + count;
+                continue;
+            }
+        }
+        // A frozen layer or the end of the network closes the run.
+        if (start >= 0) {
+            SweepTask task = { params + start, grads + start, m ? m + start : NULL, v ? v + start : NULL,
+                               cfg, arena->adam_t, lr, !logvar };
+            parallel_for_elements(end - start, parallel_grain(16), sweep_range, &task);
+            start = -1;
+        }
+    }
+}
+
 // Iterate over each layer in the network and update its parameters.
 void network_update_params(Network *net, const Config *cfg, int current_epoch) {
     // Calculate the decayed learning rate
     double decayed_lr = calculate_decayed_lr(cfg, current_epoch);
     
+    // Parameters in the arena are updated in flat sweeps; Adam uses one time step for all of them.
+    if (cfg->optimizer == 1) {
+        param_arena_init_adam(net->arena);
+        net->arena->adam_t++;
+    }
+    update_arena_slab(net, cfg, decayed_lr, 0);
+    if (cfg->bbb_learn_variance) {
+        update_arena_slab(net, cfg, decayed_lr, 1);
+    }
+    
     for (int i = 0; i < net->num_layers; i++) {
         printf("Updating layer %d with optimizer type: %d\n", i, cfg->optimizer);
         
-        // Handle different layer types
-        switch (net->layers[i]->type) {
-            case LAYER_BAYESIAN_LINEAR:
-                if (cfg->optimizer == 1) { // Adam
-                    adam_update_bayesian_linear((BayesianLinear*)net->layers[i]->layer, 
-                                              net->layers[i]->optimizer_state, cfg);
-                } else { // SGD
-                    update_bayesian_linear((BayesianLinear*)net->layers[i]->layer, decayed_lr);
-                }
-                break;
-                
-            case LAYER_STOCHASTIC_ACTIVATION:
-                if (cfg->optimizer == 1) { // Adam
-                    adam_update_stochastic_activation((StochasticActivation*)net->layers[i]->layer,
-                                                    net->layers[i]->optimizer_state, cfg);
-                } else { // SGD
-                    update_stochastic_activation((StochasticActivation*)net->layers[i]->layer, decayed_lr);
-                }
-                break;
-                
-            case LAYER_DROPOUT:
-                // Dropout layers don't have learnable parameters
-                break;
-                
-            case LAYER_BAYESIAN_CONV:
-                // TODO: Implement update_bayesian_conv
-                printf("Warning: BayesianConv layer updates not yet implemented.\n");
-                break;
-                
-            case LAYER_PROJECTION:
-                // Projection layers don't have learnable parameters
-                break;
-                
-            default:
-                printf("Warning: Unknown layer type %d encountered during update.\n", 
-                       net->layers[i]->type);
-                break;
+        // Frozen layers keep their parameters, and therefore their cached KL.
+        if (net->layers[i]->frozen) {
+            continue;
+        }
+        
+        // The sweeps above updated this layer; only the caches derived from it remain.
+        if (net->layers[i]->arena_mean_count > 0) {
+            if (cfg->bbb_learn_variance) {
+                mark_sigma_dirty(net->layers[i]);
+            }
+            net->layers[i]->kl_dirty = 1;
+            continue;
+        }
+        
+        // Outside the arena only the Concrete dropout logit is learned.
+        if (net->layers[i]->type != LAYER_DROPOUT ||
+            ((DropoutLayer*)net->layers[i]->layer)->type != DROPOUT_CONCRETE) {
+            continue;
+        }
+        DropoutLayer *dl = (DropoutLayer*)net->layers[i]->layer;
+        if (cfg->optimizer == 1) { // Adam
+            // Adam moments are allocated on first use.
+            if (!net->layers[i]->optimizer_state) {
+                net->layers[i]->optimizer_state = init_adam_state(1);
+            }
+            adam_update_concrete_dropout(dl, net->layers[i]->optimizer_state, cfg);
+        } else { // SGD
+            update_concrete_dropout(dl, decayed_lr);
         }
+        net->layers[i]->kl_dirty = 1;
     }
 }
@@ -0,0 +1,143 @@
+// bnn_load: closed-loop load generator for bnn_serve.
+//
+//   bnn_load --socket path [--input_dim D] [--requests N] [--concurrency C]
+//
+// Opens C connections to the server. Each sends one request with random inputs, waits for the
+// response and sends the next, until N requests have been answered in total. Reports the
+// throughput and the median, 99th percentile and maximum latency. More connections than the
+// server's batch size measure it saturated; a single connection measures unbatched latency.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../config/config.h"
+#include "../utils/random_utils.h"
+#include "../utils/utils.h"
+
+typedef struct {
+    const char *socket_path;
+    int input_dim;
+    int num_requests;
+    int next_request;        // Next request index to claim, taken atomically
+    double *latency_us;      // Latency of every request, by index
+    int errors;              // Responses that were errors or did not match their request
+} LoadTest;
+
+typedef struct {
+    LoadTest *test;
+    int index;
+} Client;
+
+static double now_us(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec * 1e-3;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void* run_client(void *arg) {
+    Client *client = (Client*)arg;
+    LoadTest *test = client->test;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", test->socket_path);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        handle_error("Failed to connect to the server.");
+    }
+    FILE *in = fdopen(fd, "r");
+    FILE *out = fdopen(dup(fd), "w");
+    if (!in || !out) {
+        handle_error("Failed to open the connection streams.");
+    }
+    random_seed_stream(12345, (uint64_t) client->index);
+    char *line = NULL;
+    size_t capacity = 0;
+    for (;;) {
+        int request = __atomic_fetch_add(&test->next_request, 1, __ATOMIC_RELAXED);
+        if (request >= test->num_requests) {
+            break;
+        }
+        double start = now_us();
+        fprintf(out, "%d", request);
+        for (int i = 0; i < test->input_dim; i++) {
+            fprintf(out, " %.6f", random_uniform());
+        }
+        fputc('\n', out);
+        fflush(out);
+        if (getline(&line, &capacity, in) <= 0) {
+            handle_error("The server closed the connection.");
+        }
+        test->latency_us[request] = now_us() - start;
+        char *rest;
+        if (strtol(line, &rest, 10) != request || strncmp(rest, " error", 6) == 0) {
+            __atomic_add_fetch(&test->errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+    free(line);
+    fclose(out);
+    fclose(in);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    LoadTest test = { NULL, DEFAULT_INPUT_DIM, 1000, 0, NULL, 0 };
+    int concurrency = 8;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            test.socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--input_dim") == 0 && i + 1 < argc) {
+            test.input_dim = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--requests") == 0 && i + 1 < argc) {
+            test.num_requests = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--concurrency") == 0 && i + 1 < argc) {
+            concurrency = atoi(argv[++i]);
+        } else {
+            printf("Unknown argument: %s\n", argv[i]);
+        }
+    }
+    if (!test.socket_path || test.input_dim < 1 || test.num_requests < 1 || concurrency < 1) {
+        fprintf(stderr, "Usage: %s --socket path [--input_dim D] [--requests N] [--concurrency C]\n", argv[0]);
+        return 1;
+    }
+    test.latency_us = (double*)malloc(sizeof(double) * test.num_requests);
+    pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * concurrency);
+    Client *clients = (Client*)malloc(sizeof(Client) * concurrency);
+    if (!test.latency_us || !threads || !clients) {
+        handle_error("Failed to allocate the load test.");
+    }
+    double start = now_us();
+    for (int c = 0; c < concurrency; c++) {
+        clients[c].test = &test;
+        clients[c].index = c;
+        if (pthread_create(&threads[c], NULL, run_client, &clients[c]) != 0) {
+            handle_error("Failed to start a client thread.");
+        }
+    }
+    for (int c = 0; c < concurrency; c++) {
+        pthread_join(threads[c], NULL);
+    }
+    double seconds = (now_us() - start) * 1e-6;
+
+    qsort(test.latency_us, test.num_requests, sizeof(double), compare_doubles);
+    int n = test.num_requests;
+    printf("requests:    %d (%d errors) over %d connections\n", n, test.errors, concurrency);
+    printf("throughput:  %.1f requests/s\n", n / seconds);
+    printf("latency p50: %.3f ms\n", test.latency_us[(n - 1) / 2] * 1e-3);
+    printf("latency p99: %.3f ms\n", test.latency_us[(int) ((n - 1) * 0.99)] * 1e-3);
+    printf("latency max: %.3f ms\n", test.latency_us[n - 1] * 1e-3);
+    free(clients);
+    free(threads);
+    free(test.latency_us);
+    return test.errors != 0;
+}
@@ -0,0 +1,262 @@
+// bnn_serve: answer prediction requests with the predictive mean and variance of a network.
+//
+//   bnn_serve [--config file] [--model file] [--socket path] [--serve_max_batch n]
+//             [--serve_max_latency_us us] [--mc_samples_inference S] [other Config flags]
+//
+// The network is created from the Config and its parameters are read from --model (a file
+// written by network_save()); without one it serves the freshly initialized network. With
+// --socket it listens on a Unix domain socket and serves any number of connections at once;
+// without, it serves stdin and writes to stdout, and exits at the end of the input.
+//
+// Protocol, one request or response per line:
+//   request:   <id> <x_1> ... <x_input_dim>
+//   response:  <id> <mean_1> ... <mean_output_dim> <var_1> ... <var_output_dim>
+//   error:     <id> error <message>
+// The id is any unsigned integer chosen by the client. Responses on one connection may come back
+// in another order than the requests when they land in different micro-batches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../config/config.h"
+#include "../network/network.h"
+#include "../network/micro_batcher.h"
+#include "../utils/utils.h"
+
+// One client: requests are read from in_fd, responses written to out_fd. The connection is
+// freed when the reader has reached the end of the input and every request has been answered.
+typedef struct {
+    int in_fd;
+    int out_fd;
+    pthread_mutex_t write_lock;
+    int refs;                      // The reader, plus one per outstanding request
+    MicroBatcher *batcher;
+} Connection;
+
+typedef struct {
+    ServeRequest req;
+    unsigned long long id;
+    Connection *conn;
+} PendingRequest;
+
+static void release_connection(Connection *conn) {
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    if (conn->in_fd > STDERR_FILENO) {
+        close(conn->in_fd);
+    }
+    pthread_mutex_destroy(&conn->write_lock);
+    free(conn);
+}
+
+static void write_all(Connection *conn, const char *buf, size_t len) {
+    pthread_mutex_lock(&conn->write_lock);
+    while (len > 0) {
+        ssize_t n = write(conn->out_fd, buf, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;   // The client went away; its remaining responses are dropped.
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+    pthread_mutex_unlock(&conn->write_lock);
+}
+
+static void complete_request(ServeRequest *req) {
+    PendingRequest *pending = (PendingRequest*)req->user;
+    int out = pending->conn->batcher->output_dim;
+    size_t capacity = 32 + (size_t) 2 * out * 26, len = 0;
+    char *line = (char*)malloc(capacity);
+    if (!line) {
+        handle_error("Failed to allocate response.");
+    }
+    len += snprintf(line + len, capacity - len, "%llu", pending->id);
+    for (int j = 0; j < out; j++) {
+        len += snprintf(line + len, capacity - len, " %.17g", req->mean[j]);
+    }
+    for (int j = 0; j < out; j++) {
+        len += snprintf(line + len, capacity - len, " %.17g", req->variance[j]);
+    }
+    line[len++] = '\n';
+    write_all(pending->conn, line, len);
+    free(line);
+    Connection *conn = pending->conn;
+    free(req->input);
+    free(req->mean);
+    free(pending);
+    release_connection(conn);
+}
+
+// Parse "<id> <x_1> ... <x_n>" into a new request, or write an error response and return NULL.
+static PendingRequest* parse_request(Connection *conn, char *line) {
+    int in = conn->batcher->input_dim, out = conn->batcher->output_dim;
+    char *end;
+    errno = 0;
+    unsigned long long id = strtoull(line, &end, 10);
+    if (end == line || errno != 0) {
+        write_all(conn, "0 error malformed id\n", 21);
+        return NULL;
+    }
+    PendingRequest *pending = (PendingRequest*)malloc(sizeof(PendingRequest));
+    double *input = (double*)malloc(sizeof(double) * in);
+    double *result = (double*)malloc(sizeof(double) * 2 * out);
+    if (!pending || !input || !result) {
+        handle_error("Failed to allocate request.");
+    }
+    char *p = end;
+    int count = 0;
+    for (;;) {
+        double value = strtod(p, &end);
+        if (end == p) {
+            break;
+        }
+        if (count < in) {
+            input[count] = value;
+        }
+        count++;
+        p = end;
+    }
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+        p++;
+    }
+    if (count != in || *p != '\0') {
+        char message[96];
+        int len = snprintf(message, sizeof(message), "%llu error expected %d numeric inputs\n", id, in);
+        write_all(conn, message, (size_t) len);
+        free(pending);
+        free(input);
+        free(result);
+        return NULL;
+    }
+    pending->id = id;
+    pending->conn = conn;
+    pending->req.input = input;
+    pending->req.mean = result;
+    pending->req.variance = result + out;
+    pending->req.complete = complete_request;
+    pending->req.user = pending;
+    return pending;
+}
+
+static void* serve_connection(void *arg) {
+    Connection *conn = (Connection*)arg;
+    FILE *in = fdopen(dup(conn->in_fd), "r");
+    if (!in) {
+        handle_error("Failed to read from connection.");
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, in) > 0) {
+        if (line[0] == '\n') {
+            continue;
+        }
+        PendingRequest *pending = parse_request(conn, line);
+        if (pending) {
+            __atomic_add_fetch(&conn->refs, 1, __ATOMIC_RELAXED);
+            micro_batcher_submit(conn->batcher, &pending->req);
+        }
+    }
+    free(line);
+    fclose(in);
+    release_connection(conn);
+    return NULL;
+}
+
+static Connection* open_connection(MicroBatcher *batcher, int in_fd, int out_fd) {
+    Connection *conn = (Connection*)malloc(sizeof(Connection));
+    if (!conn) {
+        handle_error("Failed to allocate connection.");
+    }
+    conn->in_fd = in_fd;
+    conn->out_fd = out_fd;
+    conn->refs = 1;
+    conn->batcher = batcher;
+    pthread_mutex_init(&conn->write_lock, NULL);
+    return conn;
+}
+
+static void serve_socket(MicroBatcher *batcher, const char *path) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        handle_error("Failed to create socket.");
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        handle_error("Failed to listen on the serving socket.");
+    }
+    log_info("Listening on %s", path);
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            handle_error("Failed to accept a connection.");
+        }
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, open_connection(batcher, fd, fd)) != 0) {
+            handle_error("Failed to start a connection thread.");
+        }
+        pthread_detach(thread);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    Config cfg;
+    init_config(&cfg);
+    // --config is read first so that the other flags override the file.
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && load_config_file(&cfg, argv[i + 1]) != 0) {
+            return 1;
+        }
+    }
+    int num_args = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            i++;
+        } else {
+            argv[num_args++] = argv[i];
+        }
+    }
+    parse_args(&cfg, num_args, argv);
+    signal(SIGPIPE, SIG_IGN);
+
+    Network *net = create_network(&cfg);
+    if (cfg.model_path[0] != '\0') {
+        if (network_load(net, cfg.model_path) != 0) {
+            free_network(net);
+            return 1;
+        }
+    } else {
+        log_warn("No --model given; serving an untrained network.");
+    }
+    MicroBatcher *batcher = micro_batcher_create(net, cfg.mc_samples_inference, cfg.serve_max_batch,
+                                                 cfg.serve_max_latency_us, 0);
+    if (cfg.serve_socket[0] != '\0') {
+        serve_socket(batcher, cfg.serve_socket);
+    } else {
+        serve_connection(open_connection(batcher, STDIN_FILENO, STDOUT_FILENO));
+    }
+    // End of the input: answer what is still queued.
+    pthread_mutex_lock(&batcher->lock);
+    long queued = batcher->queued;
+    pthread_mutex_unlock(&batcher->lock);
+    micro_batcher_free(batcher);
+    log_info("Input closed; answered the %ld requests still queued.", queued);
+    free_network(net);
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../utils/thread_pool.h"
+
+// Microbenchmark for the kernel threads: the cost of one parallel_for() dispatch, and the time
+// of an elementwise sweep and a dot-product reduction by size, to show where splitting a kernel
+// starts to pay. Run as ./parallel_bench [max_threads].
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+typedef struct {
+    double *x;
+    const double *y;
+} AxpyTask;
+
+static void empty_range(void *arg, int begin, int end) {
+    (void) arg;
+    (void) begin;
+    (void) end;
+}
+
+static void axpy_range(void *arg, int begin, int end) {
+    AxpyTask *t = (AxpyTask*)arg;
+    for (int i = begin; i < end; i++) {
+        t->x[i] += 0.5 * t->y[i];
+    }
+}
+
+static double dot_block(void *arg, int begin, int end) {
+    AxpyTask *t = (AxpyTask*)arg;
+    double sum = 0.0;
+    for (int i = begin; i < end; i++) {
+        sum += t->x[i] * t->y[i];
+    }
+    return sum;
+}
+
+// Seconds per sweep, averaged over about 50 ms of repetitions.
+static double time_axpy(int n, int grain, AxpyTask *task) {
+    int reps = 0;
+    double start = now(), elapsed;
+    do {
+        parallel_for_elements(n, grain, axpy_range, task);
+        reps++;
+    } while ((elapsed = now() - start) < 0.05);
+    return elapsed / reps;
+}
+
+static double time_dot(int n, AxpyTask *task) {
+    int reps = 0;
+    double start = now(), elapsed, sink = 0.0;
+    do {
+        sink += parallel_sum(n, 8192, dot_block, task);
+        reps++;
+    } while ((elapsed = now() - start) < 0.05);
+    if (sink == 0.123) {
+        printf(" ");
+    }
+    return elapsed / reps;
+}
+
+int main(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc > 1) ? atoi(argv[1]) : (cpus > 1 ? (int) cpus : 2);
+    int max_n = 1 << 22;
+    double *x = (double*)malloc(sizeof(double) * max_n);
+    double *y = (double*)malloc(sizeof(double) * max_n);
+    if (!x || !y) {
+        fprintf(stderr, "Out of memory.\n");
+        return 1;
+    }
+    for (int i = 0; i < max_n; i++) {
+        x[i] = 1.0;
+        y[i] = 1e-9 * i;
+    }
+    AxpyTask task = { x, y };
+    printf("Online CPUs: %ld\n", cpus);
+    for (int threads = 2; threads <= max_threads; threads *= 2) {
+        parallel_set_threads(threads);
+        int reps = 20000;
+        double start = now();
+        for (int r = 0; r < reps; r++) {
+            parallel_for(threads * 8, 8, empty_range, NULL);
+        }
+        double dispatch = (now() - start) / reps;
+        printf("\n%d threads: parallel_for dispatch overhead %.2f us\n", threads, 1e6 * dispatch);
+        printf("%10s %14s %14s %8s %14s %14s %8s\n", "n", "axpy 1 thr", "axpy split", "speedup",
+               "dot 1 thr", "dot split", "speedup");
+        int break_even = 0;
+        for (int n = 1 << 10; n <= max_n; n <<= 2) {
+            double serial = time_axpy(n, n, &task);          // grain n: always inline
+            double split = time_axpy(n, 8, &task);
+            parallel_set_threads(1);
+            double dot_serial = time_dot(n, &task);
+            parallel_set_threads(threads);
+            double dot_split = time_dot(n, &task);
+            printf("%10d %11.2f us %11.2f us %7.2fx %11.2f us %11.2f us %7.2fx\n", n, 1e6 * serial, 1e6 * split,
+                   serial / split, 1e6 * dot_serial, 1e6 * dot_split, dot_serial / dot_split);
+            if (!break_even && split < serial) {
+                break_even = n;
+            }
+        }
+        if (break_even) {
+            printf("Splitting the sweep pays from about n = %d (PARALLEL_GRAIN_WORK = %d per range).\n",
+                   break_even, PARALLEL_GRAIN_WORK);
+        } else {
+            printf("Splitting the sweep never paid here (PARALLEL_GRAIN_WORK = %d per range).\n",
+                   PARALLEL_GRAIN_WORK);
+        }
+    }
+    parallel_set_threads(1);
+    free(x);
+    free(y);
+    return 0;
+}
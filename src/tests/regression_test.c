@@ -3,6 +3,7 @@
 #include <math.h>
 #include "../config/config.h"
 #include "../network/network.h"
+#include "../network/mc_inference.h"
 #include "../utils/math_utils.h"
 #include "../utils/utils.h"
 #include "../utils/random_utils.h"
@@ -143,7 +144,7 @@ int main(void) {
         fflush(stdout);
         
         // Update parameters using the optimizer.
-        network_update_params(net, &cfg);
+        network_update_params(net, &cfg, epoch);
         printf("3");
         fflush(stdout);
 
@@ -155,10 +156,10 @@ int main(void) {
     // Evaluate uncertainty via Monte Carlo sampling.
     // ------------------------------
     int num_samples = 50;
-    Matrix **pred_samples = malloc(sizeof(Matrix*) * num_samples);
-    for (int i = 0; i < num_samples; i++) {
-        pred_samples[i] = network_forward(net, X, 1); // stochastic mode
-    }
+    Matrix *pred_samples = create_matrix(num_samples * batch_size, 1);
+    MCInference *mc = mc_inference_create(net, 0); // one worker per core
+    mc_inference_predict(mc, X, num_samples, pred_samples);
+    mc_inference_free(mc);
     
     // Compute per-sample mean and variance.
     Matrix *mean_pred = create_matrix(batch_size, 1);
@@ -166,14 +167,14 @@ int main(void) {
     for (int b = 0; b < batch_size; b++) {
         double sum = 0.0;
         for (int i = 0; i < num_samples; i++) {
-            sum += pred_samples[i]->data[b];
+            sum += pred_samples->data[i * batch_size + b];
         }
         double mean = sum / num_samples;
         mean_pred->data[b] = mean;
         
         double sq_sum = 0.0;
         for (int i = 0; i < num_samples; i++) {
-            double diff = pred_samples[i]->data[b] - mean;
+            double diff = pred_samples->data[i * batch_size + b] - mean;
             sq_sum += diff * diff;
         }
         var_pred->data[b] = sq_sum / num_samples;
@@ -185,10 +186,7 @@ int main(void) {
     }
     
     // Clean up.
-    for (int i = 0; i < num_samples; i++) {
-        free_matrix(pred_samples[i]);
-    }
-    free(pred_samples);
+    free_matrix(pred_samples);
     free_matrix(mean_pred);
     free_matrix(var_pred);
     free_matrix(X);
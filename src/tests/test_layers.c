@@ -1,15 +1,43 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <math.h>
+#include <string.h>
 #include "../config/config.h"
 #include "layers/bayesian_linear.h"
 #include "layers/bayesian_conv.h"
 #include "layers/dropout_layer.h"
 #include "layers/stochastic_activation.h"
+#include "layers/pooling_layer.h"
+#include "layers/bayesian_dwconv.h"
+#include "layers/noise_injection.h"
 #include "priors/prior_laplace.h"
+#include "priors/prior_mixture.h"
+#include "priors/prior_gaussian.h"
 #include "posteriors/posterior_flipout.h"
 #include "posteriors/posterior_structured.h"
 #include "../utils/utils.h"
+#include "../utils/random_utils.h"
+
+// KL(N(mu, S) || N(prior_mean, prior_variance * I)) for a dense n x n covariance S, with log det S
+// by Gaussian elimination (S is overwritten).
+static double dense_gaussian_kl(const double *mu, double *S, int n, double prior_mean, double prior_variance) {
+    double trace = 0.0, dist = 0.0, logdet = 0.0;
+    for (int a = 0; a < n; a++) {
+        trace += S[a * n + a];
+        dist += (mu[a] - prior_mean) * (mu[a] - prior_mean);
+    }
+    for (int a = 0; a < n; a++) {
+        logdet += log(S[a * n + a]);
+        for (int b = a + 1; b < n; b++) {
+            double f = S[b * n + a] / S[a * n + a];
+            for (int c = a; c < n; c++) {
+                S[b * n + c] -= f * S[a * n + c];
+            }
+        }
+    }
+    return 0.5 * ((trace + dist) / prior_variance - n + n * log(prior_variance) - logdet);
+}
 
 int main() {
     // Initialize configuration with default values.
@@ -33,9 +61,539 @@ int main() {
     printf("BayesianLinear layer created with Prior and Posterior assigned.\n");
     free_bayesian_linear(bl);
     
+    // --- Test Prior KL kernels ---
+    // kl_sum must agree with compute_kl, and its gradients with finite differences.
+    Prior *priors[3] = {
+        create_gaussian_prior(0.0, 2.0),
+        create_laplace_prior(0.1, 0.7),
+        create_mixture_prior(0.0, 1.5, 0.3, 0.2, 0.4)
+    };
+    double kl_mu[5] = {-1.2, -0.1, 0.0, 0.4, 2.5};
+    double kl_logvar[5] = {-3.0, -0.5, 0.2, -1.0, 0.7};
+    for (int k = 0; k < 3; k++) {
+        double g_mu[5] = {0}, g_logvar[5] = {0};
+        double total = priors[k]->kl_sum(priors[k], kl_mu, kl_logvar, 5, g_mu, g_logvar, 1.0);
+        double expected_total = 0.0;
+        for (int i = 0; i < 5; i++) {
+            expected_total += priors[k]->compute_kl(priors[k], kl_mu[i], kl_logvar[i]);
+            double eps = 1e-6;
+            double fd_mu = (priors[k]->compute_kl(priors[k], kl_mu[i] + eps, kl_logvar[i])
+                          - priors[k]->compute_kl(priors[k], kl_mu[i] - eps, kl_logvar[i])) / (2 * eps);
+            double fd_lv = (priors[k]->compute_kl(priors[k], kl_mu[i], kl_logvar[i] + eps)
+                          - priors[k]->compute_kl(priors[k], kl_mu[i], kl_logvar[i] - eps)) / (2 * eps);
+            // The Laplace gradient is that of the exact erf while the KL uses a 1.5e-7
+            // approximation, so the comparison is at 1e-5 rather than round-off level.
+            assert(fabs(fd_mu - g_mu[i]) < 1e-5 && fabs(fd_lv - g_logvar[i]) < 1e-5);
+        }
+        assert(fabs(total - expected_total) < 1e-12);
+    }
+    // The Laplace KL is closed-form: compare E_q[log q - log p] with a midpoint-rule integral.
+    {
+        double mu = 0.4, logvar = -1.0, sigma = exp(0.5 * logvar), integral = 0.0, dx = 1e-4;
+        for (double x = mu - 12 * sigma; x < mu + 12 * sigma; x += dx) {
+            double xm = x + 0.5 * dx;
+            double q = exp(-0.5 * (xm - mu) * (xm - mu) / (sigma * sigma)) / (sigma * sqrt(2 * M_PI));
+            integral += q * (log(q) - priors[1]->log_prob(priors[1], xm)) * dx;
+        }
+        assert(fabs(integral - priors[1]->compute_kl(priors[1], mu, logvar)) < 1e-5);
+    }
+    // log_prob_sum must agree with log_prob, and its gradient with finite differences.
+    for (int k = 0; k < 3; k++) {
+        double g_w[5];
+        double total = priors[k]->log_prob_sum(priors[k], kl_mu, 5, g_w);
+        double expected_total = 0.0;
+        for (int i = 0; i < 5; i++) {
+            expected_total += priors[k]->log_prob(priors[k], kl_mu[i]);
+            double eps = 1e-6;
+            double fd = (priors[k]->log_prob(priors[k], kl_mu[i] + eps)
+                       - priors[k]->log_prob(priors[k], kl_mu[i] - eps)) / (2 * eps);
+            assert(fabs(fd - g_w[i]) < 1e-5);
+        }
+        assert(fabs(total - expected_total) < 1e-9);
+    }
+    // The Monte Carlo KL is unbiased: averaged over many samples it matches the closed form
+    // (the exact KL for Gaussian and Laplace) and so do its gradients.
+    {
+        int n = 100000;
+        double mu = 0.4, logvar = -1.0;
+        double *mc_mu = (double*)malloc(n * sizeof(double));
+        double *mc_logvar = (double*)malloc(n * sizeof(double));
+        double *mc_w = (double*)malloc(n * sizeof(double));
+        double *mc_g_mu = (double*)malloc(n * sizeof(double));
+        double *mc_g_logvar = (double*)malloc(n * sizeof(double));
+        for (int i = 0; i < n; i++) {
+            mc_mu[i] = mu;
+            mc_logvar[i] = logvar;
+            mc_w[i] = sample_gaussian(mu, logvar);
+        }
+        for (int k = 0; k < 2; k++) {
+            for (int i = 0; i < n; i++) {
+                mc_g_mu[i] = mc_g_logvar[i] = 0.0;
+            }
+            double mc = prior_mc_kl_sum(priors[k], 1.0, mc_mu, mc_logvar, mc_w, n, mc_g_mu, mc_g_logvar, 1.0) / n;
+            double g_mu = 0.0, g_logvar = 0.0, mean_g_mu = 0.0, mean_g_logvar = 0.0;
+            double kl = priors[k]->kl_sum(priors[k], &mu, &logvar, 1, &g_mu, &g_logvar, 1.0);
+            for (int i = 0; i < n; i++) {
+                mean_g_mu += mc_g_mu[i] / n;
+                mean_g_logvar += mc_g_logvar[i] / n;
+            }
+            assert(fabs(mc - kl) < 0.02);
+            assert(fabs(mean_g_mu - g_mu) < 0.02 && fabs(mean_g_logvar - g_logvar) < 0.02);
+        }
+        free(mc_g_logvar);
+        free(mc_g_mu);
+        free(mc_w);
+        free(mc_logvar);
+        free(mc_mu);
+    }
+    // A three-component mixture against a direct evaluation of its density and of the
+    // Hershey-Olsen KL, over more values than one kernel chunk (with a ragged tail).
+    {
+        const double mw[3] = {2.0, 1.0, 1.0}, mm[3] = {0.0, -0.5, 0.8}, ms[3] = {1.2, 0.1, 0.4};
+        Prior *mix = create_mixture_prior_k(3, mw, mm, ms);
+        int n = 301;
+        double *x = (double*)malloc(n * sizeof(double));
+        double *lv = (double*)malloc(n * sizeof(double));
+        double *g_x = (double*)malloc(n * sizeof(double));
+        double *g_lv = (double*)calloc(n, sizeof(double));
+        double *g_mu = (double*)calloc(n, sizeof(double));
+        double ref_lp = 0.0, ref_kl = 0.0;
+        for (int i = 0; i < n; i++) {
+            x[i] = 3.0 * sin(0.7 * i);
+            lv[i] = -3.0 + 2.5 * cos(0.3 * i);
+            double p = 0.0, r = 0.0;
+            for (int k = 0; k < 3; k++) {
+                double v = ms[k] * ms[k], d = x[i] - mm[k];
+                p += 0.25 * mw[k] * exp(-0.5 * d * d / v) / sqrt(2 * M_PI * v);
+                double kl_k = 0.5 * ((exp(lv[i]) + d * d) / v - 1.0 + log(v) - lv[i]);
+                r += 0.25 * mw[k] * exp(-kl_k);
+            }
+            ref_lp += log(p);
+            ref_kl -= log(r);
+        }
+        assert(fabs(mix->log_prob_sum(mix, x, n, g_x) - ref_lp) < 1e-9 * n);
+        assert(fabs(mix->kl_sum(mix, x, lv, n, g_mu, g_lv, 1.0) - ref_kl) < 1e-9 * n);
+        for (int i = 0; i < n; i += 37) {
+            double eps = 1e-6;
+            double fd_x = (mix->log_prob(mix, x[i] + eps) - mix->log_prob(mix, x[i] - eps)) / (2 * eps);
+            double fd_mu = (mix->compute_kl(mix, x[i] + eps, lv[i]) - mix->compute_kl(mix, x[i] - eps, lv[i])) / (2 * eps);
+            double fd_lv = (mix->compute_kl(mix, x[i], lv[i] + eps) - mix->compute_kl(mix, x[i], lv[i] - eps)) / (2 * eps);
+            assert(fabs(fd_x - g_x[i]) < 1e-5);
+            assert(fabs(fd_mu - g_mu[i]) < 1e-5 && fabs(fd_lv - g_lv[i]) < 1e-5);
+        }
+        free(g_mu);
+        free(g_lv);
+        free(g_x);
+        free(lv);
+        free(x);
+        free(mix->data);
+        free(mix);
+    }
+    for (int k = 0; k < 3; k++) {
+        free(priors[k]->data);
+        free(priors[k]);
+    }
+    printf("Prior KL kernels passed.\n");
+    
+    // --- Test the fused BayesianLinear backward pass ---
+    // On a deterministic pass the objective sum(output) + kl_weight * KL has dW_mean and
+    // dW_logvar as its gradients, the KL part coming from the layer's (Laplace) prior.
+    {
+        BayesianLinear *fl = create_bayesian_linear(6, 3);
+        fl->prior = create_laplace_prior(0.05, 0.8);
+        Matrix *fx = create_matrix(2, 6);
+        for (int i = 0; i < fx->rows * fx->cols; i++) {
+            fx->data[i] = 0.1 * (i % 5) - 0.2;
+        }
+        Config fcfg = cfg;
+        fcfg.kl_weight = 0.3;
+        Matrix *fy = bayesian_linear_forward(fl, fx, 0);
+        Matrix *fg = create_matrix(fy->rows, fy->cols);
+        for (int i = 0; i < fg->rows * fg->cols; i++) {
+            fg->data[i] = 1.0;
+        }
+        Matrix *fgin = bayesian_linear_backward(fl, fg, &fcfg);
+        for (int k = 0; k < 18; k += 5) {
+            double eps = 1e-6, saved = fl->W_mean->data[k], obj[2];
+            for (int side = 0; side < 2; side++) {
+                fl->W_mean->data[k] = saved + (side ? -eps : eps);
+                Matrix *y = bayesian_linear_forward(fl, fx, 0);
+                obj[side] = fcfg.kl_weight * bayesian_linear_kl(fl, 1.0);
+                for (int i = 0; i < y->rows * y->cols; i++) {
+                    obj[side] += y->data[i];
+                }
+                free_matrix(y);
+            }
+            fl->W_mean->data[k] = saved;
+            assert(fabs((obj[0] - obj[1]) / (2 * eps) - fl->dW_mean->data[k]) < 1e-5);
+            saved = fl->W_logvar->data[k];
+            fl->W_logvar->data[k] = saved + eps;
+            double kl_plus = bayesian_linear_kl(fl, 1.0);
+            fl->W_logvar->data[k] = saved - eps;
+            double kl_minus = bayesian_linear_kl(fl, 1.0);
+            fl->W_logvar->data[k] = saved;
+            assert(fabs(fcfg.kl_weight * (kl_plus - kl_minus) / (2 * eps) - fl->dW_logvar->data[k]) < 1e-5);
+        }
+        free_matrix(fgin);
+        free_matrix(fy);
+
+        // On a stochastic pass the input gradient goes through the sampled weights: replaying
+        // the seed draws the same weights for every finite-difference evaluation.
+        for (int i = 0; i < 18; i++) {
+            fl->W_logvar->data[i] = log(0.25);
+        }
+        fl->sigma_dirty = 1;
+        for (int i = 0; i < fg->rows * fg->cols; i++) {
+            fg->data[i] = 0.5 + 0.25 * i;
+        }
+        random_seed_stream(99, 0);
+        fy = bayesian_linear_forward(fl, fx, 1);
+        assert(fabs(fl->W_sample->data[0] - fl->W_mean->data[0]) > 1e-6);
+        fgin = bayesian_linear_backward(fl, fg, &fcfg);
+        for (int k = 0; k < fx->rows * fx->cols; k++) {
+            double eps = 1e-6, saved = fx->data[k], obj[2];
+            for (int side = 0; side < 2; side++) {
+                fx->data[k] = saved + (side ? -eps : eps);
+                random_seed_stream(99, 0);
+                Matrix *y = bayesian_linear_forward(fl, fx, 1);
+                obj[side] = 0.0;
+                for (int i = 0; i < y->rows * y->cols; i++) {
+                    obj[side] += fg->data[i] * y->data[i];
+                }
+                free_matrix(y);
+            }
+            fx->data[k] = saved;
+            assert(fabs((obj[0] - obj[1]) / (2 * eps) - fgin->data[k]) < 1e-5);
+        }
+        free_matrix(fgin);
+        free_matrix(fg);
+        free_matrix(fy);
+        free_matrix(fx);
+        free(fl->prior->data);
+        free(fl->prior);
+        free_bayesian_linear(fl);
+    }
+    printf("Fused BayesianLinear backward passed.\n");
+
+    // --- Test the cached standard deviations ---
+    // Stochastic passes draw with exp(logvar / 2) cached until sigma_dirty is set again.
+    {
+        BayesianLinear *sl = create_bayesian_linear(100, 200);
+        Matrix *sx = create_matrix(1, 100);
+        for (int i = 0; i < 200 * 100; i++) {
+            sl->W_logvar->data[i] = log(4.0);
+        }
+        Matrix *sy = bayesian_linear_forward(sl, sx, 1);
+        free_matrix(sy);
+        assert(!sl->sigma_dirty && fabs(sl->W_sigma[123] - 2.0) < 1e-12);
+        double var = 0.0;
+        for (int i = 0; i < 200 * 100; i++) {
+            double d = sl->W_sample->data[i] - sl->W_mean->data[i];
+            var += d * d / (200 * 100);
+        }
+        assert(fabs(var - 4.0) < 0.15);
+        sl->W_logvar->data[123] = 0.0;
+        sy = bayesian_linear_forward(sl, sx, 1);
+        free_matrix(sy);
+        assert(sl->W_sigma[123] == 2.0);
+        sl->sigma_dirty = 1;
+        sy = bayesian_linear_forward(sl, sx, 1);
+        free_matrix(sy);
+        assert(fabs(sl->W_sigma[123] - 1.0) < 1e-12);
+        free_matrix(sx);
+        free_bayesian_linear(sl);
+    }
+    printf("Cached standard deviations passed.\n");
+
+    // --- Test the batched predictive pass ---
+    // Block s uses the s-th draw: rows of a block share it, and the outputs over blocks have the
+    // mean and variance of W x + b with x = 1.
+    {
+        int in = 5, out = 3, S = 4000;
+        BayesianLinear *pl = create_bayesian_linear(in, out);
+        for (int i = 0; i < in * out; i++) {
+            pl->W_logvar->data[i] = log(0.25);
+        }
+        for (int o = 0; o < out; o++) {
+            pl->b_mean[o] = 0.1 * o;
+            pl->b_logvar[o] = log(0.25);
+        }
+        pl->sigma_dirty = 1;
+        Matrix *px = create_matrix(S * 2, in);
+        for (int i = 0; i < S * 2 * in; i++) {
+            px->data[i] = 1.0;
+        }
+        Matrix *py = bayesian_linear_forward_mc(pl, px, S, 0);
+        assert(py->rows == S * 2 && py->cols == out);
+        for (int o = 0; o < out; o++) {
+            double expected = pl->b_mean[o], mean = 0.0, var = 0.0;
+            for (int j = 0; j < in; j++) {
+                expected += pl->W_mean->data[o * in + j];
+            }
+            for (int s = 0; s < S; s++) {
+                assert(py->data[(s * 2) * out + o] == py->data[(s * 2 + 1) * out + o]);
+                mean += py->data[s * 2 * out + o] / S;
+            }
+            for (int s = 0; s < S; s++) {
+                double d = py->data[s * 2 * out + o] - mean;
+                var += d * d / S;
+            }
+            assert(fabs(mean - expected) < 0.1);
+            assert(fabs(var - (in + 1) * 0.25) < 0.15);
+        }
+        free_matrix(py);
+        // With a negligible variance every block reproduces the deterministic output.
+        for (int i = 0; i < in * out; i++) {
+            pl->W_logvar->data[i] = -60.0;
+        }
+        for (int o = 0; o < out; o++) {
+            pl->b_logvar[o] = -60.0;
+        }
+        pl->sigma_dirty = 1;
+        Matrix *dx = create_matrix(2, in);
+        for (int i = 0; i < 2 * in; i++) {
+            dx->data[i] = 0.3 * i - 1.0;
+        }
+        Matrix *dy = bayesian_linear_forward(pl, dx, 0);
+        Matrix *stacked = create_matrix(3 * 2, in);
+        for (int s = 0; s < 3; s++) {
+            memcpy(stacked->data + s * 2 * in, dx->data, sizeof(double) * 2 * in);
+        }
+        py = bayesian_linear_forward_mc(pl, stacked, 3, 0);
+        for (int i = 0; i < 3 * 2 * out; i++) {
+            assert(fabs(py->data[i] - dy->data[i % (2 * out)]) < 1e-9);
+        }
+        free_matrix(py);
+        // Truncated draws: the same holds for a rank-2 perturbation.
+        bayesian_linear_set_mc_rank(pl, 2);
+        py = bayesian_linear_forward_mc(pl, stacked, 3, 0);
+        for (int i = 0; i < 3 * 2 * out; i++) {
+            assert(fabs(py->data[i] - dy->data[i % (2 * out)]) < 1e-9);
+        }
+        free_matrix(py);
+        free_matrix(stacked);
+        free_matrix(dy);
+        free_matrix(dx);
+        // With a shared input the truncated draws keep the mean and, for constant standard
+        // deviations, the variance of the exact ones.
+        for (int i = 0; i < in * out; i++) {
+            pl->W_logvar->data[i] = log(0.25);
+        }
+        for (int o = 0; o < out; o++) {
+            pl->b_logvar[o] = log(0.25);
+        }
+        pl->sigma_dirty = 1;
+        Matrix *ones = create_matrix(2, in);
+        for (int i = 0; i < 2 * in; i++) {
+            ones->data[i] = 1.0;
+        }
+        py = bayesian_linear_forward_mc(pl, ones, S, 1);
+        assert(py->rows == S * 2 && py->cols == out);
+        for (int o = 0; o < out; o++) {
+            double expected = pl->b_mean[o], mean = 0.0, var = 0.0;
+            for (int j = 0; j < in; j++) {
+                expected += pl->W_mean->data[o * in + j];
+            }
+            for (int s = 0; s < S; s++) {
+                assert(fabs(py->data[(s * 2) * out + o] - py->data[(s * 2 + 1) * out + o]) < 1e-12);
+                mean += py->data[s * 2 * out + o] / S;
+            }
+            for (int s = 0; s < S; s++) {
+                double d = py->data[s * 2 * out + o] - mean;
+                var += d * d / S;
+            }
+            assert(fabs(mean - expected) < 0.1);
+            assert(fabs(var - (in + 1) * 0.25) < 0.15);
+        }
+        free_matrix(py);
+        free_matrix(ones);
+        free_matrix(px);
+        free_bayesian_linear(pl);
+    }
+    printf("Batched predictive pass passed.\n");
+
+    // --- Test the low-rank plus diagonal posterior ---
+    {
+        // KL against the dense formula.
+        int n = 5, rank = 2;
+        double lr_mu[5] = {0.3, -0.2, 0.1, 0.0, 0.5};
+        double lr_lv[5] = {-1.0, -0.5, -2.0, -1.5, -0.8};
+        double lr_U[10] = {0.4, -0.1, 0.2, 0.3, -0.3, 0.1, 0.05, 0.2, 0.1, -0.25};
+        double S[25];
+        for (int a = 0; a < n; a++) {
+            for (int b = 0; b < n; b++) {
+                S[a * n + b] = lr_U[a * 2] * lr_U[b * 2] + lr_U[a * 2 + 1] * lr_U[b * 2 + 1]
+                             + (a == b ? exp(lr_lv[a]) : 0.0);
+            }
+        }
+        double dense_kl = dense_gaussian_kl(lr_mu, S, n, 0.1, 2.0);
+        double g_mu[5] = {0}, g_lv[5] = {0}, g_U[10] = {0};
+        double kl = lowrank_posterior_kl(lr_mu, lr_lv, lr_U, n, rank, 0.1, 2.0, g_mu, g_lv, g_U, 1.0);
+        assert(fabs(kl - dense_kl) < 1e-12);
+        double *params[3] = {lr_mu, lr_lv, lr_U};
+        double *grads[3] = {g_mu, g_lv, g_U};
+        for (int p = 0; p < 3; p++) {
+            for (int i = 0; i < (p == 2 ? 10 : 5); i++) {
+                double eps = 1e-6, saved = params[p][i];
+                params[p][i] = saved + eps;
+                double kl_plus = lowrank_posterior_kl(lr_mu, lr_lv, lr_U, n, rank, 0.1, 2.0, NULL, NULL, NULL, 0.0);
+                params[p][i] = saved - eps;
+                double kl_minus = lowrank_posterior_kl(lr_mu, lr_lv, lr_U, n, rank, 0.1, 2.0, NULL, NULL, NULL, 0.0);
+                params[p][i] = saved;
+                assert(fabs((kl_plus - kl_minus) / (2 * eps) - grads[p][i]) < 1e-6);
+            }
+        }
+        // Samples have covariance diag(exp(logvar)) + U U^T.
+        int draws = 200000;
+        double w[5], z[2], lr_sigma[5], cov01 = 0.0, var2 = 0.0;
+        compute_sigma(lr_lv, lr_sigma, n);
+        for (int s = 0; s < draws; s++) {
+            z[0] = random_gaussian(0.0, 1.0);
+            z[1] = random_gaussian(0.0, 1.0);
+            lowrank_posterior_sample(lr_mu, lr_sigma, lr_U, z, n, rank, w);
+            cov01 += (w[0] - lr_mu[0]) * (w[1] - lr_mu[1]) / draws;
+            var2 += (w[2] - lr_mu[2]) * (w[2] - lr_mu[2]) / draws;
+        }
+        assert(fabs(cov01 - (lr_U[0] * lr_U[2] + lr_U[1] * lr_U[3])) < 0.01);
+        assert(fabs(var2 - (exp(lr_lv[2]) + lr_U[4] * lr_U[4] + lr_U[5] * lr_U[5])) < 0.01);
+
+        // A low-rank linear layer on a deterministic pass: dW_factor is kl_weight * dKL/dU.
+        BayesianLinear *ll = create_bayesian_linear(4, 3);
+        bayesian_linear_set_rank(ll, 3);
+        Matrix *lx = create_matrix(2, 4);
+        for (int i = 0; i < 8; i++) {
+            lx->data[i] = 0.2 * i - 0.7;
+        }
+        Config lcfg = cfg;
+        lcfg.kl_weight = 0.5;
+        Matrix *ly = bayesian_linear_forward(ll, lx, 0);
+        Matrix *lgin = bayesian_linear_backward(ll, ly, &lcfg);
+        for (int k = 0; k < 36; k += 7) {
+            double eps = 1e-6, saved = ll->W_factor[k];
+            ll->W_factor[k] = saved + eps;
+            double kl_plus = bayesian_linear_kl(ll, 1.0);
+            ll->W_factor[k] = saved - eps;
+            double kl_minus = bayesian_linear_kl(ll, 1.0);
+            ll->W_factor[k] = saved;
+            assert(fabs(lcfg.kl_weight * (kl_plus - kl_minus) / (2 * eps) - ll->dW_factor[k]) < 1e-6);
+        }
+        free_matrix(lgin);
+        free_matrix(ly);
+        Matrix *ls = bayesian_linear_forward(ll, lx, 1);
+        free_matrix(ls);
+        free_matrix(lx);
+        free_bayesian_linear(ll);
+    }
+    printf("Low-rank posterior passed.\n");
+
+    // --- Test the matrix-normal posterior ---
+    {
+        // KL against the dense formula for vec(W) ~ N(vec(M), V kron U), and its gradients.
+        int rows = 2, cols = 3, n = 6;
+        double mn_M[6] = {0.2, -0.1, 0.4, 0.0, 0.3, -0.5};
+        double mn_Lr[4] = {0.7, 0.0, 0.2, 0.5};
+        double mn_Lc[9] = {0.6, 0.0, 0.0, -0.1, 0.4, 0.0, 0.3, 0.2, 0.8};
+        double Ur[4], Vc[9], S[36], mu_vec[6];
+        for (int a = 0; a < 2; a++) {
+            for (int b = 0; b < 2; b++) {
+                Ur[a * 2 + b] = mn_Lr[a * 2] * mn_Lr[b * 2] + mn_Lr[a * 2 + 1] * mn_Lr[b * 2 + 1];
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            for (int b = 0; b < 3; b++) {
+                Vc[a * 3 + b] = 0.0;
+                for (int k = 0; k < 3; k++) {
+                    Vc[a * 3 + b] += mn_Lc[a * 3 + k] * mn_Lc[b * 3 + k];
+                }
+            }
+        }
+        // Row-major W: index i * cols + j, Cov(W_ij, W_kl) = U_ik V_jl.
+        for (int p = 0; p < n; p++) {
+            mu_vec[p] = mn_M[p];
+            for (int q = 0; q < n; q++) {
+                S[p * n + q] = Ur[(p / cols) * 2 + q / cols] * Vc[(p % cols) * 3 + q % cols];
+            }
+        }
+        double dense_kl = dense_gaussian_kl(mu_vec, S, n, -0.1, 1.5);
+        double g_M[6] = {0}, g_Lr[4] = {0}, g_Lc[9] = {0};
+        double kl = matnorm_posterior_kl(mn_M, mn_Lr, mn_Lc, rows, cols, -0.1, 1.5, g_M, g_Lr, g_Lc, 1.0);
+        assert(fabs(kl - dense_kl) < 1e-12);
+        double *params[3] = {mn_M, mn_Lr, mn_Lc};
+        double *grads[3] = {g_M, g_Lr, g_Lc};
+        int sizes[3] = {6, 4, 9}, dims[3] = {0, 2, 3};
+        for (int p = 0; p < 3; p++) {
+            for (int i = 0; i < sizes[p]; i++) {
+                if (p > 0 && i % dims[p] > i / dims[p]) {
+                    continue;  // Upper triangle of a factor.
+                }
+                double eps = 1e-6, saved = params[p][i];
+                params[p][i] = saved + eps;
+                double kl_plus = matnorm_posterior_kl(mn_M, mn_Lr, mn_Lc, rows, cols, -0.1, 1.5, NULL, NULL, NULL, 0.0);
+                params[p][i] = saved - eps;
+                double kl_minus = matnorm_posterior_kl(mn_M, mn_Lr, mn_Lc, rows, cols, -0.1, 1.5, NULL, NULL, NULL, 0.0);
+                params[p][i] = saved;
+                assert(fabs((kl_plus - kl_minus) / (2 * eps) - grads[p][i]) < 1e-6);
+            }
+        }
+
+        // A matrix-normal linear layer, with a shared sample and with local reparameterization:
+        // replaying the random seed fixes the noise, so the stochastic objective
+        // sum(output) + kl_weight * KL can be differentiated numerically.
+        for (int local = 0; local < 2; local++) {
+            BayesianLinear *ml = create_bayesian_linear(4, 3);
+            bayesian_linear_set_matrix_normal(ml, local);
+            ml->L_row[3] = 0.1;   // Off-diagonal entries, so the correlations are exercised.
+            ml->L_col[4] = -0.2;
+            ml->L_col[14] = 0.15;
+            Matrix *mx = create_matrix(2, 4);
+            for (int i = 0; i < 8; i++) {
+                mx->data[i] = 0.3 * i - 1.0;
+            }
+            Config mcfg = cfg;
+            mcfg.kl_weight = 0.2;
+            init_random(7);
+            Matrix *my = bayesian_linear_forward(ml, mx, 1);
+            Matrix *mg = create_matrix(my->rows, my->cols);
+            for (int i = 0; i < mg->rows * mg->cols; i++) {
+                mg->data[i] = 1.0;
+            }
+            Matrix *mgin = bayesian_linear_backward(ml, mg, &mcfg);
+            double *fd_params[3] = {ml->L_row, ml->L_col, mx->data};
+            double *fd_grads[3] = {ml->dL_row, ml->dL_col, mgin->data};
+            int fd_sizes[3] = {9, 16, 8};
+            for (int p = 0; p < 3; p++) {
+                for (int i = 0; i < fd_sizes[p]; i++) {
+                    int dim = (p == 0) ? 3 : 4;
+                    if (p < 2 && i % dim > i / dim) {
+                        continue;
+                    }
+                    double eps = 1e-6, saved = fd_params[p][i], obj[2];
+                    for (int side = 0; side < 2; side++) {
+                        fd_params[p][i] = saved + (side ? -eps : eps);
+                        init_random(7);
+                        Matrix *y = bayesian_linear_forward(ml, mx, 1);
+                        obj[side] = (p < 2) ? mcfg.kl_weight * bayesian_linear_kl(ml, 1.0) : 0.0;
+                        for (int k = 0; k < y->rows * y->cols; k++) {
+                            obj[side] += y->data[k];
+                        }
+                        free_matrix(y);
+                    }
+                    fd_params[p][i] = saved;
+                    assert(fabs((obj[0] - obj[1]) / (2 * eps) - fd_grads[p][i]) < 1e-5);
+                }
+            }
+            free_matrix(mgin);
+            free_matrix(mg);
+            free_matrix(my);
+            free_matrix(mx);
+            free_bayesian_linear(ml);
+        }
+    }
+    printf("Matrix-normal posterior passed.\n");
+    
     // --- Test BayesianConv Layer ---
     int in_channels = 3, out_channels = 8, kernel_h = 3, kernel_w = 3;
-    BayesianConv *bc = create_bayesian_conv(in_channels, out_channels, kernel_h, kernel_w);
+    BayesianConv *bc = create_bayesian_conv(in_channels, out_channels, kernel_h, kernel_w, 2, 1);
     bc->prior = create_laplace_prior(0.0, cfg.prior_variance);
     bc->posterior = create_flipout_posterior();
     
@@ -43,18 +601,197 @@ int main() {
     assert(bc->prior != NULL);
     assert(bc->posterior != NULL);
     printf("BayesianConv layer created with Prior and Posterior assigned.\n");
+    
+    // Stride 2 with padding 1 halves an 8x8 image.
+    bayesian_conv_set_input_size(bc, 8, 8);
+    assert(bc->output_height == 4 && bc->output_width == 4);
+    Matrix *img = create_matrix(2, 8 * 8 * in_channels);
+    for (int i = 0; i < img->rows * img->cols; i++) {
+        img->data[i] = (double)(i % 7) - 3.0;
+    }
+    Matrix *conv_out = bayesian_conv_forward(bc, img, 0);
+    assert(conv_out->rows == 2 && conv_out->cols == 4 * 4 * out_channels);
+    // Output pixel (0,0) only sees input rows/cols 0..1 (the rest is padding).
+    double expected = bc->b_mean[0];
+    for (int kh = 1; kh < 3; kh++) {
+        for (int kw = 1; kw < 3; kw++) {
+            for (int ic = 0; ic < in_channels; ic++) {
+                double x = img->data[((kh - 1) * 8 + (kw - 1)) * in_channels + ic];
+                expected += x * bc->W_mean[((kh * 3 + kw) * in_channels + ic) * out_channels + 0];
+            }
+        }
+    }
+    assert(fabs(conv_out->data[0] - expected) < 1e-12);
+    Matrix *conv_grad = bayesian_conv_backward(bc, conv_out, &cfg);
+    assert(conv_grad->rows == img->rows && conv_grad->cols == img->cols);
+    printf("BayesianConv stride/padding forward and backward passed.\n");
+    free_matrix(conv_grad);
+    free_matrix(conv_out);
+    free_matrix(img);
     free_bayesian_conv(bc);
     
+    // --- Test BayesianDWConv Layer ---
+    // Finite-difference check of the input and pointwise-weight gradients of
+    // L = sum(out * out) / 2 on the mean (non-stochastic) network.
+    BayesianDWConv *dc = create_bayesian_dwconv(3, 5, 3, 3, 1, 1);
+    bayesian_dwconv_set_input_size(dc, 5, 5);
+    assert(dc->output_height == 5 && dc->output_width == 5);
+    assert(bayesian_dwconv_num_params(dc) == 27 + 15 + 5);
+    Config no_kl = cfg;
+    no_kl.kl_weight = 0.0;
+    Matrix *dw_in = create_matrix(2, 5 * 5 * 3);
+    for (int i = 0; i < dw_in->rows * dw_in->cols; i++) {
+        dw_in->data[i] = sin(0.37 * i);
+    }
+    Matrix *dw_out = bayesian_dwconv_forward(dc, dw_in, 0);
+    Matrix *dw_gin = bayesian_dwconv_backward(dc, dw_out, &no_kl);
+    double h = 1e-6;
+    int probes[3] = {0, 40, 149};
+    for (int k = 0; k < 3; k++) {
+        int idx = probes[k];
+        double saved = dw_in->data[idx];
+        double loss[2];
+        for (int side = 0; side < 2; side++) {
+            dw_in->data[idx] = saved + (side ? h : -h);
+            Matrix *o = bayesian_dwconv_forward(dc, dw_in, 0);
+            loss[side] = 0.0;
+            for (int j = 0; j < o->rows * o->cols; j++) loss[side] += 0.5 * o->data[j] * o->data[j];
+            free_matrix(o);
+        }
+        dw_in->data[idx] = saved;
+        assert(fabs((loss[1] - loss[0]) / (2 * h) - dw_gin->data[idx]) < 1e-5);
+    }
+    double saved_pw = dc->pw_mean[7];
+    double pw_grad = dc->d_pw_mean[7];
+    double loss_pw[2];
+    for (int side = 0; side < 2; side++) {
+        dc->pw_mean[7] = saved_pw + (side ? h : -h);
+        Matrix *o = bayesian_dwconv_forward(dc, dw_in, 0);
+        loss_pw[side] = 0.0;
+        for (int j = 0; j < o->rows * o->cols; j++) loss_pw[side] += 0.5 * o->data[j] * o->data[j];
+        free_matrix(o);
+    }
+    dc->pw_mean[7] = saved_pw;
+    assert(fabs((loss_pw[1] - loss_pw[0]) / (2 * h) - pw_grad) < 1e-5);
+    printf("BayesianDWConv forward and backward passed.\n");
+    free_matrix(dw_gin);
+    free_matrix(dw_out);
+    free_matrix(dw_in);
+    free_bayesian_dwconv(dc);
+    
+    // --- Test Pooling Layers ---
+    // One 4x4 image with 2 channels (NHWC): channel 0 counts up, channel 1 counts down.
+    Matrix *pool_in = create_matrix(1, 4 * 4 * 2);
+    for (int p = 0; p < 16; p++) {
+        pool_in->data[p * 2 + 0] = p;
+        pool_in->data[p * 2 + 1] = -p;
+    }
+    PoolingLayer *maxpool = create_pooling_layer(POOL_MAX, 2, 4, 4, 2, 2);
+    Matrix *pooled = pooling_forward(maxpool, pool_in, 0);
+    assert(pooled->cols == 2 * 2 * 2);
+    assert(pooled->data[0] == 5.0 && pooled->data[1] == 0.0);
+    assert(pooled->data[6] == 15.0 && pooled->data[7] == -10.0);
+    Matrix *pool_grad = pooling_backward(maxpool, pooled, &cfg);
+    assert(pool_grad->data[5 * 2 + 0] == 5.0 && pool_grad->data[0] == 0.0);
+    free_matrix(pool_grad);
+    free_matrix(pooled);
+    free_pooling_layer(maxpool);
+    
+    PoolingLayer *gap = create_pooling_layer(POOL_GLOBAL_AVG, 2, 4, 4, 0, 0);
+    pooled = pooling_forward(gap, pool_in, 0);
+    assert(pooled->cols == 2);
+    assert(fabs(pooled->data[0] - 7.5) < 1e-12 && fabs(pooled->data[1] + 7.5) < 1e-12);
+    free_matrix(pooled);
+    free_pooling_layer(gap);
+    free_matrix(pool_in);
+    printf("Pooling layers passed.\n");
+    
     // --- Test Dropout Layer ---
     DropoutLayer *dl = create_dropout_layer(DROPOUT_MC, cfg.dropout_prob, 0.0);
     // Dropout layers typically do not use Prior/Posterior.
     assert(dl != NULL);
-    printf("Dropout layer created successfully.\n");
+    // 3 x 50 = 150 elements, so the packed mask ends in a partial word.
+    Matrix *drop_in = create_matrix(3, 50);
+    for (int i = 0; i < drop_in->rows * drop_in->cols; i++) {
+        drop_in->data[i] = 1.0 + i;
+    }
+    Matrix *dropped = dropout_forward(dl, drop_in, 1);
+    Matrix *drop_grad = dropout_backward(dl, drop_in, &cfg);
+    int zeros = 0;
+    for (int i = 0; i < dropped->rows * dropped->cols; i++) {
+        // Forward and backward must apply the same mask and scale.
+        assert(dropped->data[i] == drop_grad->data[i]);
+        if (dropped->data[i] == 0.0) {
+            zeros++;
+        } else {
+            assert(fabs(dropped->data[i] - drop_in->data[i] * dl->mask_scale) < 1e-12);
+        }
+    }
+    assert(zeros > 0 && zeros < dropped->rows * dropped->cols);
+    free_matrix(drop_grad);
+    free_matrix(dropped);
+    free_matrix(drop_in);
+    printf("Dropout layer forward and backward passed.\n");
     free_dropout_layer(dl);
     
+    // Concrete dropout: finite-difference check of the dropout logit gradient of
+    // L = sum(out * out) / 2, replaying the same uniforms by reseeding.
+    DropoutLayer *cd = create_dropout_layer(DROPOUT_CONCRETE, 0.3, 0.1);
+    Config no_reg_cd = cfg;
+    no_reg_cd.regularization_weight = 0.0;
+    Matrix *cd_in = create_matrix(4, 33);
+    for (int i = 0; i < cd_in->rows * cd_in->cols; i++) {
+        cd_in->data[i] = cos(0.21 * i);
+    }
+    init_random(7);
+    Matrix *cd_out = dropout_forward(cd, cd_in, 1);
+    Matrix *cd_grad = dropout_backward(cd, cd_out, &no_reg_cd);
+    double cd_logit = cd->p_logit, cd_loss[2];
+    for (int side = 0; side < 2; side++) {
+        cd->p_logit = cd_logit + (side ? h : -h);
+        cd->dropout_prob = 1.0 / (1.0 + exp(-cd->p_logit));
+        init_random(7);
+        Matrix *o = dropout_forward(cd, cd_in, 1);
+        cd_loss[side] = 0.0;
+        for (int j = 0; j < o->rows * o->cols; j++) cd_loss[side] += 0.5 * o->data[j] * o->data[j];
+        free_matrix(o);
+    }
+    assert(fabs((cd_loss[1] - cd_loss[0]) / (2 * h) - cd->d_p_logit) < 1e-5 * (1.0 + fabs(cd->d_p_logit)));
+    free_matrix(cd_grad);
+    free_matrix(cd_out);
+    free_matrix(cd_in);
+    free_dropout_layer(cd);
+    printf("Concrete dropout logit gradient passed.\n");
+    
+    // --- Test NoiseInjection Layer ---
+    NoiseInjection *ni = create_noise_injection(NOISE_GAUSSIAN, 0.0, 0.5);
+    Matrix *noise_in = create_matrix(10, 101);
+    for (int i = 0; i < noise_in->rows * noise_in->cols; i++) {
+        noise_in->data[i] = 2.0;
+    }
+    Matrix *noisy = noise_injection_forward(ni, noise_in, 1);
+    double noise_sum = 0.0, noise_sq = 0.0;
+    int noise_n = noisy->rows * noisy->cols;
+    for (int i = 0; i < noise_n; i++) {
+        double e = noisy->data[i] - 2.0;
+        noise_sum += e;
+        noise_sq += e * e;
+    }
+    assert(fabs(noise_sum / noise_n) < 0.05);
+    assert(fabs(sqrt(noise_sq / noise_n) - 0.5) < 0.05);
+    noise_injection_forward_inplace(ni, noise_in, 0);
+    assert(noise_in->data[0] == 2.0 && noise_in->data[noise_n - 1] == 2.0);
+    Matrix *noise_grad = noise_injection_backward(ni, noisy, &cfg);
+    assert(noise_grad->data[17] == noisy->data[17]);
+    free_matrix(noise_grad);
+    free_matrix(noisy);
+    free_matrix(noise_in);
+    free_noise_injection(ni);
+    printf("NoiseInjection forward and backward passed.\n");
+    
     // --- Test StochasticActivation Layer ---
     double alpha_mean = 0.25, alpha_logvar = -5.0;
-    StochasticActivation *sa = create_stochastic_activation(alpha_mean, alpha_logvar);
+    StochasticActivation *sa = create_stochastic_activation(7, alpha_mean, alpha_logvar);
     sa->prior = create_laplace_prior(0.0, cfg.prior_variance);
     sa->posterior = create_flipout_posterior();
     
@@ -62,6 +799,95 @@ int main() {
     assert(sa->prior != NULL);
     assert(sa->posterior != NULL);
     printf("StochasticActivation layer created with Prior and Posterior assigned.\n");
+    
+    // In-place forward/backward must match the allocating versions.
+    Config no_reg = cfg;
+    no_reg.kl_weight = 0.0;
+    no_reg.grad_clip = 0.0;
+    for (int c = 0; c < sa->num_channels; c++) {
+        sa->alpha_mean[c] = 0.1 * (c + 1);
+    }
+    Matrix *act_in = create_matrix(2, 70);
+    for (int i = 0; i < act_in->rows * act_in->cols; i++) {
+        act_in->data[i] = sin(0.9 * i);
+    }
+    Matrix *act_out = stochastic_activation_forward(sa, act_in, 0);
+    Matrix *act_grad = stochastic_activation_backward(sa, act_in, &no_reg);
+    double d_alpha[7];
+    for (int c = 0; c < 7; c++) {
+        d_alpha[c] = sa->d_alpha_mean[c];
+    }
+    Matrix *act_buf = copy_matrix(act_in);
+    stochastic_activation_forward_inplace(sa, act_buf, 0);
+    for (int i = 0; i < act_buf->rows * act_buf->cols; i++) {
+        double x = act_in->data[i];
+        assert(act_buf->data[i] == act_out->data[i]);
+        assert(act_out->data[i] == ((x < 0) ? sa->alpha_mean[i % 7] * x : x));
+        act_buf->data[i] = act_in->data[i];
+    }
+    stochastic_activation_backward_inplace(sa, act_buf, &no_reg);
+    for (int i = 0; i < act_buf->rows * act_buf->cols; i++) {
+        assert(act_buf->data[i] == act_grad->data[i]);
+    }
+    // dL/dalpha[c] for L = sum(grad * out) is the sum of grad * x over the negative inputs of channel c.
+    for (int c = 0; c < 7; c++) {
+        double expected_alpha = 0.0;
+        for (int i = c; i < act_in->rows * act_in->cols; i += 7) {
+            if (act_in->data[i] < 0) expected_alpha += act_in->data[i] * act_in->data[i];
+        }
+        assert(fabs(sa->d_alpha_mean[c] - d_alpha[c]) < 1e-12);
+        assert(fabs(d_alpha[c] - expected_alpha) < 1e-9);
+    }
+    free_matrix(act_buf);
+    free_matrix(act_grad);
+    free_matrix(act_out);
+    free_matrix(act_in);
+    printf("StochasticActivation in-place forward and backward passed.\n");
+    
+    // With a KL term, d_alpha_mean is the gradient of sum(grad * out) + kl_weight * KL under the
+    // layer's own prior: the Laplace prior above, then a Gaussian one of variance 2.5.
+    Config kl_cfg = no_reg;
+    kl_cfg.kl_weight = 0.3;
+    kl_cfg.kl_annealing = 0;
+    Matrix *fd_in = create_matrix(2, 70);
+    for (int i = 0; i < fd_in->rows * fd_in->cols; i++) {
+        fd_in->data[i] = sin(0.9 * i);
+    }
+    Matrix *fd_grad = create_matrix(fd_in->rows, fd_in->cols);
+    for (int i = 0; i < fd_grad->rows * fd_grad->cols; i++) {
+        fd_grad->data[i] = cos(0.7 * i);
+    }
+    for (int variant = 0; variant < 2; variant++) {
+        if (variant == 1) {
+            free(sa->prior->data);
+            free(sa->prior);
+            sa->prior = NULL;
+            sa->prior_variance = 2.5;
+        }
+        Matrix *fd_out = stochastic_activation_forward(sa, fd_in, 0);
+        Matrix *fd_in_grad = stochastic_activation_backward(sa, fd_grad, &kl_cfg);
+        for (int c = 0; c < 7; c++) {
+            double h = 1e-6, saved = sa->alpha_mean[c], objective[2];
+            for (int side = 0; side < 2; side++) {
+                sa->alpha_mean[c] = saved + (side ? -h : h);
+                Matrix *o = stochastic_activation_forward(sa, fd_in, 0);
+                double data_term = 0.0;
+                for (int i = 0; i < o->rows * o->cols; i++) {
+                    data_term += fd_grad->data[i] * o->data[i];
+                }
+                objective[side] = data_term + kl_cfg.kl_weight * stochastic_activation_kl(sa);
+                free_matrix(o);
+            }
+            sa->alpha_mean[c] = saved;
+            double numeric = (objective[0] - objective[1]) / (2.0 * h);
+            assert(fabs(sa->d_alpha_mean[c] - numeric) < 1e-5 * (1.0 + fabs(numeric)));
+        }
+        free_matrix(fd_in_grad);
+        free_matrix(fd_out);
+    }
+    free_matrix(fd_grad);
+    free_matrix(fd_in);
+    printf("StochasticActivation KL gradient matches finite differences under non-unit priors.\n");
     free_stochastic_activation(sa);
     
     printf("All layer creation tests passed successfully.\n");
@@ -3,9 +3,51 @@
 #include <assert.h>
 #include "../config/config.h"
 #include "../network/network.h"
+#include "../network/network_plan.h"
+#include "../network/mc_inference.h"
+#include "../network/data_parallel.h"
+#include "../network/micro_batcher.h"
+#include "../network/layers/bayesian_linear.h"
+#include "../network/layers/stochastic_activation.h"
+#include "../optimizer/optimizer.h"
 #include "../utils/math_utils.h"
 #include "../utils/utils.h"
+#include "../utils/thread_pool.h"
 #include <string.h>
+#include <math.h>
+
+// Mean squared error over the rows of pred, for the data-parallel test.
+static double mse_gradient(const Matrix *pred, const Matrix *target, Matrix *grad) {
+    double loss = 0.0;
+    for (int i = 0; i < pred->rows * pred->cols; i++) {
+        double diff = pred->data[i] - target->data[i];
+        grad->data[i] = 2.0 * diff / pred->rows;
+        loss += diff * diff / pred->rows;
+    }
+    return loss;
+}
+
+// Sum of 1 / (i + 1) over [begin, end), for the parallel_sum() test.
+static double harmonic_block(void *arg, int begin, int end) {
+    (void) arg;
+    double sum = 0.0;
+    for (int i = begin; i < end; i++) {
+        sum += 1.0 / (i + 1);
+    }
+    return sum;
+}
+
+// Count the ranges parallel_for() hands out, for the kernel-thread test.
+static void count_range(void *arg, int begin, int end) {
+    (void) begin;
+    (void) end;
+    __atomic_add_fetch((int*)arg, 1, __ATOMIC_RELAXED);
+}
+
+// Completion callback of the micro-batcher test: counts the answered requests.
+static void count_served(ServeRequest *req) {
+    (*(int*)req->user)++;
+}
 
 int main(void) {
     // Initialize configuration with defaults.
@@ -62,9 +104,414 @@ int main(void) {
     
     // Clean up allocated resources.
     free_matrix(output);
-    free_matrix(input);
     free_network(net);
     
+    // A leading noise layer perturbs stochastic passes only; the caller's input is never modified.
+    snprintf(cfg.neurons_per_layer, sizeof(cfg.neurons_per_layer), "%d,10", cfg.input_dim);
+    strncpy(cfg.layer_types, "noise,linear", sizeof(cfg.layer_types) - 1);
+    cfg.noise_injection = 0.1;
+    net = create_network(&cfg);
+    assert(net->num_layers == 2);
+    Matrix *det1 = network_forward(net, input, 0);
+    Matrix *det2 = network_forward(net, input, 0);
+    for (int i = 0; i < det1->cols; i++) {
+        assert(det1->data[i] == det2->data[i]);
+    }
+    Matrix *noisy_out = network_forward(net, input, 1);
+    Matrix *grad_in = network_backward(net, noisy_out, &cfg);
+    assert(grad_in->rows == input->rows && grad_in->cols == input->cols);
+    for (int i = 0; i < batch_size * cfg.input_dim; i++) {
+        assert(input->data[i] == 1.0);
+    }
+    free_matrix(grad_in);
+    free_matrix(noisy_out);
+    free_matrix(det2);
+    free_matrix(det1);
+    free_network(net);
+    
+    // The KL is cached per layer: an update only invalidates the layers it touched.
+    snprintf(cfg.neurons_per_layer, sizeof(cfg.neurons_per_layer), "%d,10", cfg.input_dim);
+    strncpy(cfg.layer_types, "linear,linear", sizeof(cfg.layer_types) - 1);
+    cfg.optimizer = 0;
+    net = create_network(&cfg);
+    double kl_before = network_total_kl(net);
+    assert(!net->layers[0]->kl_dirty && !net->layers[1]->kl_dirty);
+    network_set_frozen(net, 0, 1);
+    BayesianLinear *frozen_bl = (BayesianLinear*)net->layers[0]->layer;
+    double frozen_w0 = frozen_bl->W_mean->data[0];
+    Matrix *train_out = network_forward(net, input, 1);
+    Matrix *train_grad = network_backward(net, train_out, &cfg);
+    network_update_params(net, &cfg, 0);
+    assert(frozen_bl->W_mean->data[0] == frozen_w0);
+    assert(!net->layers[0]->kl_dirty && net->layers[1]->kl_dirty);
+    double kl_after = network_total_kl(net);
+    double kl_fresh = 0.0;
+    for (int i = 0; i < net->num_layers; i++) {
+        kl_fresh += net->layers[i]->kl(net->layers[i]->layer);
+    }
+    assert(kl_after == kl_fresh);
+    printf("KL before/after partial update: %f / %f\n", kl_before, kl_after);
+    free_matrix(train_grad);
+    free_matrix(train_out);
+    free_network(net);
+    
+    // Parameters live in the arena: each layer's weights and biases are one aligned block,
+    // and an SGD step is a flat sweep that skips the frozen layers' ranges.
+    strncpy(cfg.layer_types, "linear,stochastic,linear", sizeof(cfg.layer_types) - 1);
+    snprintf(cfg.neurons_per_layer, sizeof(cfg.neurons_per_layer), "%d,%d,10", cfg.input_dim, cfg.input_dim);
+    net = create_network(&cfg);
+    ParamArena *arena = net->arena;
+    for (int i = 0; i < net->num_layers; i++) {
+        assert(net->layers[i]->arena_mean_offset % PARAM_ARENA_ALIGN == 0);
+        if (net->layers[i]->type == LAYER_BAYESIAN_LINEAR) {
+            BayesianLinear *al = (BayesianLinear*)net->layers[i]->layer;
+            int nw = al->output_dim * al->input_dim;
+            assert(al->W_mean->data == arena->mean + net->layers[i]->arena_mean_offset);
+            assert(al->b_mean == al->W_mean->data + nw && al->db_logvar == al->dW_logvar->data + nw);
+            assert(net->layers[i]->arena_mean_count == nw + al->output_dim);
+        }
+    }
+    Matrix *ar_out = network_forward(net, input, 1);
+    Matrix *ar_grad = network_backward(net, ar_out, &cfg);
+    network_set_frozen(net, 1, 1);
+    double *mean0 = (double*)malloc(sizeof(double) * arena->num_means);
+    double *gmean0 = (double*)malloc(sizeof(double) * arena->num_means);
+    memcpy(mean0, arena->mean, sizeof(double) * arena->num_means);
+    memcpy(gmean0, arena->grad_mean, sizeof(double) * arena->num_means);
+    double lv0 = arena->logvar[3], glv0 = arena->grad_logvar[3];
+    network_update_params(net, &cfg, 0);
+    Layer *fl = net->layers[1];
+    for (int i = 0; i < arena->num_means; i++) {
+        int frozen_param = i >= fl->arena_mean_offset && i < fl->arena_mean_offset + fl->arena_mean_count;
+        double expect = frozen_param ? mean0[i] : mean0[i] - cfg.learning_rate * gmean0[i];
+        assert(arena->mean[i] == expect);
+        assert(frozen_param || arena->grad_mean[i] == 0.0);
+    }
+    assert(arena->logvar[3] == lv0 - cfg.learning_rate * glv0);
+    free(gmean0);
+    free(mean0);
+    free_matrix(ar_grad);
+    free_matrix(ar_out);
+    free_network(net);
+
+    // Activations and gradients come from the network's matrix arena: once it has warmed up a
+    // training step allocates nothing, and outputs may outlive the network.
+    net = create_network(&cfg);
+    Matrix *late_out = NULL;
+    for (int step = 0; step < 4; step++) {
+        Matrix *st_out = network_forward(net, input, 1);
+        Matrix *st_grad = network_backward(net, st_out, &cfg);
+        size_t step_bytes = network_step_alloc_bytes(net);
+        assert(step == 0 ? step_bytes > 0 : (step < 2 || step_bytes == 0));
+        free_matrix(st_grad);
+        free_matrix(st_out);
+        network_update_params(net, &cfg, 0);
+    }
+    late_out = network_forward(net, input, 0);
+    free_network(net);
+    assert(late_out->rows == 1 && late_out->cols == 10);
+    free_matrix(late_out);
+
+    // The memory plan: shapes are recorded per layer (the inserted projection included),
+    // values that share a buffer are never live at the same step, and in-place layers reuse
+    // their input's buffer.
+    snprintf(cfg.neurons_per_layer, sizeof(cfg.neurons_per_layer), "64,32,10");
+    strncpy(cfg.layer_types, "linear,dropout,linear", sizeof(cfg.layer_types) - 1);
+    cfg.mini_batch_size = 4;
+    net = create_network(&cfg);
+    NetworkPlan *plan = net->plan;
+    assert(net->num_layers == 4 && plan->num_layers == 4 && plan->max_batch == 4);
+    assert(net->shapes[0].channels * net->shapes[0].height * net->shapes[0].width == cfg.input_dim);
+    assert(net->shapes[1].channels == 64 && net->shapes[2].channels == 64);
+    assert(net->shapes[3].channels == 32 && net->shapes[4].channels == 10);
+    assert(plan->output_value[1] == plan->output_value[0]);
+    for (int a = 0; a < plan->num_values; a++) {
+        for (int b = a + 1; b < plan->num_values; b++) {
+            PlanValue *va = &plan->values[a], *vb = &plan->values[b];
+            assert(va->buffer != vb->buffer || va->end < vb->start || vb->end < va->start);
+        }
+    }
+    assert(plan->live_bytes <= plan->peak_bytes && plan->peak_bytes < plan->unplanned_bytes);
+    assert(net->activations->bytes_reserved >= plan->peak_bytes);
+    print_network_plan(net, plan);
+    free_network(net);
+    cfg.mini_batch_size = 32;
+    snprintf(cfg.neurons_per_layer, sizeof(cfg.neurons_per_layer), "%d,10", cfg.input_dim);
+
+    // With the Monte Carlo estimator every stochastic pass redraws the KL with the weights;
+    // deterministic passes leave it alone.
+    strncpy(cfg.layer_types, "linear,linear", sizeof(cfg.layer_types) - 1);
+    cfg.kl_estimator = 1;
+    net = create_network(&cfg);
+    Matrix *mc_out = network_forward(net, input, 1);
+    double mc_kl1 = network_total_kl(net);
+    free_matrix(mc_out);
+    mc_out = network_forward(net, input, 0);
+    assert(network_total_kl(net) == mc_kl1);
+    free_matrix(mc_out);
+    mc_out = network_forward(net, input, 1);
+    double mc_kl2 = network_total_kl(net);
+    assert(isfinite(mc_kl1) && isfinite(mc_kl2) && mc_kl1 != mc_kl2);
+    Matrix *mc_grad = network_backward(net, mc_out, &cfg);
+    free_matrix(mc_grad);
+    free_matrix(mc_out);
+    free_network(net);
+    cfg.kl_estimator = 0;
+
+    // Low-rank plus diagonal posterior: the Adam update moves the covariance factor.
+    cfg.posterior_method = 1;
+    cfg.covariance_structure = 2;
+    cfg.posterior_rank = 4;
+    cfg.prior_type = 0;
+    cfg.optimizer = 1;
+    net = create_network(&cfg);
+    BayesianLinear *lr_bl = (BayesianLinear*)net->layers[0]->layer;
+    assert(lr_bl->posterior_rank == 4 && lr_bl->W_factor != NULL);
+    double lr_u0 = lr_bl->W_factor[0], lr_kl0 = network_total_kl(net);
+    Matrix *lr_out = network_forward(net, input, 1);
+    Matrix *lr_grad = network_backward(net, lr_out, &cfg);
+    network_update_params(net, &cfg, 0);
+    assert(lr_bl->W_factor[0] != lr_u0);
+    assert(isfinite(lr_kl0) && isfinite(network_total_kl(net)));
+    free_matrix(lr_grad);
+    free_matrix(lr_out);
+    free_network(net);
+
+    // Matrix-normal posterior with local reparameterization: Adam moves both factors.
+    cfg.covariance_structure = 3;
+    cfg.local_reparam = 1;
+    net = create_network(&cfg);
+    BayesianLinear *mn_bl = (BayesianLinear*)net->layers[0]->layer;
+    assert(mn_bl->matrix_normal && mn_bl->local_reparam);
+    double mn_r0 = mn_bl->L_row[0], mn_c0 = mn_bl->L_col[0];
+    Matrix *mn_out = network_forward(net, input, 1);
+    Matrix *mn_grad = network_backward(net, mn_out, &cfg);
+    network_update_params(net, &cfg, 0);
+    assert(mn_bl->L_row[0] != mn_r0 && mn_bl->L_col[0] != mn_c0);
+    assert(isfinite(network_total_kl(net)));
+    free_matrix(mn_grad);
+    free_matrix(mn_out);
+    free_network(net);
+    cfg.local_reparam = 0;
+    cfg.posterior_method = 0;
+    cfg.covariance_structure = 0;
+
+    // Batched predictive pass: one block per draw, through linear and per-block dropout layers.
+    strncpy(cfg.layer_types, "linear,dropout,linear", sizeof(cfg.layer_types) - 1);
+    strncpy(cfg.neurons_per_layer, "64,32,10", sizeof(cfg.neurons_per_layer) - 1);
+    cfg.num_layers = 3;
+    net = create_network(&cfg);
+    int pred_samples = 5;
+    Matrix *pred_out = create_matrix(pred_samples * input->rows, 10);
+    network_forward_mc(net, input, pred_samples, pred_out);
+    int differs = 0;
+    for (int i = 0; i < input->rows * 10; i++) {
+        assert(isfinite(pred_out->data[i]) && isfinite(pred_out->data[(pred_samples - 1) * input->rows * 10 + i]));
+        differs |= pred_out->data[i] != pred_out->data[input->rows * 10 + i];
+    }
+    assert(differs);
+    free_matrix(pred_out);
+    free_network(net);
+    // Truncated draws: the first layer computes its mean output once for every draw.
+    cfg.mc_perturbation_rank = 4;
+    net = create_network(&cfg);
+    pred_out = create_matrix(pred_samples * input->rows, 10);
+    network_forward_mc(net, input, pred_samples, pred_out);
+    differs = 0;
+    for (int i = 0; i < input->rows * 10; i++) {
+        assert(isfinite(pred_out->data[i]));
+        differs |= pred_out->data[i] != pred_out->data[input->rows * 10 + i];
+    }
+    assert(differs);
+    free_matrix(pred_out);
+    free_network(net);
+    cfg.mc_perturbation_rank = 0;
+
+    // Multithreaded prediction is bit-identical for any number of threads.
+    net = create_network(&cfg);
+    int par_samples = 10;
+    Matrix *par_one = create_matrix(par_samples * input->rows, 10);
+    Matrix *par_many = create_matrix(par_samples * input->rows, 10);
+    MCInference *mc_one = mc_inference_create(net, 1);
+    MCInference *mc_many = mc_inference_create(net, 3);
+    init_random(7);
+    mc_inference_predict(mc_one, input, par_samples, par_one);
+    init_random(7);
+    mc_inference_predict(mc_many, input, par_samples, par_many);
+    assert(memcmp(par_one->data, par_many->data, sizeof(double) * par_one->rows * par_one->cols) == 0);
+    assert(par_one->data[0] != par_one->data[(par_samples - 1) * input->rows * 10]);
+    mc_inference_predict(mc_many, input, par_samples, par_many);
+    assert(memcmp(par_one->data, par_many->data, sizeof(double) * par_one->rows * par_one->cols) != 0);
+    mc_inference_free(mc_one);
+    mc_inference_free(mc_many);
+    free_matrix(par_one);
+    free_matrix(par_many);
+    free_network(net);
+
+    // Data-parallel gradients match those of one pass over the whole batch. The variances are
+    // made negligible so that both see the same weights.
+    strncpy(cfg.layer_types, "linear,linear,linear", sizeof(cfg.layer_types) - 1);
+    net = create_network(&cfg);
+    for (int i = 0; i < net->arena->num_logvars; i++) {
+        net->arena->logvar[i] = -60.0;
+    }
+    Network *dp_net = create_network(&cfg);
+    network_copy_params(dp_net, net);
+    // A context computes the same pass as its network, from the same random stream.
+    ExecContext *ctx_a = exec_context_create(dp_net);
+    ExecContext *ctx_b = exec_context_create(dp_net);
+    exec_context_seed(ctx_a, 11, 0);
+    exec_context_seed(ctx_b, 11, 0);
+    random_seed_stream(11, 0);
+    Matrix *ctx_ref = network_forward(dp_net, input, 1);
+    Matrix *ctx_out_a = exec_forward(ctx_a, input, 1);
+    Matrix *ctx_out_b = exec_forward(ctx_b, input, 1);
+    assert(memcmp(ctx_out_a->data, ctx_ref->data, sizeof(double) * ctx_ref->rows * ctx_ref->cols) == 0);
+    assert(memcmp(ctx_out_b->data, ctx_ref->data, sizeof(double) * ctx_ref->rows * ctx_ref->cols) == 0);
+    assert(fabs(exec_total_kl(ctx_a) - network_total_kl(dp_net)) < 1e-9 * (1.0 + network_total_kl(dp_net)));
+    free_matrix(ctx_out_b);
+    free_matrix(ctx_out_a);
+    free_matrix(ctx_ref);
+    exec_context_free(ctx_b);
+    exec_context_free(ctx_a);
+    // Five rows over three workers, so the shards are uneven and none is empty.
+    Matrix *dp_input = create_matrix(5, cfg.input_dim);
+    for (int i = 0; i < dp_input->rows * dp_input->cols; i++) {
+        dp_input->data[i] = sin(0.31 * i);
+    }
+    Matrix *dp_target = create_matrix(dp_input->rows, 10);
+    for (int i = 0; i < dp_input->rows * 10; i++) {
+        dp_target->data[i] = 0.1 * (i % 7);
+    }
+    Matrix *dp_pred = network_forward(net, dp_input, 1);
+    Matrix *dp_grad = create_matrix(dp_pred->rows, dp_pred->cols);
+    double serial_loss = mse_gradient(dp_pred, dp_target, dp_grad);
+    free_matrix(network_backward(net, dp_grad, &cfg));
+    DataParallelTrainer *trainer = data_parallel_create(dp_net, 3);
+    for (int step = 0; step < 2; step++) {  // The second step must not see the first's gradients.
+        double dp_loss = data_parallel_gradients(trainer, dp_input, dp_target, mse_gradient, &cfg);
+        assert(fabs(dp_loss - serial_loss) < 1e-9 * (1.0 + serial_loss));
+        for (int i = 0; i < net->arena->num_means; i++) {
+            assert(fabs(dp_net->arena->grad_mean[i] - net->arena->grad_mean[i]) < 1e-9);
+        }
+        for (int i = 0; i < net->arena->num_logvars; i++) {
+            assert(fabs(dp_net->arena->grad_logvar[i] - net->arena->grad_logvar[i]) < 1e-9);
+        }
+    }
+    data_parallel_free(trainer);
+    free_matrix(dp_grad);
+    free_matrix(dp_pred);
+    free_matrix(dp_target);
+    free_matrix(dp_input);
+    free_network(dp_net);
+    free_network(net);
+
+    // A saved network loads into another of the same configuration, and not into one of another.
+    net = create_network(&cfg);
+    for (int i = 0; i < net->arena->num_logvars; i++) {
+        net->arena->logvar[i] = -60.0;
+    }
+    assert(network_save(net, "test_network_model.bnn") == 0);
+    Network *loaded = create_network(&cfg);
+    assert(network_load(loaded, "test_network_model.bnn") == 0);
+    assert(memcmp(loaded->arena->mean, net->arena->mean, sizeof(double) * net->arena->num_means) == 0);
+    assert(memcmp(loaded->arena->logvar, net->arena->logvar, sizeof(double) * net->arena->num_logvars) == 0);
+    Config other_cfg = cfg;
+    strncpy(other_cfg.neurons_per_layer, "128,64,10", sizeof(other_cfg.neurons_per_layer) - 1);
+    Network *other = create_network(&other_cfg);
+    assert(network_load(other, "test_network_model.bnn") != 0);
+    free_network(other);
+    remove("test_network_model.bnn");
+
+    // The micro-batcher answers every request, in batches of at most max_batch, with the moments
+    // of the predictive draws; with negligible variances those are the mean network's output.
+    int serve_count = 10, served = 0;
+    Matrix *serve_ref = network_forward(net, input, 0);
+    MicroBatcher *batcher = micro_batcher_create(loaded, 3, 4, 1000, 2);
+    ServeRequest requests[10];
+    double serve_mean[10][10], serve_var[10][10];
+    for (int r = 0; r < serve_count; r++) {
+        requests[r].input = input->data + (size_t) (r % input->rows) * input->cols;
+        requests[r].mean = serve_mean[r];
+        requests[r].variance = serve_var[r];
+        requests[r].complete = count_served;
+        requests[r].user = &served;
+        micro_batcher_submit(batcher, &requests[r]);
+    }
+    micro_batcher_free(batcher);
+    assert(served == serve_count);
+    for (int r = 0; r < serve_count; r++) {
+        for (int j = 0; j < 10; j++) {
+            assert(fabs(serve_mean[r][j] - serve_ref->data[(r % input->rows) * 10 + j]) < 1e-9);
+            assert(serve_var[r][j] < 1e-12);
+        }
+    }
+    free_matrix(serve_ref);
+    free_network(loaded);
+    free_network(net);
+
+    // Kernel threads: a mean-field training pass gives bit-identical outputs, gradients and KL
+    // with one and with three threads, and so does a stochastic activation whose slope gradient is
+    // reduced over many blocks.
+    cfg.posterior_method = 1;
+    net = create_network(&cfg);
+    Matrix *kt_target = create_matrix(input->rows, 10);
+    zero_matrix(kt_target);
+    Matrix *kt_out[2];
+    double *kt_grads[2], kt_kl[2], kt_sum[2];
+    StochasticActivation *kt_act = create_stochastic_activation(8, 0.25, -3.0);
+    Matrix *kt_act_in = create_matrix(64, 1024);
+    for (int i = 0; i < kt_act_in->rows * kt_act_in->cols; i++) {
+        kt_act_in->data[i] = sin(0.37 * i);
+    }
+    Matrix *kt_act_grad[2];
+    double kt_alpha[2][8];
+    for (int run = 0; run < 2; run++) {
+        parallel_set_threads(run ? 3 : 1);
+        assert(parallel_num_threads() == (run ? 3 : 1));
+        init_random(11);
+        kt_out[run] = network_forward(net, input, 1);
+        Matrix *kt_grad = create_matrix(kt_out[run]->rows, kt_out[run]->cols);
+        mse_gradient(kt_out[run], kt_target, kt_grad);
+        free_matrix(network_backward(net, kt_grad, &cfg));
+        free_matrix(kt_grad);
+        kt_grads[run] = (double*)malloc(sizeof(double) * net->arena->num_means);
+        memcpy(kt_grads[run], net->arena->grad_mean, sizeof(double) * net->arena->num_means);
+        network_invalidate_kl(net);
+        kt_kl[run] = network_total_kl(net);
+        kt_sum[run] = parallel_sum(100000, 1000, harmonic_block, NULL);
+        init_random(12);
+        free_matrix(stochastic_activation_forward(kt_act, kt_act_in, 1));
+        kt_act_grad[run] = stochastic_activation_backward(kt_act, kt_act_in, &cfg);
+        memcpy(kt_alpha[run], kt_act->d_alpha_mean, sizeof(kt_alpha[run]));
+    }
+    assert(memcmp(kt_act_grad[0]->data, kt_act_grad[1]->data,
+                  sizeof(double) * kt_act_in->rows * kt_act_in->cols) == 0);
+    assert(memcmp(kt_alpha[0], kt_alpha[1], sizeof(kt_alpha[0])) == 0);
+    free_matrix(kt_act_grad[0]);
+    free_matrix(kt_act_grad[1]);
+    free_matrix(kt_act_in);
+    free_stochastic_activation(kt_act);
+    assert(memcmp(kt_out[0]->data, kt_out[1]->data, sizeof(double) * kt_out[0]->rows * kt_out[0]->cols) == 0);
+    assert(memcmp(kt_grads[0], kt_grads[1], sizeof(double) * net->arena->num_means) == 0);
+    assert(kt_kl[0] == kt_kl[1]);
+    assert(kt_sum[0] == kt_sum[1] && fabs(kt_sum[0] - 12.0901461) < 1e-6);
+    // A handful of blocks still splits over the threads; element ranges stay multiples of 8.
+    int kt_ranges = 0;
+    parallel_for(3, 1, count_range, &kt_ranges);
+    assert(kt_ranges == 3);
+    kt_ranges = 0;
+    parallel_for_elements(12, 1, count_range, &kt_ranges);
+    assert(kt_ranges == 2);
+    parallel_set_threads(1);
+    free_matrix(kt_target);
+    for (int run = 0; run < 2; run++) {
+        free_matrix(kt_out[run]);
+        free(kt_grads[run]);
+    }
+    free_network(net);
+
+    free_matrix(input);
     printf("Network test completed successfully.\n");
     return 0;
 }
@@ -0,0 +1,91 @@
+#ifndef FAST_MATH_H
+#define FAST_MATH_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Branch-free exp/log/sigmoid built from polynomials and IEEE-754 bit manipulation.
+// Unlike the libm calls they contain no function calls or data-dependent branches, so loops
+// that use them can be auto-vectorized. Accuracy is a few ulp over the ranges used in the
+// library (finite arguments; fast_log() requires a positive, normal argument).
+
+static inline double fast_bits_to_double(uint64_t b) {
+    double d;
+    memcpy(&d, &b, sizeof(d));
+    return d;
+}
+
+static inline uint64_t fast_double_to_bits(double d) {
+    uint64_t b;
+    memcpy(&b, &d, sizeof(b));
+    return b;
+}
+
+// exp(x) for x clamped to [-708, 708]: x = n*ln2 + r with |r| <= ln2/2, exp(r) by a degree-12
+// Taylor polynomial and 2^n assembled directly in the exponent field.
+static inline double fast_exp(double x) {
+    const double log2e = 1.4426950408889634;
+    const double ln2_hi = 6.93147180369123816490e-01;
+    const double ln2_lo = 1.90821492927058770002e-10;
+    const double shifter = 6755399441055744.0;  // 1.5 * 2^52: adding it rounds to an integer
+    // Clamp |x| to 708 on the bit pattern: integer compares become vector selects, whereas
+    // floating-point compares may trap and keep the caller's loop from being vectorized.
+    uint64_t xb = fast_double_to_bits(x);
+    uint64_t over = 0 - (uint64_t) ((xb & 0x7FFFFFFFFFFFFFFFULL) > 0x4086200000000000ULL);  // 708.0
+    xb = (xb & ~over) | (((xb & 0x8000000000000000ULL) | 0x4086200000000000ULL) & over);
+    x = fast_bits_to_double(xb);
+    double t = x * log2e + shifter;
+    double n = t - shifter;
+    double r = (x - n * ln2_hi) - n * ln2_lo;
+    double p = 1.0 / 479001600.0;
+    p = p * r + 1.0 / 39916800.0;
+    p = p * r + 1.0 / 3628800.0;
+    p = p * r + 1.0 / 362880.0;
+    p = p * r + 1.0 / 40320.0;
+    p = p * r + 1.0 / 5040.0;
+    p = p * r + 1.0 / 720.0;
+    p = p * r + 1.0 / 120.0;
+    p = p * r + 1.0 / 24.0;
+    p = p * r + 1.0 / 6.0;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    // The low bits of t hold n (two's complement); shift n + 1023 into the exponent field.
+    uint64_t scale = (fast_double_to_bits(t) + 1023) << 52;
+    return p * fast_bits_to_double(scale);
+}
+
+// log(x) for positive normal x: x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then
+// log(m) = 2 * atanh(f) with f = (m - 1) / (m + 1), |f| < 0.172, by an odd series.
+static inline double fast_log(double x) {
+    const double two52 = 4503599627370496.0;
+    uint64_t bits = fast_double_to_bits(x);
+    uint64_t mant = bits & 0x000FFFFFFFFFFFFFULL;
+    // m > sqrt(2), decided on the mantissa bits (see fast_exp() for why not a double compare).
+    uint64_t big = 0 - (uint64_t) (mant > 0x6A09E667F3BCDULL);
+    double m = fast_bits_to_double(mant | (0x3FF0000000000000ULL - (big & 0x0010000000000000ULL)));
+    // The biased exponent and the 0/1 adjustment are converted to double through the bit
+    // pattern as well, since 64-bit integer to double conversion has no AVX2 instruction.
+    double e = fast_bits_to_double((bits >> 52) | 0x4330000000000000ULL) - two52 - 1023.0
+               + fast_bits_to_double(big & 0x3FF0000000000000ULL);
+    double f = (m - 1.0) / (m + 1.0);
+    double f2 = f * f;
+    double s = 1.0 / 19.0;
+    s = s * f2 + 1.0 / 17.0;
+    s = s * f2 + 1.0 / 15.0;
+    s = s * f2 + 1.0 / 13.0;
+    s = s * f2 + 1.0 / 11.0;
+    s = s * f2 + 1.0 / 9.0;
+    s = s * f2 + 1.0 / 7.0;
+    s = s * f2 + 1.0 / 5.0;
+    s = s * f2 + 1.0 / 3.0;
+    s = s * f2 + 1.0;
+    return e * 0.6931471805599453 + 2.0 * f * s;
+}
+
+// Logistic sigmoid 1 / (1 + exp(-x)).
+static inline double fast_sigmoid(double x) {
+    return 1.0 / (1.0 + fast_exp(-x));
+}
+
+#endif // FAST_MATH_H
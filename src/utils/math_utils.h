@@ -1,16 +1,48 @@
 #ifndef MATH_UTILS_H
 #define MATH_UTILS_H
 
+#include <stddef.h>
+
+struct MatrixArena;
+
 // A simple matrix structure for use in BNN math operations.
 typedef struct {
     int rows;
     int cols;
     double *data;  // Stored in row-major order.
+    struct MatrixArena *arena;  // Arena that free_matrix() returns the matrix to (NULL: the heap)
+    int capacity;  // Number of doubles allocated for data
 } Matrix;
 
+// Reusable storage for the matrices of a computation that repeats with the same shapes, such as
+// a network's forward and backward passes. While an arena is active on a thread, create_matrix()
+// takes the smallest released matrix that fits instead of calling malloc, and free_matrix()
+// hands it back; after the first step no new memory is needed. Matrices remember their arena, so
+// they may be freed after it is deactivated, and even after matrix_arena_free(). An arena must
+// only be used by one thread at a time.
+typedef struct MatrixArena {
+    Matrix **free_list;      // Released matrices, ready for reuse
+    int num_free;
+    int free_capacity;
+    int outstanding;         // Matrices handed out and not yet released
+    int closing;             // Set by matrix_arena_free() while matrices are still outstanding
+    size_t bytes_reserved;   // Bytes of matrix data owned by the arena
+    size_t bytes_allocated;  // Bytes of matrix data allocated since the last reset (a "step")
+} MatrixArena;
+
+MatrixArena* matrix_arena_create(void);
+// Make 'arena' the allocator of create_matrix() on the calling thread (NULL: the heap).
+// Returns the previously active arena, so calls can be nested.
+MatrixArena* matrix_arena_activate(MatrixArena *arena);
+// Add a released matrix with room for n doubles, so that a later create_matrix() of up to that
+// size finds it instead of allocating.
+void matrix_arena_reserve(MatrixArena *arena, int n);
+// Free the released matrices; the arena itself goes away with its last outstanding matrix.
+void matrix_arena_free(MatrixArena *arena);
+
 // Matrix management
 Matrix* create_matrix(int rows, int cols);
-// Allocates and initializes a matrix with the given dimensions
+// Allocates and initializes a matrix with the given dimensions (zero-filled)
 void free_matrix(Matrix *m);
 
 // Basic matrix operations
@@ -23,6 +55,9 @@ double vector_dot(const double *a, const double *b, int length);
 // Dot product of the vector
 double vector_norm(const double *a, int length);
 // L2 norm of a vector
+// y[i] += a * x[i] and x[i] *= scale over non-overlapping arrays, vectorized for any length.
+void vector_axpy(double *restrict y, double a, const double *restrict x, int length);
+void vector_scale(double *restrict x, double scale, int length);
 
 // Example: Compute the KL divergence between two univariate Gaussians.
 // D_KL( N(mu1, var1) || N(mu2, var2) )
@@ -3,12 +3,62 @@
 #include <math.h>
 #include <time.h>
 
+// State of the xoshiro256** generator behind every function here. Each thread has its own
+// stream; threads other than the one calling init_random() start from this fixed state until
+// they call random_seed_stream().
+static _Thread_local uint64_t xoshiro_state[4] = {
+    0x9E3779B97F4A7C15ULL, 0xBF58476D1CE4E5B9ULL, 0x94D049BB133111EBULL, 0x2545F4914F6CDD1DULL
+};
+
+// splitmix64 step, used to expand a seed into generator state.
+static uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
 void init_random(unsigned int seed) {
     srand(seed);
+    uint64_t sm = seed;
+    for (int i = 0; i < 4; i++) {
+        xoshiro_state[i] = splitmix64(&sm);
+    }
+}
+
+void random_seed_stream(uint64_t seed, uint64_t stream) {
+    uint64_t sm = stream;
+    uint64_t mixed = seed ^ splitmix64(&sm);
+    for (int i = 0; i < 4; i++) {
+        xoshiro_state[i] = splitmix64(&mixed);
+    }
+}
+
+RandomState random_get_state(void) {
+    RandomState state;
+    for (int i = 0; i < 4; i++) {
+        state.s[i] = xoshiro_state[i];
+    }
+    return state;
+}
+
+void random_set_state(const RandomState *state) {
+    for (int i = 0; i < 4; i++) {
+        xoshiro_state[i] = state->s[i];
+    }
+}
+
+// Map the top 53 bits of a random word to a double in (0, 1), never 0 so log() is finite.
+static inline double u64_to_open_unit(uint64_t x) {
+    return ((double) (x >> 11) + 0.5) * (1.0 / 9007199254740992.0);
 }
 
 double random_uniform() {
-    return ((double)rand() + 1.0) / ((double)RAND_MAX + 1.0);
+    return u64_to_open_unit(random_u64());
 }
 
 
@@ -23,3 +73,74 @@ double random_gaussian(double mean, double stddev) {
 int random_bernoulli(double p) {
     return (random_uniform() < p) ? 1 : 0;
 }
+
+uint64_t random_u64(void) {
+    uint64_t *st = xoshiro_state;
+    uint64_t result = rotl64(st[1] * 5, 7) * 9;
+    uint64_t t = st[1] << 17;
+    st[2] ^= st[0];
+    st[3] ^= st[1];
+    st[1] ^= st[2];
+    st[0] ^= st[3];
+    st[2] ^= t;
+    st[3] = rotl64(st[3], 45);
+    return result;
+}
+
+double random_bernoulli_bits(uint64_t *bits, int num_words, double p) {
+    const uint32_t one = 1u << RANDOM_BITS_PRECISION;
+    double scaled = p * one + 0.5;
+    uint32_t q = (scaled <= 0.0) ? 0 : (scaled >= one) ? one : (uint32_t) scaled;
+    if (q == 0 || q == one) {
+        uint64_t fill = (q == one) ? ~0ULL : 0ULL;
+        for (int w = 0; w < num_words; w++) {
+            bits[w] = fill;
+        }
+        return (double) q / one;
+    }
+    // A bit is 1 iff a uniform RANDOM_BITS_PRECISION-bit number U is < q. Comparing U with q
+    // digit by digit from the least significant end: where q has a 1, U "wins" if its digit is 0
+    // or it already won below; where q has a 0, U wins only if its digit is 0 and it won below.
+    // Trailing zero digits of q never change the result, so they are skipped.
+    int low = 0;
+    while (!((q >> low) & 1u)) {
+        low++;
+    }
+    for (int w = 0; w < num_words; w++) {
+        uint64_t less = 0;
+        for (int d = low; d < RANDOM_BITS_PRECISION; d++) {
+            uint64_t u = random_u64();
+            less = ((q >> d) & 1u) ? (~u | less) : (~u & less);
+        }
+        bits[w] = less;
+    }
+    return (double) q / one;
+}
+
+void random_add_gaussian(double *dst, const double *src, int n, double mean, double stddev) {
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        double u1 = u64_to_open_unit(random_u64());
+        double u2 = u64_to_open_unit(random_u64());
+        double r = stddev * sqrt(-2.0 * log(u1));
+        double theta = 2.0 * M_PI * u2;
+        double base0 = src ? src[i] : 0.0;
+        double base1 = src ? src[i + 1] : 0.0;
+        dst[i] = base0 + mean + r * cos(theta);
+        dst[i + 1] = base1 + mean + r * sin(theta);
+    }
+    if (i < n) {
+        double u1 = u64_to_open_unit(random_u64());
+        double u2 = u64_to_open_unit(random_u64());
+        double base = src ? src[i] : 0.0;
+        dst[i] = base + mean + stddev * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+    }
+}
+
+void random_add_uniform(double *dst, const double *src, int n, double low, double high) {
+    double range = high - low;
+    for (int i = 0; i < n; i++) {
+        double base = src ? src[i] : 0.0;
+        dst[i] = base + low + range * u64_to_open_unit(random_u64());
+    }
+}
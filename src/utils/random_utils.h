@@ -1,10 +1,27 @@
 #ifndef RANDOM_UTILS_H
 #define RANDOM_UTILS_H
 
-// Initialize the random number generator with a given seed.
+#include <stdint.h>
+
+// Every function below draws from a xoshiro256** generator whose state is private to the
+// calling thread, so threads never share a stream.
+
+// Initialize the calling thread's generator (and the C library's rand()) with a given seed.
 void init_random(unsigned int seed);
 
-// Return a random double in the range [0, 1)
+// Seed the calling thread's generator with stream number 'stream' of 'seed'. Different streams
+// of one seed are independent, so work split into numbered pieces, each drawing from its own
+// stream, gives the same numbers whichever thread runs each piece.
+void random_seed_stream(uint64_t seed, uint64_t stream);
+
+// The calling thread's generator state, to put a stream aside while drawing from another.
+typedef struct {
+    uint64_t s[4];
+} RandomState;
+RandomState random_get_state(void);
+void random_set_state(const RandomState *state);
+
+// Return a random double in the range (0, 1)
 double random_uniform();
 
 // Generate a normally distributed random number using the Box-Muller transform.
@@ -13,4 +30,21 @@ double random_gaussian(double mean, double stddev);
 // Return 1 with probability p, 0 otherwise.
 int random_bernoulli(double p);
 
+// Return 64 uniformly random bits.
+uint64_t random_u64(void);
+
+// Fill 'num_words' words with packed Bernoulli bits: each bit is 1 with probability p,
+// with p quantized to RANDOM_BITS_PRECISION bits. The 64 bits of a word are produced
+// together by a bit-sliced comparison of random words against the binary digits of p,
+// costing at most RANDOM_BITS_PRECISION random words per 64 bits (one word when p = 0.5).
+// Returns the quantized probability actually used.
+#define RANDOM_BITS_PRECISION 16
+double random_bernoulli_bits(uint64_t *bits, int num_words, double p);
+
+// Bulk noise kernels: dst[i] = src[i] + noise_i for i < n, drawing from the xoshiro256**
+// generator so no per-element rand() call is needed. 'dst' may alias 'src'; pass src = NULL
+// to fill 'dst' with noise alone. Gaussian values are produced in Box-Muller pairs.
+void random_add_gaussian(double *dst, const double *src, int n, double mean, double stddev);
+void random_add_uniform(double *dst, const double *src, int n, double low, double high);
+
 #endif // RANDOM_UTILS_H
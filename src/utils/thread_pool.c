@@ -0,0 +1,237 @@
+#include "thread_pool.h"
+#include "utils.h"   // For handle_error().
+#include <stdlib.h>
+#include <unistd.h>
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} WorkerStart;
+
+// Set on every pool worker; intra-op kernels called there run inline.
+static _Thread_local int is_pool_worker = 0;
+
+static void* worker_main(void *p) {
+    WorkerStart start = *(WorkerStart*)p;
+    free(p);
+    is_pool_worker = 1;
+    ThreadPool *pool = start.pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        void (*task)(void*, int) = pool->task;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+        task(arg, start.index);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* thread_pool_create(int num_threads) {
+    if (num_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = (cpus > 0) ? (int) cpus : 1;
+    }
+    ThreadPool *pool = (ThreadPool*)malloc(sizeof(ThreadPool));
+    if (!pool) {
+        handle_error("Failed to allocate thread pool.");
+    }
+    pool->num_threads = num_threads;
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * num_threads);
+    if (!pool->threads) {
+        handle_error("Failed to allocate thread pool.");
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->task = NULL;
+    pool->arg = NULL;
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutdown = 0;
+    for (int i = 0; i < num_threads; i++) {
+        WorkerStart *start = (WorkerStart*)malloc(sizeof(WorkerStart));
+        if (!start) {
+            handle_error("Failed to allocate thread pool.");
+        }
+        start->pool = pool;
+        start->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, start) != 0) {
+            handle_error("Failed to start thread pool worker.");
+        }
+    }
+    return pool;
+}
+
+static void pool_post(ThreadPool *pool, void (*task)(void *arg, int worker), void *arg) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->pending = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void pool_wait(ThreadPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_run(ThreadPool *pool, void (*task)(void *arg, int worker), void *arg) {
+    pool_post(pool, task, arg);
+    pool_wait(pool);
+}
+
+void thread_pool_free(ThreadPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
+// ==================
+// Intra-op parallelism
+// ==================
+
+static ThreadPool *intra_pool = NULL;   // num_threads - 1 workers, or NULL for one thread
+static int intra_threads = 1;
+static pthread_mutex_t dispatch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    void (*body)(void *arg, int begin, int end);
+    void *arg;
+    int n;
+    int parts;
+    int align_mask;       // ~0, or ~7 to round the boundaries down to multiples of 8
+} ForTask;
+
+// Boundary of part p of the task's parts over [0, n).
+static int part_start(const ForTask *task, int p) {
+    return (p == task->parts) ? task->n : (int) ((long) task->n * p / task->parts) & task->align_mask;
+}
+
+static void run_part(ForTask *task, int p) {
+    if (p >= task->parts) {
+        return;
+    }
+    int begin = part_start(task, p), end = part_start(task, p + 1);
+    if (begin < end) {
+        task->body(task->arg, begin, end);
+    }
+}
+
+static void for_worker(void *arg, int worker) {
+    run_part((ForTask*)arg, worker + 1);
+}
+
+void parallel_set_threads(int n) {
+    if (is_pool_worker) {
+        return;
+    }
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = (cpus > 0) ? (int) cpus : 1;
+    }
+    if (n == intra_threads) {
+        return;
+    }
+    thread_pool_free(intra_pool);
+    intra_pool = (n > 1) ? thread_pool_create(n - 1) : NULL;
+    intra_threads = n;
+}
+
+int parallel_num_threads(void) {
+    return intra_threads;
+}
+
+static void dispatch_for(int n, int grain, int align_mask, void (*body)(void *arg, int begin, int end),
+                         void *arg) {
+    int parts = (grain > 0) ? n / grain : n;
+    parts = (parts < intra_threads) ? parts : intra_threads;
+    if (parts < 2 || is_pool_worker || pthread_mutex_trylock(&dispatch_lock) != 0) {
+        if (n > 0) {
+            body(arg, 0, n);
+        }
+        return;
+    }
+    // Workers beyond 'parts' return at once.
+    ForTask task = { body, arg, n, parts, align_mask };
+    pool_post(intra_pool, for_worker, &task);
+    run_part(&task, 0);
+    pool_wait(intra_pool);
+    pthread_mutex_unlock(&dispatch_lock);
+}
+
+void parallel_for(int n, int grain, void (*body)(void *arg, int begin, int end), void *arg) {
+    dispatch_for(n, grain, ~0, body, arg);
+}
+
+void parallel_for_elements(int n, int grain, void (*body)(void *arg, int begin, int end), void *arg) {
+    dispatch_for(n, grain, ~7, body, arg);
+}
+
+typedef struct {
+    double (*body)(void *arg, int begin, int end);
+    void *arg;
+    int n;
+    int block;
+    double *partial;
+} SumTask;
+
+static void sum_blocks(void *arg, int begin, int end) {
+    SumTask *task = (SumTask*)arg;
+    for (int b = begin; b < end; b++) {
+        int first = b * task->block;
+        int last = (first + task->block < task->n) ? first + task->block : task->n;
+        task->partial[b] = task->body(task->arg, first, last);
+    }
+}
+
+double parallel_sum(int n, int block, double (*body)(void *arg, int begin, int end), void *arg) {
+    if (n <= block) {
+        return (n > 0) ? body(arg, 0, n) : 0.0;
+    }
+    int num_blocks = (n + block - 1) / block;
+    double stack_partial[64];
+    double *partial = (num_blocks <= 64) ? stack_partial : (double*)malloc(sizeof(double) * num_blocks);
+    if (!partial) {
+        handle_error("Failed to allocate parallel_sum partials.");
+    }
+    SumTask task = { body, arg, n, block, partial };
+    parallel_for(num_blocks, 1, sum_blocks, &task);
+    double total = 0.0;
+    for (int b = 0; b < num_blocks; b++) {
+        total += partial[b];
+    }
+    if (partial != stack_partial) {
+        free(partial);
+    }
+    return total;
+}
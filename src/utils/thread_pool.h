@@ -0,0 +1,73 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+// A fixed set of worker threads that are started once and then handed one task at a time.
+// thread_pool_run() wakes every worker, each calls task(arg, worker) with its own index, and
+// the call returns when all of them have finished. Workers sleep on a condition variable in
+// between, so an idle pool costs nothing.
+typedef struct ThreadPool {
+    int num_threads;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;          // Signalled when a new task is posted (or on shutdown)
+    pthread_cond_t done;           // Signalled when the last worker finishes the task
+    void (*task)(void *arg, int worker);
+    void *arg;
+    unsigned long generation;      // Incremented for every posted task
+    int pending;                   // Workers still running the current task
+    int shutdown;
+} ThreadPool;
+
+// Start num_threads workers, or one per online CPU when num_threads <= 0.
+ThreadPool* thread_pool_create(int num_threads);
+
+// Run task(arg, worker) on every worker, worker = 0 .. num_threads - 1, and wait for all of them.
+// Not reentrant: tasks must not call thread_pool_run() on the same pool.
+void thread_pool_run(ThreadPool *pool, void (*task)(void *arg, int worker), void *arg);
+
+// Stop and join the workers.
+void thread_pool_free(ThreadPool *pool);
+
+// ==================
+// Intra-op parallelism
+// ==================
+// One process-wide pool splits single kernels (matrix products, weight sampling, KL sums,
+// elementwise layers, optimizer sweeps) across threads. The calling thread takes the first
+// range itself, so n threads means n - 1 workers. A kernel runs inline, on the calling thread
+// alone, when it is too small to pay for the dispatch, when it is called from a worker of any
+// ThreadPool (so contexts run by MCInference or DataParallelTrainer workers never nest), or while
+// another thread is using the pool.
+
+// Use n threads for the kernels, or one per online CPU when n <= 0; 1 (the default) runs every
+// kernel inline. Call it during setup: not while kernels are running on other threads. Calls from
+// pool workers are ignored.
+void parallel_set_threads(int n);
+
+// Number of threads the kernels use.
+int parallel_num_threads(void);
+
+// Call body(arg, begin, end) on disjoint ranges covering [0, n), in parallel. Each range holds at
+// least 'grain' items (so n < 2 * grain runs inline).
+void parallel_for(int n, int grain, void (*body)(void *arg, int begin, int end), void *arg);
+
+// parallel_for() over the elements of arrays swept by vectorized loops: the range boundaries are
+// rounded down to multiples of 8, so that only the last range has a scalar remainder. Items
+// that are rows or blocks should use parallel_for(), where small counts still split.
+void parallel_for_elements(int n, int grain, void (*body)(void *arg, int begin, int end), void *arg);
+
+// Work, in multiply-adds or comparable steps, that a range should hold to be worth handing to
+// another thread; see tests/parallel_bench.c for how it compares with the dispatch cost.
+#define PARALLEL_GRAIN_WORK 32768
+
+// Grain for parallel_for() over items that cost 'work_per_item' steps each.
+static inline int parallel_grain(long work_per_item) {
+    return (int) (PARALLEL_GRAIN_WORK / (work_per_item > 0 ? work_per_item : 1)) + 1;
+}
+
+// Sum of body(arg, begin, end) over consecutive blocks of 'block' items covering [0, n). The
+// partial sums are added in block order, so the result does not depend on the thread count.
+double parallel_sum(int n, int block, double (*body)(void *arg, int begin, int end), void *arg);
+
+#endif // THREAD_POOL_H